@@ -0,0 +1,14 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+
+layout(set = 0, binding = 12, std140) uniform UBO {
+    mat4 mvp;
+} ubo;
+
+// Matches pbr.vert exactly, as the forward pass tests for equality
+invariant gl_Position;
+
+void main() {
+    gl_Position = ubo.mvp * vec4(inPosition, 1.0);
+}
@@ -8,16 +8,23 @@ layout(location = 0) out vec4 outColor;
 
 layout(set = 0, binding = 1, std140) uniform UBO {
     vec2 halfPixel;
+    vec2 uvScale; // rendered part of the source, for dynamic resolution
+    vec2 uvMax;
 } ubo;
 
+vec4 sampleBase(vec2 uv) {
+    return texture(baseTex, min(uv, ubo.uvMax));
+}
+
 void main() {
     vec2 hp = ubo.halfPixel;
+    vec2 uv = inUVs * ubo.uvScale;
 
-    vec4 sum = texture(baseTex, inUVs) * 4.0;
-    sum += texture(baseTex, inUVs - hp.xy);
-    sum += texture(baseTex, inUVs + hp.xy);
-    sum += texture(baseTex, inUVs + vec2(hp.x, -hp.y));
-    sum += texture(baseTex, inUVs - vec2(hp.x, -hp.y));
+    vec4 sum = sampleBase(uv) * 4.0;
+    sum += sampleBase(uv - hp.xy);
+    sum += sampleBase(uv + hp.xy);
+    sum += sampleBase(uv + vec2(hp.x, -hp.y));
+    sum += sampleBase(uv - vec2(hp.x, -hp.y));
 
     outColor = sum / 8.0;
 }
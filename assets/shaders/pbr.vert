@@ -4,6 +4,16 @@
 layout(location = 0) in vec3 inPosition;
 #endif
 
+#ifdef PACKED_ATTRIBUTES
+// Octahedral-encoded, with the bitangent sign in the tangent
+#ifdef HAS_NORMALS
+layout(location = 1) in vec2 inPackedNormal;
+#endif
+
+#ifdef HAS_TANGENTS
+layout(location = 2) in vec2 inPackedTangent;
+#endif
+#else // !PACKED_ATTRIBUTES
 #ifdef HAS_NORMALS
 layout(location = 1) in vec3 inNormal;
 #endif
@@ -11,6 +21,7 @@ layout(location = 1) in vec3 inNormal;
 #ifdef HAS_TANGENTS
 layout(location = 2) in vec3 inTangent;
 #endif
+#endif // PACKED_ATTRIBUTES
 
 #ifdef HAS_BITANGENTS
 layout(location = 3) in vec3 inBitangent;
@@ -51,6 +62,9 @@ layout(location = 8) out vec3 outNormal;
 
 layout(location = 11) out vec3 outShadowPos;
 
+// Matches the depth pre-pass exactly, as it is tested for equality
+invariant gl_Position;
+
 layout(set = 0, binding = 12, std140) uniform VertUBO {
 	mat4 mvp;
 	mat4 model;
@@ -58,16 +72,41 @@ layout(set = 0, binding = 12, std140) uniform VertUBO {
 	mat4 shadowMvp;
 } ubo;
 
+#ifdef PACKED_ATTRIBUTES
+vec3 octDecode(vec2 e) {
+    vec3 v = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0) {
+        v.xy = (1.0 - abs(v.yx)) *
+               vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(v);
+}
+#endif
+
 void main()
 {
     vec4 pos = ubo.model * vec4(inPosition, 1.0);
     outPosition = pos.xyz / pos.w;
 
+#ifdef PACKED_ATTRIBUTES
+#ifdef HAS_NORMALS
+    vec3 inNormal = octDecode(inPackedNormal);
+#endif
+#ifdef HAS_TANGENTS
+    float bitangentSign = inPackedTangent.x < 0.0 ? -1.0 : 1.0;
+    float tangentX = (abs(inPackedTangent.x) - TANGENT_SIGN_BIAS) /
+                     (1.0 - TANGENT_SIGN_BIAS);
+    vec3 inTangent = octDecode(vec2(tangentX * 2.0 - 1.0, inPackedTangent.y));
+#endif
+#else // !PACKED_ATTRIBUTES
+    float bitangentSign = 1.0;
+#endif
+
 #ifdef HAS_NORMALS
 #ifdef HAS_TANGENTS
     vec3 normalW = normalize(vec3(ubo.normal * vec4(inNormal.xyz, 0.0)));
     vec3 tangentW = normalize(vec3(ubo.model * vec4(inTangent.xyz, 0.0)));
-    vec3 bitangentW = cross(normalW, tangentW);
+    vec3 bitangentW = cross(normalW, tangentW) * bitangentSign;
     outTBN = mat3(tangentW, bitangentW, normalW);
 #else // !HAS_TANGENTS
     outNormal = normalize(vec3(ubo.normal * vec4(inNormal.xyz, 0.0)));
@@ -11,6 +11,8 @@ layout(location = 0) out vec4 outColor;
 layout(set = 0, binding = 3, std140) uniform UBO {
     vec4 dofParams; // x: focusDistance / y: focusRange / z: strength
     vec2 nearFarPlane;
+    vec2 uvScale; // rendered part of the inputs, for dynamic resolution
+    vec2 uvMax;
 } ubo;
 
 float linearizeDepth(float depth, float nearPlane, float farPlane)
@@ -24,9 +26,10 @@ void main() {
     float dofStrength = ubo.dofParams.z;
 
     // Depth of field
-    float depth = texelFetch(depthTex, ivec2(gl_FragCoord.xy), 0).r;
+    float depth = texelFetch(depthTex, ivec2(gl_FragCoord.xy * ubo.uvScale), 0).r;
     float linDepth = linearizeDepth(depth, ubo.nearFarPlane.x, ubo.nearFarPlane.y);
 
     float coc = clamp(abs(linDepth - focusDistance) / focusRange, 0.0, 1.0) * dofStrength;
-    outColor = mix(texture(baseTex, inUVs), texture(blurTex, inUVs), coc);
+    vec2 uv = min(inUVs * ubo.uvScale, ubo.uvMax);
+    outColor = mix(texture(baseTex, uv), texture(blurTex, uv), coc);
 }
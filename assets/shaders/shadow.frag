@@ -0,0 +1,20 @@
+#version 450
+
+layout(location = 5) in vec2 inUV0;
+
+#ifdef HAS_DIFFUSE_MAP
+layout(set = 0, binding = 0) uniform sampler2D diffuseTex;
+#endif
+
+layout(set = 0, binding = 13, std140) uniform UBO {
+    float alphaCutoff;
+} ubo;
+
+// Alpha test of pbr.frag, so that shadows match the masked surface
+void main() {
+#ifdef HAS_DIFFUSE_MAP
+    if (texture(diffuseTex, inUV0).a < ubo.alphaCutoff) {
+        discard;
+    }
+#endif
+}
@@ -8,19 +8,26 @@ layout(location = 0) out vec4 outColor;
 
 layout(set = 0, binding = 1, std140) uniform UBO {
     vec2 halfPixel;
+    vec2 uvScale; // rendered part of the source, for dynamic resolution
+    vec2 uvMax;
 } ubo;
 
+vec4 sampleBase(vec2 uv) {
+    return texture(baseTex, min(uv, ubo.uvMax));
+}
+
 void main() {
     vec2 hp = ubo.halfPixel;
+    vec2 uv = inUVs * ubo.uvScale;
 
-    vec4 sum = texture(baseTex, inUVs + vec2(-hp.x * 2.0, 0.0));
-    sum += texture(baseTex, inUVs + vec2(-hp.x, hp.y)) * 2.0;
-    sum += texture(baseTex, inUVs + vec2(0.0, hp.y * 2.0));
-    sum += texture(baseTex, inUVs + vec2(hp.x, hp.y)) * 2.0;
-    sum += texture(baseTex, inUVs + vec2(hp.x * 2.0, 0.0));
-    sum += texture(baseTex, inUVs + vec2(hp.x, -hp.y)) * 2.0;
-    sum += texture(baseTex, inUVs + vec2(0.0, -hp.y * 2.0));
-    sum += texture(baseTex, inUVs + vec2(-hp.x, -hp.y)) * 2.0;
+    vec4 sum = sampleBase(uv + vec2(-hp.x * 2.0, 0.0));
+    sum += sampleBase(uv + vec2(-hp.x, hp.y)) * 2.0;
+    sum += sampleBase(uv + vec2(0.0, hp.y * 2.0));
+    sum += sampleBase(uv + vec2(hp.x, hp.y)) * 2.0;
+    sum += sampleBase(uv + vec2(hp.x * 2.0, 0.0));
+    sum += sampleBase(uv + vec2(hp.x, -hp.y)) * 2.0;
+    sum += sampleBase(uv + vec2(0.0, -hp.y * 2.0));
+    sum += sampleBase(uv + vec2(-hp.x, -hp.y)) * 2.0;
 
     outColor = sum / 12.0;
 }
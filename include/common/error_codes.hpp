@@ -31,6 +31,8 @@ enum class Error {
     ConfigNotSupported = 22,
     DimensionsNotMatching = 23,
     NoRenderPlan = 24,
+    InvalidBuffer = 25,
+    SavingFailed = 26,
 };
 
 }
@@ -106,6 +108,10 @@ class GomaError_category : public std::error_category {
                 return "dimensions not matching";
             case goma::Error::NoRenderPlan:
                 return "no render plan";
+            case goma::Error::InvalidBuffer:
+                return "invalid buffer";
+            case goma::Error::SavingFailed:
+                return "saving failed";
             default:
                 return "unknown error";
         }
@@ -22,6 +22,7 @@ using mapbox::util::variant;
 
 #include <algorithm>
 #include <array>
+#include <deque>
 #include <fstream>
 #include <functional>
 #include <limits>
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace goma {
+
+// Reports files that were modified since the last poll. Uses inotify on
+// Linux, otherwise compares modification times and sizes, at most once
+// per poll interval. Files can be added from any thread.
+class FileWatcher {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    FileWatcher(Clock::duration poll_interval = std::chrono::milliseconds(250))
+        : poll_interval_(poll_interval) {
+#ifdef __linux__
+        inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    }
+
+    ~FileWatcher() {
+#ifdef __linux__
+        if (inotify_fd_ >= 0) {
+            close(inotify_fd_);
+        }
+#endif
+    }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    void Watch(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (files_.count(path)) {
+            return;
+        }
+        files_[path] = GetFileState(path);
+
+#ifdef __linux__
+        if (inotify_fd_ >= 0) {
+            // Directories are watched, as editors often save
+            // by replacing the file instead of writing to it
+            auto prefix = path.substr(0, path.find_last_of('/') + 1);
+            if (!watched_dirs_.count(prefix)) {
+                auto dir = prefix.empty() ? "." : prefix;
+                int wd = inotify_add_watch(inotify_fd_, dir.c_str(),
+                                           IN_CLOSE_WRITE | IN_MOVED_TO);
+                if (wd >= 0) {
+                    watched_dirs_.insert(prefix);
+                    dir_prefixes_[wd] = prefix;
+                }
+            }
+        }
+#endif
+    }
+
+    std::vector<std::string> Poll() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::set<std::string> changed;
+
+#ifdef __linux__
+        if (inotify_fd_ >= 0) {
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = read(inotify_fd_, buffer, sizeof(buffer))) > 0) {
+                for (char* ptr = buffer; ptr < buffer + length;) {
+                    auto event = reinterpret_cast<inotify_event*>(ptr);
+                    ptr += sizeof(inotify_event) + event->len;
+
+                    auto prefix = dir_prefixes_.find(event->wd);
+                    if (event->len == 0 || prefix == dir_prefixes_.end()) {
+                        continue;
+                    }
+
+                    auto path = prefix->second + event->name;
+                    auto file = files_.find(path);
+                    if (file != files_.end()) {
+                        file->second = GetFileState(path);
+                        changed.insert(path);
+                    }
+                }
+            }
+        }
+#endif
+
+        auto now = Clock::now();
+        if (now - last_poll_ >= poll_interval_) {
+            last_poll_ = now;
+
+            for (auto& file : files_) {
+#ifdef __linux__
+                auto prefix =
+                    file.first.substr(0, file.first.find_last_of('/') + 1);
+                if (watched_dirs_.count(prefix)) {
+                    continue;
+                }
+#endif
+                auto state = GetFileState(file.first);
+                if (state != file.second) {
+                    file.second = state;
+                    changed.insert(file.first);
+                }
+            }
+        }
+
+        return {changed.begin(), changed.end()};
+    }
+
+  private:
+    // Modification time and size, zero for missing files
+    using FileState = std::pair<int64_t, int64_t>;
+
+    static FileState GetFileState(const std::string& path) {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) {
+            return {0, 0};
+        }
+        return {static_cast<int64_t>(info.st_mtime),
+                static_cast<int64_t>(info.st_size)};
+    }
+
+    std::mutex mutex_{};
+    std::map<std::string, FileState> files_{};
+
+    Clock::duration poll_interval_;
+    Clock::time_point last_poll_{};
+
+#ifdef __linux__
+    int inotify_fd_{-1};
+    // Directories are stored as path prefixes, up to the last slash
+    std::set<std::string> watched_dirs_{};
+    std::map<int, std::string> dir_prefixes_{};
+#endif
+};
+
+}  // namespace goma
@@ -0,0 +1,265 @@
+#pragma once
+
+#include "infrastructure/murmur_hash.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace goma {
+
+// Hashes the bytes of a key, so keys must be plain data without padding,
+// e.g. integers, handles or arrays of them
+template <typename Key>
+struct FlatHash {
+    static_assert(std::is_trivially_copyable<Key>::value,
+                  "Keys must be plain data");
+
+    size_t operator()(const Key& key) const {
+        return static_cast<size_t>(MurmurHash3(&key, sizeof(Key)).low);
+    }
+};
+
+// Hash map with open addressing and linear probing, storing entries in a
+// single array. Lookups do not allocate and touch few cache lines, which
+// suits small fixed-width keys. Erased entries leave a marker behind
+// until the next rehash, so iterators stay valid across erase() and
+// only insertions can invalidate them.
+template <typename Key, typename Value, typename Hash = FlatHash<Key>>
+class FlatHashMap {
+  public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<Key, Value>;
+
+    template <typename MapT, typename EntryT>
+    class Iterator {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = FlatHashMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = EntryT*;
+        using reference = EntryT&;
+
+        Iterator(MapT* map, size_t slot) : map_(map), slot_(slot) {
+            SkipEmpty();
+        }
+
+        // Allows converting iterators to const iterators
+        template <typename OtherMapT, typename OtherEntryT>
+        Iterator(const Iterator<OtherMapT, OtherEntryT>& other)
+            : map_(other.map_), slot_(other.slot_) {}
+
+        reference operator*() const { return map_->entries_[slot_]; }
+        pointer operator->() const { return &map_->entries_[slot_]; }
+
+        Iterator& operator++() {
+            slot_++;
+            SkipEmpty();
+            return *this;
+        }
+        Iterator operator++(int) {
+            auto ret = *this;
+            ++*this;
+            return ret;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return slot_ == other.slot_;
+        }
+        bool operator!=(const Iterator& other) const {
+            return slot_ != other.slot_;
+        }
+
+      private:
+        template <typename, typename>
+        friend class Iterator;
+        friend class FlatHashMap;
+
+        MapT* map_;
+        size_t slot_;
+
+        void SkipEmpty() {
+            while (slot_ < map_->states_.size() &&
+                   map_->states_[slot_] != SlotState::Full) {
+                slot_++;
+            }
+        }
+    };
+    using iterator = Iterator<FlatHashMap, value_type>;
+    using const_iterator = Iterator<const FlatHashMap, const value_type>;
+
+    iterator begin() { return {this, 0}; }
+    iterator end() { return {this, states_.size()}; }
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, states_.size()}; }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t capacity() const { return states_.size(); }
+
+    iterator find(const Key& key) { return {this, FindSlot(key)}; }
+    const_iterator find(const Key& key) const {
+        return {this, FindSlot(key)};
+    }
+    size_t count(const Key& key) const {
+        return FindSlot(key) != states_.size() ? 1 : 0;
+    }
+
+    std::pair<iterator, bool> insert(value_type entry) {
+        auto slot = FindSlot(entry.first);
+        if (slot != states_.size()) {
+            return {{this, slot}, false};
+        }
+
+        slot = InsertSlot(entry.first);
+        entries_[slot] = std::move(entry);
+        return {{this, slot}, true};
+    }
+
+    template <typename InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (; first != last; ++first) {
+            insert(*first);
+        }
+    }
+
+    Value& operator[](const Key& key) {
+        auto slot = FindSlot(key);
+        if (slot == states_.size()) {
+            slot = InsertSlot(key);
+            entries_[slot].first = key;
+        }
+        return entries_[slot].second;
+    }
+
+    // Returns the iterator following the erased entry
+    iterator erase(const_iterator pos) {
+        auto slot = pos.slot_;
+        states_[slot] = SlotState::Erased;
+        entries_[slot] = value_type{};
+        size_--;
+        erased_++;
+        return {this, slot + 1};
+    }
+    iterator erase(iterator pos) { return erase(const_iterator(pos)); }
+
+    size_t erase(const Key& key) {
+        auto slot = FindSlot(key);
+        if (slot == states_.size()) {
+            return 0;
+        }
+        erase(const_iterator(this, slot));
+        return 1;
+    }
+
+    // Keeps the capacity
+    void clear() {
+        for (size_t i = 0; i < states_.size(); i++) {
+            if (states_[i] != SlotState::Empty) {
+                states_[i] = SlotState::Empty;
+                entries_[i] = value_type{};
+            }
+        }
+        size_ = 0;
+        erased_ = 0;
+    }
+
+    void reserve(size_t count) {
+        size_t capacity = kMinCapacity;
+        while (!FitsLoadFactor(count, capacity)) {
+            capacity *= 2;
+        }
+        if (capacity > states_.size()) {
+            Rehash(capacity);
+        }
+    }
+
+  private:
+    enum class SlotState : uint8_t { Empty, Full, Erased };
+
+    static constexpr size_t kMinCapacity = 16;
+
+    std::vector<SlotState> states_{};
+    std::vector<value_type> entries_{};
+    size_t size_{0};
+    size_t erased_{0};
+    Hash hash_{};
+
+    // Up to 7/8 of the slots can be taken, counting erased ones
+    static bool FitsLoadFactor(size_t count, size_t capacity) {
+        return count * 8 <= capacity * 7;
+    }
+
+    // The end slot if the key is not there
+    size_t FindSlot(const Key& key) const {
+        if (states_.empty()) {
+            return 0;
+        }
+
+        size_t mask = states_.size() - 1;
+        for (size_t slot = hash_(key) & mask;; slot = (slot + 1) & mask) {
+            if (states_[slot] == SlotState::Empty) {
+                return states_.size();
+            }
+            if (states_[slot] == SlotState::Full &&
+                entries_[slot].first == key) {
+                return slot;
+            }
+        }
+    }
+
+    // Takes a slot for a key that is not in the map
+    size_t InsertSlot(const Key& key) {
+        if (!FitsLoadFactor(size_ + erased_ + 1, states_.size())) {
+            // Only grow if erased slots do not make enough room
+            size_t capacity =
+                states_.empty() ? size_t{kMinCapacity} : states_.size();
+            if (!FitsLoadFactor(size_ + 1, capacity)) {
+                capacity *= 2;
+            }
+            Rehash(capacity);
+        }
+
+        size_t mask = states_.size() - 1;
+        size_t slot = hash_(key) & mask;
+        while (states_[slot] == SlotState::Full) {
+            slot = (slot + 1) & mask;
+        }
+
+        if (states_[slot] == SlotState::Erased) {
+            erased_--;
+        }
+        states_[slot] = SlotState::Full;
+        size_++;
+        return slot;
+    }
+
+    void Rehash(size_t capacity) {
+        std::vector<SlotState> states(capacity, SlotState::Empty);
+        std::vector<value_type> entries(capacity);
+
+        size_t mask = capacity - 1;
+        for (size_t i = 0; i < states_.size(); i++) {
+            if (states_[i] != SlotState::Full) {
+                continue;
+            }
+
+            size_t slot = hash_(entries_[i].first) & mask;
+            while (states[slot] == SlotState::Full) {
+                slot = (slot + 1) & mask;
+            }
+            states[slot] = SlotState::Full;
+            entries[slot] = std::move(entries_[i]);
+        }
+
+        states_ = std::move(states);
+        entries_ = std::move(entries);
+        erased_ = 0;
+    }
+};
+
+}  // namespace goma
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace goma {
+
+struct Hash128 {
+    uint64_t low{0};
+    uint64_t high{0};
+
+    bool operator==(const Hash128& other) const {
+        return low == other.low && high == other.high;
+    }
+    bool operator!=(const Hash128& other) const { return !(*this == other); }
+    bool operator<(const Hash128& other) const {
+        return high < other.high || (high == other.high && low < other.low);
+    }
+};
+
+namespace detail {
+
+inline uint64_t Rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t Fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+}  // namespace detail
+
+// MurmurHash3, x64 128-bit variant, by Austin Appleby (public domain).
+// Not cryptographic, but strong enough to key caches by content.
+inline Hash128 MurmurHash3(const void* key, size_t size, uint32_t seed = 0) {
+    using detail::Rotl64;
+
+    constexpr uint64_t c1 = 0x87c37b91114253d5ULL;
+    constexpr uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    auto data = static_cast<const uint8_t*>(key);
+    size_t block_count = size / 16;
+
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+
+    for (size_t i = 0; i < block_count; i++) {
+        uint64_t k1, k2;
+        memcpy(&k1, data + i * 16, sizeof(k1));
+        memcpy(&k2, data + i * 16 + 8, sizeof(k2));
+
+        k1 *= c1;
+        k1 = Rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+
+        h1 = Rotl64(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2;
+        k2 = Rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+
+        h2 = Rotl64(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    // Remaining bytes, the first 8 go to k1 and the rest to k2
+    auto tail = data + block_count * 16;
+    size_t tail_size = size & 15;
+
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    for (size_t i = tail_size; i > 8; i--) {
+        k2 ^= static_cast<uint64_t>(tail[i - 1]) << ((i - 9) * 8);
+    }
+    if (tail_size > 8) {
+        k2 *= c2;
+        k2 = Rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+    }
+
+    for (size_t i = tail_size < 8 ? tail_size : 8; i > 0; i--) {
+        k1 ^= static_cast<uint64_t>(tail[i - 1]) << ((i - 1) * 8);
+    }
+    if (tail_size > 0) {
+        k1 *= c1;
+        k1 = Rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+    }
+
+    h1 ^= size;
+    h2 ^= size;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = detail::Fmix64(h1);
+    h2 = detail::Fmix64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    return {h1, h2};
+}
+
+}  // namespace goma
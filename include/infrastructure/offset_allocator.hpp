@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+
+namespace goma {
+
+// Best-fit allocator of ranges within a fixed size, e.g. to sub-allocate
+// a large buffer. Freed ranges are merged with their free neighbours.
+class OffsetAllocator {
+  public:
+    static constexpr uint64_t kInvalidOffset = ~0ULL;
+
+    OffsetAllocator(uint64_t size = 0) { reset(size); }
+
+    void reset(uint64_t size) {
+        size_ = size;
+        used_ = 0;
+        allocations_.clear();
+        free_blocks_.clear();
+        free_sizes_.clear();
+
+        if (size > 0) {
+            insert_free_block(0, size);
+        }
+    }
+
+    uint64_t allocate(uint64_t size) {
+        if (size == 0) {
+            return kInvalidOffset;
+        }
+
+        auto block = free_sizes_.lower_bound(size);
+        if (block == free_sizes_.end()) {
+            return kInvalidOffset;
+        }
+
+        uint64_t offset = block->second;
+        uint64_t block_size = block->first;
+        free_sizes_.erase(block);
+        free_blocks_.erase(offset);
+
+        if (block_size > size) {
+            insert_free_block(offset + size, block_size - size);
+        }
+
+        allocations_[offset] = size;
+        used_ += size;
+        return offset;
+    }
+
+    bool free(uint64_t offset) {
+        auto allocation = allocations_.find(offset);
+        if (allocation == allocations_.end()) {
+            return false;
+        }
+
+        uint64_t size = allocation->second;
+        allocations_.erase(allocation);
+        used_ -= size;
+
+        // Merge with the following free block
+        auto next = free_blocks_.find(offset + size);
+        if (next != free_blocks_.end()) {
+            size += next->second;
+            erase_free_block(next);
+        }
+
+        // Merge with the preceding free block
+        auto prev = free_blocks_.lower_bound(offset);
+        if (prev != free_blocks_.begin()) {
+            prev--;
+            if (prev->first + prev->second == offset) {
+                offset = prev->first;
+                size += prev->second;
+                erase_free_block(prev);
+            }
+        }
+
+        insert_free_block(offset, size);
+        return true;
+    }
+
+    uint64_t size() const { return size_; }
+    uint64_t used() const { return used_; }
+
+    uint64_t largest_free_block() const {
+        return free_sizes_.empty() ? 0 : free_sizes_.rbegin()->first;
+    }
+
+    // 0 when all free space is contiguous, approaching 1
+    // as it gets split into many small blocks
+    float fragmentation() const {
+        uint64_t free_size = size_ - used_;
+        if (free_size == 0) {
+            return 0.0f;
+        }
+        return 1.0f - float(largest_free_block()) / free_size;
+    }
+
+    // Offset to size of all the allocations, sorted by offset
+    const std::map<uint64_t, uint64_t>& allocations() const {
+        return allocations_;
+    }
+
+  private:
+    uint64_t size_{0};
+    uint64_t used_{0};
+
+    std::map<uint64_t, uint64_t> allocations_{};
+    std::map<uint64_t, uint64_t> free_blocks_{};
+    std::multimap<uint64_t, uint64_t> free_sizes_{};
+
+    void insert_free_block(uint64_t offset, uint64_t size) {
+        free_blocks_[offset] = size;
+        free_sizes_.emplace(size, offset);
+    }
+
+    void erase_free_block(std::map<uint64_t, uint64_t>::iterator block) {
+        auto range = free_sizes_.equal_range(block->second);
+        for (auto it = range.first; it != range.second; it++) {
+            if (it->second == block->first) {
+                free_sizes_.erase(it);
+                break;
+            }
+        }
+        free_blocks_.erase(block);
+    }
+};
+
+}  // namespace goma
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+namespace goma {
+
+// Offset allocator for a ring buffer, e.g. a staging buffer. Allocations
+// are grouped into batches, which must be released in the order they
+// were closed, typically once the GPU is done with them.
+class RingAllocator {
+  public:
+    static constexpr uint64_t kInvalidOffset = ~0ULL;
+
+    struct Batch {
+        uint64_t end{0};
+        uint64_t size{0};
+    };
+
+    RingAllocator(uint64_t size = 0) : size_(size) {}
+
+    uint64_t allocate(uint64_t size, uint64_t alignment = 1) {
+        if (size == 0 || size > size_ || used_ == size_) {
+            return kInvalidOffset;
+        }
+
+        uint64_t offset = align(head_, alignment);
+        uint64_t padding = 0;
+
+        if (head_ >= tail_) {
+            // Free space is [head, end) and [0, tail)
+            if (offset + size <= size_) {
+                padding = offset - head_;
+            } else if (size <= tail_) {
+                // Wrap around, wasting the end of the buffer
+                offset = 0;
+                padding = size_ - head_;
+            } else {
+                return kInvalidOffset;
+            }
+        } else {
+            // Free space is [head, tail)
+            if (offset + size <= tail_) {
+                padding = offset - head_;
+            } else {
+                return kInvalidOffset;
+            }
+        }
+
+        head_ = offset + size;
+        used_ += padding + size;
+        batch_size_ += padding + size;
+        return offset;
+    }
+
+    // Largest size that can currently be allocated in one go
+    uint64_t largest_free_block(uint64_t alignment = 1) const {
+        if (used_ == size_) {
+            return 0;
+        }
+
+        uint64_t offset = align(head_, alignment);
+        if (head_ >= tail_) {
+            uint64_t end_block = offset < size_ ? size_ - offset : 0;
+            return std::max(end_block, tail_);
+        }
+        return offset < tail_ ? tail_ - offset : 0;
+    }
+
+    // Groups all allocations since the last call into a batch
+    Batch close_batch() {
+        Batch batch{head_, batch_size_};
+        batch_size_ = 0;
+        return batch;
+    }
+
+    void release(const Batch& batch) {
+        tail_ = batch.end;
+        used_ -= batch.size;
+    }
+
+    uint64_t size() const { return size_; }
+    uint64_t used() const { return used_; }
+
+  private:
+    uint64_t size_{0};
+    uint64_t head_{0};
+    uint64_t tail_{0};
+    uint64_t used_{0};
+    uint64_t batch_size_{0};
+
+    static uint64_t align(uint64_t offset, uint64_t alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+};
+
+}  // namespace goma
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace goma {
+
+// Fixed set of worker threads consuming a FIFO of tasks.
+// Workers are joined when the pool is destroyed, after draining the queue.
+class ThreadPool {
+  public:
+    ThreadPool(size_t thread_count = std::thread::hardware_concurrency()) {
+        thread_count = std::max(thread_count, size_t(1));
+        workers_.reserve(thread_count);
+        for (size_t i = 0; i < thread_count; i++) {
+            workers_.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        condition_.notify_all();
+
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::future<void> push(std::function<void()> task) {
+        auto packaged_task =
+            std::make_shared<std::packaged_task<void()>>(std::move(task));
+        auto future = packaged_task->get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.emplace_back([packaged_task]() { (*packaged_task)(); });
+        }
+        condition_.notify_one();
+
+        return future;
+    }
+
+    // Calls fn(i) for each i in [0, count) and waits for all of them.
+    // Each call should only write to its own outputs, so that results
+    // do not depend on scheduling.
+    void parallel_for(size_t count, const std::function<void(size_t)>& fn) {
+        std::vector<std::future<void>> futures;
+        futures.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            futures.push_back(push([&fn, i]() { fn(i); }));
+        }
+
+        // Wait for all tasks before rethrowing, as they reference fn
+        for (auto& future : futures) {
+            future.wait();
+        }
+        for (auto& future : futures) {
+            future.get();
+        }
+    }
+
+    size_t size() const { return workers_.size(); }
+
+  private:
+    std::vector<std::thread> workers_{};
+    std::deque<std::function<void()>> tasks_{};
+
+    std::mutex mutex_{};
+    std::condition_variable condition_{};
+    bool stopping_{false};
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                condition_.wait(
+                    lock, [this]() { return stopping_ || !tasks_.empty(); });
+                if (tasks_.empty()) {
+                    return;
+                }
+
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+
+            task();
+        }
+    }
+};
+
+}  // namespace goma
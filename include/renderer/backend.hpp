@@ -1,6 +1,10 @@
 #pragma once
 
+#include "renderer/command_stream.hpp"
 #include "renderer/handles.hpp"
+#include "renderer/render_graph.hpp"
+#include "renderer/resource_name.hpp"
+#include "renderer/spirv_cache.hpp"
 #include "platform/platform.hpp"
 #include "scene/attachments/mesh.hpp"
 
@@ -16,12 +20,49 @@ enum class FramebufferColorSpace { Linear, Srgb };
 
 using FrameIndex = size_t;
 using PassFn = std::function<result<void>(FrameIndex, const RenderPassDesc*)>;
+using RecordFn = std::function<result<void>(uint32_t thread)>;
 
 class Backend {
   public:
     struct Config {
         Buffering buffering{Buffering::Triple};
         FramebufferColorSpace fb_color_space{FramebufferColorSpace::Linear};
+
+        // Size of the staging memory for uploads, and maximum bytes
+        // uploaded per frame. Any excess is deferred to later frames.
+        uint64_t staging_size{64 * 1024 * 1024};
+        uint64_t upload_budget{16 * 1024 * 1024};
+
+        // Threads available to RecordParallel, 0 for one per core
+        uint32_t recording_threads{0};
+
+        // Threads compiling pipelines in the background, 0 for one
+        // every two cores
+        uint32_t compile_threads{0};
+
+        // File for compiled shaders, kept across runs. Empty to disable.
+        std::string shader_cache_path{"shader_cache.bin"};
+
+        // Reload shaders when their source files change
+        bool watch_shaders{true};
+
+        // Count the fragments shaded by each render pass, if the device
+        // supports pipeline statistics queries
+        bool pass_statistics{true};
+    };
+
+    // Binds and dynamic state changes of a frame, split between the ones
+    // sent to the driver and the ones dropped as already bound
+    struct BindStats {
+        uint64_t issued{0};
+        uint64_t elided{0};
+    };
+
+    // Fragment shader invocations of a render pass in a frame, across
+    // all of its command buffers
+    struct PassStats {
+        PassName name;
+        uint64_t fragment_invocations{0};
     };
 
     Backend(const Config& config = {}, const RenderPlan& render_plan = {})
@@ -31,11 +72,34 @@ class Backend {
     const RenderPlan& render_plan() { return render_plan_; }
     const Config& config() { return config_; }
 
+    // Fraction of each side of the targets relative to the swapchain
+    // that passes render to, for dynamic resolution. Resolves of those
+    // targets are limited to it.
+    float render_scale() const { return render_scale_; }
+    void SetRenderScale(float scale) { render_scale_ = scale; }
+
     virtual result<void> SetRenderPlan(RenderPlan render_plan) {
         render_plan_ = std::move(render_plan);
         return outcome::success();
     }
 
+    // Disabled passes are skipped with their blits, so their targets
+    // keep the contents they had, e.g. to reuse what was rendered before
+    void SetPassEnabled(const PassName& pass, bool enabled) {
+        if (enabled) {
+            disabled_passes_.erase(pass);
+        } else {
+            disabled_passes_.insert(pass);
+        }
+    }
+    bool IsPassEnabled(const PassName& pass) const {
+        return disabled_passes_.find(pass) == disabled_passes_.end();
+    }
+
+    // Frame that the next call to RenderFrame() renders, i.e. the set of
+    // per-frame render targets that it uses
+    virtual FrameIndex GetNextFrameIndex() { return 0; }
+
     virtual result<void> SetBuffering(Buffering) {
         return Error::ConfigNotSupported;
     }
@@ -50,46 +114,96 @@ class Backend {
     virtual result<std::shared_ptr<Pipeline>> GetGraphicsPipeline(
         const ShaderDesc& vert, const ShaderDesc& frag = {}) = 0;
     virtual result<void> ClearShaderCache() = 0;
+
+    // Like GetGraphicsPipeline, but may compile in the background. Returns
+    // null while the pipeline is not ready, call it again to poll.
+    virtual result<std::shared_ptr<Pipeline>> RequestGraphicsPipeline(
+        const ShaderDesc& vert, const ShaderDesc& frag = {}) {
+        return GetGraphicsPipeline(vert, frag);
+    }
+    virtual size_t GetPendingPipelineCount() { return 0; }
+
+    // Recompiles, in the background, the shaders whose source files have
+    // changed. Once they are all compiled, the pipelines using them are
+    // updated in place, so existing handles pick up the new shaders.
+    // Meant to be called once per frame, outside of recording.
+    virtual result<void> ReloadChangedShaders() { return outcome::success(); }
+
+    // Changes whenever shaders are reloaded or cleared, so that
+    // anything drawn with the previous ones can be drawn again
+    virtual uint64_t GetShaderRevision() { return 0; }
     virtual result<std::shared_ptr<VertexInputFormat>> GetVertexInputFormat(
         const VertexInputFormatDesc& desc) = 0;
 
     virtual result<std::shared_ptr<Image>> CreateTexture(
-        const char* name, const TextureDesc& texture_desc,
+        ResourceName name, const TextureDesc& texture_desc,
         void* initial_contents = nullptr) = 0;
     virtual result<std::shared_ptr<Image>> CreateCubemap(
-        const char* name, const TextureDesc& texture_desc,
+        ResourceName name, const TextureDesc& texture_desc,
         const CubemapContents& initial_contents) = 0;
-    virtual result<std::shared_ptr<Image>> GetTexture(const char* name) = 0;
+    virtual result<std::shared_ptr<Image>> GetTexture(ResourceName name) = 0;
+    virtual result<void> DestroyTexture(const Image& image) = 0;
+    // Bytes per texel of images in the format
+    virtual uint32_t GetFormatSize(Format format) = 0;
     virtual result<std::shared_ptr<Image>> GetRenderTarget(
-        FrameIndex frame_id, const char* name) = 0;
+        FrameIndex frame_id, ResourceName name) = 0;
     virtual Extent GetAbsoluteExtent(Extent extent) = 0;
 
     virtual result<std::shared_ptr<Buffer>> CreateUniformBuffer(
-        BufferType type, const GenIndex& index, const char* name, uint64_t size,
-        bool gpu_stored = true, void* initial_contents = nullptr) = 0;
+        BufferType type, const GenIndex& index, ResourceName name,
+        uint64_t size, bool gpu_stored = true,
+        void* initial_contents = nullptr) = 0;
     virtual result<std::shared_ptr<Buffer>> GetUniformBuffer(
-        BufferType type, const GenIndex& index, const char* name) = 0;
+        BufferType type, const GenIndex& index, ResourceName name) = 0;
     virtual result<std::shared_ptr<Buffer>> CreateUniformBuffer(
-        const char* name, uint64_t size, bool gpu_stored = true,
+        ResourceName name, uint64_t size, bool gpu_stored = true,
         void* initial_contents = nullptr) = 0;
     virtual result<std::shared_ptr<Buffer>> GetUniformBuffer(
-        const char* name) = 0;
+        ResourceName name) = 0;
 
     virtual result<std::shared_ptr<Buffer>> CreateVertexBuffer(
-        const AttachmentIndex<Mesh>& mesh, const char* name, uint64_t size,
+        const AttachmentIndex<Mesh>& mesh, ResourceName name, uint64_t size,
         bool gpu_stored = true, void* initial_contents = nullptr) = 0;
     virtual result<std::shared_ptr<Buffer>> GetVertexBuffer(
-        const AttachmentIndex<Mesh>& mesh, const char* name) = 0;
+        const AttachmentIndex<Mesh>& mesh, ResourceName name) = 0;
     virtual result<std::shared_ptr<Buffer>> CreateIndexBuffer(
-        const AttachmentIndex<Mesh>& mesh, const char* name, uint64_t size,
+        const AttachmentIndex<Mesh>& mesh, ResourceName name, uint64_t size,
         bool gpu_stored = true, void* initial_contents = nullptr) = 0;
     virtual result<std::shared_ptr<Buffer>> GetIndexBuffer(
-        const AttachmentIndex<Mesh>& mesh, const char* name) = 0;
+        const AttachmentIndex<Mesh>& mesh, ResourceName name) = 0;
     virtual result<void> UpdateBuffer(const Buffer& buffer, uint64_t offset,
                                       uint64_t size, const void* contents) = 0;
+    virtual result<UploadTicket> UploadBuffer(const Buffer& buffer,
+                                              uint64_t offset, uint64_t size,
+                                              const void* contents) = 0;
+    virtual result<UploadTicket> CopyBuffer(const Buffer& src,
+                                            uint64_t src_offset,
+                                            const Buffer& dst,
+                                            uint64_t dst_offset,
+                                            uint64_t size) = 0;
+    virtual result<void> DestroyBuffer(const Buffer& buffer) = 0;
+    virtual bool IsUploadComplete(UploadTicket ticket) = 0;
 
     virtual result<void> RenderFrame(std::vector<PassFn> pass_fns,
-                                     const char* present_image) = 0;
+                                     ResourceName present_image) = 0;
+
+    virtual uint32_t GetRecordingThreadCount() { return 1; }
+
+    // Whether RasterizationState::depth_clamp takes effect. Otherwise,
+    // depth outside of the near and far planes is clipped.
+    virtual bool SupportsDepthClamp() { return false; }
+
+    // Calls record_fn(thread) for each thread in [0, thread_count) within
+    // the current pass, possibly concurrently. Commands recorded by each
+    // thread are executed in thread order. While it runs, only
+    // ExecuteCommands and lookups of existing resources are thread-safe.
+    virtual result<void> RecordParallel(uint32_t thread_count,
+                                        const RecordFn& record_fn) {
+        for (uint32_t thread = 0; thread < thread_count; thread++) {
+            OUTCOME_TRY(record_fn(thread));
+        }
+        return outcome::success();
+    }
 
     virtual result<void> BindUniformBuffer(const Buffer& buffer,
                                            uint64_t offset, uint64_t size,
@@ -148,11 +262,33 @@ class Backend {
                                      uint32_t vertex_offset = 0,
                                      uint32_t first_instance = 0) = 0;
 
+    // Translates a recorded stream into the calls above, in order
+    virtual result<void> ExecuteCommands(const CommandStream& stream) = 0;
+
+    // Counters of the last finished frame
+    virtual BindStats GetBindStats() { return {}; }
+
+    // Counters of the last frame whose results are available, in the
+    // order of the compiled render plan
+    virtual std::vector<PassStats> GetPassStats() { return {}; }
+
+    // GPU time of the last frame whose results are available, in
+    // seconds. Zero if the device cannot time frames.
+    virtual float GetGpuFrameTime() { return 0.0f; }
+
+    // Counters of the compiled shader cache since startup
+    virtual SpirvCache::Stats GetShaderCacheStats() { return {}; }
+
+    // Render target traffic of the current render plan, per frame
+    virtual RenderPlanBandwidth GetRenderPlanBandwidth() { return {}; }
+
     virtual result<void> TeardownContext() = 0;
 
   protected:
     Config config_{};
     RenderPlan render_plan_{};
+    float render_scale_{1.0f};
+    std::set<PassName> disabled_passes_{};
 };
 
 }  // namespace goma
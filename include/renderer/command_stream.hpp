@@ -0,0 +1,266 @@
+#pragma once
+
+#include "renderer/handles.hpp"
+
+#include "common/include.hpp"
+
+namespace goma {
+
+enum class CommandType : uint32_t {
+    BindGraphicsPipeline,
+    BindVertexInputFormat,
+    BindVertexBuffer,
+    BindIndexBuffer,
+    BindTexture,
+    BindUniformBuffer,
+    UpdateBuffer,
+    BindDepthStencilState,
+    BindRasterizationState,
+    BindMultisampleState,
+    SetViewport,
+    SetScissor,
+    Draw,
+    DrawIndexed
+};
+
+// Plain data recorded for each command. Resources are referenced by
+// pointer, so they must outlive the stream until it is executed.
+namespace commands {
+
+struct BindGraphicsPipeline {
+    static constexpr CommandType kType = CommandType::BindGraphicsPipeline;
+    const Pipeline* pipeline;
+};
+
+struct BindVertexInputFormat {
+    static constexpr CommandType kType = CommandType::BindVertexInputFormat;
+    const VertexInputFormat* vertex_input_format;
+};
+
+struct BindVertexBuffer {
+    static constexpr CommandType kType = CommandType::BindVertexBuffer;
+    const Buffer* buffer;
+    uint64_t offset;
+    uint32_t binding;
+};
+
+struct BindIndexBuffer {
+    static constexpr CommandType kType = CommandType::BindIndexBuffer;
+    const Buffer* buffer;
+    uint64_t offset;
+    bool short_indices;
+};
+
+struct BindTexture {
+    static constexpr CommandType kType = CommandType::BindTexture;
+    const Image* image;
+    uint32_t binding;
+    bool has_sampler_override;
+    SamplerDesc sampler_override;
+};
+
+struct BindUniformBuffer {
+    static constexpr CommandType kType = CommandType::BindUniformBuffer;
+    const Buffer* buffer;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t binding;
+    uint32_t array_index;
+};
+
+// Followed by size bytes of contents
+struct UpdateBuffer {
+    static constexpr CommandType kType = CommandType::UpdateBuffer;
+    const Buffer* buffer;
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct BindDepthStencilState {
+    static constexpr CommandType kType = CommandType::BindDepthStencilState;
+    DepthStencilState state;
+};
+
+struct BindRasterizationState {
+    static constexpr CommandType kType = CommandType::BindRasterizationState;
+    RasterizationState state;
+};
+
+struct BindMultisampleState {
+    static constexpr CommandType kType = CommandType::BindMultisampleState;
+    MultisampleState state;
+};
+
+struct SetViewport {
+    static constexpr CommandType kType = CommandType::SetViewport;
+    Viewport viewport;
+    uint32_t index;
+};
+
+struct SetScissor {
+    static constexpr CommandType kType = CommandType::SetScissor;
+    Scissor scissor;
+    uint32_t index;
+};
+
+struct Draw {
+    static constexpr CommandType kType = CommandType::Draw;
+    uint32_t vertex_count;
+    uint32_t instance_count;
+    uint32_t first_vertex;
+    uint32_t first_instance;
+};
+
+struct DrawIndexed {
+    static constexpr CommandType kType = CommandType::DrawIndexed;
+    uint32_t index_count;
+    uint32_t instance_count;
+    uint32_t first_index;
+    uint32_t vertex_offset;
+    uint32_t first_instance;
+};
+
+}  // namespace commands
+
+// Backend-neutral list of rendering commands, packed back to back in a
+// byte arena. Recording does not touch the backend, so streams can be
+// filled on any thread and executed later with Backend::ExecuteCommands.
+// Clearing keeps the memory, so a stream reused every frame stops
+// allocating once it has grown to its working size.
+class CommandStream {
+  public:
+    // Every command starts at a multiple of this
+    static constexpr size_t kAlignment = 8;
+
+    struct Header {
+        CommandType type;
+        // Bytes from this header to the next one
+        uint32_t stride;
+    };
+    static_assert(sizeof(Header) == kAlignment, "Unexpected header padding");
+
+    class ConstIterator;
+
+    class Command {
+      public:
+        Command(const uint8_t* data) : data_(data) {}
+
+        CommandType type() const { return header().type; }
+
+        template <typename T>
+        const T& as() const {
+            return *reinterpret_cast<const T*>(data_ + sizeof(Header));
+        }
+
+        // Inline contents recorded after the command, if any
+        template <typename T>
+        const void* payload() const {
+            return data_ + sizeof(Header) + PaddedSize(sizeof(T));
+        }
+
+      private:
+        friend class ConstIterator;
+        const uint8_t* data_;
+
+        const Header& header() const {
+            return *reinterpret_cast<const Header*>(data_);
+        }
+    };
+
+    class ConstIterator {
+      public:
+        ConstIterator(const uint8_t* data) : command_(data) {}
+
+        const Command& operator*() const { return command_; }
+        const Command* operator->() const { return &command_; }
+
+        ConstIterator& operator++() {
+            command_.data_ += command_.header().stride;
+            return *this;
+        }
+
+        bool operator==(const ConstIterator& other) const {
+            return command_.data_ == other.command_.data_;
+        }
+        bool operator!=(const ConstIterator& other) const {
+            return !(*this == other);
+        }
+
+      private:
+        Command command_;
+    };
+
+    void BindGraphicsPipeline(const Pipeline& pipeline);
+    void BindVertexInputFormat(const VertexInputFormat& vertex_input_format);
+    void BindVertexBuffer(const Buffer& vertex_buffer, uint32_t binding = 0,
+                          uint64_t offset = 0);
+    void BindIndexBuffer(const Buffer& index_buffer, uint64_t offset = 0,
+                         bool short_indices = false);
+    void BindTexture(const Image& image, uint32_t binding = 0,
+                     const SamplerDesc* sampler_override = nullptr);
+    void BindUniformBuffer(const Buffer& buffer, uint64_t offset,
+                           uint64_t size, uint32_t binding,
+                           uint32_t array_index = 0);
+
+    // Contents are copied into the stream
+    void UpdateBuffer(const Buffer& buffer, uint64_t offset, uint64_t size,
+                      const void* contents);
+
+    void BindDepthStencilState(const DepthStencilState& state);
+    void BindRasterizationState(const RasterizationState& state);
+    void BindMultisampleState(const MultisampleState& state);
+    void SetViewport(const Viewport& viewport, uint32_t index = 0);
+    void SetScissor(const Scissor& scissor, uint32_t index = 0);
+
+    void Draw(uint32_t vertex_count, uint32_t instance_count = 1,
+              uint32_t first_vertex = 0, uint32_t first_instance = 0);
+    void DrawIndexed(uint32_t index_count, uint32_t instance_count = 1,
+                     uint32_t first_index = 0, uint32_t vertex_offset = 0,
+                     uint32_t first_instance = 0);
+
+    void Clear() {
+        data_.clear();
+        size_ = 0;
+    }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    size_t bytes() const { return data_.size(); }
+
+    ConstIterator begin() const { return {data_.data()}; }
+    ConstIterator end() const { return {data_.data() + data_.size()}; }
+
+  private:
+    std::vector<uint8_t> data_{};
+    size_t size_{0};
+
+    static constexpr size_t PaddedSize(size_t size) {
+        return (size + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
+    template <typename T>
+    void Push(const T& command, const void* payload = nullptr,
+              size_t payload_size = 0) {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "Commands must be plain data");
+        static_assert(alignof(T) <= kAlignment,
+                      "Commands must fit the stream alignment");
+
+        size_t stride = sizeof(Header) + PaddedSize(sizeof(T)) +
+                        PaddedSize(payload_size);
+        size_t offset = data_.size();
+        data_.resize(offset + stride);
+
+        Header header{T::kType, static_cast<uint32_t>(stride)};
+        memcpy(&data_[offset], &header, sizeof(header));
+        memcpy(&data_[offset + sizeof(Header)], &command, sizeof(T));
+        if (payload_size > 0) {
+            memcpy(&data_[offset + sizeof(Header) + PaddedSize(sizeof(T))],
+                   payload, payload_size);
+        }
+
+        size_++;
+    }
+};
+
+}  // namespace goma
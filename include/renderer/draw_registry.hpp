@@ -0,0 +1,71 @@
+#pragma once
+
+#include "scene/gen_index.hpp"
+#include "scene/attachments/mesh.hpp"
+
+#include "common/include.hpp"
+
+namespace goma {
+
+class Scene;
+
+struct DrawItem {
+    AttachmentIndex<Mesh> mesh;
+    NodeIndex node;
+
+    glm::mat4 model{1.0f};
+    glm::mat4 normals{1.0f};
+
+    // World-space bounding box, not valid for meshes without bounds
+    Box bounds{};
+    bool bounded{false};
+
+    // LOD picked in the last frame, kept for hysteresis
+    size_t lod{0};
+    size_t lod_count{0};
+
+    // Worth culling per meshlet
+    bool has_meshlets{false};
+
+    // From the mobility of the node
+    bool is_static{false};
+};
+
+// Persistent list of (mesh, node) pairs to be drawn. It is only
+// updated when meshes are attached/detached or nodes move, so that
+// static scenes do not pay for rebuilding it every frame.
+class DrawRegistry {
+  public:
+    result<void> Update(Scene& scene);
+
+    const std::vector<DrawItem>& items() const { return items_; }
+    // Only the per-frame state of the items should be modified
+    std::vector<DrawItem>& items() { return items_; }
+    size_t size() const { return items_.size(); }
+
+    // Changes whenever a static item is added, removed or updated, or
+    // the material or textures of its mesh are modified, so that data
+    // cached from static items can be invalidated
+    uint64_t static_revision() const { return static_revision_; }
+
+  private:
+    using DrawKey = std::pair<NodeIndex, AttachmentIndex<Mesh>>;
+
+    std::vector<DrawItem> items_{};
+    std::map<DrawKey, size_t> item_map_{};
+    uint64_t scene_id_{0};  // never a valid id
+
+    uint64_t mesh_revision_{0};
+    uint64_t material_revision_{0};
+    uint64_t texture_revision_{0};
+    uint64_t static_revision_{0};
+    bool initialized_{false};
+
+    void Reset();
+    void SyncAttachments(Scene& scene);
+    bool UpdateItem(Scene& scene, DrawItem& item);
+    bool IsStaticMaterialModified(Scene& scene);
+    void RemoveItem(size_t index);
+};
+
+}  // namespace goma
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common/include.hpp"
+
+namespace goma {
+
+// Picks the scale of the scene render targets that keeps frame times
+// at a target. Frame times are smoothed, and the scale only changes when
+// they leave a band below the target, so that it does not oscillate.
+class DynamicResolution {
+  public:
+    struct Config {
+        // When off, the scale stays at max_scale
+        bool enabled{true};
+
+        // In seconds
+        float target_frame_time{1.0f / 60.0f};
+
+        // Scale of each side of the render targets. They are allocated
+        // at full size, so the scale is at most 1.
+        float min_scale{0.5f};
+        float max_scale{1.0f};
+
+        // Weight of each new frame time in the smoothed one
+        float smoothing{0.1f};
+        // Fraction of the target below which the scale grows again
+        float headroom{0.85f};
+        // Largest change of the scale in a frame
+        float max_step{0.05f};
+    };
+
+    DynamicResolution(const Config& config = {})
+        : config_(config), scale_(config.max_scale) {}
+
+    // Takes the GPU time of a recent frame and returns the scale to use.
+    // CPU time would include waiting for presentation, e.g. for vsync.
+    float Update(float frame_time);
+
+    float scale() const { return scale_; }
+    float smoothed_frame_time() const { return smoothed_frame_time_; }
+    const Config& config() const { return config_; }
+
+  private:
+    Config config_;
+    float scale_;
+    float smoothed_frame_time_{0.0f};
+};
+
+}  // namespace goma
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "renderer/backend.hpp"
+#include "infrastructure/offset_allocator.hpp"
+#include "scene/gen_index.hpp"
+#include "scene/attachments/mesh.hpp"
+
+#include "common/include.hpp"
+
+namespace goma {
+
+class Scene;
+
+// Sub-allocates mesh geometry out of a few large buffers, one per vertex
+// stream plus one for indices, so that meshes only differ by their offsets.
+// Streams have fixed strides, so one vertex offset works for all of them.
+// Buffers are compacted when free space gets too fragmented, and grown
+// when an allocation does not fit.
+class GeometryPool {
+  public:
+    struct Config {
+        uint64_t vertex_capacity{1 << 20};
+        uint64_t index_capacity{1 << 22};
+        float max_fragmentation{0.5f};
+    };
+
+    struct Stats {
+        size_t meshes{0};
+        size_t buffers{0};
+        size_t compactions{0};
+    };
+
+    GeometryPool(Backend& backend, const Config& config = {})
+        : backend_(backend), config_(config) {
+        Reset();
+    }
+
+    // Returns the bytes of geometry uploaded for the mesh
+    result<size_t> Allocate(Scene& scene, AttachmentIndex<Mesh> id,
+                            Mesh& mesh);
+    void Free(AttachmentIndex<Mesh> id);
+
+    // Compacts the buffers if frees left them too fragmented, and
+    // releases buffers that have been copied out of
+    result<void> Update(Scene& scene);
+    void Reset();
+
+    float fragmentation() const;
+    const Stats& stats() const { return stats_; }
+
+  private:
+    // Positions, packed attributes and packed extras
+    static constexpr size_t kStreamCount = 3;
+
+    struct Allocation {
+        uint64_t vertex_offset{OffsetAllocator::kInvalidOffset};
+        uint64_t vertex_count{0};
+        // Indices are allocated in 32-bit units, holding two short indices
+        uint64_t index_offset{OffsetAllocator::kInvalidOffset};
+        uint64_t index_count{0};
+        bool short_indices{false};
+        uint32_t streams{0};
+    };
+
+    Backend& backend_;
+    Config config_;
+
+    OffsetAllocator vertex_allocator_{};
+    OffsetAllocator index_allocator_{};
+    std::array<std::shared_ptr<Buffer>, kStreamCount> vertex_buffers_{};
+    std::shared_ptr<Buffer> index_buffer_{};
+    uint32_t generation_{0};
+
+    std::map<AttachmentIndex<Mesh>, Allocation> allocations_{};
+    bool freed_{false};
+
+    // Buffers replaced by a rebuild, kept with their pending uploads
+    // until the copies out of them have completed
+    struct RetiredBuffers {
+        std::vector<std::shared_ptr<Buffer>> buffers;
+        UploadTicket ticket;
+    };
+    std::vector<RetiredBuffers> retired_buffers_{};
+
+    Stats stats_{};
+
+    result<std::shared_ptr<Buffer>> GetVertexBuffer(size_t stream);
+    result<std::shared_ptr<Buffer>> GetIndexBuffer();
+    bool AllocateRanges(Allocation& allocation);
+    result<void> Rebuild(Scene& scene, uint64_t vertex_capacity,
+                         uint64_t index_capacity);
+    void DestroyBuffers();
+    void ReleaseRetiredBuffers(bool force = false);
+    void SetBuffers(Mesh& mesh, const Allocation& allocation);
+};
+
+}  // namespace goma
@@ -11,9 +11,13 @@ struct VulkanImage {
     VkSampler sampler{VK_NULL_HANDLE};
 };
 
+// Identifies an upload, resources can be used once it is complete
+using UploadTicket = uint64_t;
+
 struct Image {
     VulkanImage vez{};
     bool valid{false};
+    UploadTicket upload_ticket{0};
 
     Image(VulkanImage vez_) : vez(vez_), valid(true) {}
 };
@@ -35,6 +39,7 @@ struct Pipeline {
 struct Buffer {
     VkBuffer vez{VK_NULL_HANDLE};
     bool valid{false};
+    UploadTicket upload_ticket{0};
 
     Buffer(VkBuffer vez_) : vez(vez_), valid(true) {}
 };
@@ -46,6 +51,13 @@ struct Viewport {
     float y{0.0f};
     float min_depth{0.0f};
     float max_depth{1.0f};
+
+    bool operator==(const Viewport& other) const {
+        return width == other.width && height == other.height &&
+               x == other.x && y == other.y && min_depth == other.min_depth &&
+               max_depth == other.max_depth;
+    }
+    bool operator!=(const Viewport& other) const { return !(*this == other); }
 };
 
 struct Scissor {
@@ -53,6 +65,12 @@ struct Scissor {
     uint32_t height;
     int32_t x{0};
     int32_t y{0};
+
+    bool operator==(const Scissor& other) const {
+        return width == other.width && height == other.height &&
+               x == other.x && y == other.y;
+    }
+    bool operator!=(const Scissor& other) const { return !(*this == other); }
 };
 
 struct VertexInputFormat {
@@ -72,6 +90,11 @@ enum class Format {
     SFloatRGB32,
     SFloatRG32,
     SFloatR32,
+    SFloatRGBA16,
+    SFloatRG16,
+    SNormRG16,
+    UNormRG16,
+    UFloatB10G11R11,  // no alpha, half the size of SFloatRGBA16
     DepthOnly,
     DepthStencil
 };
@@ -182,6 +205,9 @@ struct ColorRenderTargetDesc {
 
     Format format{Format::SwapchainFormat};
     SamplerDesc sampler{};
+
+    // Contents are kept from one frame to the next, e.g. for caches
+    bool persistent{false};
 };
 
 struct DepthRenderTargetDesc {
@@ -190,6 +216,9 @@ struct DepthRenderTargetDesc {
 
     Format format{Format::DepthStencil};
     SamplerDesc sampler{};
+
+    // Contents are kept from one frame to the next, e.g. for caches
+    bool persistent{false};
 };
 
 struct ColorAttachmentDesc {
@@ -231,15 +260,20 @@ struct BlitDesc {
 using RenderTargetName = std::string;
 using PassName = std::string;
 
+// Passes list the render targets they sample as inputs, so that the plan
+// knows how long each target is needed. Targets sampled without being
+// listed may share memory with others, and hold other contents.
 struct RenderPassEntry {
     PassName name;
     RenderPassDesc desc;
     std::vector<BlitDesc> blits{};
+    std::vector<RenderTargetName> inputs{};
 };
 
 struct GeneralPassEntry {
     PassName name;
     std::vector<BlitDesc> blits{};
+    std::vector<RenderTargetName> inputs{};
 };
 
 using PassEntry = variant<RenderPassEntry, GeneralPassEntry>;
@@ -249,6 +283,10 @@ struct RenderPlan {
     std::map<RenderTargetName, DepthRenderTargetDesc> depth_images{};
 
     std::vector<PassEntry> passes{};
+
+    // Target presented at the end of the frame. Passes that do not
+    // contribute to it are culled. If empty, all passes are run.
+    RenderTargetName output{};
 };
 
 struct VertexInputBindingDesc {
@@ -287,6 +325,15 @@ struct StencilOpState {
     StencilOp pass_op{StencilOp::Keep};
     StencilOp depth_fail_op{StencilOp::Keep};
     CompareOp compare_op{CompareOp::Never};
+
+    bool operator==(const StencilOpState& other) const {
+        return fail_op == other.fail_op && pass_op == other.pass_op &&
+               depth_fail_op == other.depth_fail_op &&
+               compare_op == other.compare_op;
+    }
+    bool operator!=(const StencilOpState& other) const {
+        return !(*this == other);
+    }
 };
 
 struct DepthStencilState {
@@ -298,6 +345,18 @@ struct DepthStencilState {
     bool stencil_test{false};
     StencilOpState front{};
     StencilOpState back{};
+
+    bool operator==(const DepthStencilState& other) const {
+        return depth_test == other.depth_test &&
+               depth_write == other.depth_write &&
+               depth_compare == other.depth_compare &&
+               depth_bounds == other.depth_bounds &&
+               stencil_test == other.stencil_test && front == other.front &&
+               back == other.back;
+    }
+    bool operator!=(const DepthStencilState& other) const {
+        return !(*this == other);
+    }
 };
 
 enum class LogicOp {
@@ -372,6 +431,15 @@ struct MultisampleState {
     uint32_t samples{1};
     bool sample_shading{false};
     float min_sample_shading{1.0f};
+
+    bool operator==(const MultisampleState& other) const {
+        return samples == other.samples &&
+               sample_shading == other.sample_shading &&
+               min_sample_shading == other.min_sample_shading;
+    }
+    bool operator!=(const MultisampleState& other) const {
+        return !(*this == other);
+    }
 };
 
 enum class PrimitiveTopology {
@@ -386,6 +454,14 @@ enum class PrimitiveTopology {
 struct InputAssemblyState {
     PrimitiveTopology topology{PrimitiveTopology::TriangleList};
     bool primitive_restart{true};
+
+    bool operator==(const InputAssemblyState& other) const {
+        return topology == other.topology &&
+               primitive_restart == other.primitive_restart;
+    }
+    bool operator!=(const InputAssemblyState& other) const {
+        return !(*this == other);
+    }
 };
 
 enum class PolygonMode { Fill = 0, Line = 1, Point = 2 };
@@ -401,6 +477,18 @@ struct RasterizationState {
     CullMode cull_mode{CullMode::Back};
     FrontFace front_face{FrontFace::CounterClockwise};
     bool depth_bias{false};
+
+    bool operator==(const RasterizationState& other) const {
+        return depth_clamp == other.depth_clamp &&
+               rasterizer_discard == other.rasterizer_discard &&
+               polygon_mode == other.polygon_mode &&
+               cull_mode == other.cull_mode &&
+               front_face == other.front_face &&
+               depth_bias == other.depth_bias;
+    }
+    bool operator!=(const RasterizationState& other) const {
+        return !(*this == other);
+    }
 };
 
 enum class ShaderSourceType { Source, Filename };
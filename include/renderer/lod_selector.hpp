@@ -0,0 +1,38 @@
+#pragma once
+
+#include "scene/attachments/mesh.hpp"
+
+#include "common/include.hpp"
+
+namespace goma {
+
+// Picks mesh LODs from the projected size of their bounding sphere,
+// with a band around each threshold so that objects sitting right at
+// a threshold do not flip between two LODs every frame.
+class LodSelector {
+  public:
+    struct Config {
+        // Screen sizes below which each LOD is used, in decreasing order
+        std::array<float, kMaxMeshLods> screen_sizes{0.5f, 0.25f, 0.125f,
+                                                     0.0625f};
+        // Relative distance from a threshold needed to switch LOD
+        float hysteresis{0.1f};
+    };
+
+    LodSelector(const Config& config = {}) : config_(config) {}
+
+    // Projected diameter of a sphere over the viewport height.
+    // projection_scale is the [1][1] element of the projection matrix.
+    static float GetScreenSize(const glm::vec3& center, float radius,
+                               const glm::vec3& camera_position,
+                               float projection_scale);
+
+    // Returns a LOD in [0, lod_count], where 0 is the full-detail mesh
+    size_t Select(float screen_size, size_t current_lod,
+                  size_t lod_count) const;
+
+  private:
+    Config config_;
+};
+
+}  // namespace goma
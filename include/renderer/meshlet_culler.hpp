@@ -0,0 +1,39 @@
+#pragma once
+
+#include "scene/attachments/mesh.hpp"
+
+#include "common/include.hpp"
+
+namespace goma {
+
+// Indices to draw, relative to the first index of the mesh
+struct IndexRange {
+    uint32_t first{0};
+    uint32_t count{0};
+};
+
+// Culls the meshlets of a mesh against the view frustum and their
+// backfacing cones, so that large meshes only draw their visible parts.
+class MeshletCuller {
+  public:
+    struct Stats {
+        size_t tested_meshlets{0};
+        size_t visible_meshlets{0};
+        size_t ranges{0};
+    };
+
+    // Appends the index ranges of the visible meshlets, merging adjacent
+    // ones. The camera position is in the object space of the mesh.
+    // Returns the number of ranges appended.
+    size_t Cull(const Mesh& mesh, const glm::mat4& mvp,
+                const glm::vec3& os_camera_pos, bool backface_culling,
+                std::vector<IndexRange>& ranges);
+
+    void ResetStats() { stats_ = {}; }
+    const Stats& stats() const { return stats_; }
+
+  private:
+    Stats stats_{};
+};
+
+}  // namespace goma
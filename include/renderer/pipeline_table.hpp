@@ -0,0 +1,37 @@
+#pragma once
+
+#include "renderer/handles.hpp"
+
+#include "common/include.hpp"
+
+namespace goma {
+
+using PipelineId = uint32_t;
+constexpr PipelineId kInvalidPipelineId = UINT32_MAX;
+
+// Pipelines in use by the renderer, addressed by small integer ids so
+// that draws find theirs with an array lookup instead of hashing shader
+// descriptions. Each distinct pipeline gets a single id.
+class PipelineTable {
+  public:
+    PipelineId Add(std::shared_ptr<Pipeline> pipeline);
+
+    // Null for invalid ids
+    const Pipeline* Get(PipelineId id) const {
+        return id < pipelines_.size() ? pipelines_[id].get() : nullptr;
+    }
+
+    // Drops all pipelines, e.g. after reloading shaders. Ids from
+    // previous generations must be resolved again.
+    void Clear();
+
+    uint32_t generation() const { return generation_; }
+    size_t size() const { return pipelines_.size(); }
+
+  private:
+    std::vector<std::shared_ptr<Pipeline>> pipelines_{};
+    std::map<const Pipeline*, PipelineId> ids_{};
+    uint32_t generation_{1};
+};
+
+}  // namespace goma
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "renderer/handles.hpp"
+#include "renderer/resource_name.hpp"
+#include "infrastructure/flat_hash_map.hpp"
+
+#include "common/include.hpp"
+#include "common/error_codes.hpp"
+
+namespace goma {
+
+// Render plan compiled into a graph of passes and render targets, both
+// addressed by index. Passes that do not contribute to the output are
+// culled, and each target knows the range of passes that use it.
+struct CompiledRenderPlan {
+    static constexpr size_t kNone = SIZE_MAX;
+
+    struct Target {
+        RenderTargetName name;
+        ResourceName id;
+
+        bool depth{false};
+        ColorRenderTargetDesc color_desc{};
+        DepthRenderTargetDesc depth_desc{};
+
+        // Indices of the first and last compiled passes using the
+        // target. The output is in use until the end of the frame.
+        size_t first_use{kNone};
+        size_t last_use{0};
+
+        // Fully overwritten by its first use, so the previous contents
+        // are not needed
+        bool transient{false};
+
+        Target(const RenderTargetName& name_) : name(name_), id(name_) {}
+        bool used() const { return first_use != kNone; }
+        bool persistent() const {
+            return depth ? depth_desc.persistent : color_desc.persistent;
+        }
+    };
+
+    struct Pass {
+        size_t entry;  // index in RenderPlan::passes and in pass functions
+        PassName name;
+        bool render_pass{false};
+
+        std::vector<size_t> color_targets{};
+        std::vector<size_t> resolve_targets{};  // kNone if not resolved
+        size_t depth_target{kNone};
+        std::vector<std::pair<size_t, size_t>> blits{};  // source, dest
+
+        // Targets read, e.g. sampled or loaded, and written by the pass
+        std::vector<size_t> reads{};
+        std::vector<size_t> writes{};
+        std::vector<size_t> targets{};  // both of the above
+
+        bool Uses(size_t target) const {
+            return std::find(targets.begin(), targets.end(), target) !=
+                   targets.end();
+        }
+    };
+
+    std::vector<Target> targets{};
+    std::vector<Pass> passes{};
+    size_t output{kNone};
+    size_t culled_passes{0};
+
+    // By hash of the target names
+    FlatHashMap<uint64_t, size_t> target_indices{};
+
+    // kNone if not in the plan
+    size_t FindTarget(ResourceName name) const {
+        auto target = target_indices.find(name.hash());
+        return target != target_indices.end() ? target->second : kNone;
+    }
+};
+
+// Without an output, no pass is culled and no target is transient,
+// as any of them could be read after the frame
+result<CompiledRenderPlan> CompileRenderPlan(const RenderPlan& render_plan);
+
+// Estimated traffic to render targets in a frame, assuming that passes
+// read and write whole targets. Resolves read the multisampled target.
+struct RenderPlanBandwidth {
+    struct Pass {
+        PassName name;
+        uint64_t read{0};
+        uint64_t written{0};
+    };
+    std::vector<Pass> passes{};
+    uint64_t read{0};
+    uint64_t written{0};
+};
+
+// target_sizes holds the size in bytes of each target in the plan
+RenderPlanBandwidth EstimateBandwidth(
+    const CompiledRenderPlan& plan, const std::vector<uint64_t>& target_sizes);
+
+}  // namespace goma
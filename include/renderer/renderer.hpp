@@ -1,6 +1,16 @@
 #pragma once
 
 #include "renderer/backend.hpp"
+#include "renderer/command_stream.hpp"
+#include "renderer/draw_registry.hpp"
+#include "renderer/dynamic_resolution.hpp"
+#include "renderer/lod_selector.hpp"
+#include "renderer/meshlet_culler.hpp"
+#include "renderer/pipeline_table.hpp"
+#include "renderer/residency_manager.hpp"
+#include "renderer/shader_permutations.hpp"
+#include "renderer/shadow_caster_culler.hpp"
+#include "renderer/uniform_arena.hpp"
 
 #include "common/include.hpp"
 
@@ -19,9 +29,39 @@ class Renderer {
     result<void> CreateSphere();
     result<void> CreateBRDFLut();
 
+    // Compiles the pipelines of every permutation in the manifest, so
+    // that meshes do not wait for them when they first become visible
+    void PreloadShaders(const ShaderManifest& manifest);
+
+    const ResidencyManager& residency_manager() const {
+        return residency_manager_;
+    }
+
+    // Pipelines still compiling in the background
+    size_t pending_pipeline_count() const {
+        return backend_->GetPendingPipelineCount();
+    }
+
+    const ShadowCasterCuller::Stats& shadow_caster_stats() const {
+        return shadow_caster_culler_.stats();
+    }
+
+    const DynamicResolution& dynamic_resolution() const {
+        return dynamic_resolution_;
+    }
+    void SetDynamicResolution(const DynamicResolution::Config& config) {
+        dynamic_resolution_ = DynamicResolution(config);
+    }
+
+    // Fragments shaded by each pass in a recent frame
+    std::vector<Backend::PassStats> pass_stats() const {
+        return backend_->GetPassStats();
+    }
+
   private:
     Engine& engine_;
     std::unique_ptr<Backend> backend_{};
+    ResidencyManager residency_manager_;
 
     std::map<uint32_t, std::string> vs_preamble_map_{};
     std::map<uint32_t, std::string> fs_preamble_map_{};
@@ -30,13 +70,105 @@ class Renderer {
     uint32_t upscale_index_{0};
     uint32_t skybox_mip_count{0};
 
+    // Whether the current render plan has a depth pre-pass, as chosen
+    // by the render settings of the scene
+    bool depth_prepass_{false};
+    RenderPlan CreateRenderPlan() const;
+
     struct RenderSequenceElement {
-        AttachmentIndex<Mesh> mesh;
-        NodeIndex node;
-        glm::vec3 cs_center;
+        const DrawItem* item;
+        float cs_depth;
+
+        // Visible meshlets in visible_ranges_, if the mesh has been
+        // culled per meshlet. Otherwise the whole mesh is drawn.
+        uint32_t first_range{0};
+        uint32_t range_count{0};
     };
     using RenderSequence = std::vector<RenderSequenceElement>;
 
+    DrawRegistry draw_registry_{};
+    RenderSequence visible_seq_{};
+    LodSelector lod_selector_{};
+    MeshletCuller meshlet_culler_{};
+    std::vector<IndexRange> visible_ranges_{};
+
+    // Casters in the shadow frustum, sorted by mesh
+    RenderSequence static_shadow_seq_{};
+    RenderSequence dynamic_shadow_seq_{};
+    ShadowCasterCuller shadow_caster_culler_{};
+
+    // Static casters are drawn into their own map, which is only redrawn
+    // when the light or a static caster changes, and copied into the
+    // shadow map of each frame before dynamic casters are drawn. As
+    // targets are per frame, the revision drawn is kept for each frame.
+    uint64_t static_shadow_revision_{1};
+    uint64_t registry_static_revision_{0};
+    uint64_t shader_revision_{0};
+    glm::mat4 static_shadow_vp_{1.0f};
+    std::vector<uint64_t> drawn_static_shadow_revisions_{};
+    void UpdateStaticShadowCache(const glm::mat4& shadow_vp);
+
+    // Scale of the scene targets, from the time of previous frames.
+    // Targets are allocated at full size and only partly rendered to.
+    DynamicResolution dynamic_resolution_{};
+    Extent GetRenderExtent();
+
+    // Consecutive draws of the same mesh in a pass, with the resources
+    // they share. These are looked up before recording, as worker
+    // threads cannot create resources.
+    struct DrawBatch {
+        const Mesh* mesh;
+        const Material* material;
+        const Pipeline* pipeline;
+        size_t first_draw;
+        size_t draw_count;
+        uint64_t frag_ubo_offset{0};
+    };
+    std::vector<DrawBatch> shadow_batches_{};
+    size_t shadow_draws_recorded_{0};  // by the last shadow pass
+    std::vector<DrawBatch> depth_batches_{};
+    std::vector<DrawBatch> forward_batches_{};
+
+    // Whether each draw of the visible sequence had its depth laid down
+    // by the pre-pass this frame. Written by recording threads, one byte
+    // per draw so that they do not share elements.
+    std::vector<uint8_t> prepass_draws_{};
+
+    // Pipelines for drawing each mesh with its material, indexed by mesh
+    // id. They are requested when the mesh is first drawn, and again when
+    // the mesh, its material or the pipeline table change. While they
+    // compile, forward draws use a fallback pipeline and shadow draws are
+    // skipped.
+    struct MeshPipelines {
+        AttachmentIndex<Mesh> mesh{};
+        uint64_t mesh_revision{0};
+        uint64_t material_revision{0};
+        uint32_t generation{0};
+
+        PipelineId shadow{kInvalidPipelineId};
+        PipelineId forward{kInvalidPipelineId};
+        bool shadow_pending{false};
+        bool forward_pending{false};
+    };
+    PipelineTable pipeline_table_{};
+    std::vector<MeshPipelines> mesh_pipelines_{};
+
+    // Untextured forward pipelines, by vertex shader preamble
+    std::map<std::string, PipelineId> fallback_pipelines_{};
+    uint32_t fallback_generation_{0};
+
+    // Minimum draws for each thread recording a pass
+    static constexpr size_t kMinDrawsPerThread{256};
+
+    // One stream per recording thread
+    std::vector<CommandStream> shadow_commands_{};
+    std::vector<CommandStream> depth_commands_{};
+    std::vector<CommandStream> forward_commands_{};
+
+    // Per-draw uniforms of a frame, for each frame in flight
+    static constexpr uint64_t kUniformArenaSize{32 * 1024 * 1024};
+    UniformArena uniform_arena_{kUniformArenaSize};
+
     struct LightData {
         glm::vec3 direction;
         int32_t type;
@@ -63,84 +195,89 @@ class Renderer {
     };
 
     // Rendering setup
-    void CreateMeshBuffers(Scene& scene);
-    void CreateVertexInputFormats(Scene& scene);
-    void UploadTextures(Scene& scene);
-    RenderSequence Cull(Scene& scene, const RenderSequence& render_seq,
-                        const glm::mat4& vp);
+    void Cull(Scene& scene, const glm::mat4& vp,
+              const glm::vec3& camera_ws_pos, float projection_scale,
+              RenderSequence& visible_seq);
+    void CullShadowCasters(const glm::mat4& shadow_vp,
+                           RenderSequence& static_seq,
+                           RenderSequence& dynamic_seq);
     LightBufferData GetLightBufferData(Scene& scene);
 
     // Render passes
     result<void> UpdateLightBuffer(FrameIndex frame_id, Scene& scene,
                                    const LightBufferData& light_buffer_data);
+    result<void> StaticShadowPass(FrameIndex frame_id, Scene& scene,
+                                  const glm::mat4& shadow_vp);
     result<void> ShadowPass(FrameIndex frame_id, Scene& scene,
-                            const RenderSequence& render_seq,
-                            const glm::mat4& shadow_vp);
+                            const RenderSequence& shadow_seq,
+                            const glm::mat4& shadow_vp,
+                            bool full_detail = false);
+    result<void> DepthPrepass(FrameIndex frame_id, Scene& scene,
+                              const RenderSequence& render_seq,
+                              const glm::mat4& camera_vp);
     result<void> ForwardPass(FrameIndex frame_id, Scene& scene,
                              const RenderSequence& render_seq,
                              const glm::vec3& camera_ws_pos,
                              const glm::mat4& camera_vp,
                              const glm::mat4& shadow_vp);
+    result<void> RecordSkybox(CommandStream& commands, FrameIndex frame_id,
+                              Scene& scene, const glm::mat4& camera_vp);
+
+    // Parallel recording
+    using MeshIndexFn = std::function<AttachmentIndex<Mesh>(size_t draw)>;
+    void PrepareBatches(Scene& scene, size_t draw_count,
+                        const MeshIndexFn& get_mesh,
+                        PipelineId MeshPipelines::*pipeline,
+                        std::vector<DrawBatch>& batches);
+    const MeshPipelines& GetMeshPipelines(Scene& scene,
+                                          AttachmentIndex<Mesh> mesh_id,
+                                          const Mesh& mesh,
+                                          const Material& material);
+    PipelineId GetFallbackPipeline(const Mesh& mesh, const char* vs_preamble);
+
+    using RecordStateFn = std::function<void(CommandStream& commands)>;
+    using RecordBatchFn =
+        std::function<void(CommandStream& commands, const DrawBatch& batch)>;
+    using RecordDrawFn = std::function<void(
+        CommandStream& commands, const DrawBatch& batch, size_t draw)>;
+    result<void> RecordBatches(const std::vector<DrawBatch>& batches,
+                               std::vector<CommandStream>& streams,
+                               const RecordStateFn& record_state,
+                               const RecordBatchFn& record_batch,
+                               const RecordDrawFn& record_draw);
+
+    result<std::shared_ptr<Buffer>> GetUniformArenaBuffer();
+    result<void> FlushUniforms(FrameIndex frame_id,
+                               const Buffer& uniform_buffer, uint64_t first);
     result<void> DownscalePass(FrameIndex frame_id, const std::string& src,
                                const std::string& dst);
     result<void> UpscalePass(FrameIndex frame_id, const std::string& src,
                              const std::string& dst);
     result<void> PostprocessingPass(FrameIndex frame_id);
 
-    union VertexShaderPreambleDesc {
-        struct {
-            bool has_positions : 1;
-            bool has_normals : 1;
-            bool has_tangents : 1;
-            bool has_bitangents : 1;
-            bool has_colors : 1;
-            bool has_uv0 : 1;
-            bool has_uv1 : 1;
-            bool has_uvw : 1;
-        };
-
-        uint32_t int_repr;
-    };
     const char* GetVertexShaderPreamble(const VertexShaderPreambleDesc& desc);
     const char* GetVertexShaderPreamble(const Mesh& mesh);
 
-    union FragmentShaderPreambleDesc {
-        struct {
-            // Mesh
-            bool has_positions : 1;
-            bool has_normals : 1;
-            bool has_tangents : 1;
-            bool has_bitangents : 1;
-            bool has_colors : 1;
-            bool has_uv0 : 1;
-            bool has_uv1 : 1;
-            bool has_uvw : 1;
-
-            // Material
-            bool has_diffuse_map : 1;
-            bool has_specular_map : 1;
-            bool has_ambient_map : 1;
-            bool has_emissive_map : 1;
-            bool has_metallic_roughness_map : 1;
-            bool has_height_map : 1;
-            bool has_normal_map : 1;
-            bool has_shininess_map : 1;
-            bool has_opacity_map : 1;
-            bool has_displacement_map : 1;
-            bool has_light_map : 1;
-            bool has_reflection_map : 1;
-            bool alpha_mask : 1;
-        };
-
-        uint32_t int_repr;
-    };
     const char* GetFragmentShaderPreamble(
         const FragmentShaderPreambleDesc& desc);
     const char* GetFragmentShaderPreamble(const Mesh& mesh,
                                           const Material& material);
 
-    result<void> BindMeshBuffers(const Mesh& mesh);
-    result<void> BindMaterialTextures(const Material& material);
+    bool IsUploadComplete(Scene& scene, const Mesh& mesh);
+    void BindMeshBuffers(CommandStream& commands, const Mesh& mesh);
+
+    // Depth-only passes read the position stream alone
+    result<std::shared_ptr<VertexInputFormat>> GetPositionInputFormat();
+    void BindPositionBuffer(CommandStream& commands, const Mesh& mesh);
+    void DrawMesh(CommandStream& commands, const Mesh& mesh, size_t lod = 0);
+    void DrawMeshRanges(CommandStream& commands, const Mesh& mesh,
+                        const IndexRange* ranges, size_t range_count);
+    result<void> BindMaterialTextures(CommandStream& commands,
+                                      const Material& material);
+    result<void> BindMaterialTexture(CommandStream& commands,
+                                     const Material& material,
+                                     TextureType texture_type,
+                                     uint32_t binding_id);
 };
 
 }  // namespace goma
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "renderer/backend.hpp"
+#include "renderer/geometry_pool.hpp"
+#include "scene/gen_index.hpp"
+#include "scene/attachments/mesh.hpp"
+#include "scene/attachments/texture.hpp"
+
+#include "common/include.hpp"
+
+namespace goma {
+
+class Scene;
+
+// Tracks which meshes and textures have GPU resources. Creation is only
+// queued when the scene reports new or modified attachments, so that
+// steady-state frames do no resource setup work at all.
+class ResidencyManager {
+  public:
+    struct Stats {
+        size_t resident_meshes{0};
+        size_t resident_textures{0};
+        size_t mesh_bytes{0};
+        size_t texture_bytes{0};
+    };
+
+    ResidencyManager(Backend& backend)
+        : backend_(backend), geometry_pool_(backend) {}
+
+    result<void> Update(Scene& scene);
+
+    const Stats& stats() const { return stats_; }
+    const GeometryPool& geometry_pool() const { return geometry_pool_; }
+    size_t pending_count() const {
+        return pending_meshes_.size() + pending_textures_.size();
+    }
+
+  private:
+    Backend& backend_;
+    GeometryPool geometry_pool_;
+    uint64_t scene_id_{0};  // never a valid id
+
+    uint64_t mesh_revision_{0};
+    uint64_t texture_revision_{0};
+    uint64_t material_revision_{0};
+
+    struct Residency {
+        uint64_t revision{0};
+        size_t bytes{0};
+
+        // Of textures, destroyed when replaced or no longer in the scene
+        std::shared_ptr<Image> image{};
+    };
+    std::map<AttachmentIndex<Mesh>, Residency> meshes_{};
+    std::map<AttachmentIndex<Texture>, Residency> textures_{};
+
+    // Attachments waiting for GPU resources, failures are retried
+    std::set<AttachmentIndex<Mesh>> pending_meshes_{};
+    std::set<AttachmentIndex<Texture>> pending_textures_{};
+
+    Stats stats_{};
+
+    void Reset();
+    void DestroyImage(Residency& residency);
+    void QueueMeshes(Scene& scene);
+    void QueueTextures(Scene& scene);
+
+    result<void> MakeResident(Scene& scene, AttachmentIndex<Mesh> id);
+    result<void> MakeResident(Scene& scene, AttachmentIndex<Texture> id);
+
+    result<void> CreateVertexInputFormat(Mesh& mesh);
+};
+
+}  // namespace goma
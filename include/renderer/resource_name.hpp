@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+namespace goma {
+
+// Names a backend resource, such as a render target or a buffer, by the
+// 64-bit FNV-1a hash of its name. Names can be built from string literals
+// in constant expressions, e.g. constexpr ResourceName kDepth{"depth"},
+// so that lookups by name only compare integers at runtime.
+// Debug builds also keep the name, to be shown in logs.
+class ResourceName {
+  public:
+    constexpr ResourceName(const char* name) : hash_(Hash(name)) {
+#ifndef NDEBUG
+        name_ = name;
+#endif
+    }
+
+    ResourceName(const std::string& name) : hash_(Hash(name.c_str())) {
+#ifndef NDEBUG
+        name_ = Intern(name);
+#endif
+    }
+
+    // Name for one of several similar resources, without building a
+    // string for it, e.g. ResourceName("downscale").WithIndex(2)
+    constexpr ResourceName WithIndex(uint64_t index) const {
+        ResourceName ret = *this;
+        for (int i = 0; i < 8; i++) {
+            ret.hash_ = (ret.hash_ ^ ((index >> (i * 8)) & 0xff)) * kFnvPrime;
+        }
+#ifndef NDEBUG
+        ret.index_ = index;
+        ret.indexed_ = true;
+#endif
+        return ret;
+    }
+
+    constexpr uint64_t hash() const { return hash_; }
+
+    // The name in debug builds, otherwise the hash
+    std::string str() const {
+#ifndef NDEBUG
+        if (name_) {
+            return indexed_ ? std::string(name_) + "_" + std::to_string(index_)
+                            : std::string(name_);
+        }
+#endif
+        char buffer[20];
+        snprintf(buffer, sizeof(buffer), "#%016llx",
+                 static_cast<unsigned long long>(hash_));
+        return buffer;
+    }
+
+    constexpr bool operator==(const ResourceName& other) const {
+        return hash_ == other.hash_;
+    }
+    constexpr bool operator!=(const ResourceName& other) const {
+        return hash_ != other.hash_;
+    }
+    constexpr bool operator<(const ResourceName& other) const {
+        return hash_ < other.hash_;
+    }
+
+  private:
+    static constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ULL;
+    static constexpr uint64_t kFnvPrime = 0x100000001b3ULL;
+
+    static constexpr uint64_t Hash(const char* str) {
+        uint64_t hash = kFnvOffsetBasis;
+        while (*str) {
+            hash = (hash ^ static_cast<uint8_t>(*str++)) * kFnvPrime;
+        }
+        return hash;
+    }
+
+    uint64_t hash_{0};
+
+#ifndef NDEBUG
+    // Names built at runtime are stored here, so that they outlive
+    // the strings they came from
+    static const char* Intern(const std::string& name) {
+        static std::mutex mutex;
+        static std::unordered_set<std::string> names;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        return names.insert(name).first->c_str();
+    }
+
+    const char* name_{nullptr};
+    uint64_t index_{0};
+    bool indexed_{false};
+#endif
+};
+
+}  // namespace goma
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "renderer/backend.hpp"
+#include "scene/attachments/material.hpp"
+#include "scene/attachments/mesh.hpp"
+
+#include "common/include.hpp"
+#include "common/error_codes.hpp"
+
+namespace goma {
+
+class Scene;
+
+union VertexShaderPreambleDesc {
+    struct {
+        bool has_positions : 1;
+        bool has_normals : 1;
+        bool has_tangents : 1;
+        bool has_bitangents : 1;
+        bool has_colors : 1;
+        bool has_uv0 : 1;
+        bool has_uv1 : 1;
+        bool has_uvw : 1;
+        bool has_packed_attributes : 1;
+    };
+
+    uint32_t int_repr;
+};
+
+union FragmentShaderPreambleDesc {
+    struct {
+        // Mesh
+        bool has_positions : 1;
+        bool has_normals : 1;
+        bool has_tangents : 1;
+        bool has_bitangents : 1;
+        bool has_colors : 1;
+        bool has_uv0 : 1;
+        bool has_uv1 : 1;
+        bool has_uvw : 1;
+
+        // Material
+        bool has_diffuse_map : 1;
+        bool has_specular_map : 1;
+        bool has_ambient_map : 1;
+        bool has_emissive_map : 1;
+        bool has_metallic_roughness_map : 1;
+        bool has_height_map : 1;
+        bool has_normal_map : 1;
+        bool has_shininess_map : 1;
+        bool has_opacity_map : 1;
+        bool has_displacement_map : 1;
+        bool has_light_map : 1;
+        bool has_reflection_map : 1;
+        bool alpha_mask : 1;
+    };
+
+    uint32_t int_repr;
+};
+
+// Unused bits of int_repr are zero, so it can be used as a key
+VertexShaderPreambleDesc GetVertexShaderPreambleDesc(const Mesh& mesh);
+FragmentShaderPreambleDesc GetFragmentShaderPreambleDesc(
+    const Mesh& mesh, const Material& material, bool has_reflection_map);
+
+std::string BuildVertexShaderPreamble(const VertexShaderPreambleDesc& desc);
+std::string BuildFragmentShaderPreamble(
+    const FragmentShaderPreambleDesc& desc);
+
+// Preambles of a mesh drawn with its material. The reflection map
+// depends on the skybox, so it is left out and chosen when compiling.
+struct ShaderPermutation {
+    uint32_t vs;
+    uint32_t fs;
+
+    bool operator<(const ShaderPermutation& other) const {
+        return vs < other.vs || (vs == other.vs && fs < other.fs);
+    }
+    bool operator==(const ShaderPermutation& other) const {
+        return vs == other.vs && fs == other.fs;
+    }
+};
+
+// What a mesh is drawn with while its own pipeline is compiling: the same
+// vertex shader, and a fragment shader for an opaque, untextured material
+ShaderPermutation GetFallbackPermutation(const ShaderPermutation& permutation);
+
+// The shader permutations needed to draw a scene, so that they can be
+// compiled ahead of time instead of when meshes first become visible.
+// Saved as text, one permutation per line.
+class ShaderManifest {
+  public:
+    void Add(const ShaderPermutation& permutation) {
+        permutations_.insert(permutation);
+    }
+    void Add(const Mesh& mesh, const Material& material);
+
+    // Adds every mesh of the scene
+    void Add(Scene& scene);
+
+    result<void> Save(const std::string& path) const;
+    static result<ShaderManifest> Load(const std::string& path);
+
+    const std::set<ShaderPermutation>& permutations() const {
+        return permutations_;
+    }
+    size_t size() const { return permutations_.size(); }
+
+  private:
+    std::set<ShaderPermutation> permutations_{};
+};
+
+// Requests the shadow and forward pipelines of every permutation, and
+// the forward pipelines of their fallbacks, then waits until the backend
+// has compiled them, in parallel if it compiles in the background.
+// Returns how many pipelines could not be created.
+size_t CompileShaderManifest(Backend& backend, const ShaderManifest& manifest,
+                             bool has_reflection_map);
+
+}  // namespace goma
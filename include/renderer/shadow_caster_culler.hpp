@@ -0,0 +1,31 @@
+#pragma once
+
+#include "renderer/handles.hpp"
+
+#include "common/include.hpp"
+
+namespace goma {
+
+// Culls shadow casters against the frustum of a light. The frustum is
+// extruded toward the light, as casters between the light and the near
+// plane still cast shadows into it. The shadow pass clamps their depth
+// to the near plane.
+class ShadowCasterCuller {
+  public:
+    struct Stats {
+        size_t tested_casters{0};
+        size_t visible_casters{0};
+    };
+
+    // light_vp maps the frustum to clip space, with depth in [0, 1].
+    // The bounds are in world space.
+    bool IsVisible(const glm::mat4& light_vp, const Box& bounds);
+
+    void ResetStats() { stats_ = {}; }
+    const Stats& stats() const { return stats_; }
+
+  private:
+    Stats stats_{};
+};
+
+}  // namespace goma
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "infrastructure/murmur_hash.hpp"
+
+#include "common/include.hpp"
+#include "common/error_codes.hpp"
+
+namespace goma {
+
+// SPIR-V compiled at runtime, persisted to a single file so that later
+// runs can skip the GLSL compiler. Entries are found by the identity of
+// a shader, e.g. its source name, preamble, entry point and stage, and
+// store a hash of everything that affects the compiled code, including
+// the source text and the compiler version. A shader whose source has
+// changed since it was cached is a miss, and its entry gets replaced.
+class SpirvCache {
+  public:
+    struct Key {
+        Hash128 identity;
+        Hash128 content;
+    };
+
+    struct Stats {
+        size_t hits{0};
+        size_t misses{0};
+        // Misses on entries for an outdated version of the shader
+        size_t invalidated{0};
+        // Entries in the file that failed validation when loading
+        size_t rejected{0};
+    };
+
+    SpirvCache(std::string path = "") : path_(std::move(path)) {}
+
+    // A missing file leaves the cache empty, and entries that
+    // fail validation are dropped. No-op without a path.
+    result<void> Load();
+
+    // Writes the file if entries changed since loading. The previous
+    // file is replaced in one step, so it is never left half-written.
+    result<void> Save();
+
+    // Null on a miss
+    const std::vector<uint32_t>* Find(const Key& key);
+    void Insert(const Key& key, std::vector<uint32_t> code);
+
+    const std::string& path() const { return path_; }
+    size_t size() const { return entries_.size(); }
+    const Stats& stats() const { return stats_; }
+
+  private:
+    struct Entry {
+        Hash128 content;
+        std::vector<uint32_t> code;
+    };
+
+    std::string path_{};
+    std::map<Hash128, Entry> entries_{};
+    bool dirty_{false};
+    Stats stats_{};
+};
+
+}  // namespace goma
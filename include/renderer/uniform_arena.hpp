@@ -0,0 +1,45 @@
+#pragma once
+
+#include "common/include.hpp"
+#include "common/error_codes.hpp"
+
+#include <atomic>
+
+namespace goma {
+
+// CPU-side storage for uniforms that change with every draw. Threads
+// push data concurrently and bind it at the returned offsets, then the
+// used part is copied to a GPU buffer with a single update, instead of
+// mapping a buffer for each draw.
+class UniformArena {
+  public:
+    // Offset alignment of uniform buffer bindings on most devices
+    static constexpr uint64_t kDefaultAlignment = 256;
+
+    UniformArena(uint64_t size, uint64_t alignment = kDefaultAlignment)
+        : data_(size), alignment_(alignment) {}
+
+    // Thread-safe. Returns the offset of the copy in the arena,
+    // or Error::OutOfCPUMemory if it does not fit.
+    result<uint64_t> Push(const void* data, uint64_t size);
+
+    template <typename T>
+    result<uint64_t> Push(const T& data) {
+        return Push(&data, sizeof(T));
+    }
+
+    // Not thread-safe, previous offsets become invalid
+    void Reset() { head_ = 0; }
+
+    uint64_t size() const { return data_.size(); }
+    uint64_t used() const { return std::min<uint64_t>(head_, data_.size()); }
+    bool exhausted() const { return head_ > data_.size(); }
+    const uint8_t* data() const { return data_.data(); }
+
+  private:
+    std::vector<uint8_t> data_{};
+    uint64_t alignment_{kDefaultAlignment};
+    std::atomic<uint64_t> head_{0};
+};
+
+}  // namespace goma
@@ -2,6 +2,8 @@
 
 #include "renderer/backend.hpp"
 #include "renderer/vez/vez_context.hpp"
+#include "infrastructure/file_watcher.hpp"
+#include "infrastructure/thread_pool.hpp"
 
 #include "common/include.hpp"
 #include "common/vez.hpp"
@@ -23,48 +25,75 @@ class VezBackend : public Backend {
     virtual result<std::shared_ptr<Pipeline>> GetGraphicsPipeline(
         const ShaderDesc& vert, const ShaderDesc& frag = {}) override;
     virtual result<void> ClearShaderCache() override;
+    virtual result<std::shared_ptr<Pipeline>> RequestGraphicsPipeline(
+        const ShaderDesc& vert, const ShaderDesc& frag = {}) override;
+    virtual size_t GetPendingPipelineCount() override;
+    virtual result<void> ReloadChangedShaders() override;
+    virtual uint64_t GetShaderRevision() override { return shader_revision_; }
     virtual result<std::shared_ptr<VertexInputFormat>> GetVertexInputFormat(
         const VertexInputFormatDesc& desc) override;
 
     virtual result<std::shared_ptr<Image>> CreateTexture(
-        const char* name, const TextureDesc& texture_desc,
+        ResourceName name, const TextureDesc& texture_desc,
         void* initial_contents = nullptr) override;
     virtual result<std::shared_ptr<Image>> CreateCubemap(
-        const char* name, const TextureDesc& texture_desc,
+        ResourceName name, const TextureDesc& texture_desc,
         const CubemapContents& initial_contents) override;
     virtual result<std::shared_ptr<Image>> GetTexture(
-        const char* name) override;
+        ResourceName name) override;
+    virtual result<void> DestroyTexture(const Image& image) override;
+    virtual uint32_t GetFormatSize(Format format) override;
     virtual result<std::shared_ptr<Image>> GetRenderTarget(
-        FrameIndex frame_id, const char* name) override;
+        FrameIndex frame_id, ResourceName name) override;
     virtual Extent GetAbsoluteExtent(Extent extent) override;
+    virtual FrameIndex GetNextFrameIndex() override {
+        return context_.current_frame;
+    }
 
     virtual result<std::shared_ptr<Buffer>> CreateUniformBuffer(
-        BufferType type, const GenIndex& index, const char* name, uint64_t size,
-        bool gpu_stored = true, void* initial_contents = nullptr) override;
+        BufferType type, const GenIndex& index, ResourceName name,
+        uint64_t size, bool gpu_stored = true,
+        void* initial_contents = nullptr) override;
     virtual result<std::shared_ptr<Buffer>> GetUniformBuffer(
-        BufferType type, const GenIndex& index, const char* name) override;
+        BufferType type, const GenIndex& index, ResourceName name) override;
     virtual result<std::shared_ptr<Buffer>> CreateUniformBuffer(
-        const char* name, uint64_t size, bool gpu_stored = true,
+        ResourceName name, uint64_t size, bool gpu_stored = true,
         void* initial_contents = nullptr) override;
     virtual result<std::shared_ptr<Buffer>> GetUniformBuffer(
-        const char* name) override;
+        ResourceName name) override;
 
     virtual result<std::shared_ptr<Buffer>> CreateVertexBuffer(
-        const AttachmentIndex<Mesh>& mesh, const char* name, uint64_t size,
+        const AttachmentIndex<Mesh>& mesh, ResourceName name, uint64_t size,
         bool gpu_stored = true, void* initial_contents = nullptr) override;
     virtual result<std::shared_ptr<Buffer>> GetVertexBuffer(
-        const AttachmentIndex<Mesh>& mesh, const char* name) override;
+        const AttachmentIndex<Mesh>& mesh, ResourceName name) override;
     virtual result<std::shared_ptr<Buffer>> CreateIndexBuffer(
-        const AttachmentIndex<Mesh>& mesh, const char* name, uint64_t size,
+        const AttachmentIndex<Mesh>& mesh, ResourceName name, uint64_t size,
         bool gpu_stored = true, void* initial_contents = nullptr) override;
     virtual result<std::shared_ptr<Buffer>> GetIndexBuffer(
-        const AttachmentIndex<Mesh>& mesh, const char* name) override;
+        const AttachmentIndex<Mesh>& mesh, ResourceName name) override;
     virtual result<void> UpdateBuffer(const Buffer& buffer, uint64_t offset,
                                       uint64_t size,
                                       const void* contents) override;
+    virtual result<UploadTicket> UploadBuffer(const Buffer& buffer,
+                                              uint64_t offset, uint64_t size,
+                                              const void* contents) override;
+    virtual result<UploadTicket> CopyBuffer(const Buffer& src,
+                                            uint64_t src_offset,
+                                            const Buffer& dst,
+                                            uint64_t dst_offset,
+                                            uint64_t size) override;
+    virtual result<void> DestroyBuffer(const Buffer& buffer) override;
+    virtual bool IsUploadComplete(UploadTicket ticket) override;
 
     virtual result<void> RenderFrame(std::vector<PassFn> pass_fns,
-                                     const char* present_image) override;
+                                     ResourceName present_image) override;
+    virtual uint32_t GetRecordingThreadCount() override;
+    virtual bool SupportsDepthClamp() override {
+        return context_.features.depthClamp == VK_TRUE;
+    }
+    virtual result<void> RecordParallel(uint32_t thread_count,
+                                        const RecordFn& record_fn) override;
 
     virtual result<void> BindUniformBuffer(const Buffer& buffer,
                                            uint64_t offset, uint64_t size,
@@ -123,6 +152,16 @@ class VezBackend : public Backend {
                                      uint32_t first_index = 0,
                                      uint32_t vertex_offset = 0,
                                      uint32_t first_instance = 0) override;
+    virtual result<void> ExecuteCommands(const CommandStream& stream) override;
+    virtual BindStats GetBindStats() override { return bind_stats_; }
+    virtual std::vector<PassStats> GetPassStats() override {
+        return pass_stats_;
+    }
+    virtual float GetGpuFrameTime() override { return gpu_frame_time_; }
+    virtual SpirvCache::Stats GetShaderCacheStats() override {
+        return context_.spirv_cache.stats();
+    }
+    virtual RenderPlanBandwidth GetRenderPlanBandwidth() override;
 
     virtual result<void> TeardownContext() override;
 
@@ -139,6 +178,8 @@ class VezBackend : public Backend {
     result<VezSwapchain> CreateSwapchain(VkSurfaceKHR surface);
     result<VkShaderModule> GetVertexShaderModule(const ShaderDesc& vert);
     result<VkShaderModule> GetFragmentShaderModule(const ShaderDesc& frag);
+    result<VkShaderModule> CreateShaderModule(const ShaderDesc& desc,
+                                              VkShaderStageFlagBits stage);
     result<std::shared_ptr<Buffer>> CreateBuffer(
         VezContext::BufferHash hash, VkDeviceSize size,
         VezMemoryFlagsBits storage, VkBufferUsageFlags usage,
@@ -146,38 +187,140 @@ class VezBackend : public Backend {
     result<std::shared_ptr<Buffer>> GetBuffer(VezContext::BufferHash hash);
     result<VkSampler> GetSampler(const SamplerDesc& sampler_desc);
 
+    // Stages of the frame that wait for its setup command buffer, which
+    // holds staged copies, mipmap blits and geometry compaction
+    static VkPipelineStageFlags GetSetupWaitStages();
+
   private:
     VezContext context_{};
     bool rp_in_progress_{false};
+    VezFramebuffer current_framebuffer_{VK_NULL_HANDLE};
+    RenderPassDesc current_rp_desc_{};
+
+    // Pipeline statistics are queried for each render pass instance,
+    // i.e. once for each command buffer that a pass is recorded into
+    static constexpr uint32_t kMaxStatsQueries{256};
+    size_t current_pass_{0};  // in compiled_plan_.passes
+    std::mutex stats_mutex_{};
+    std::vector<PassStats> pass_stats_{};
+    result<void> ResetPassStats();
+    void BeginPassQuery();
+    void ReadPassStats();
+    void EndRenderPass();
+
+    // Timestamps at the start of the first command buffer of a frame and
+    // at the end of the last one, read back along with the statistics
+    float gpu_frame_time_{0.0f};
+    result<void> BeginFrameTimer();
+    void EndFrameTimer();
+    void ReadFrameTimer();
+
+    std::unique_ptr<ThreadPool> thread_pool_{};
+    std::mutex sampler_mutex_{};
+
+    // Guards the shader and pipeline caches, which background
+    // compilation fills in
+    std::mutex shader_mutex_{};
+    std::unique_ptr<ThreadPool> compile_pool_{};
+
+    struct PendingPipeline {
+        std::future<void> done{};
+        result<std::shared_ptr<Pipeline>> pipeline{
+            std::shared_ptr<Pipeline>()};
+    };
+    // Keyed by vertex and fragment shader
+    using PendingPipelineHash =
+        std::pair<VezContext::ShaderHash, VezContext::ShaderHash>;
+    std::map<PendingPipelineHash, std::shared_ptr<PendingPipeline>>
+        pending_pipelines_{};
+    void WaitForPendingPipelines();
+    std::shared_ptr<Pipeline> FindGraphicsPipeline(const ShaderDesc& vert,
+                                                   const ShaderDesc& frag);
+    result<VezPipeline> CreateGraphicsPipeline(VkShaderModule vs,
+                                               VkShaderModule fs);
+
+    // Shaders being recompiled after their files changed, with the
+    // pipelines using them. Only one reload runs at a time.
+    struct ShaderReload {
+        struct Module {
+            VkShaderStageFlagBits stage;
+            ShaderDesc desc;
+            VezContext::ShaderHash hash;
+            VkShaderModule old_module;
+            VkShaderModule new_module;
+        };
+        std::vector<Module> modules{};
+        std::map<VezContext::PipelineHash, VezPipeline> pipelines{};
+
+        std::future<void> done{};
+        result<void> status{outcome::success()};
+    };
+    FileWatcher shader_watcher_{};
+    std::set<std::string> changed_shader_files_{};
+    std::unique_ptr<ShaderReload> shader_reload_{};
+    uint64_t shader_revision_{0};
+    void RegisterShaderFile(const ShaderDesc& desc,
+                            VkShaderStageFlagBits stage);
+    result<void> RebuildShaders(ShaderReload& reload);
+    void ApplyShaderReload(ShaderReload& reload);
+    void CancelShaderReload();
+    BindStats bind_stats_{};
 
     result<VulkanImage> CreateImage(VezContext::ImageHash hash,
                                     VezImageCreateInfo image_info);
-    result<void> FillImage(VkImage image, VkExtent2D extent,
-                           std::vector<void*> initial_contents);
+    result<VkImageView> CreateImageView(VkImage image,
+                                        const VezImageCreateInfo& image_info);
+    result<UploadTicket> FillImage(VkImage image, VkExtent2D extent,
+                                   uint32_t texel_size,
+                                   std::vector<void*> initial_contents);
     result<void> GenerateMipmaps(VkImage image, uint32_t layer_count,
                                  VkExtent2D extent);
+
+    result<void> InitUploads();
+    UploadTicket QueueUpload(VezContext::PendingUpload upload,
+                             const void* data);
+    void StageUpload(VezContext::PendingUpload& upload, const void* data);
+    void CancelUploads(VkBuffer buffer, VkImage image);
+    result<void> FlushUploads();
+    result<void> SubmitStagedCopies();
     result<void> GetSetupCommandBuffer();
-    result<void> GetActiveCommandBuffer(uint32_t thread = 0);
+    result<void> GetActiveCommandBuffer();
+    result<size_t> AcquireCommandBuffers(uint32_t count);
+    result<void> BeginCommandBuffer(size_t index);
     VkFormat GetVkFormat(Format format);
+    void OrphanImage(Image& image);
 
-    result<Framebuffer> CreateFramebuffer(FrameIndex frame_id, const char* name,
+    result<Framebuffer> CreateFramebuffer(FrameIndex frame_id,
+                                          ResourceName name,
                                           RenderPassDesc fb_desc);
-    result<Framebuffer> GetFramebuffer(FrameIndex frame_id, const char* name);
+    result<Framebuffer> GetFramebuffer(FrameIndex frame_id, ResourceName name);
     result<std::shared_ptr<Image>> CreateRenderTarget(
-        FrameIndex frame_id, const char* name,
+        FrameIndex frame_id, ResourceName name,
         const ColorRenderTargetDesc& desc);
     result<std::shared_ptr<Image>> CreateRenderTarget(
-        FrameIndex frame_id, const char* name,
+        FrameIndex frame_id, ResourceName name,
         const DepthRenderTargetDesc& desc);
+    VezImageCreateInfo GetRenderTargetInfo(const ColorRenderTargetDesc& desc);
+    VezImageCreateInfo GetRenderTargetInfo(const DepthRenderTargetDesc& desc);
+
+    // The format of the description, or a fallback if the
+    // device cannot render to it with the requested samples
+    Format GetRenderTargetFormat(const ColorRenderTargetDesc& desc);
+
+    // Compiled when the render plan is set
+    CompiledRenderPlan compiled_plan_{};
+    void DestroyRenderTargets();
 
-    result<size_t> StartFrame(uint32_t threads = 1);
+    result<size_t> StartFrame();
     result<void> StartRenderPass(Framebuffer fb, RenderPassDesc rp_desc);
+    void BeginRenderPass(VezFramebuffer framebuffer,
+                         const RenderPassDesc& rp_desc, bool load);
     result<void> FinishFrame();
-    result<void> PresentImage(const char* present_image_name);
+    result<void> PresentImage(ResourceName present_image_name);
 
-    VezContext::BufferHash GetBufferHash(const char* name);
+    VezContext::BufferHash GetBufferHash(ResourceName name);
     VezContext::BufferHash GetBufferHash(BufferType type, const GenIndex& index,
-                                         const char* name);
+                                         ResourceName name);
     VezContext::ShaderHash GetShaderHash(const char* source,
                                          const char* preamble,
                                          const char* entry_point);
@@ -186,10 +329,10 @@ class VezBackend : public Backend {
     VezContext::VertexInputFormatHash GetVertexInputFormatHash(
         const VertexInputFormatDesc& desc);
     VezContext::ImageHash GetRenderTargetHash(FrameIndex frame_id,
-                                              const char* name);
-    VezContext::ImageHash GetTextureHash(const char* name);
+                                              ResourceName name);
+    VezContext::ImageHash GetTextureHash(ResourceName name);
     VezContext::FramebufferHash GetFramebufferHash(FrameIndex frame_id,
-                                                   const char* name);
+                                                   ResourceName name);
     VezContext::SamplerHash GetSamplerHash(const SamplerDesc& sampler_desc);
 };
 
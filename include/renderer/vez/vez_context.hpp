@@ -1,6 +1,9 @@
 #pragma once
 
 #include "renderer/handles.hpp"
+#include "renderer/spirv_cache.hpp"
+#include "infrastructure/flat_hash_map.hpp"
+#include "infrastructure/ring_allocator.hpp"
 
 #include "common/include.hpp"
 #include "common/vez.hpp"
@@ -8,27 +11,30 @@
 namespace goma {
 
 struct VezContext {
-    using ShaderHash = std::vector<uint64_t>;
-    using ShaderCache = std::map<ShaderHash, VkShaderModule>;
+    // Keys are fixed-width, so that lookups do not allocate
+    using ShaderHash = std::array<uint64_t, 3>;
+    using ShaderCache = FlatHashMap<ShaderHash, VkShaderModule>;
 
-    using PipelineHash = std::vector<VkShaderModule>;
-    using PipelineCache = std::map<PipelineHash, std::shared_ptr<Pipeline>>;
+    using PipelineHash = std::array<VkShaderModule, 2>;
+    using PipelineCache = FlatHashMap<PipelineHash, std::shared_ptr<Pipeline>>;
 
-    using VertexInputFormatHash = std::vector<uint64_t>;
+    using VertexInputFormatHash = Hash128;
     using VertexInputFormatCache =
-        std::map<VertexInputFormatHash, std::shared_ptr<VertexInputFormat>>;
+        FlatHashMap<VertexInputFormatHash, std::shared_ptr<VertexInputFormat>>;
 
-    using BufferHash = std::vector<uint64_t>;
-    using BufferCache = std::map<BufferHash, std::shared_ptr<Buffer>>;
+    // Type, index id, index generation and name
+    using BufferHash = std::array<uint64_t, 4>;
+    using BufferCache = FlatHashMap<BufferHash, std::shared_ptr<Buffer>>;
 
-    using ImageHash = std::vector<uint64_t>;
-    using ImageCache = std::map<ImageHash, std::shared_ptr<Image>>;
+    // Frame and name
+    using ImageHash = std::array<uint64_t, 2>;
+    using ImageCache = FlatHashMap<ImageHash, std::shared_ptr<Image>>;
 
-    using SamplerHash = std::vector<uint64_t>;
-    using SamplerCache = std::map<SamplerHash, VkSampler>;
+    using SamplerHash = std::array<uint64_t, 3>;
+    using SamplerCache = FlatHashMap<SamplerHash, VkSampler>;
 
-    using FramebufferHash = std::vector<uint64_t>;
-    using FramebufferCache = std::map<FramebufferHash, VezFramebuffer>;
+    using FramebufferHash = std::array<uint64_t, 2>;
+    using FramebufferCache = FlatHashMap<FramebufferHash, VezFramebuffer>;
 
     VkInstance instance{VK_NULL_HANDLE};
     VkDebugReportCallbackEXT debug_callback{VK_NULL_HANDLE};
@@ -47,6 +53,7 @@ struct VezContext {
 
     ShaderCache vertex_shader_cache{};
     ShaderCache fragment_shader_cache{};
+    SpirvCache spirv_cache{};
     PipelineCache pipeline_cache{};
     VertexInputFormatCache vertex_input_format_cache{};
     BufferCache buffer_cache{};
@@ -55,9 +62,182 @@ struct VezContext {
     SamplerCache sampler_cache{};
     FramebufferCache framebuffer_cache{};
 
+    // Cached shaders compiled from each source file
+    struct ShaderSource {
+        VkShaderStageFlagBits stage;
+        ShaderDesc desc;
+    };
+    std::map<std::string, std::vector<ShaderSource>> shader_files{};
+
+    // Uploads go through a staging ring buffer, and are submitted
+    // on a transfer queue if the device has one
+    VkQueue transfer_queue{VK_NULL_HANDLE};
+    std::vector<uint32_t> upload_queue_families{};
+
+    VkBuffer staging_buffer{VK_NULL_HANDLE};
+    uint8_t* staging_data{nullptr};
+    RingAllocator staging_ring{};
+
+    struct PendingUpload {
+        UploadTicket ticket{0};
+
+        VkBuffer buffer{VK_NULL_HANDLE};
+        VkDeviceSize buffer_offset{0};
+        VkImage image{VK_NULL_HANDLE};
+        VkExtent2D extent{};
+        uint32_t layer{0};
+        uint32_t texel_size{1};
+
+        VkDeviceSize size{0};
+        VkDeviceSize uploaded{0};
+        std::vector<uint8_t> data{};
+    };
+
+    struct StagedCopy {
+        VkBuffer buffer{VK_NULL_HANDLE};
+        VezBufferCopy buffer_region{};
+        VkImage image{VK_NULL_HANDLE};
+        VezBufferImageCopy image_region{};
+    };
+
+    // Device-side copies, e.g. to move data between buffers
+    struct BufferCopy {
+        UploadTicket ticket{0};
+        VkBuffer src{VK_NULL_HANDLE};
+        VkBuffer dst{VK_NULL_HANDLE};
+        VezBufferCopy region{};
+    };
+
+    struct MipmapRequest {
+        UploadTicket ticket{0};
+        VkImage image{VK_NULL_HANDLE};
+        uint32_t layer_count{1};
+        VkExtent2D extent{};
+    };
+
+    std::deque<PendingUpload> pending_uploads{};
+    std::vector<StagedCopy> staged_copies{};
+    std::deque<BufferCopy> pending_buffer_copies{};
+    std::vector<MipmapRequest> pending_mipmaps{};
+    uint64_t frame_upload_bytes{0};
+
+    UploadTicket last_upload_ticket{0};
+    UploadTicket submitted_upload_ticket{0};
+
+    // Shadow of the state bound on a command buffer, so that binds
+    // matching it can be dropped. Only slot 0 of each array is tracked.
+    struct BoundState {
+        static constexpr uint32_t kMaxBindings = 32;
+
+        template <typename T>
+        struct Tracked {
+            bool valid{false};
+            T value{};
+        };
+
+        struct BufferBinding {
+            VkBuffer buffer{VK_NULL_HANDLE};
+            VkDeviceSize offset{0};
+            VkDeviceSize size{0};
+
+            bool operator==(const BufferBinding& other) const {
+                return buffer == other.buffer && offset == other.offset &&
+                       size == other.size;
+            }
+        };
+
+        struct IndexBinding {
+            VkBuffer buffer{VK_NULL_HANDLE};
+            VkDeviceSize offset{0};
+            VkIndexType index_type{VK_INDEX_TYPE_UINT32};
+
+            bool operator==(const IndexBinding& other) const {
+                return buffer == other.buffer && offset == other.offset &&
+                       index_type == other.index_type;
+            }
+        };
+
+        struct ImageBinding {
+            VkImageView image_view{VK_NULL_HANDLE};
+            VkSampler sampler{VK_NULL_HANDLE};
+
+            bool operator==(const ImageBinding& other) const {
+                return image_view == other.image_view &&
+                       sampler == other.sampler;
+            }
+        };
+
+        struct Bindings {
+            Tracked<VezPipeline> pipeline{};
+            Tracked<VezVertexInputFormat> vertex_input_format{};
+            std::array<Tracked<BufferBinding>, kMaxBindings> vertex_buffers{};
+            Tracked<IndexBinding> index_buffer{};
+            std::array<Tracked<BufferBinding>, kMaxBindings> uniform_buffers{};
+            std::array<Tracked<ImageBinding>, kMaxBindings> images{};
+
+            Tracked<DepthStencilState> depth_stencil{};
+            Tracked<RasterizationState> rasterization{};
+            Tracked<MultisampleState> multisample{};
+            Tracked<InputAssemblyState> input_assembly{};
+            Tracked<Viewport> viewport{};
+            Tracked<Scissor> scissor{};
+        };
+        Bindings bindings{};
+
+        uint64_t issued{0};
+        uint64_t elided{0};
+
+        // Returns whether the bind has to be issued. Passing no slot
+        // means the bind is not tracked, so it is always issued.
+        template <typename T>
+        bool Set(Tracked<T>* slot, const T& value) {
+            if (Update(slot, value)) {
+                issued++;
+                return true;
+            }
+            elided++;
+            return false;
+        }
+
+        // As above, without counting, for binds that cover several slots
+        template <typename T>
+        static bool Update(Tracked<T>* slot, const T& value) {
+            if (slot && slot->valid && slot->value == value) {
+                return false;
+            }
+
+            if (slot) {
+                slot->valid = true;
+                slot->value = value;
+            }
+            return true;
+        }
+
+        template <typename T>
+        static Tracked<T>* Slot(std::array<Tracked<T>, kMaxBindings>& slots,
+                                uint32_t binding) {
+            return binding < kMaxBindings ? &slots[binding] : nullptr;
+        }
+
+        // Forgets the bound state, but keeps the counters
+        void Invalidate() { bindings = {}; }
+
+        void Reset() {
+            Invalidate();
+            issued = 0;
+            elided = 0;
+        }
+    };
+
     struct PerFrame {
+        // In submission order, the frame uses the first
+        // command_buffer_count and the rest are kept for later frames
         std::vector<VkCommandBuffer> command_buffers{};
-        std::vector<bool> command_buffer_active{};
+        size_t command_buffer_count{0};
+        bool command_buffer_active{false};
+        // One for each command buffer, a deque keeps them in place
+        // while more are added
+        std::deque<BoundState> bound_states{};
 
         VkCommandBuffer setup_command_buffer{VK_NULL_HANDLE};
         bool setup_command_buffer_active{false};
@@ -68,7 +248,24 @@ struct VezContext {
         VkFence submission_fence{VK_NULL_HANDLE};
         VkFence setup_fence{VK_NULL_HANDLE};
 
+        VkCommandBuffer upload_command_buffer{VK_NULL_HANDLE};
+        VkSemaphore upload_semaphore{VK_NULL_HANDLE};
+        VkFence upload_fence{VK_NULL_HANDLE};
+        RingAllocator::Batch staging_batch{};
+
         std::vector<VezPipeline> orphaned_pipelines{};
+        std::vector<VkBuffer> orphaned_buffers{};
+        std::vector<VulkanImage> orphaned_images{};
+
+        // Render pass of each query in the pool, by index in the
+        // compiled render plan
+        VkQueryPool stats_query_pool{VK_NULL_HANDLE};
+        std::vector<size_t> stats_query_passes{};
+
+        // Start and end of the frame on the GPU, if the device has
+        // timestamps on its graphics queue
+        VkQueryPool timestamp_query_pool{VK_NULL_HANDLE};
+        bool frame_timed{false};
     };
     std::vector<PerFrame> per_frame{};
     size_t current_frame{0};
@@ -12,6 +12,9 @@ struct Attachment {
     std::set<NodeIndex> nodes;
     T data{};
 
+    // Manager revision at which the data was last created or modified
+    uint64_t revision{0};
+
     Attachment(AttachmentIndex<T> id_, const std::set<NodeIndex>& nodes_,
                T&& data_ = T())
         : id(id_), nodes(nodes_), data(std::forward<T>(data_)) {}
@@ -37,7 +40,7 @@ class AttachmentManagerBase {
 template <typename T>
 class AttachmentManager : public AttachmentManagerBase {
   public:
-    AttachmentManager() : valid_count_(0) {}
+    AttachmentManager() : valid_count_(0), revision_(0) {}
     virtual ~AttachmentManager() = default;
 
     result<AttachmentIndex<T>> Create(const std::set<NodeIndex>& nodes,
@@ -61,6 +64,7 @@ class AttachmentManager : public AttachmentManagerBase {
             ret_id = {id};
         }
         valid_count_++;
+        attachments_[ret_id.id].revision = ++revision_;
         return ret_id;
     }
 
@@ -126,6 +130,7 @@ class AttachmentManager : public AttachmentManagerBase {
             return Error::InvalidAttachment;
         }
         attachments_[id.id].nodes.insert(node);
+        revision_++;
         return outcome::success();
     }
 
@@ -134,6 +139,7 @@ class AttachmentManager : public AttachmentManagerBase {
             return Error::InvalidAttachment;
         }
         attachments_[id.id].nodes.erase(node);
+        revision_++;
         return outcome::success();
     }
 
@@ -142,6 +148,15 @@ class AttachmentManager : public AttachmentManagerBase {
             return Error::InvalidAttachment;
         }
         attachments_[id.id].nodes.clear();
+        revision_++;
+        return outcome::success();
+    }
+
+    result<void> MarkModified(AttachmentIndex<T> id) {
+        if (!Validate(id)) {
+            return Error::InvalidAttachment;
+        }
+        attachments_[id.id].revision = ++revision_;
         return outcome::success();
     }
 
@@ -155,12 +170,17 @@ class AttachmentManager : public AttachmentManagerBase {
 
     size_t count() { return valid_count_; }
 
+    // Incremented whenever an attachment is created, modified,
+    // attached or detached
+    uint64_t revision() { return revision_; }
+
   private:
     std::vector<Attachment<T>> attachments_;
     std::map<std::string, AttachmentIndex<T>> attachment_map_;
     std::queue<size_t> recycled_attachments_;
 
     size_t valid_count_;
+    uint64_t revision_;
 
     bool Validate(AttachmentIndex<T> id) {
         return id.gen != 0 && id.id < attachments_.size() &&
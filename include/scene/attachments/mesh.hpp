@@ -9,18 +9,91 @@ namespace goma {
 
 struct Material;
 
-struct MeshBuffers {
-    std::shared_ptr<Buffer> vertex;
-    std::shared_ptr<Buffer> normal;
-    std::shared_ptr<Buffer> tangent;
-    std::shared_ptr<Buffer> bitangent;
-    std::shared_ptr<Buffer> color;
+// Most simplified LODs per mesh, not counting the full-detail one
+constexpr size_t kMaxMeshLods = 4;
+
+// Coarser index buffer over the same vertices as the full-detail mesh
+struct MeshLod {
+    std::vector<uint32_t> indices;
+    // Geometric error relative to the mesh extent
+    float error{0.0f};
+};
+
+// Limits of a meshlet, small enough for its vertices to stay in cache
+constexpr size_t kMeshletMaxVertices = 64;
+constexpr size_t kMeshletMaxTriangles = 124;
+
+// Range of consecutive full-detail triangles with bounds for culling,
+// see BuildMeshlets
+struct Meshlet {
+    uint32_t first_index{0};
+    uint32_t index_count{0};
+    uint32_t vertex_count{0};
+
+    glm::vec3 center{};
+    float radius{0.0f};
+
+    // All triangle normals are within the cone, which is backfacing when
+    // dot(center - camera, cone_axis) >= cone_cutoff * distance + radius *
+    // (1 + cone_cutoff). A cutoff of 1 means the cone is too wide to cull.
+    glm::vec3 cone_axis{};
+    float cone_cutoff{1.0f};
+};
+
+// Quantized attributes, interleaved in the hot vertex stream.
+// Normals and tangents are octahedral-encoded as SNorm16 pairs,
+// with the bitangent sign folded into the tangent.
+struct PackedAttributes {
+    uint32_t normal{0};
+    uint32_t tangent{0};
+    uint32_t uv0{0};
+};
 
+// Attributes that few meshes use, in an optional stream
+struct PackedExtras {
+    uint32_t color{0};
+    uint32_t uv1{0};
+    glm::vec3 uvw{};
+};
+
+enum class UVEncoding { UNorm16, Half };
+
+// GPU-ready vertex data, built by PackVertices at import time
+struct PackedVertices {
+    size_t vertex_count{0};
+    UVEncoding uv_encoding{UVEncoding::UNorm16};
+
+    // Attributes that were packed, i.e. the ones with a value for every
+    // vertex. Vertex input formats and shaders must follow these.
+    bool has_normals{false};
+    bool has_tangents{false};
+    bool has_uv0{false};
+    bool has_colors{false};
+    bool has_uv1{false};
+    bool has_uvw{false};
+
+    std::vector<PackedAttributes> attributes;
+    std::vector<PackedExtras> extras;
+
+    // Filled instead of the 32-bit indices when all indices fit,
+    // followed by the indices of each LOD
+    std::vector<uint16_t> short_indices;
+};
+
+// Buffers are shared between meshes, which are
+// drawn from the given vertex and index offsets
+struct MeshBuffers {
+    std::shared_ptr<Buffer> position;
+    std::shared_ptr<Buffer> attributes;
+    std::shared_ptr<Buffer> extras;
     std::shared_ptr<Buffer> index;
 
-    std::shared_ptr<Buffer> uv0;
-    std::shared_ptr<Buffer> uv1;
-    std::shared_ptr<Buffer> uvw;
+    uint32_t vertex_offset{0};
+    uint32_t index_offset{0};
+    // First index of each LOD, in the same buffer
+    std::vector<uint32_t> lod_index_offsets;
+    bool short_indices{false};
+    UploadTicket upload_ticket{0};
 };
 
 struct Mesh {
@@ -32,6 +105,10 @@ struct Mesh {
     std::vector<glm::vec3> bitangents;
 
     std::vector<uint32_t> indices;
+    // From the most detailed to the coarsest, see GenerateLods
+    std::vector<MeshLod> lods;
+    // Partition of the full-detail indices
+    std::vector<Meshlet> meshlets;
 
     std::vector<glm::vec4> colors;
     std::vector<std::vector<glm::vec2>> uv_sets;
@@ -39,6 +116,10 @@ struct Mesh {
 
     AttachmentIndex<Material> material{};
 
+    // Rebuilt when the vertex count changes, call PackVertices
+    // again after editing the attributes above in place
+    PackedVertices packed{};
+
     std::shared_ptr<VertexInputFormat> vertex_input_format;
     std::unique_ptr<Box> bounding_box{};
     MeshBuffers buffers{};
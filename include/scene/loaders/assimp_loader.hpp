@@ -2,6 +2,7 @@
 
 #include "scene/scene_loader.hpp"
 #include "scene/attachments/material.hpp"
+#include "renderer/shader_permutations.hpp"
 
 #include "assimp/scene.h"
 
@@ -14,7 +15,12 @@ class AssimpLoader : public SceneLoader {
     virtual result<std::unique_ptr<Scene>> ReadSceneFromFile(
         const char* file_path) override;
 
+    // Shader permutations of the last scene read
+    const ShaderManifest& shader_manifest() const { return shader_manifest_; }
+
   private:
+    ShaderManifest shader_manifest_{};
+
     result<std::unique_ptr<Scene>> ConvertScene(const aiScene* ai_scene,
                                                 const std::string& base_path);
 
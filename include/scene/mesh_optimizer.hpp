@@ -0,0 +1,70 @@
+#pragma once
+
+#include "scene/attachments/mesh.hpp"
+
+#include "common/include.hpp"
+
+namespace goma {
+
+// Entries of the FIFO post-transform cache that the optimizer targets
+constexpr size_t kVertexCacheSize = 16;
+
+struct VertexCacheStats {
+    // Average cache misses per triangle, from 3 down to about 0.5
+    float acmr{0.0f};
+    // Average transformed vertices per vertex, 1 at best
+    float atvr{0.0f};
+};
+
+struct MeshOptimizationStats {
+    bool optimized{false};
+    size_t welded_vertices{0};
+
+    VertexCacheStats cache_before{};
+    VertexCacheStats cache_after{};
+
+    // Shaded fragments per covered pixel, see AnalyzeOverdraw
+    float overdraw_before{0.0f};
+    float overdraw_after{0.0f};
+};
+
+VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices,
+                                    size_t vertex_count,
+                                    size_t cache_size = kVertexCacheSize);
+
+// Rasterizes the mesh on a small grid from the six axis directions,
+// in index order and with depth testing, and averages how many times
+// each covered pixel is shaded
+float AnalyzeOverdraw(const std::vector<uint32_t>& indices,
+                      const std::vector<glm::vec3>& positions);
+
+// Merges vertices whose attributes are all bitwise identical,
+// returns how many vertices were removed. This and the other functions
+// that renumber vertices leave the mesh unchanged if any attribute is
+// neither empty nor the size of the vertices.
+size_t WeldVertices(Mesh& mesh);
+
+// Reorders triangles for the post-transform cache (Tipsify)
+void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertex_count,
+                         size_t cache_size = kVertexCacheSize);
+
+// Splits cache-optimized triangles into clusters where the cache is cold
+// and the cluster ACMR is within threshold of the whole mesh, then draws
+// the clusters facing away from the mesh center first, as they are more
+// likely to occlude the rest
+void OptimizeOverdraw(std::vector<uint32_t>& indices,
+                      const std::vector<glm::vec3>& positions,
+                      float threshold = 1.05f,
+                      size_t cache_size = kVertexCacheSize);
+
+// Renumbers vertices in the order they are first used by the indices,
+// dropping unused ones
+void OptimizeVertexFetch(Mesh& mesh);
+
+// Runs all the stages above on a triangle-list mesh, if its attributes
+// match its vertices. Results only depend on the input mesh, so meshes
+// can be optimized on any thread.
+// Must run before PackVertices, as it rewrites the full-precision data.
+MeshOptimizationStats OptimizeMesh(Mesh& mesh);
+
+}  // namespace goma
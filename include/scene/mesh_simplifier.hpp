@@ -0,0 +1,28 @@
+#pragma once
+
+#include "scene/attachments/mesh.hpp"
+
+#include "common/include.hpp"
+
+namespace goma {
+
+// Largest error allowed for generated LODs, relative to the mesh extent
+constexpr float kMaxLodError = 0.05f;
+
+// Collapses edges in order of quadric error until the index count drops to
+// target_index_count, or the next collapse would move the surface by more
+// than target_error, relative to the mesh extent. The result references the
+// same vertices as the input. Open borders only collapse along themselves,
+// and vertices on UV or normal seams are never moved.
+std::vector<uint32_t> SimplifyMesh(const Mesh& mesh,
+                                   const std::vector<uint32_t>& indices,
+                                   size_t target_index_count,
+                                   float target_error,
+                                   float* result_error = nullptr);
+
+// Fills mesh.lods with up to kMaxMeshLods index buffers, each with about
+// half the triangles of the previous one. Stops early when simplifying
+// no longer pays off. Must run before PackVertices.
+void GenerateLods(Mesh& mesh);
+
+}  // namespace goma
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "scene/attachments/mesh.hpp"
+
+#include "common/include.hpp"
+
+namespace goma {
+
+// Splits the full-detail indices into meshlets of consecutive triangles,
+// each with at most kMeshletMaxVertices unique vertices and
+// kMeshletMaxTriangles triangles. Triangles are not reordered, so this
+// should run after OptimizeMesh for spatially coherent meshlets.
+void BuildMeshlets(Mesh& mesh);
+
+}  // namespace goma
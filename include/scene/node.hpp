@@ -27,10 +27,16 @@ struct Transform {
     friend std::ostream& operator<<(std::ostream& o, const goma::Transform& t);
 };
 
+// Static nodes are expected to keep their transform, so that renderers
+// can cache what they draw, e.g. shadow maps. They can still be moved,
+// at the cost of rebuilding those caches.
+enum class Mobility { Static, Movable };
+
 struct Node {
     NodeIndex id;
     NodeIndex parent;  // root node has parent {0, 0}
     Transform transform{};
+    Mobility mobility{Mobility::Static};
 
     std::set<NodeIndex> children{};
     std::unique_ptr<glm::mat4> cached_model{};
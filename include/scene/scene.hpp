@@ -15,6 +15,18 @@ class Scene {
   public:
     Scene();
 
+    // Unique to each scene created, unlike its address, which may be
+    // reused by a scene created after this one is destroyed
+    uint64_t id() const { return id_; }
+
+    // Rendering choices that depend on the content of the scene
+    struct RenderSettings {
+        // Lay down depth before the forward pass, so that it only shades
+        // visible fragments. Pays off when there is a lot of overdraw.
+        bool depth_prepass{false};
+    };
+    RenderSettings& render_settings() { return render_settings_; }
+
     result<NodeIndex> CreateNode(const NodeIndex parent,
                                  const Transform& transform = Transform());
     NodeIndex GetRootNode() { return nodes_[0].id; }
@@ -26,6 +38,14 @@ class Scene {
     result<glm::mat4> GetTransformMatrix(NodeIndex id);
     result<void> SetTransform(NodeIndex id, const Transform& transform);
 
+    result<Mobility> GetMobility(NodeIndex id);
+    result<void> SetMobility(NodeIndex id, Mobility mobility);
+
+    // Nodes whose world transform changed (or that were deleted)
+    // since the last call to ClearMovedNodes()
+    const std::set<NodeIndex>& GetMovedNodes() { return moved_nodes_; }
+    void ClearMovedNodes() { moved_nodes_.clear(); }
+
     template <typename T>
     result<AttachmentIndex<T>> CreateAttachment(const NodeIndex& node_id,
                                                 T&& data = T()) {
@@ -78,6 +98,11 @@ class Scene {
         return GetAttachmentManager<T>()->count();
     }
 
+    template <typename T>
+    uint64_t GetAttachmentRevision() {
+        return GetAttachmentManager<T>()->revision();
+    }
+
     template <typename T>
     result<void> Attach(AttachmentIndex<T> id, NodeIndex node) {
         return GetAttachmentManager<T>()->Attach(id, node);
@@ -93,6 +118,13 @@ class Scene {
         return GetAttachmentManager<T>()->DetachAll(id);
     }
 
+    // Flags the attachment data as changed, so that systems caching
+    // derived state (e.g. GPU resources) pick up the new data
+    template <typename T>
+    result<void> MarkAttachmentModified(AttachmentIndex<T> id) {
+        return GetAttachmentManager<T>()->MarkModified(id);
+    }
+
     template <typename T>
     result<std::reference_wrapper<std::set<NodeIndex>>> GetAttachedNodes(
         AttachmentIndex<T> id) {
@@ -103,8 +135,12 @@ class Scene {
     using AttachmentManagerMap =
         TypeMap<std::unique_ptr<AttachmentManagerBase>>;
 
+    uint64_t id_{0};
+    RenderSettings render_settings_{};
+
     std::vector<Node> nodes_{};
     std::queue<size_t> recycled_nodes_{};
+    std::set<NodeIndex> moved_nodes_{};
 
     AttachmentManagerMap attachment_managers_{};
 
@@ -123,6 +159,7 @@ class Scene {
     }
 
     bool ValidateNode(NodeIndex id);
+    void InvalidateTransforms(NodeIndex id);
     result<void> ComputeTransformMatrix(NodeIndex id);
 };
 
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "scene/attachments/mesh.hpp"
+
+#include "common/include.hpp"
+
+namespace goma {
+
+// Tangents keep the bitangent sign in their first component,
+// which is offset by this much so that it is never zero
+constexpr float kTangentSignBias = 1.0f / 32767.0f;
+
+// Octahedral encoding of unit vectors into [-1, 1]^2
+glm::vec2 OctEncode(const glm::vec3& v);
+glm::vec3 OctDecode(const glm::vec2& e);
+
+uint32_t PackNormal(const glm::vec3& normal);
+uint32_t PackTangent(const glm::vec3& tangent, float bitangent_sign);
+glm::vec3 UnpackNormal(uint32_t packed);
+glm::vec3 UnpackTangent(uint32_t packed, float* bitangent_sign = nullptr);
+
+// Fills mesh.packed from the full-precision attributes: positions stay
+// in their own stream, normals, tangents and UV0 are interleaved and
+// quantized, the rest goes to an optional stream. Bitangents are not
+// stored, shaders rebuild them from the normal, tangent and sign.
+void PackVertices(Mesh& mesh);
+
+// Whether mesh.packed holds the current vertices. Meshes without
+// vertices have nothing packed.
+bool IsPacked(const Mesh& mesh);
+
+// Bytes per vertex of the packed and full-precision layouts
+size_t GetPackedVertexSize(const Mesh& mesh);
+size_t GetUnpackedVertexSize(const Mesh& mesh);
+
+}  // namespace goma
@@ -69,6 +69,9 @@ result<void> Engine::LoadScene(const char* file_path) {
 
     OUTCOME_TRY(renderer_->CreateSkybox());
 
+    // Compile shaders now rather than when meshes first show up
+    renderer_->PreloadShaders(loader.shader_manifest());
+
     return outcome::success();
 }
 
@@ -0,0 +1,80 @@
+#include "renderer/command_stream.hpp"
+
+namespace goma {
+
+void CommandStream::BindGraphicsPipeline(const Pipeline& pipeline) {
+    Push(commands::BindGraphicsPipeline{&pipeline});
+}
+
+void CommandStream::BindVertexInputFormat(
+    const VertexInputFormat& vertex_input_format) {
+    Push(commands::BindVertexInputFormat{&vertex_input_format});
+}
+
+void CommandStream::BindVertexBuffer(const Buffer& vertex_buffer,
+                                     uint32_t binding, uint64_t offset) {
+    Push(commands::BindVertexBuffer{&vertex_buffer, offset, binding});
+}
+
+void CommandStream::BindIndexBuffer(const Buffer& index_buffer,
+                                    uint64_t offset, bool short_indices) {
+    Push(commands::BindIndexBuffer{&index_buffer, offset, short_indices});
+}
+
+void CommandStream::BindTexture(const Image& image, uint32_t binding,
+                                const SamplerDesc* sampler_override) {
+    commands::BindTexture command{&image, binding, false, {}};
+    if (sampler_override) {
+        command.has_sampler_override = true;
+        command.sampler_override = *sampler_override;
+    }
+    Push(command);
+}
+
+void CommandStream::BindUniformBuffer(const Buffer& buffer, uint64_t offset,
+                                      uint64_t size, uint32_t binding,
+                                      uint32_t array_index) {
+    Push(commands::BindUniformBuffer{&buffer, offset, size, binding,
+                                     array_index});
+}
+
+void CommandStream::UpdateBuffer(const Buffer& buffer, uint64_t offset,
+                                 uint64_t size, const void* contents) {
+    Push(commands::UpdateBuffer{&buffer, offset, size}, contents,
+         static_cast<size_t>(size));
+}
+
+void CommandStream::BindDepthStencilState(const DepthStencilState& state) {
+    Push(commands::BindDepthStencilState{state});
+}
+
+void CommandStream::BindRasterizationState(const RasterizationState& state) {
+    Push(commands::BindRasterizationState{state});
+}
+
+void CommandStream::BindMultisampleState(const MultisampleState& state) {
+    Push(commands::BindMultisampleState{state});
+}
+
+void CommandStream::SetViewport(const Viewport& viewport, uint32_t index) {
+    Push(commands::SetViewport{viewport, index});
+}
+
+void CommandStream::SetScissor(const Scissor& scissor, uint32_t index) {
+    Push(commands::SetScissor{scissor, index});
+}
+
+void CommandStream::Draw(uint32_t vertex_count, uint32_t instance_count,
+                         uint32_t first_vertex, uint32_t first_instance) {
+    Push(commands::Draw{vertex_count, instance_count, first_vertex,
+                        first_instance});
+}
+
+void CommandStream::DrawIndexed(uint32_t index_count, uint32_t instance_count,
+                                uint32_t first_index, uint32_t vertex_offset,
+                                uint32_t first_instance) {
+    Push(commands::DrawIndexed{index_count, instance_count, first_index,
+                               vertex_offset, first_instance});
+}
+
+}  // namespace goma
@@ -0,0 +1,200 @@
+#include "renderer/draw_registry.hpp"
+
+#include "scene/scene.hpp"
+#include "scene/attachments/material.hpp"
+
+namespace goma {
+
+result<void> DrawRegistry::Update(Scene& scene) {
+    if (scene_id_ != scene.id()) {
+        // A new scene has been loaded, items refer to the old one
+        Reset();
+        scene_id_ = scene.id();
+    }
+
+    // Attachments changed: add new (mesh, node) pairs, remove stale ones
+    auto mesh_revision = scene.GetAttachmentRevision<Mesh>();
+    if (!initialized_ || mesh_revision != mesh_revision_) {
+        SyncAttachments(scene);
+        mesh_revision_ = mesh_revision;
+        initialized_ = true;
+    }
+
+    // Refresh transforms and bounds for the items whose node moved
+    std::vector<DrawKey> moved_keys;
+    for (const auto& node : scene.GetMovedNodes()) {
+        auto it = item_map_.lower_bound({node, AttachmentIndex<Mesh>{}});
+        for (; it != item_map_.end() && it->first.first == node; it++) {
+            moved_keys.push_back(it->first);
+        }
+    }
+    scene.ClearMovedNodes();
+
+    for (const auto& key : moved_keys) {
+        auto it = item_map_.find(key);
+        if (it == item_map_.end()) {
+            continue;
+        }
+
+        if (!UpdateItem(scene, items_[it->second])) {
+            // The node has been deleted
+            RemoveItem(it->second);
+        }
+    }
+
+    // Shadow casters are drawn with their alpha cutoff and texture
+    auto material_revision = scene.GetAttachmentRevision<Material>();
+    auto texture_revision = scene.GetAttachmentRevision<Texture>();
+    if (material_revision != material_revision_ ||
+        texture_revision != texture_revision_) {
+        if (IsStaticMaterialModified(scene)) {
+            static_revision_++;
+        }
+        material_revision_ = material_revision;
+        texture_revision_ = texture_revision;
+    }
+
+    return outcome::success();
+}
+
+void DrawRegistry::Reset() {
+    items_.clear();
+    item_map_.clear();
+    mesh_revision_ = 0;
+    material_revision_ = 0;
+    texture_revision_ = 0;
+    initialized_ = false;
+
+    // Static items of the old scene are gone
+    static_revision_++;
+}
+
+void DrawRegistry::SyncAttachments(Scene& scene) {
+    std::set<DrawKey> current_keys;
+    scene.ForEach<Mesh>([&](auto id, const auto& nodes, Mesh&) {
+        for (const auto& node : nodes) {
+            current_keys.insert({node, id});
+        }
+    });
+
+    // Iterate backwards, since removal moves the last item in place
+    for (size_t i = items_.size(); i-- > 0;) {
+        const auto& item = items_[i];
+        if (current_keys.find({item.node, item.mesh}) == current_keys.end()) {
+            RemoveItem(i);
+        }
+    }
+
+    // Mesh data may have been modified, which changes the bounds
+    const auto& meshes = scene.GetAttachments<Mesh>();
+    for (auto& item : items_) {
+        if (meshes[item.mesh.id].revision > mesh_revision_) {
+            UpdateItem(scene, item);
+        }
+    }
+
+    for (const auto& key : current_keys) {
+        if (item_map_.find(key) != item_map_.end()) {
+            continue;
+        }
+
+        DrawItem item{key.second, key.first};
+        if (UpdateItem(scene, item)) {
+            item_map_[key] = items_.size();
+            items_.push_back(std::move(item));
+        }
+    }
+}
+
+bool DrawRegistry::UpdateItem(Scene& scene, DrawItem& item) {
+    auto model_res = scene.GetTransformMatrix(item.node);
+    auto mesh_res = scene.GetAttachment<Mesh>(item.mesh);
+    auto mobility_res = scene.GetMobility(item.node);
+    if (!model_res || !mesh_res || !mobility_res) {
+        return false;
+    }
+
+    // Also when the item stops being static
+    auto is_static = mobility_res.value() == Mobility::Static;
+    if (is_static || item.is_static) {
+        static_revision_++;
+    }
+    item.is_static = is_static;
+
+    item.model = model_res.value();
+    item.normals = glm::inverseTranspose(item.model);
+
+    auto& mesh = mesh_res.value().get();
+    item.bounded = mesh.bounding_box != nullptr;
+    item.lod_count = mesh.lods.size();
+    item.lod = std::min(item.lod, item.lod_count);
+    item.has_meshlets = mesh.meshlets.size() > 1;
+
+    if (item.bounded) {
+        // Transform the box as center + extent to get the world-space AABB
+        auto center = (mesh.bounding_box->min + mesh.bounding_box->max) * 0.5f;
+        auto extent = (mesh.bounding_box->max - mesh.bounding_box->min) * 0.5f;
+
+        glm::vec3 ws_center = item.model * glm::vec4(center, 1.0f);
+        glm::vec3 ws_extent =
+            glm::abs(glm::vec3(item.model[0])) * extent.x +
+            glm::abs(glm::vec3(item.model[1])) * extent.y +
+            glm::abs(glm::vec3(item.model[2])) * extent.z;
+
+        item.bounds.min = ws_center - ws_extent;
+        item.bounds.max = ws_center + ws_extent;
+    }
+
+    return true;
+}
+
+bool DrawRegistry::IsStaticMaterialModified(Scene& scene) {
+    const auto& meshes = scene.GetAttachments<Mesh>();
+    const auto& materials = scene.GetAttachments<Material>();
+    const auto& textures = scene.GetAttachments<Texture>();
+
+    for (const auto& item : items_) {
+        auto material_id = meshes[item.mesh.id].data.material;
+        if (!item.is_static || !material_id.valid() ||
+            material_id.id >= materials.size()) {
+            continue;
+        }
+
+        const auto& material = materials[material_id.id];
+        if (material.revision > material_revision_) {
+            return true;
+        }
+
+        // Masked casters sample the diffuse texture for alpha
+        const auto& bindings = material.data.texture_bindings;
+        auto diffuse = bindings.find(TextureType::Diffuse);
+        if (diffuse == bindings.end()) {
+            continue;
+        }
+        for (const auto& binding : diffuse->second) {
+            auto texture_id = binding.index;
+            if (texture_id.valid() && texture_id.id < textures.size() &&
+                textures[texture_id.id].revision > texture_revision_) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void DrawRegistry::RemoveItem(size_t index) {
+    if (items_[index].is_static) {
+        static_revision_++;
+    }
+
+    item_map_.erase({items_[index].node, items_[index].mesh});
+
+    if (index != items_.size() - 1) {
+        items_[index] = std::move(items_.back());
+        item_map_[{items_[index].node, items_[index].mesh}] = index;
+    }
+    items_.pop_back();
+}
+
+}  // namespace goma
@@ -0,0 +1,38 @@
+#include "renderer/dynamic_resolution.hpp"
+
+namespace goma {
+
+float DynamicResolution::Update(float frame_time) {
+    if (!config_.enabled) {
+        scale_ = config_.max_scale;
+        return scale_;
+    }
+
+    if (frame_time <= 0.0f) {
+        return scale_;
+    }
+
+    smoothed_frame_time_ =
+        smoothed_frame_time_ > 0.0f
+            ? glm::mix(smoothed_frame_time_, frame_time, config_.smoothing)
+            : frame_time;
+
+    // Within the band below the target, the current scale is kept.
+    // Otherwise, the scale moves towards the middle of the band.
+    float target = config_.target_frame_time;
+    if (smoothed_frame_time_ <= target &&
+        smoothed_frame_time_ >= target * config_.headroom) {
+        return scale_;
+    }
+    float goal = target * (1.0f + config_.headroom) / 2.0f;
+
+    // Frame time is taken to grow with the pixel count, i.e. the square
+    // of the scale
+    float next_scale = scale_ * std::sqrt(goal / smoothed_frame_time_);
+    next_scale = glm::clamp(next_scale, scale_ - config_.max_step,
+                            scale_ + config_.max_step);
+    scale_ = glm::clamp(next_scale, config_.min_scale, config_.max_scale);
+    return scale_;
+}
+
+}  // namespace goma
@@ -0,0 +1,432 @@
+#include "renderer/geometry_pool.hpp"
+
+#include "scene/scene.hpp"
+#include "scene/vertex_layout.hpp"
+
+namespace goma {
+
+namespace {
+
+enum Stream { Position, Attributes, Extras };
+
+const char* kStreamNames[] = {"position", "attributes", "extras"};
+const uint64_t kStreamStrides[] = {sizeof(glm::vec3), sizeof(PackedAttributes),
+                                   sizeof(PackedExtras)};
+const uint64_t kIndexUnitSize = sizeof(uint32_t);
+
+struct StreamData {
+    const void* data{nullptr};
+    uint64_t count{0};
+};
+
+StreamData GetStreamData(const Mesh& mesh, size_t stream) {
+    switch (stream) {
+        case Position:
+            return {mesh.vertices.data(), mesh.vertices.size()};
+        case Attributes:
+            return {mesh.packed.attributes.data(),
+                    mesh.packed.attributes.size()};
+        case Extras:
+            return {mesh.packed.extras.data(), mesh.packed.extras.size()};
+        default:
+            return {};
+    }
+}
+
+std::shared_ptr<Buffer>& GetStreamBuffer(MeshBuffers& buffers, size_t stream) {
+    switch (stream) {
+        case Attributes:
+            return buffers.attributes;
+        case Extras:
+            return buffers.extras;
+        case Position:
+        default:
+            return buffers.position;
+    }
+}
+
+// Full-detail indices followed by the indices of each LOD
+uint64_t GetIndexCount(const Mesh& mesh) {
+    uint64_t count = mesh.indices.size();
+    for (const auto& lod : mesh.lods) {
+        count += lod.indices.size();
+    }
+    return count;
+}
+
+uint64_t GrowCapacity(const OffsetAllocator& allocator, uint64_t size) {
+    uint64_t capacity = std::max(allocator.size(), uint64_t(1));
+    while (capacity < allocator.used() + size) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+}  // namespace
+
+result<size_t> GeometryPool::Allocate(Scene& scene, AttachmentIndex<Mesh> id,
+                                      Mesh& mesh) {
+    // Modified meshes get a new allocation
+    Free(id);
+
+    if (!IsPacked(mesh)) {
+        // Not packed at import, e.g. created at runtime
+        PackVertices(mesh);
+    }
+
+    Allocation allocation{};
+    for (size_t i = 0; i < kStreamCount; i++) {
+        auto count = GetStreamData(mesh, i).count;
+        if (count > 0) {
+            allocation.vertex_count = std::max(allocation.vertex_count, count);
+            allocation.streams |= 1 << i;
+        }
+    }
+    allocation.short_indices = !mesh.packed.short_indices.empty();
+    auto index_count = GetIndexCount(mesh);
+    allocation.index_count =
+        allocation.short_indices ? (index_count + 1) / 2 : index_count;
+
+    if (!AllocateRanges(allocation)) {
+        // Compaction might be enough, otherwise grow the buffers
+        auto vertex_capacity =
+            GrowCapacity(vertex_allocator_, allocation.vertex_count);
+        auto index_capacity =
+            GrowCapacity(index_allocator_, allocation.index_count);
+        OUTCOME_TRY(Rebuild(scene, vertex_capacity, index_capacity));
+
+        if (!AllocateRanges(allocation)) {
+            return Error::OutOfGPUMemory;
+        }
+    }
+
+    size_t bytes = 0;
+    UploadTicket ticket = 0;
+
+    for (size_t i = 0; i < kStreamCount; i++) {
+        auto stream = GetStreamData(mesh, i);
+        if (stream.count == 0) {
+            continue;
+        }
+
+        OUTCOME_TRY(buffer, GetVertexBuffer(i));
+        auto stride = kStreamStrides[i];
+        OUTCOME_TRY(upload_ticket,
+                    backend_.UploadBuffer(*buffer,
+                                          allocation.vertex_offset * stride,
+                                          stream.count * stride, stream.data));
+        ticket = std::max(ticket, upload_ticket);
+        bytes += stream.count * stride;
+    }
+
+    if (allocation.index_count > 0) {
+        // Short indices are already concatenated with the LODs
+        std::vector<std::pair<const void*, uint64_t>> ranges;
+        if (allocation.short_indices) {
+            ranges.push_back(
+                {mesh.packed.short_indices.data(),
+                 mesh.packed.short_indices.size() * sizeof(uint16_t)});
+        } else {
+            ranges.push_back({mesh.indices.data(),
+                              mesh.indices.size() * sizeof(uint32_t)});
+            for (const auto& lod : mesh.lods) {
+                ranges.push_back({lod.indices.data(),
+                                  lod.indices.size() * sizeof(uint32_t)});
+            }
+        }
+
+        OUTCOME_TRY(buffer, GetIndexBuffer());
+        uint64_t offset = allocation.index_offset * kIndexUnitSize;
+        for (const auto& range : ranges) {
+            if (range.second == 0) {
+                continue;
+            }
+
+            OUTCOME_TRY(upload_ticket,
+                        backend_.UploadBuffer(*buffer, offset, range.second,
+                                              range.first));
+            ticket = std::max(ticket, upload_ticket);
+            offset += range.second;
+            bytes += range.second;
+        }
+    }
+
+    SetBuffers(mesh, allocation);
+    mesh.buffers.upload_ticket = ticket;
+
+    allocations_[id] = allocation;
+    stats_.meshes = allocations_.size();
+
+    return bytes;
+}
+
+void GeometryPool::Free(AttachmentIndex<Mesh> id) {
+    auto result = allocations_.find(id);
+    if (result == allocations_.end()) {
+        return;
+    }
+
+    const auto& allocation = result->second;
+    if (allocation.vertex_count > 0) {
+        vertex_allocator_.free(allocation.vertex_offset);
+    }
+    if (allocation.index_count > 0) {
+        index_allocator_.free(allocation.index_offset);
+    }
+
+    allocations_.erase(result);
+    stats_.meshes = allocations_.size();
+    freed_ = true;
+}
+
+result<void> GeometryPool::Update(Scene& scene) {
+    ReleaseRetiredBuffers();
+
+    // Fragmentation can only grow when meshes are freed
+    if (freed_ && fragmentation() > config_.max_fragmentation) {
+        OUTCOME_TRY(Rebuild(scene, vertex_allocator_.size(),
+                            index_allocator_.size()));
+    }
+    freed_ = false;
+
+    return outcome::success();
+}
+
+void GeometryPool::Reset() {
+    ReleaseRetiredBuffers(true);
+    DestroyBuffers();
+    allocations_.clear();
+    freed_ = false;
+
+    vertex_allocator_.reset(config_.vertex_capacity);
+    index_allocator_.reset(config_.index_capacity);
+
+    stats_ = {};
+}
+
+float GeometryPool::fragmentation() const {
+    return std::max(vertex_allocator_.fragmentation(),
+                    index_allocator_.fragmentation());
+}
+
+result<std::shared_ptr<Buffer>> GeometryPool::GetVertexBuffer(size_t stream) {
+    auto& buffer = vertex_buffers_[stream];
+    if (!buffer) {
+        // Buffers of previous generations may still be alive
+        auto name = std::string("goma_geometry_") + kStreamNames[stream] +
+                    "_" + std::to_string(generation_);
+        OUTCOME_TRY(vb, backend_.CreateVertexBuffer(
+                            AttachmentIndex<Mesh>{}, name.c_str(),
+                            vertex_allocator_.size() * kStreamStrides[stream]));
+        buffer = vb;
+        stats_.buffers++;
+    }
+    return buffer;
+}
+
+result<std::shared_ptr<Buffer>> GeometryPool::GetIndexBuffer() {
+    if (!index_buffer_) {
+        auto name = "goma_geometry_index_" + std::to_string(generation_);
+        OUTCOME_TRY(ib, backend_.CreateIndexBuffer(
+                            AttachmentIndex<Mesh>{}, name.c_str(),
+                            index_allocator_.size() * kIndexUnitSize));
+        index_buffer_ = ib;
+        stats_.buffers++;
+    }
+    return index_buffer_;
+}
+
+bool GeometryPool::AllocateRanges(Allocation& allocation) {
+    if (allocation.vertex_count > 0) {
+        allocation.vertex_offset =
+            vertex_allocator_.allocate(allocation.vertex_count);
+        if (allocation.vertex_offset == OffsetAllocator::kInvalidOffset) {
+            return false;
+        }
+    }
+
+    if (allocation.index_count > 0) {
+        allocation.index_offset =
+            index_allocator_.allocate(allocation.index_count);
+        if (allocation.index_offset == OffsetAllocator::kInvalidOffset) {
+            if (allocation.vertex_count > 0) {
+                vertex_allocator_.free(allocation.vertex_offset);
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+result<void> GeometryPool::Rebuild(Scene& scene, uint64_t vertex_capacity,
+                                   uint64_t index_capacity) {
+    uint64_t vertex_count = 0;
+    uint64_t index_count = 0;
+    for (const auto& entry : allocations_) {
+        vertex_count += entry.second.vertex_count;
+        index_count += entry.second.index_count;
+    }
+    if (vertex_count > vertex_capacity || index_count > index_capacity) {
+        return Error::OutOfGPUMemory;
+    }
+
+    auto old_vertex_buffers = vertex_buffers_;
+    auto old_index_buffer = index_buffer_;
+    auto old_allocations = std::move(allocations_);
+
+    allocations_.clear();
+    vertex_buffers_ = {};
+    index_buffer_ = nullptr;
+    generation_++;
+
+    vertex_allocator_.reset(vertex_capacity);
+    index_allocator_.reset(index_capacity);
+
+    // Live ranges are packed at the start of the new buffers
+    // with device-side copies, so nothing is uploaded again.
+    // Meshes take the tickets of their copies, so they are not drawn
+    // from the new offsets until the copies are ordered before them.
+    UploadTicket last_ticket = 0;
+    size_t failed_count = 0;
+    for (const auto& entry : old_allocations) {
+        auto mesh_res = scene.GetAttachment<Mesh>(entry.first);
+        if (!mesh_res) {
+            continue;
+        }
+        auto& mesh = mesh_res.value().get();
+
+        const auto& old = entry.second;
+        auto allocation = old;
+        if (!AllocateRanges(allocation)) {
+            // Not drawn until the residency manager uploads it again
+            SetBuffers(mesh, Allocation{});
+            scene.MarkAttachmentModified<Mesh>(entry.first);
+            failed_count++;
+            continue;
+        }
+
+        UploadTicket ticket = 0;
+        for (size_t i = 0; i < kStreamCount; i++) {
+            if (!(old.streams & (1 << i)) || !old_vertex_buffers[i]) {
+                continue;
+            }
+
+            OUTCOME_TRY(buffer, GetVertexBuffer(i));
+            auto stride = kStreamStrides[i];
+            OUTCOME_TRY(copy_ticket,
+                        backend_.CopyBuffer(*old_vertex_buffers[i],
+                                            old.vertex_offset * stride, *buffer,
+                                            allocation.vertex_offset * stride,
+                                            old.vertex_count * stride));
+            ticket = std::max(ticket, copy_ticket);
+        }
+
+        if (old.index_count > 0 && old_index_buffer) {
+            OUTCOME_TRY(buffer, GetIndexBuffer());
+            auto unit = kIndexUnitSize;
+            OUTCOME_TRY(copy_ticket,
+                        backend_.CopyBuffer(*old_index_buffer,
+                                            old.index_offset * unit, *buffer,
+                                            allocation.index_offset * unit,
+                                            old.index_count * unit));
+            ticket = std::max(ticket, copy_ticket);
+        }
+
+        SetBuffers(mesh, allocation);
+        mesh.buffers.upload_ticket = ticket;
+        allocations_[entry.first] = allocation;
+        last_ticket = std::max(last_ticket, ticket);
+    }
+
+    // Destroying the buffers now would cancel uploads that the copies
+    // still read from, so they are released once the copies are done
+    RetiredBuffers retired{{}, last_ticket};
+    for (auto& buffer : old_vertex_buffers) {
+        if (buffer) {
+            retired.buffers.push_back(buffer);
+        }
+    }
+    if (old_index_buffer) {
+        retired.buffers.push_back(old_index_buffer);
+    }
+    retired_buffers_.push_back(std::move(retired));
+
+    stats_.meshes = allocations_.size();
+    stats_.compactions++;
+
+    spdlog::info("Geometry compacted into {} vertices, {} indices.",
+                 vertex_allocator_.used(), index_allocator_.used());
+
+    if (failed_count > 0) {
+        spdlog::error("{} meshes did not fit in the compacted geometry.",
+                      failed_count);
+        return Error::OutOfGPUMemory;
+    }
+    return outcome::success();
+}
+
+void GeometryPool::ReleaseRetiredBuffers(bool force) {
+    // A complete ticket means that the copies have been submitted.
+    // The backend keeps destroyed buffers alive until the frames that
+    // may be using them, which include the copies, are complete.
+    for (auto it = retired_buffers_.begin(); it != retired_buffers_.end();) {
+        if (!force && !backend_.IsUploadComplete(it->ticket)) {
+            it++;
+            continue;
+        }
+
+        for (const auto& buffer : it->buffers) {
+            backend_.DestroyBuffer(*buffer);
+            stats_.buffers--;
+        }
+        it = retired_buffers_.erase(it);
+    }
+}
+
+void GeometryPool::DestroyBuffers() {
+    for (auto& buffer : vertex_buffers_) {
+        if (buffer) {
+            backend_.DestroyBuffer(*buffer);
+            buffer = nullptr;
+        }
+    }
+
+    if (index_buffer_) {
+        backend_.DestroyBuffer(*index_buffer_);
+        index_buffer_ = nullptr;
+    }
+
+    stats_.buffers = 0;
+}
+
+void GeometryPool::SetBuffers(Mesh& mesh, const Allocation& allocation) {
+    for (size_t i = 0; i < kStreamCount; i++) {
+        GetStreamBuffer(mesh.buffers, i) =
+            (allocation.streams & (1 << i)) ? vertex_buffers_[i] : nullptr;
+    }
+    mesh.buffers.index = allocation.index_count > 0 ? index_buffer_ : nullptr;
+
+    mesh.buffers.vertex_offset =
+        allocation.vertex_count > 0
+            ? static_cast<uint32_t>(allocation.vertex_offset)
+            : 0;
+    // First index in units of the index type
+    mesh.buffers.short_indices = allocation.short_indices;
+    mesh.buffers.index_offset =
+        allocation.index_count > 0
+            ? static_cast<uint32_t>(allocation.index_offset *
+                                    (allocation.short_indices ? 2 : 1))
+            : 0;
+
+    // LODs follow the full-detail indices
+    mesh.buffers.lod_index_offsets.clear();
+    auto lod_index_offset =
+        mesh.buffers.index_offset + static_cast<uint32_t>(mesh.indices.size());
+    for (const auto& lod : mesh.lods) {
+        mesh.buffers.lod_index_offsets.push_back(lod_index_offset);
+        lod_index_offset += static_cast<uint32_t>(lod.indices.size());
+    }
+}
+
+}  // namespace goma
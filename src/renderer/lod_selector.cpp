@@ -0,0 +1,36 @@
+#include "renderer/lod_selector.hpp"
+
+namespace goma {
+
+float LodSelector::GetScreenSize(const glm::vec3& center, float radius,
+                                 const glm::vec3& camera_position,
+                                 float projection_scale) {
+    float distance = glm::length(center - camera_position);
+    if (distance <= radius) {
+        // The camera is inside the sphere
+        return std::numeric_limits<float>::max();
+    }
+
+    return radius * std::abs(projection_scale) / distance;
+}
+
+size_t LodSelector::Select(float screen_size, size_t current_lod,
+                           size_t lod_count) const {
+    size_t lod = 0;
+    auto max_lod = std::min(lod_count, config_.screen_sizes.size());
+
+    for (size_t i = 0; i < max_lod; i++) {
+        // Moving to a coarser LOD takes a smaller size than moving back
+        float threshold = config_.screen_sizes[i];
+        threshold *= current_lod > i ? 1.0f + config_.hysteresis
+                                     : 1.0f - config_.hysteresis;
+
+        if (screen_size < threshold) {
+            lod = i + 1;
+        }
+    }
+
+    return lod;
+}
+
+}  // namespace goma
@@ -0,0 +1,80 @@
+#include "renderer/meshlet_culler.hpp"
+
+namespace goma {
+
+namespace {
+
+// Object-space frustum planes, normalized, with the
+// inside on the positive side and Vulkan's [0, w] depth
+std::array<glm::vec4, 6> GetFrustumPlanes(const glm::mat4& mvp) {
+    auto row = [&mvp](int i) {
+        return glm::vec4(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+    };
+
+    std::array<glm::vec4, 6> planes = {row(3) + row(0), row(3) - row(0),
+                                       row(3) + row(1), row(3) - row(1),
+                                       row(2),          row(3) - row(2)};
+
+    for (auto& plane : planes) {
+        float length = glm::length(glm::vec3(plane));
+        if (length > 0.0f) {
+            plane /= length;
+        }
+    }
+    return planes;
+}
+
+bool IsInFrustum(const std::array<glm::vec4, 6>& planes,
+                 const glm::vec3& center, float radius) {
+    return std::all_of(planes.begin(), planes.end(), [&](const auto& plane) {
+        return glm::dot(glm::vec3(plane), center) + plane.w >= -radius;
+    });
+}
+
+bool IsBackfacing(const Meshlet& meshlet, const glm::vec3& os_camera_pos) {
+    if (meshlet.cone_cutoff >= 1.0f) {
+        return false;
+    }
+
+    auto view = meshlet.center - os_camera_pos;
+    float distance = glm::length(view);
+    return glm::dot(view, meshlet.cone_axis) >=
+           meshlet.cone_cutoff * distance +
+               meshlet.radius * (1.0f + meshlet.cone_cutoff);
+}
+
+}  // namespace
+
+size_t MeshletCuller::Cull(const Mesh& mesh, const glm::mat4& mvp,
+                           const glm::vec3& os_camera_pos,
+                           bool backface_culling,
+                           std::vector<IndexRange>& ranges) {
+    auto planes = GetFrustumPlanes(mvp);
+    auto first_range = ranges.size();
+
+    for (const auto& meshlet : mesh.meshlets) {
+        stats_.tested_meshlets++;
+
+        if (!IsInFrustum(planes, meshlet.center, meshlet.radius) ||
+            (backface_culling && IsBackfacing(meshlet, os_camera_pos))) {
+            continue;
+        }
+        stats_.visible_meshlets++;
+
+        // Meshlets are consecutive, so neighbours share a draw
+        if (ranges.size() > first_range) {
+            auto& last = ranges.back();
+            if (last.first + last.count == meshlet.first_index) {
+                last.count += meshlet.index_count;
+                continue;
+            }
+        }
+        ranges.push_back({meshlet.first_index, meshlet.index_count});
+    }
+
+    auto range_count = ranges.size() - first_range;
+    stats_.ranges += range_count;
+    return range_count;
+}
+
+}  // namespace goma
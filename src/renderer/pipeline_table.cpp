@@ -0,0 +1,27 @@
+#include "renderer/pipeline_table.hpp"
+
+namespace goma {
+
+PipelineId PipelineTable::Add(std::shared_ptr<Pipeline> pipeline) {
+    if (!pipeline) {
+        return kInvalidPipelineId;
+    }
+
+    auto result = ids_.find(pipeline.get());
+    if (result != ids_.end()) {
+        return result->second;
+    }
+
+    auto id = static_cast<PipelineId>(pipelines_.size());
+    ids_[pipeline.get()] = id;
+    pipelines_.push_back(std::move(pipeline));
+    return id;
+}
+
+void PipelineTable::Clear() {
+    pipelines_.clear();
+    ids_.clear();
+    generation_++;
+}
+
+}  // namespace goma
@@ -0,0 +1,256 @@
+#include "renderer/render_graph.hpp"
+
+
+namespace goma {
+
+constexpr size_t CompiledRenderPlan::kNone;
+
+namespace {
+
+// Targets accessed by a pass, before culling
+struct PassAccess {
+    std::vector<size_t> reads{};
+    std::vector<size_t> writes{};
+    // Written without reading the previous contents
+    std::vector<size_t> overwrites{};
+};
+
+bool Contains(const std::vector<size_t>& targets, size_t target) {
+    return std::find(targets.begin(), targets.end(), target) != targets.end();
+}
+
+}  // namespace
+
+result<CompiledRenderPlan> CompileRenderPlan(const RenderPlan& render_plan) {
+    CompiledRenderPlan plan;
+    using Target = CompiledRenderPlan::Target;
+    constexpr auto kNone = CompiledRenderPlan::kNone;
+
+    auto add_target = [&plan](Target target) -> result<void> {
+        auto index = plan.targets.size();
+        if (!plan.target_indices.insert({target.id.hash(), index}).second) {
+            spdlog::error("Render target \"{}\" is defined more than once.",
+                          target.name);
+            return Error::KeyAlreadyExists;
+        }
+
+        plan.targets.push_back(std::move(target));
+        return outcome::success();
+    };
+
+    for (const auto& image : render_plan.color_images) {
+        Target target(image.first);
+        target.color_desc = image.second;
+        OUTCOME_TRY(add_target(std::move(target)));
+    }
+
+    for (const auto& image : render_plan.depth_images) {
+        Target target(image.first);
+        target.depth = true;
+        target.depth_desc = image.second;
+        OUTCOME_TRY(add_target(std::move(target)));
+    }
+
+    if (!render_plan.output.empty()) {
+        plan.output = plan.FindTarget(render_plan.output);
+        if (plan.output == kNone) {
+            spdlog::error("Output \"{}\" is not in the render plan.",
+                          render_plan.output);
+            return Error::NotFound;
+        }
+    }
+
+    std::vector<CompiledRenderPlan::Pass> passes;
+    std::vector<PassAccess> accesses;
+
+    for (size_t i = 0; i < render_plan.passes.size(); i++) {
+        const auto& entry = render_plan.passes[i];
+        const auto& pass_name =
+            entry.match([](const GeneralPassEntry& gp) { return gp.name; },
+                        [](const RenderPassEntry& rp) { return rp.name; });
+
+        auto find_target = [&plan, &pass_name](
+                               const RenderTargetName& name) -> result<size_t> {
+            auto target = plan.FindTarget(name);
+            if (target == kNone) {
+                spdlog::error(
+                    "Render target \"{}\" used by pass \"{}\" is not in the "
+                    "render plan.",
+                    name, pass_name);
+                return Error::NotFound;
+            }
+            return target;
+        };
+
+        CompiledRenderPlan::Pass pass{i, pass_name};
+        PassAccess access;
+
+        // Attachments that are not cleared are loaded, so they are read
+        auto add_attachment = [&access](size_t target, bool clear) {
+            (clear ? access.overwrites : access.reads).push_back(target);
+            access.writes.push_back(target);
+        };
+
+        if (entry.is<RenderPassEntry>()) {
+            const auto& desc = entry.get<RenderPassEntry>().desc;
+            pass.render_pass = true;
+
+            for (const auto& attachment : desc.color_attachments) {
+                OUTCOME_TRY(target, find_target(attachment.rt_name));
+                pass.color_targets.push_back(target);
+                add_attachment(target, attachment.clear);
+
+                auto resolve_target = kNone;
+                if (!attachment.resolve_to_rt.empty()) {
+                    OUTCOME_TRY(resolve,
+                                find_target(attachment.resolve_to_rt));
+                    resolve_target = resolve;
+                    add_attachment(resolve_target, true);
+                }
+                pass.resolve_targets.push_back(resolve_target);
+            }
+
+            const auto& depth_attachment = desc.depth_attachment;
+            if (!depth_attachment.rt_name.empty()) {
+                OUTCOME_TRY(target, find_target(depth_attachment.rt_name));
+                pass.depth_target = target;
+                add_attachment(target, depth_attachment.clear);
+            }
+        }
+
+        const auto& blits =
+            entry.match([](const GeneralPassEntry& gp) { return gp.blits; },
+                        [](const RenderPassEntry& rp) { return rp.blits; });
+        for (const auto& blit : blits) {
+            OUTCOME_TRY(src, find_target(blit.src.rt));
+            OUTCOME_TRY(dst, find_target(blit.dst.rt));
+            pass.blits.push_back({src, dst});
+
+            // Blits may cover part of the destination only
+            access.reads.push_back(src);
+            add_attachment(dst, false);
+        }
+
+        const auto& inputs =
+            entry.match([](const GeneralPassEntry& gp) { return gp.inputs; },
+                        [](const RenderPassEntry& rp) { return rp.inputs; });
+        for (const auto& input : inputs) {
+            OUTCOME_TRY(target, find_target(input));
+            access.reads.push_back(target);
+        }
+
+        passes.push_back(std::move(pass));
+        accesses.push_back(std::move(access));
+    }
+
+    // Walking back from the output, passes are kept if they write targets
+    // needed later on. Passes that write no target may have other side
+    // effects, e.g. updating buffers, so they are always kept.
+    std::vector<bool> live(passes.size(), true);
+    if (plan.output != kNone) {
+        std::vector<bool> needed(plan.targets.size(), false);
+        needed[plan.output] = true;
+
+        for (size_t i = passes.size(); i-- > 0;) {
+            const auto& access = accesses[i];
+            live[i] = access.writes.empty() ||
+                      std::any_of(access.writes.begin(), access.writes.end(),
+                                  [&needed](size_t t) { return needed[t]; });
+
+            if (live[i]) {
+                for (auto target : access.reads) {
+                    needed[target] = true;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < passes.size(); i++) {
+        if (!live[i]) {
+            plan.culled_passes++;
+            continue;
+        }
+
+        auto index = plan.passes.size();
+        auto pass = std::move(passes[i]);
+        const auto& access = accesses[i];
+
+        auto add_unique = [](std::vector<size_t>& targets, size_t t) {
+            if (!Contains(targets, t)) {
+                targets.push_back(t);
+            }
+        };
+
+        for (auto t : access.reads) {
+            add_unique(pass.reads, t);
+            add_unique(pass.targets, t);
+        }
+        for (auto t : access.writes) {
+            add_unique(pass.writes, t);
+            add_unique(pass.targets, t);
+        }
+
+        for (auto t : pass.targets) {
+            auto& target = plan.targets[t];
+            if (!target.used()) {
+                target.first_use = index;
+                // Persistent targets keep contents across frames
+                target.transient = plan.output != kNone && t != plan.output &&
+                                   !target.persistent() &&
+                                   Contains(access.overwrites, t) &&
+                                   !Contains(access.reads, t);
+            }
+            target.last_use = index;
+        }
+
+        plan.passes.push_back(std::move(pass));
+    }
+
+    if (plan.output != kNone) {
+        auto& output = plan.targets[plan.output];
+        if (!output.used()) {
+            output.first_use = 0;
+        }
+        output.last_use = plan.passes.size();
+    }
+
+    // Without an output, targets could be read after the frame
+    if (plan.output == kNone) {
+        for (auto& target : plan.targets) {
+            if (target.used()) {
+                target.last_use = plan.passes.size();
+            }
+        }
+    }
+
+    return plan;
+}
+
+RenderPlanBandwidth EstimateBandwidth(
+    const CompiledRenderPlan& plan, const std::vector<uint64_t>& target_sizes) {
+    RenderPlanBandwidth bandwidth;
+
+    for (const auto& pass : plan.passes) {
+        RenderPlanBandwidth::Pass pass_bandwidth{pass.name};
+
+        for (auto t : pass.reads) {
+            pass_bandwidth.read += target_sizes[t];
+        }
+        for (auto t : pass.writes) {
+            pass_bandwidth.written += target_sizes[t];
+        }
+        for (size_t i = 0; i < pass.resolve_targets.size(); i++) {
+            if (pass.resolve_targets[i] != CompiledRenderPlan::kNone) {
+                pass_bandwidth.read += target_sizes[pass.color_targets[i]];
+            }
+        }
+
+        bandwidth.read += pass_bandwidth.read;
+        bandwidth.written += pass_bandwidth.written;
+        bandwidth.passes.push_back(std::move(pass_bandwidth));
+    }
+
+    return bandwidth;
+}
+
+}  // namespace goma
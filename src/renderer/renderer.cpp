@@ -6,6 +6,7 @@
 #include "scene/attachments/light.hpp"
 #include "scene/attachments/material.hpp"
 #include "scene/attachments/mesh.hpp"
+#include "scene/vertex_layout.hpp"
 
 #include <stb_image.h>
 
@@ -15,8 +16,34 @@
 
 namespace goma {
 
+namespace {
+
+// Resources looked up every frame, hashed at compile time
+constexpr ResourceName kBrdfLut{"brdf_lut"};
+constexpr ResourceName kSkyboxTexture{"goma_skybox"};
+constexpr ResourceName kShadowDepth{"shadow_depth"};
+constexpr ResourceName kResolvedImage{"resolved_image"};
+constexpr ResourceName kBlurFull{"blur_full"};
+constexpr ResourceName kDepth{"depth"};
+
+constexpr ResourceName kLightsBuffer{"lights"};
+constexpr ResourceName kSkyboxBuffer{"skybox"};
+constexpr ResourceName kDownscaleBuffer{"downscale"};
+constexpr ResourceName kUpscaleBuffer{"upscale"};
+constexpr ResourceName kPostprocessingBuffer{"postprocessing"};
+constexpr ResourceName kUniformArenaBuffer{"uniform_arena"};
+
+// Half the side of the shadow frustum, and how far its near plane is
+// moved toward the light on devices without depth clamping
+constexpr float kShadowFrustumSize = 20.0f;
+constexpr float kShadowNearPullback = 100.0f;
+
+}  // namespace
+
 Renderer::Renderer(Engine& engine)
-    : engine_(engine), backend_(std::make_unique<VezBackend>()) {
+    : engine_(engine),
+      backend_(std::make_unique<VezBackend>()),
+      residency_manager_(*backend_) {
     if (auto result = backend_->InitContext()) {
         spdlog::info("Context initialized.");
     } else {
@@ -29,6 +56,12 @@ Renderer::Renderer(Engine& engine)
         throw std::runtime_error(result.error().message());
     }
 
+    backend_->SetRenderPlan(CreateRenderPlan());
+
+    CreateBRDFLut();
+}
+
+RenderPlan Renderer::CreateRenderPlan() const {
     RenderPlan render_plan{};
 
     render_plan.color_images = {
@@ -43,21 +76,34 @@ Renderer::Renderer(Engine& engine)
     SamplerDesc shadow_sampler;
     shadow_sampler.compare_op = CompareOp::Less;
 
+    const Extent shadow_extent{2048.0f, 2048.0f, ExtentType::Absolute};
+    DepthRenderTargetDesc static_shadow_desc{shadow_extent, 1,
+                                             Format::DepthOnly};
+    static_shadow_desc.persistent = true;
+
     render_plan.depth_images = {
         {"depth", {{}, 4, Format::DepthOnly}},
+        {"shadow_static", static_shadow_desc},
         {
             "shadow_depth",
-            {{2048.0f, 2048.0f, ExtentType::Absolute},
-             1,
-             Format::DepthOnly,
-             shadow_sampler},
+            {shadow_extent, 1, Format::DepthOnly, shadow_sampler},
         },
     };
 
+    // Static casters are drawn to their own map only when it is stale.
+    // It is copied into the shadow map, where dynamic casters are added.
+    // The forward pass keeps the depth of the pre-pass, if any.
     render_plan.passes = {
         GeneralPassEntry{"update_light_buffer"},
         RenderPassEntry{
-            "shadow", RenderPassDesc{{}, DepthAttachmentDesc{"shadow_depth"}}},
+            "shadow_static",
+            RenderPassDesc{{}, DepthAttachmentDesc{"shadow_static"}}},
+        GeneralPassEntry{"shadow_copy",
+                         {{{"shadow_static", shadow_extent},
+                           {"shadow_depth", shadow_extent}}}},
+        RenderPassEntry{
+            "shadow",
+            RenderPassDesc{{}, DepthAttachmentDesc{"shadow_depth", false}}},
         RenderPassEntry{
             "forward",
             RenderPassDesc{{ColorAttachmentDesc{"color",
@@ -65,23 +111,42 @@ Renderer::Renderer(Engine& engine)
                                                 true,
                                                 {0.1f, 0.1f, 0.1f, 1.0f},
                                                 "resolved_image"}},
-                           DepthAttachmentDesc{"depth"}}},
+                           DepthAttachmentDesc{"depth", !depth_prepass_}},
+            {},
+            {"shadow_depth"}},
         RenderPassEntry{"blur_down_half",
-                        RenderPassDesc{{ColorAttachmentDesc{"blur_half"}}}},
+                        RenderPassDesc{{ColorAttachmentDesc{"blur_half"}}},
+                        {},
+                        {"resolved_image"}},
         RenderPassEntry{"blur_down_quarter",
-                        RenderPassDesc{{ColorAttachmentDesc{"blur_quarter"}}}},
+                        RenderPassDesc{{ColorAttachmentDesc{"blur_quarter"}}},
+                        {},
+                        {"blur_half"}},
         RenderPassEntry{"blur_up_half",
-                        RenderPassDesc{{ColorAttachmentDesc{"blur_half"}}}},
+                        RenderPassDesc{{ColorAttachmentDesc{"blur_half"}}},
+                        {},
+                        {"blur_quarter"}},
         RenderPassEntry{"blur_up_full",
-                        RenderPassDesc{{ColorAttachmentDesc{"blur_full"}}}},
+                        RenderPassDesc{{ColorAttachmentDesc{"blur_full"}}},
+                        {},
+                        {"blur_half"}},
         RenderPassEntry{
             "postprocessing",
-            RenderPassDesc{{ColorAttachmentDesc{"postprocessing"}}}},
+            RenderPassDesc{{ColorAttachmentDesc{"postprocessing"}}},
+            {},
+            {"resolved_image", "blur_full", "depth"}},
     };
+    render_plan.output = "postprocessing";
+
+    // Right before the forward pass
+    if (depth_prepass_) {
+        RenderPassEntry depth_prepass{
+            "depth_prepass", RenderPassDesc{{}, DepthAttachmentDesc{"depth"}}};
+        render_plan.passes.insert(render_plan.passes.begin() + 4,
+                                  std::move(depth_prepass));
+    }
 
-    backend_->SetRenderPlan(std::move(render_plan));
-
-    CreateBRDFLut();
+    return render_plan;
 }
 
 result<void> Renderer::Render() {
@@ -90,17 +155,26 @@ result<void> Renderer::Render() {
     }
     Scene& scene = *engine_.scene();
 
-    downscale_index_ = 0;
-    upscale_index_ = 0;
+    // A pre-pass disabled in the backend is also left out of the plan,
+    // so that the forward pass clears depth rather than loading it.
+    // Setting a render plan waits for the GPU.
+    bool depth_prepass = scene.render_settings().depth_prepass &&
+                         backend_->IsPassEnabled("depth_prepass");
+    if (depth_prepass != depth_prepass_) {
+        depth_prepass_ = depth_prepass;
+        OUTCOME_TRY(backend_->SetRenderPlan(CreateRenderPlan()));
+        drawn_static_shadow_revisions_.clear();  // targets are recreated
+        spdlog::info("Depth pre-pass {}.",
+                     depth_prepass_ ? "enabled" : "disabled");
+    }
 
-    // Ensure that all meshes have their own buffers
-    CreateMeshBuffers(scene);
+    backend_->SetRenderScale(dynamic_resolution_.scale());
 
-    // Ensure that all meshes have their own vertex input format
-    CreateVertexInputFormats(scene);
+    downscale_index_ = 0;
+    upscale_index_ = 0;
 
-    // Upload textures
-    UploadTextures(scene);
+    // Create GPU resources for new or modified meshes and textures
+    OUTCOME_TRY(residency_manager_.Update(scene));
 
     // Set up light buffer
     auto light_buffer_data = GetLightBufferData(scene);
@@ -157,9 +231,15 @@ result<void> Renderer::Render() {
                 auto shadow_view =
                     glm::lookAt(ws_eye, ws_eye + ws_direction, ws_up);
 
-                constexpr float size = 20.0f;
+                // Casters beyond the near plane are flattened onto it
+                // by depth clamping. Without it, they would be clipped,
+                // so the near plane is pulled back to keep them.
+                constexpr float size = kShadowFrustumSize;
+                float near_plane = backend_->SupportsDepthClamp()
+                                       ? -size
+                                       : -size - kShadowNearPullback;
                 auto shadow_proj =
-                    glm::ortho(-size, size, -size, size, -size, size);
+                    glm::ortho(-size, size, -size, size, near_plane, size);
                 shadow_vp = shadow_proj * shadow_view;
             }
 
@@ -183,68 +263,100 @@ result<void> Renderer::Render() {
         last_keypresses.find(KeyInput::C) == last_keypresses.end()) {
         spdlog::info("Reloading shaders!");
         backend_->ClearShaderCache();
+        pipeline_table_.Clear();
     }
 
-    // Get main render sequence
-    RenderSequence render_seq;
-    render_seq.reserve(scene.GetAttachmentCount<Mesh>());
+    // Edited shader files are recompiled in the background
+    OUTCOME_TRY(backend_->ReloadChangedShaders());
 
-    scene.ForEach<Mesh>([&](auto id, auto nodes, Mesh& mesh) {
-        for (auto& mesh_node : nodes) {
-            glm::mat4 mvp = vp * scene.GetTransformMatrix(mesh_node).value();
-            glm::vec3 bbox_center =
-                (mesh.bounding_box->min + mesh.bounding_box->max) * 0.5f;
-            glm::vec4 cs_center = mvp * glm::vec4(bbox_center, 1.0f);
-            cs_center /= cs_center.w;
-            render_seq.push_back({id, mesh_node, cs_center});
-        }
-    });
+    // Pick up attached/detached meshes and moved nodes
+    OUTCOME_TRY(draw_registry_.Update(scene));
 
-    // Frustum culling
-    RenderSequence visible_seq = Cull(scene, render_seq, vp);
+    // Frustum culling and LOD selection
+    Cull(scene, vp, ws_pos, proj[1][1], visible_seq_);
 
     // Sorting
-    std::sort(visible_seq.begin(), visible_seq.end(),
+    std::sort(visible_seq_.begin(), visible_seq_.end(),
               [](const auto& a, const auto& b) {
-                  return a.cs_center.z < b.cs_center.z;
+                  return a.cs_depth < b.cs_depth;
               });
 
-    backend_->RenderFrame(
-        {
-            [this, &scene, &light_buffer_data](FrameIndex frame_id,
-                                               const RenderPassDesc*) {
-                return UpdateLightBuffer(frame_id, scene, light_buffer_data);
-            },
-            [this, &scene, &render_seq, &shadow_vp](FrameIndex frame_id,
-                                                    const RenderPassDesc*) {
-                return ShadowPass(frame_id, scene, render_seq, shadow_vp);
-            },
-            [this, &scene, &visible_seq, &ws_pos, &vp, &shadow_vp](
-                FrameIndex frame_id, const RenderPassDesc*) {
-                return ForwardPass(frame_id, scene, visible_seq, ws_pos, vp,
-                                   shadow_vp);
-            },
-            [this](FrameIndex frame_id, const RenderPassDesc*) {
-                return DownscalePass(frame_id, "resolved_image", "blur_half");
-            },
-            [this](FrameIndex frame_id, const RenderPassDesc*) {
-                return DownscalePass(frame_id, "blur_half", "blur_quarter");
-            },
-            [this](FrameIndex frame_id, const RenderPassDesc*) {
-                return UpscalePass(frame_id, "blur_quarter", "blur_half");
-            },
-            [this](FrameIndex frame_id, const RenderPassDesc*) {
-                return UpscalePass(frame_id, "blur_half", "blur_full");
-            },
-            [this, &scene](FrameIndex frame_id, const RenderPassDesc*) {
-                return PostprocessingPass(frame_id);
-            },
+    // Without a shadow-casting light, the shadow map is left empty
+    if (shadow_map_found) {
+        CullShadowCasters(shadow_vp, static_shadow_seq_, dynamic_shadow_seq_);
+    } else {
+        static_shadow_seq_.clear();
+        dynamic_shadow_seq_.clear();
+    }
+    UpdateStaticShadowCache(shadow_vp);
+
+    // Passes push their uniforms from here
+    uniform_arena_.Reset();
+
+    // Filled in by the pre-pass, if it runs
+    prepass_draws_.clear();
+
+    std::vector<PassFn> pass_fns{
+        [this, &scene, &light_buffer_data](FrameIndex frame_id,
+                                           const RenderPassDesc*) {
+            return UpdateLightBuffer(frame_id, scene, light_buffer_data);
+        },
+        [this, &scene, &shadow_vp](FrameIndex frame_id,
+                                   const RenderPassDesc*) {
+            return StaticShadowPass(frame_id, scene, shadow_vp);
+        },
+        // The copy is done by the blit of the pass entry
+        [](FrameIndex, const RenderPassDesc*) -> result<void> {
+            return outcome::success();
+        },
+        [this, &scene, &shadow_vp](FrameIndex frame_id,
+                                   const RenderPassDesc*) {
+            return ShadowPass(frame_id, scene, dynamic_shadow_seq_, shadow_vp);
+        },
+        [this, &scene, &ws_pos, &vp, &shadow_vp](FrameIndex frame_id,
+                                                 const RenderPassDesc*) {
+            return ForwardPass(frame_id, scene, visible_seq_, ws_pos, vp,
+                               shadow_vp);
         },
-        "postprocessing");
+        [this](FrameIndex frame_id, const RenderPassDesc*) {
+            return DownscalePass(frame_id, "resolved_image", "blur_half");
+        },
+        [this](FrameIndex frame_id, const RenderPassDesc*) {
+            return DownscalePass(frame_id, "blur_half", "blur_quarter");
+        },
+        [this](FrameIndex frame_id, const RenderPassDesc*) {
+            return UpscalePass(frame_id, "blur_quarter", "blur_half");
+        },
+        [this](FrameIndex frame_id, const RenderPassDesc*) {
+            return UpscalePass(frame_id, "blur_half", "blur_full");
+        },
+        [this, &scene](FrameIndex frame_id, const RenderPassDesc*) {
+            return PostprocessingPass(frame_id);
+        },
+    };
+
+    // Matches the passes of CreateRenderPlan()
+    if (depth_prepass_) {
+        pass_fns.insert(
+            pass_fns.begin() + 4,
+            [this, &scene, &vp](FrameIndex frame_id, const RenderPassDesc*) {
+                return DepthPrepass(frame_id, scene, visible_seq_, vp);
+            });
+    }
+
+    backend_->RenderFrame(std::move(pass_fns), "postprocessing");
+
+    // Left unchanged on devices that cannot time frames
+    dynamic_resolution_.Update(backend_->GetGpuFrameTime());
 
     return outcome::success();
 }
 
+Extent Renderer::GetRenderExtent() {
+    auto scale = backend_->render_scale();
+    return backend_->GetAbsoluteExtent({scale, scale});
+}
+
 result<void> Renderer::CreateBRDFLut() {
     std::string path{GOMA_ASSETS_DIR "textures/brdf_lut.png"};
 
@@ -268,13 +380,28 @@ result<void> Renderer::CreateBRDFLut() {
     sampler.addressing_mode = TextureWrappingMode::MirroredRepeat;
     tex_desc.sampler = sampler;
 
-    backend_->CreateTexture("brdf_lut", tex_desc, stbi_image);
+    backend_->CreateTexture(kBrdfLut, tex_desc, stbi_image);
 
     stbi_image_free(stbi_image);
 
     return outcome::success();
 }
 
+void Renderer::PreloadShaders(const ShaderManifest& manifest) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    auto failed = CompileShaderManifest(
+        *backend_, manifest, backend_->GetTexture(kSkyboxTexture).has_value());
+
+    std::chrono::duration<float> elapsed =
+        std::chrono::high_resolution_clock::now() - start;
+    spdlog::info("Preloaded {} shader permutations in {:.2f} s.",
+                 manifest.size(), elapsed.count());
+    if (failed > 0) {
+        spdlog::warn("{} pipelines couldn't be preloaded.", failed);
+    }
+}
+
 result<void> Renderer::CreateSkybox() {
     CreateSphere();
 
@@ -310,7 +437,7 @@ result<void> Renderer::CreateSkybox() {
     tex_desc.mipmapping = true;
 
     auto res = backend_->CreateCubemap(
-        "goma_skybox", tex_desc,
+        kSkyboxTexture, tex_desc,
         {stbi_images[0], stbi_images[1], stbi_images[2], stbi_images[3],
          stbi_images[4], stbi_images[5]});
 
@@ -326,6 +453,9 @@ result<void> Renderer::CreateSkybox() {
     auto mip_levels = static_cast<uint32_t>(floor(log2(min_dim) + 1));
     skybox_mip_count = std::max(1U, mip_levels);
 
+    // Forward shaders sample the skybox once it exists
+    pipeline_table_.Clear();
+
     return outcome::success();
 }
 
@@ -367,6 +497,8 @@ result<void> Renderer::CreateSphere() {
         mesh.indices.push_back(static_cast<uint32_t>(i + 1));
     }
 
+    PackVertices(mesh);
+
     OUTCOME_TRY(attachment,
                 engine_.scene()->CreateAttachment<Mesh>(std::move(mesh)));
     engine_.scene()->RegisterAttachment<Mesh>(attachment, "goma_sphere");
@@ -374,304 +506,145 @@ result<void> Renderer::CreateSphere() {
     return outcome::success();
 }
 
-void Renderer::CreateMeshBuffers(Scene& scene) {
-    scene.ForEach<Mesh>([&](auto id, auto, Mesh& mesh) {
-        // Create vertex buffer
-        if (!mesh.vertices.empty() &&
-            (!mesh.buffers.vertex || !mesh.buffers.vertex->valid)) {
-            auto vb_result = backend_->CreateVertexBuffer(
-                id, "vertex", mesh.vertices.size() * sizeof(mesh.vertices[0]),
-                true, mesh.vertices.data());
-
-            if (vb_result) {
-                auto& vb = vb_result.value();
-                mesh.buffers.vertex = vb;
-            }
-        }
-
-        // Create normal buffer
-        if (!mesh.normals.empty() &&
-            (!mesh.buffers.normal || !mesh.buffers.normal->valid)) {
-            auto vb_result = backend_->CreateVertexBuffer(
-                id, "normal", mesh.normals.size() * sizeof(mesh.normals[0]),
-                true, mesh.normals.data());
-
-            if (vb_result) {
-                auto& vb = vb_result.value();
-                mesh.buffers.normal = vb;
-            }
-        }
-
-        // Create tangent buffer
-        if (!mesh.tangents.empty() &&
-            (!mesh.buffers.tangent || !mesh.buffers.tangent->valid)) {
-            auto vb_result = backend_->CreateVertexBuffer(
-                id, "tangent", mesh.tangents.size() * sizeof(mesh.tangents[0]),
-                true, mesh.tangents.data());
+void Renderer::Cull(Scene& scene, const glm::mat4& vp,
+                    const glm::vec3& camera_ws_pos, float projection_scale,
+                    RenderSequence& visible_seq) {
+    // Clearing keeps the capacity, so no allocations in steady state
+    visible_seq.clear();
+    visible_ranges_.clear();
+    meshlet_culler_.ResetStats();
 
-            if (vb_result) {
-                auto& vb = vb_result.value();
-                mesh.buffers.tangent = vb;
-            }
-        }
+    std::array<glm::vec4, 8> cs_vertices;
+    const auto& culling_vp = vp_hold ? *vp_hold : vp;
 
-        // Create bitangent buffer
-        if (!mesh.bitangents.empty() &&
-            (!mesh.buffers.bitangent || !mesh.buffers.bitangent->valid)) {
-            auto vb_result = backend_->CreateVertexBuffer(
-                id, "bitangent",
-                mesh.bitangents.size() * sizeof(mesh.bitangents[0]), true,
-                mesh.bitangents.data());
-
-            if (vb_result) {
-                auto& vb = vb_result.value();
-                mesh.buffers.bitangent = vb;
-            }
+    for (auto& item : draw_registry_.items()) {
+        const auto& min = item.bounds.min;
+        const auto& max = item.bounds.max;
+
+        // Culled items get a LOD too, as the shadow pass draws them
+        if (item.bounded && item.lod_count > 0) {
+            auto screen_size = LodSelector::GetScreenSize(
+                (min + max) * 0.5f, glm::length(max - min) * 0.5f,
+                camera_ws_pos, projection_scale);
+            item.lod =
+                lod_selector_.Select(screen_size, item.lod, item.lod_count);
+        } else {
+            item.lod = 0;
         }
 
-        // Create index buffer
-        if (!mesh.indices.empty() &&
-            (!mesh.buffers.index || !mesh.buffers.index->valid)) {
-            auto ib_result = backend_->CreateIndexBuffer(
-                id, "index", mesh.indices.size() * sizeof(mesh.indices[0]),
-                true, mesh.indices.data());
+        glm::vec4 cs_center;
 
-            if (ib_result) {
-                auto& ib = ib_result.value();
-                mesh.buffers.index = ib;
-            }
-        }
+        if (item.bounded) {
+            cs_vertices[0] = culling_vp * glm::vec4(min, 1.0f);
+            cs_vertices[1] = culling_vp * glm::vec4(max, 1.0f);
+            cs_vertices[2] = culling_vp * glm::vec4(min.x, min.y, max.z, 1.0f);
+            cs_vertices[3] = culling_vp * glm::vec4(min.x, max.y, max.z, 1.0f);
+            cs_vertices[4] = culling_vp * glm::vec4(min.x, max.y, min.z, 1.0f);
+            cs_vertices[5] = culling_vp * glm::vec4(max.x, max.y, min.z, 1.0f);
+            cs_vertices[6] = culling_vp * glm::vec4(max.x, min.y, min.z, 1.0f);
+            cs_vertices[7] = culling_vp * glm::vec4(max.x, min.y, max.z, 1.0f);
 
-        // Create color buffer
-        if (!mesh.colors.empty() &&
-            (!mesh.buffers.color || !mesh.buffers.color->valid)) {
-            auto vb_result = backend_->CreateVertexBuffer(
-                id, "color", mesh.colors.size() * sizeof(mesh.colors[0]), true,
-                mesh.colors.data());
+            bool culled =
+                std::all_of(cs_vertices.begin(), cs_vertices.end(),
+                            [](const auto& v) { return v.x <= -v.w; }) ||
+                std::all_of(cs_vertices.begin(), cs_vertices.end(),
+                            [](const auto& v) { return v.x >= v.w; }) ||
+                std::all_of(cs_vertices.begin(), cs_vertices.end(),
+                            [](const auto& v) { return v.y <= -v.w; }) ||
+                std::all_of(cs_vertices.begin(), cs_vertices.end(),
+                            [](const auto& v) { return v.y >= v.w; }) ||
+                std::all_of(cs_vertices.begin(), cs_vertices.end(),
+                            [](const auto& v) { return v.z <= 0; }) ||
+                std::all_of(cs_vertices.begin(), cs_vertices.end(),
+                            [](const auto& v) { return v.z >= v.w; });
 
-            if (vb_result) {
-                auto& vb = vb_result.value();
-                mesh.buffers.color = vb;
+            if (culled) {
+                continue;
             }
-        }
 
-        // Create UV0 buffer
-        if (mesh.uv_sets.size() > 0 &&
-            (!mesh.buffers.uv0 || !mesh.buffers.uv0->valid)) {
-            auto vb_result = backend_->CreateVertexBuffer(
-                id, "uv0", mesh.uv_sets[0].size() * sizeof(mesh.uv_sets[0][0]),
-                true, mesh.uv_sets[0].data());
-
-            if (vb_result) {
-                auto& vb = vb_result.value();
-                mesh.buffers.uv0 = vb;
-            }
+            cs_center = vp * glm::vec4((min + max) * 0.5f, 1.0f);
+        } else {
+            cs_center = vp * item.model[3];
         }
 
-        // Create UV1 buffer
-        if (mesh.uv_sets.size() > 1 &&
-            (!mesh.buffers.uv1 || !mesh.buffers.uv1->valid)) {
-            auto vb_result = backend_->CreateVertexBuffer(
-                id, "uv1", mesh.uv_sets[1].size() * sizeof(mesh.uv_sets[1][0]),
-                true, mesh.uv_sets[1].data());
-
-            if (vb_result) {
-                auto& vb = vb_result.value();
-                mesh.buffers.uv1 = vb;
+        RenderSequenceElement element{&item, cs_center.z / cs_center.w};
+
+        // Only the full-detail mesh is split into meshlets
+        if (item.has_meshlets && item.lod == 0) {
+            auto mesh_res = scene.GetAttachment<Mesh>(item.mesh);
+            if (mesh_res) {
+                const auto& mesh = mesh_res.value().get();
+
+                auto material_res =
+                    scene.GetAttachment<Material>(mesh.material);
+                bool two_sided =
+                    material_res && material_res.value().get().two_sided;
+
+                glm::vec3 os_camera_pos =
+                    glm::inverse(item.model) * glm::vec4(camera_ws_pos, 1.0f);
+
+                element.first_range =
+                    static_cast<uint32_t>(visible_ranges_.size());
+                element.range_count = static_cast<uint32_t>(
+                    meshlet_culler_.Cull(mesh, culling_vp * item.model,
+                                         os_camera_pos, !two_sided,
+                                         visible_ranges_));
+                if (element.range_count == 0) {
+                    continue;
+                }
             }
         }
 
-        // Create UVW buffer
-        if (mesh.uvw_sets.size() > 0 &&
-            (!mesh.buffers.uvw || !mesh.buffers.uvw->valid)) {
-            auto vb_result = backend_->CreateVertexBuffer(
-                id, "uvw",
-                mesh.uvw_sets[0].size() * sizeof(mesh.uvw_sets[0][0]), true,
-                mesh.uvw_sets[0].data());
-
-            if (vb_result) {
-                auto& vb = vb_result.value();
-                mesh.buffers.uvw = vb;
-            }
-        }
-    });
+        visible_seq.push_back(element);
+    }
 }
 
-void Renderer::CreateVertexInputFormats(Scene& scene) {
-    scene.ForEach<Mesh>([&](auto, auto, Mesh& mesh) {
-        VertexInputFormatDesc input_format_desc;
-
-        uint32_t binding_id = 0;
-        if (!mesh.vertices.empty()) {
-            input_format_desc.bindings.push_back(
-                {binding_id, sizeof(mesh.vertices[0])});
-            input_format_desc.attributes.push_back(
-                {binding_id, binding_id, Format::SFloatRGB32, 0});
-        }
-
-        binding_id++;
-        if (!mesh.normals.empty()) {
-            input_format_desc.bindings.push_back(
-                {binding_id, sizeof(mesh.normals[0])});
-            input_format_desc.attributes.push_back(
-                {binding_id, binding_id, Format::SFloatRGB32, 0});
-        }
-
-        binding_id++;
-        if (!mesh.tangents.empty()) {
-            input_format_desc.bindings.push_back(
-                {binding_id, sizeof(mesh.tangents[0])});
-            input_format_desc.attributes.push_back(
-                {binding_id, binding_id, Format::SFloatRGB32, 0});
+void Renderer::CullShadowCasters(const glm::mat4& shadow_vp,
+                                 RenderSequence& static_seq,
+                                 RenderSequence& dynamic_seq) {
+    static_seq.clear();
+    dynamic_seq.clear();
+    shadow_caster_culler_.ResetStats();
+
+    for (const auto& item : draw_registry_.items()) {
+        if (item.bounded &&
+            !shadow_caster_culler_.IsVisible(shadow_vp, item.bounds)) {
+            continue;
         }
 
-        binding_id++;
-        if (!mesh.bitangents.empty()) {
-            input_format_desc.bindings.push_back(
-                {binding_id, sizeof(mesh.bitangents[0])});
-            input_format_desc.attributes.push_back(
-                {binding_id, binding_id, Format::SFloatRGB32, 0});
-        }
-
-        binding_id++;
-        if (!mesh.colors.empty()) {
-            input_format_desc.bindings.push_back(
-                {binding_id, sizeof(mesh.colors[0])});
-            input_format_desc.attributes.push_back(
-                {binding_id, binding_id, Format::SFloatRGBA32, 0});
-        }
-
-        binding_id++;
-        if (mesh.uv_sets.size() > 0 && !mesh.uv_sets[0].empty()) {
-            input_format_desc.bindings.push_back(
-                {binding_id, sizeof(mesh.uv_sets[0][0])});
-            input_format_desc.attributes.push_back(
-                {binding_id, binding_id, Format::SFloatRG32, 0});
-        }
-
-        binding_id++;
-        if (mesh.uv_sets.size() > 1 && !mesh.uv_sets[1].empty()) {
-            input_format_desc.bindings.push_back(
-                {binding_id, sizeof(mesh.uv_sets[1][0])});
-            input_format_desc.attributes.push_back(
-                {binding_id, binding_id, Format::SFloatRG32, 0});
-        }
-
-        binding_id++;
-        if (mesh.uvw_sets.size() > 0 && !mesh.uvw_sets[0].empty()) {
-            input_format_desc.bindings.push_back(
-                {binding_id, sizeof(mesh.uvw_sets[0][0])});
-            input_format_desc.attributes.push_back(
-                {binding_id, binding_id, Format::SFloatRGB32, 0});
-        }
-
-        auto input_format_res =
-            backend_->GetVertexInputFormat(input_format_desc);
-        if (input_format_res) {
-            mesh.vertex_input_format = input_format_res.value();
-        }
-    });
-}
+        auto ls_center = shadow_vp * item.model[3];
+        auto& shadow_seq = item.is_static ? static_seq : dynamic_seq;
+        shadow_seq.push_back({&item, ls_center.z / ls_center.w});
+    }
 
-void Renderer::UploadTextures(Scene& scene) {
-    scene.ForEach<Material>([&](auto, auto, Material& material) {
-        const std::vector<TextureType> texture_types = {
-            TextureType::Diffuse,           TextureType::Specular,
-            TextureType::Ambient,           TextureType::Emissive,
-            TextureType::MetallicRoughness, TextureType::HeightMap,
-            TextureType::NormalMap,         TextureType::Shininess,
-            TextureType::Opacity,           TextureType::Displacement,
-            TextureType::LightMap,          TextureType::Reflection};
-
-        for (const auto& texture_type : texture_types) {
-            auto binding = material.texture_bindings.find(texture_type);
-
-            if (binding != material.texture_bindings.end() &&
-                !binding->second.empty()) {
-                auto texture_res =
-                    scene.GetAttachment<Texture>(binding->second[0].index);
-                if (texture_res) {
-                    auto& texture = texture_res.value().get();
-
-                    // Upload texture if necessary
-                    if (!texture.image || !texture.image->valid) {
-                        if (!texture.compressed) {
-                            TextureDesc tex_desc{texture.width, texture.height};
-                            auto image_res = backend_->CreateTexture(
-                                texture.path.c_str(), tex_desc,
-                                texture.data.data());
-
-                            if (image_res) {
-                                texture.image = image_res.value();
-                            }
-                        } else {
-                            spdlog::warn(
-                                "Compressed texture \"{}\" not supported.",
-                                texture.path);
-                        }
-                    }
-                }
-            }
-        }
-    });
+    // Draws of a mesh become a single batch, front to back within it
+    auto by_mesh = [](const auto& a, const auto& b) {
+        return std::tie(a.item->mesh.id, a.cs_depth) <
+               std::tie(b.item->mesh.id, b.cs_depth);
+    };
+    std::sort(static_seq.begin(), static_seq.end(), by_mesh);
+    std::sort(dynamic_seq.begin(), dynamic_seq.end(), by_mesh);
 }
 
-Renderer::RenderSequence Renderer::Cull(Scene& scene,
-                                        const RenderSequence& render_seq,
-                                        const glm::mat4& vp) {
-    RenderSequence visible_seq;
-    visible_seq.reserve(render_seq.size());
-
-    std::vector<glm::vec4> cs_vertices(8);
-    const auto& culling_vp = vp_hold ? *vp_hold : vp;
-
-    std::copy_if(
-        render_seq.begin(), render_seq.end(), std::back_inserter(visible_seq),
-        [&culling_vp, &cs_vertices, &scene](const RenderSequenceElement& e) {
-            glm::mat4 mvp =
-                culling_vp * scene.GetTransformMatrix(e.node).value();
-            auto& mesh = scene.GetAttachment<Mesh>(e.mesh).value().get();
-
-            cs_vertices[0] = mvp * glm::vec4(mesh.bounding_box->min, 1.0f);
-            cs_vertices[1] = mvp * glm::vec4(mesh.bounding_box->max, 1.0f);
-            cs_vertices[2] = mvp * glm::vec4(mesh.bounding_box->min.x,
-                                             mesh.bounding_box->min.y,
-                                             mesh.bounding_box->max.z, 1.0f);
-            cs_vertices[3] = mvp * glm::vec4(mesh.bounding_box->min.x,
-                                             mesh.bounding_box->max.y,
-                                             mesh.bounding_box->max.z, 1.0f);
-            cs_vertices[4] = mvp * glm::vec4(mesh.bounding_box->min.x,
-                                             mesh.bounding_box->max.y,
-                                             mesh.bounding_box->min.z, 1.0f);
-            cs_vertices[5] = mvp * glm::vec4(mesh.bounding_box->max.x,
-                                             mesh.bounding_box->max.y,
-                                             mesh.bounding_box->min.z, 1.0f);
-            cs_vertices[6] = mvp * glm::vec4(mesh.bounding_box->max.x,
-                                             mesh.bounding_box->min.y,
-                                             mesh.bounding_box->min.z, 1.0f);
-            cs_vertices[7] = mvp * glm::vec4(mesh.bounding_box->max.x,
-                                             mesh.bounding_box->min.y,
-                                             mesh.bounding_box->max.z, 1.0f);
-
-            bool culled =
-                std::all_of(cs_vertices.begin(), cs_vertices.end(),
-                            [](const auto& v) { return v.x <= -v.w; }) ||
-                std::all_of(cs_vertices.begin(), cs_vertices.end(),
-                            [](const auto& v) { return v.x >= v.w; }) ||
-                std::all_of(cs_vertices.begin(), cs_vertices.end(),
-                            [](const auto& v) { return v.y <= -v.w; }) ||
-                std::all_of(cs_vertices.begin(), cs_vertices.end(),
-                            [](const auto& v) { return v.y >= v.w; }) ||
-                std::all_of(cs_vertices.begin(), cs_vertices.end(),
-                            [](const auto& v) { return v.z <= 0; }) ||
-                std::all_of(cs_vertices.begin(), cs_vertices.end(),
-                            [](const auto& v) { return v.z >= v.w; });
-
-            return !culled;
-        });
+void Renderer::UpdateStaticShadowCache(const glm::mat4& shadow_vp) {
+    // Also redrawn when the depth or shadow shaders are reloaded
+    if (shadow_vp != static_shadow_vp_ ||
+        draw_registry_.static_revision() != registry_static_revision_ ||
+        backend_->GetShaderRevision() != shader_revision_) {
+        static_shadow_vp_ = shadow_vp;
+        registry_static_revision_ = draw_registry_.static_revision();
+        shader_revision_ = backend_->GetShaderRevision();
+        static_shadow_revision_++;
+    }
 
-    visible_seq.shrink_to_fit();
-    return visible_seq;
+    // The map of the next frame is only drawn if it is out of date
+    auto frame_id = backend_->GetNextFrameIndex();
+    if (frame_id >= drawn_static_shadow_revisions_.size()) {
+        drawn_static_shadow_revisions_.resize(frame_id + 1, 0);
+    }
+    backend_->SetPassEnabled("shadow_static",
+                             drawn_static_shadow_revisions_[frame_id] !=
+                                 static_shadow_revision_);
 }
 
 Renderer::LightBufferData Renderer::GetLightBufferData(Scene& scene) {
@@ -713,10 +686,10 @@ result<void> Renderer::UpdateLightBuffer(
     const LightBufferData& light_buffer_data) {
     constexpr auto padded_light_size =
         (sizeof(LightBufferData) / 256 + 1) * 256;
-    auto light_buffer_res = backend_->GetUniformBuffer("lights");
+    auto light_buffer_res = backend_->GetUniformBuffer(kLightsBuffer);
     if (!light_buffer_res) {
         light_buffer_res = backend_->CreateUniformBuffer(
-            "lights", 3 * padded_light_size, false);
+            kLightsBuffer, 3 * padded_light_size, false);
     }
 
     auto light_buffer = light_buffer_res.value();
@@ -727,92 +700,213 @@ result<void> Renderer::UpdateLightBuffer(
     return outcome::success();
 }
 
+result<void> Renderer::StaticShadowPass(FrameIndex frame_id, Scene& scene,
+                                        const glm::mat4& shadow_vp) {
+    // Drawn at full detail, as the LOD of casters changes with the camera
+    OUTCOME_TRY(ShadowPass(frame_id, scene, static_shadow_seq_, shadow_vp,
+                           true));
+
+    // Casters still uploading or waiting for their pipelines are skipped,
+    // as are draws whose uniforms did not fit, in which case the map is
+    // drawn again in a later frame
+    if (shadow_draws_recorded_ == static_shadow_seq_.size()) {
+        drawn_static_shadow_revisions_[frame_id] = static_shadow_revision_;
+    }
+    return outcome::success();
+}
+
 result<void> Renderer::ShadowPass(FrameIndex frame_id, Scene& scene,
-                                  const RenderSequence& render_seq,
-                                  const glm::mat4& shadow_vp) {
-    backend_->BindDepthStencilState(DepthStencilState{});
-    backend_->BindRasterizationState(RasterizationState{});
-    backend_->BindMultisampleState(MultisampleState{});
+                                  const RenderSequence& shadow_seq,
+                                  const glm::mat4& shadow_vp,
+                                  bool full_detail) {
+    PrepareBatches(
+        scene, shadow_seq.size(),
+        [&shadow_seq](size_t draw) { return shadow_seq[draw].item->mesh; },
+        &MeshPipelines::shadow, shadow_batches_);
+
+    // Opaque casters share a pipeline, so grouping batches by pipeline
+    // leaves them with no state changes in between
+    std::stable_sort(shadow_batches_.begin(), shadow_batches_.end(),
+                     [](const DrawBatch& a, const DrawBatch& b) {
+                         return std::less<const Pipeline*>()(a.pipeline,
+                                                             b.pipeline);
+                     });
+
+    auto position_format_res = GetPositionInputFormat();
+    if (!position_format_res) {
+        spdlog::error("Couldn't get the position input format.");
+        return position_format_res.error();
+    }
+    const auto& position_format = *position_format_res.value();
 
-    backend_->SetViewport({{2048.0f, 2048.0f}});
-    backend_->SetScissor({{2048, 2048}});
+    OUTCOME_TRY(uniform_buffer, GetUniformArenaBuffer());
+    auto uniform_base = frame_id * kUniformArenaSize;
+    auto uniform_start = uniform_arena_.used();
 
-    // Render meshes
-    AttachmentIndex<Mesh> last_mesh_id{0, 0};
-    Mesh* mesh{nullptr};
-    for (const auto& seq_entry : render_seq) {
-        auto mesh_id = seq_entry.mesh;
-        auto node_id = seq_entry.node;
-
-        if (mesh_id != last_mesh_id) {
-            auto mesh_res = scene.GetAttachment<Mesh>(mesh_id);
-            if (!mesh_res) {
-                spdlog::error("Couldn't find mesh {}.", mesh_id);
-                continue;
-            }
+    // Masked casters discard fragments below their alpha cutoff
+    struct FragUBO {
+        float alpha_cutoff;
+    };
 
-            mesh = &mesh_res.value().get();
-            last_mesh_id = mesh_id;
+    for (auto& batch : shadow_batches_) {
+        if (batch.material->alpha_cutoff < 1.0f) {
+            auto offset_res =
+                uniform_arena_.Push(FragUBO{batch.material->alpha_cutoff});
+            batch.frag_ubo_offset = offset_res ? offset_res.value() : 0;
+        }
+    }
 
-            // Bind the new mesh
-            auto material_result =
-                scene.GetAttachment<Material>(mesh->material);
-            if (!material_result) {
-                spdlog::error("Couldn't find material for mesh {}.",
-                              mesh->name);
-                continue;
-            }
-            auto& material = material_result.value().get();
+    auto depth_clamp = backend_->SupportsDepthClamp();
+    auto record_state = [depth_clamp](CommandStream& commands) {
+        commands.BindDepthStencilState(DepthStencilState{});
+        commands.BindMultisampleState(MultisampleState{});
 
-            auto pipeline_res = backend_->GetGraphicsPipeline(
-                {GOMA_ASSETS_DIR "shaders/shadow.vert",
-                 ShaderSourceType::Filename, GetVertexShaderPreamble(*mesh)});
-            if (!pipeline_res) {
-                spdlog::error("Couldn't get pipeline for the shadow pass.");
-                continue;
-            }
+        // Casters between the light and the near plane are flattened
+        // onto it, rather than clipped. Otherwise, the near plane has
+        // been pulled back.
+        RasterizationState rasterization_state{};
+        rasterization_state.depth_clamp = depth_clamp;
+        commands.BindRasterizationState(rasterization_state);
 
-            backend_->BindGraphicsPipeline(*pipeline_res.value());
+        commands.SetViewport({2048.0f, 2048.0f});
+        commands.SetScissor({2048, 2048});
+    };
 
-            backend_->BindVertexInputFormat(*mesh->vertex_input_format);
-            BindMeshBuffers(*mesh);
-            BindMaterialTextures(material);
+    auto record_batch = [&](CommandStream& commands, const DrawBatch& batch) {
+        const auto& mesh = *batch.mesh;
+        commands.BindGraphicsPipeline(*batch.pipeline);
+
+        if (batch.material->alpha_cutoff < 1.0f) {
+            commands.BindVertexInputFormat(*mesh.vertex_input_format);
+            BindMeshBuffers(commands, mesh);
+            BindMaterialTexture(commands, *batch.material,
+                                TextureType::Diffuse, 0);
+            commands.BindUniformBuffer(*uniform_buffer,
+                                       uniform_base + batch.frag_ubo_offset,
+                                       sizeof(FragUBO), 13);
+        } else {
+            commands.BindVertexInputFormat(position_format);
+            BindPositionBuffer(commands, mesh);
         }
+    };
 
-        // Draw the mesh node
-        auto model = scene.GetTransformMatrix(node_id).value();
-        glm::mat4 mvp = shadow_vp * model;
+    std::atomic<size_t> recorded{0};
+    auto record_draw = [&](CommandStream& commands, const DrawBatch& batch,
+                           size_t draw) {
+        const auto& item = *shadow_seq[draw].item;
 
-        auto vtx_ubo_res = backend_->GetUniformBuffer(
-            BufferType::PerNode, node_id, "shadow_vtx_ubo");
-        if (!vtx_ubo_res) {
-            vtx_ubo_res = backend_->CreateUniformBuffer(
-                BufferType::PerNode, node_id, "shadow_vtx_ubo", 3 * 256, false);
+        glm::mat4 mvp = shadow_vp * item.model;
+        auto offset_res = uniform_arena_.Push(mvp);
+        if (!offset_res) {
+            return;
         }
 
-        auto vtx_ubo = vtx_ubo_res.value();
+        commands.BindUniformBuffer(*uniform_buffer,
+                                   uniform_base + offset_res.value(),
+                                   sizeof(mvp), 12);
+        DrawMesh(commands, *batch.mesh, full_detail ? 0 : item.lod);
+        recorded++;
+    };
 
-        struct VtxUBO {
-            glm::mat4 mvp;
-            glm::mat4 model;
-            glm::mat4 normals;
-        };
-        VtxUBO vtx_ubo_data{std::move(mvp), model,
-                            glm::inverseTranspose(model)};
+    shadow_draws_recorded_ = 0;
+    OUTCOME_TRY(RecordBatches(shadow_batches_, shadow_commands_, record_state,
+                              record_batch, record_draw));
+    shadow_draws_recorded_ = recorded;
+    return FlushUniforms(frame_id, *uniform_buffer, uniform_start);
+}
+
+result<void> Renderer::DepthPrepass(FrameIndex frame_id, Scene& scene,
+                                    const RenderSequence& render_seq,
+                                    const glm::mat4& camera_vp) {
+    // The forward pass draws the same sequence, testing for equal depth
+    // where the pre-pass drew
+    PrepareBatches(
+        scene, render_seq.size(),
+        [&render_seq](size_t draw) { return render_seq[draw].item->mesh; },
+        &MeshPipelines::forward, depth_batches_);
+    prepass_draws_.assign(render_seq.size(), 0);
+
+    auto pipeline_res = backend_->GetGraphicsPipeline(
+        {GOMA_ASSETS_DIR "shaders/depth.vert", ShaderSourceType::Filename});
+    if (!pipeline_res) {
+        spdlog::error("Couldn't get pipeline for the depth pre-pass.");
+    }
+
+    auto position_format_res = GetPositionInputFormat();
+
+    // Masked materials discard fragments in pbr.frag, so they are left to
+    // the forward pass
+    auto skipped = [&](const DrawBatch& batch) {
+        return !pipeline_res || !position_format_res ||
+               !batch.mesh->buffers.position ||
+               batch.material->alpha_cutoff < 1.0f;
+    };
+    depth_batches_.erase(std::remove_if(depth_batches_.begin(),
+                                        depth_batches_.end(), skipped),
+                         depth_batches_.end());
+    for (auto& batch : depth_batches_) {
+        batch.pipeline = pipeline_res.value().get();
+    }
+
+    OUTCOME_TRY(uniform_buffer, GetUniformArenaBuffer());
+    auto uniform_base = frame_id * kUniformArenaSize;
+    auto uniform_start = uniform_arena_.used();
+
+    auto extent = GetRenderExtent();
+    auto w = extent.rounded_width();
+    auto h = extent.rounded_height();
 
-        backend_->UpdateBuffer(*vtx_ubo, frame_id * 256, sizeof(vtx_ubo_data),
-                               &vtx_ubo_data);
-        backend_->BindUniformBuffer(*vtx_ubo, frame_id * 256,
-                                    sizeof(vtx_ubo_data), 12);
+    uint32_t sample_count = 1;
+    auto image = backend_->render_plan().depth_images.find("depth");
+    if (image != backend_->render_plan().depth_images.end()) {
+        sample_count = image->second.samples;
+    }
+
+    auto record_state = [&](CommandStream& commands) {
+        commands.SetViewport({static_cast<float>(w), static_cast<float>(h)});
+        commands.SetScissor({w, h});
+
+        commands.BindDepthStencilState(DepthStencilState{});
+        commands.BindRasterizationState(RasterizationState{});
+        commands.BindMultisampleState(
+            MultisampleState{sample_count, sample_count > 1});
+    };
+
+    auto record_batch = [&](CommandStream& commands, const DrawBatch& batch) {
+        commands.BindGraphicsPipeline(*batch.pipeline);
+        commands.BindVertexInputFormat(*position_format_res.value());
+        BindPositionBuffer(commands, *batch.mesh);
+    };
+
+    // Sorted front to back, so that hidden fragments fail the depth test
+    auto record_draw = [&](CommandStream& commands, const DrawBatch& batch,
+                           size_t draw) {
+        const auto& seq_entry = render_seq[draw];
+        const auto& item = *seq_entry.item;
+
+        glm::mat4 mvp = camera_vp * item.model;
+        auto offset_res = uniform_arena_.Push(mvp);
+        if (!offset_res) {
+            return;
+        }
+        prepass_draws_[draw] = 1;
 
-        if (!mesh->indices.empty()) {
-            backend_->DrawIndexed(static_cast<uint32_t>(mesh->indices.size()));
+        commands.BindUniformBuffer(*uniform_buffer,
+                                   uniform_base + offset_res.value(),
+                                   sizeof(mvp), 12);
+
+        if (seq_entry.range_count > 0) {
+            DrawMeshRanges(commands, *batch.mesh,
+                           &visible_ranges_[seq_entry.first_range],
+                           seq_entry.range_count);
         } else {
-            backend_->Draw(static_cast<uint32_t>(mesh->vertices.size()));
+            DrawMesh(commands, *batch.mesh, item.lod);
         }
-    }
+    };
 
-    return outcome::success();
+    OUTCOME_TRY(RecordBatches(depth_batches_, depth_commands_, record_state,
+                              record_batch, record_draw));
+    return FlushUniforms(frame_id, *uniform_buffer, uniform_start);
 }
 
 result<void> Renderer::ForwardPass(FrameIndex frame_id, Scene& scene,
@@ -820,146 +914,112 @@ result<void> Renderer::ForwardPass(FrameIndex frame_id, Scene& scene,
                                    const glm::vec3& camera_ws_pos,
                                    const glm::mat4& camera_vp,
                                    const glm::mat4& shadow_vp) {
-    uint32_t sample_count = 1;
-    auto image = backend_->render_plan().color_images.find("color");
-    if (image != backend_->render_plan().color_images.end()) {
-        sample_count = image->second.samples;
+    PrepareBatches(
+        scene, render_seq.size(),
+        [&render_seq](size_t draw) { return render_seq[draw].item->mesh; },
+        &MeshPipelines::forward, forward_batches_);
+
+    OUTCOME_TRY(uniform_buffer, GetUniformArenaBuffer());
+    auto uniform_base = frame_id * kUniformArenaSize;
+    auto uniform_start = uniform_arena_.used();
+
+    // Look up the resources shared by all draws, as worker threads
+    // can only use existing ones
+    auto shadow_depth_res = backend_->GetRenderTarget(frame_id, kShadowDepth);
+    if (!shadow_depth_res) {
+        spdlog::error("Couldn't get the shadow map.");
+        forward_batches_.clear();
     }
 
-    auto w = engine_.platform().GetWidth();
-    auto h = engine_.platform().GetHeight();
-    backend_->SetViewport({{static_cast<float>(w), static_cast<float>(h)}});
-    backend_->SetScissor({{w, h}});
-
-    backend_->BindDepthStencilState(DepthStencilState{});
-    backend_->BindRasterizationState(RasterizationState{});
-    backend_->BindMultisampleState(
-        MultisampleState{sample_count, sample_count > 1});
+    auto brdf_res = backend_->GetTexture(kBrdfLut);
+    if (!brdf_res) {
+        spdlog::error("Couldn't get the BRDF LUT.");
+        forward_batches_.clear();
+    }
 
     constexpr auto padded_light_size =
         (sizeof(LightBufferData) / 256 + 1) * 256;
-    auto light_buffer_res = backend_->GetUniformBuffer("lights");
-    if (light_buffer_res) {
-        backend_->BindUniformBuffer(*light_buffer_res.value(),
-                                    frame_id * padded_light_size,
-                                    sizeof(LightBufferData), 15);
-    }
-
-    // Render meshes
-    AttachmentIndex<Mesh> last_mesh_id{0, 0};
-    Mesh* mesh{nullptr};
-    for (const auto& seq_entry : render_seq) {
-        auto mesh_id = seq_entry.mesh;
-        auto node_id = seq_entry.node;
-
-        if (mesh_id != last_mesh_id) {
-            auto mesh_res = scene.GetAttachment<Mesh>(mesh_id);
-            if (!mesh_res) {
-                spdlog::error("Couldn't find mesh {}.", mesh_id);
-                continue;
-            }
-
-            mesh = &mesh_res.value().get();
-            last_mesh_id = mesh_id;
-
-            // Bind the new mesh
-            auto material_result =
-                scene.GetAttachment<Material>(mesh->material);
-            if (!material_result) {
-                spdlog::error("Couldn't find material for mesh {}.",
-                              mesh->name);
-                continue;
-            }
-            auto& material = material_result.value().get();
-
-            auto pipeline_res = backend_->GetGraphicsPipeline(
-                {GOMA_ASSETS_DIR "shaders/pbr.vert", ShaderSourceType::Filename,
-                 GetVertexShaderPreamble(*mesh)},
-                {GOMA_ASSETS_DIR "shaders/pbr.frag", ShaderSourceType::Filename,
-                 GetFragmentShaderPreamble(*mesh, material)});
-            if (!pipeline_res) {
-                spdlog::error("Couldn't get pipeline for material {}.",
-                              material.name);
-                continue;
-            }
+    auto light_buffer_res = backend_->GetUniformBuffer(kLightsBuffer);
+
+    struct FragUBO {
+        float exposure;
+        float gamma;
+        float metallic;
+        float roughness;
+        glm::vec4 base_color;
+        glm::vec3 camera;
+        float alpha_cutoff;
+        float reflection_mip_count;
+        float ibl_strength;
+    };
 
-            backend_->BindGraphicsPipeline(*pipeline_res.value());
+    for (auto& batch : forward_batches_) {
+        const auto& material = *batch.material;
+        FragUBO frag_ubo_data{4.5f,
+                              2.2f,
+                              material.metallic_factor,
+                              material.roughness_factor,
+                              {material.diffuse_color, 1.0f},
+                              camera_ws_pos,
+                              material.alpha_cutoff,
+                              static_cast<float>(skybox_mip_count),
+                              0.4f};
+
+        auto offset_res = uniform_arena_.Push(frag_ubo_data);
+        batch.frag_ubo_offset = offset_res ? offset_res.value() : 0;
+    }
 
-            backend_->BindVertexInputFormat(*mesh->vertex_input_format);
-            BindMeshBuffers(*mesh);
-            BindMaterialTextures(material);
+    auto extent = GetRenderExtent();
+    auto w = extent.rounded_width();
+    auto h = extent.rounded_height();
 
-            auto shadow_depth_res =
-                backend_->GetRenderTarget(frame_id, "shadow_depth");
-            if (!shadow_depth_res) {
-                spdlog::error("Couldn't get the shadow map.");
-                continue;
-            }
-            backend_->BindTexture(*shadow_depth_res.value(), 14);
+    uint32_t sample_count = 1;
+    auto image = backend_->render_plan().color_images.find("color");
+    if (image != backend_->render_plan().color_images.end()) {
+        sample_count = image->second.samples;
+    }
 
-            auto brdf_res = backend_->GetTexture("brdf_lut");
-            if (!shadow_depth_res) {
-                spdlog::error("Couldn't get the BRDF LUT.");
-                continue;
-            }
-            backend_->BindTexture(*brdf_res.value(), 16);
+    auto record_state = [&](CommandStream& commands) {
+        commands.SetViewport({static_cast<float>(w), static_cast<float>(h)});
+        commands.SetScissor({w, h});
 
-            auto frag_ubo_res = backend_->GetUniformBuffer(BufferType::PerNode,
-                                                           node_id, "frag_ubo");
-            if (!frag_ubo_res) {
-                frag_ubo_res = backend_->CreateUniformBuffer(
-                    BufferType::PerNode, node_id, "frag_ubo", 3 * 256, false);
-            }
+        commands.BindDepthStencilState(DepthStencilState{});
+        commands.BindRasterizationState(RasterizationState{});
+        commands.BindMultisampleState(
+            MultisampleState{sample_count, sample_count > 1});
 
-            auto frag_ubo = frag_ubo_res.value();
-
-            struct FragUBO {
-                float exposure;
-                float gamma;
-                float metallic;
-                float roughness;
-                glm::vec4 base_color;
-                glm::vec3 camera;
-                float alpha_cutoff;
-                float reflection_mip_count;
-                float ibl_strength;
-            };
-            FragUBO frag_ubo_data{4.5f,
-                                  2.2f,
-                                  material.metallic_factor,
-                                  material.roughness_factor,
-                                  {material.diffuse_color, 1.0f},
-                                  camera_ws_pos,
-                                  material.alpha_cutoff,
-                                  static_cast<float>(skybox_mip_count),
-                                  0.4f};
-
-            backend_->UpdateBuffer(*frag_ubo, frame_id * 256,
-                                   sizeof(frag_ubo_data), &frag_ubo_data);
-            backend_->BindUniformBuffer(*frag_ubo, frame_id * 256,
-                                        sizeof(frag_ubo_data), 13);
+        if (light_buffer_res) {
+            commands.BindUniformBuffer(*light_buffer_res.value(),
+                                       frame_id * padded_light_size,
+                                       sizeof(LightBufferData), 15);
         }
+    };
 
-        // Draw the mesh node
-        auto model = scene.GetTransformMatrix(node_id).value();
-        glm::mat4 mvp = camera_vp * model;
-
-        // Shadow correction maps X and Y for the shadow MVP
-        // to the range [0, 1], useful to sample from the shadow map
-        const glm::mat4 shadow_correction = {{0.5f, 0.0f, 0.0f, 0.0f},
-                                             {0.0f, 0.5f, 0.0f, 0.0f},
-                                             {0.0f, 0.0f, 1.0f, 0.0f},
-                                             {0.5f, 0.5f, 0.0f, 1.0f}};
-        glm::mat4 shadow_mvp = shadow_correction * shadow_vp * model;
-
-        auto vtx_ubo_res =
-            backend_->GetUniformBuffer(BufferType::PerNode, node_id, "vtx_ubo");
-        if (!vtx_ubo_res) {
-            vtx_ubo_res = backend_->CreateUniformBuffer(
-                BufferType::PerNode, node_id, "vtx_ubo", 3 * 256, false);
-        }
+    auto record_batch = [&](CommandStream& commands, const DrawBatch& batch) {
+        commands.BindGraphicsPipeline(*batch.pipeline);
+        commands.BindVertexInputFormat(*batch.mesh->vertex_input_format);
+        BindMeshBuffers(commands, *batch.mesh);
+        BindMaterialTextures(commands, *batch.material);
+
+        commands.BindTexture(*shadow_depth_res.value(), 14);
+        commands.BindTexture(*brdf_res.value(), 16);
+        commands.BindUniformBuffer(*uniform_buffer,
+                                   uniform_base + batch.frag_ubo_offset,
+                                   sizeof(FragUBO), 13);
+    };
 
-        auto vtx_ubo = vtx_ubo_res.value();
+    // Shadow correction maps X and Y for the shadow MVP
+    // to the range [0, 1], useful to sample from the shadow map
+    const glm::mat4 shadow_correction = {{0.5f, 0.0f, 0.0f, 0.0f},
+                                         {0.0f, 0.5f, 0.0f, 0.0f},
+                                         {0.0f, 0.0f, 1.0f, 0.0f},
+                                         {0.5f, 0.5f, 0.0f, 1.0f}};
+    const glm::mat4 shadow_vp_corrected = shadow_correction * shadow_vp;
+
+    auto record_draw = [&](CommandStream& commands, const DrawBatch& batch,
+                           size_t draw) {
+        const auto& seq_entry = render_seq[draw];
+        const auto& item = *seq_entry.item;
 
         struct VtxUBO {
             glm::mat4 mvp;
@@ -967,22 +1027,51 @@ result<void> Renderer::ForwardPass(FrameIndex frame_id, Scene& scene,
             glm::mat4 normals;
             glm::mat4 shadow_mvp;
         };
-        VtxUBO vtx_ubo_data{std::move(mvp), model, glm::inverseTranspose(model),
-                            std::move(shadow_mvp)};
+        VtxUBO vtx_ubo_data{camera_vp * item.model, item.model, item.normals,
+                            shadow_vp_corrected * item.model};
 
-        backend_->UpdateBuffer(*vtx_ubo, frame_id * 256, sizeof(vtx_ubo_data),
-                               &vtx_ubo_data);
-        backend_->BindUniformBuffer(*vtx_ubo, frame_id * 256,
-                                    sizeof(vtx_ubo_data), 12);
+        auto offset_res = uniform_arena_.Push(vtx_ubo_data);
+        if (!offset_res) {
+            return;
+        }
 
-        if (!mesh->indices.empty()) {
-            backend_->DrawIndexed(static_cast<uint32_t>(mesh->indices.size()));
+        // Only the closest fragments, as found by the pre-pass, are
+        // shaded. Draws that it skipped or failed test as usual.
+        commands.BindDepthStencilState(
+            draw < prepass_draws_.size() && prepass_draws_[draw]
+                ? DepthStencilState{true, false, CompareOp::Equal}
+                : DepthStencilState{});
+
+        commands.BindUniformBuffer(*uniform_buffer,
+                                   uniform_base + offset_res.value(),
+                                   sizeof(vtx_ubo_data), 12);
+
+        if (seq_entry.range_count > 0) {
+            DrawMeshRanges(commands, *batch.mesh,
+                           &visible_ranges_[seq_entry.first_range],
+                           seq_entry.range_count);
         } else {
-            backend_->Draw(static_cast<uint32_t>(mesh->vertices.size()));
+            DrawMesh(commands, *batch.mesh, item.lod);
         }
-    }
+    };
+
+    OUTCOME_TRY(RecordBatches(forward_batches_, forward_commands_,
+                              record_state, record_batch, record_draw));
+    OUTCOME_TRY(FlushUniforms(frame_id, *uniform_buffer, uniform_start));
 
-    // Draw skybox
+    // Meshes are still drawn if the skybox is missing
+    auto& commands = forward_commands_[0];
+    commands.Clear();
+    record_state(commands);
+
+    auto skybox_res = RecordSkybox(commands, frame_id, scene, camera_vp);
+    OUTCOME_TRY(backend_->ExecuteCommands(commands));
+    return skybox_res;
+}
+
+result<void> Renderer::RecordSkybox(CommandStream& commands,
+                                    FrameIndex frame_id, Scene& scene,
+                                    const glm::mat4& camera_vp) {
     auto pipeline_res = backend_->GetGraphicsPipeline(
         {GOMA_ASSETS_DIR "shaders/skybox.vert", ShaderSourceType::Filename},
         {GOMA_ASSETS_DIR "shaders/skybox.frag", ShaderSourceType::Filename});
@@ -998,38 +1087,44 @@ result<void> Renderer::ForwardPass(FrameIndex frame_id, Scene& scene,
     }
     auto& sphere = sphere_res.value().second.get();
 
-    backend_->BindGraphicsPipeline(*pipeline_res.value());
-    backend_->BindVertexInputFormat(*sphere.vertex_input_format);
-    BindMeshBuffers(sphere);
-
-    // Set depth clamp to 1.0f and depth test to Equal
-    backend_->BindDepthStencilState({true, false, CompareOp::Equal});
-    backend_->BindRasterizationState(
-        RasterizationState{true, false, PolygonMode::Fill, CullMode::None});
-    backend_->SetViewport(
-        {{float(engine_.platform().GetWidth()),
-          float(engine_.platform().GetHeight()), 0.0f, 0.0f, 1.0f, 1.0f}});
-
-    auto skybox_tex_res = backend_->GetTexture("goma_skybox");
+    auto skybox_tex_res = backend_->GetTexture(kSkyboxTexture);
     if (!skybox_tex_res) {
         spdlog::error("Couldn't get skybox texture.");
         return Error::NotFound;
     }
 
-    auto skybox_ubo_res = backend_->GetUniformBuffer("skybox");
+    if (!IsUploadComplete(scene, sphere) ||
+        !backend_->IsUploadComplete(skybox_tex_res.value()->upload_ticket)) {
+        return outcome::success();
+    }
+
+    commands.BindGraphicsPipeline(*pipeline_res.value());
+    commands.BindVertexInputFormat(*sphere.vertex_input_format);
+    BindMeshBuffers(commands, sphere);
+
+    // Set depth clamp to 1.0f and depth test to Equal
+    commands.BindDepthStencilState({true, false, CompareOp::Equal});
+    commands.BindRasterizationState(
+        RasterizationState{true, false, PolygonMode::Fill, CullMode::None});
+    auto extent = GetRenderExtent();
+    commands.SetViewport({float(extent.rounded_width()),
+                          float(extent.rounded_height()), 0.0f, 0.0f, 1.0f,
+                          1.0f});
+
+    auto skybox_ubo_res = backend_->GetUniformBuffer(kSkyboxBuffer);
     if (!skybox_ubo_res) {
         skybox_ubo_res =
-            backend_->CreateUniformBuffer("skybox", 3 * 256, false);
+            backend_->CreateUniformBuffer(kSkyboxBuffer, 3 * 256, false);
     }
     auto skybox_ubo = skybox_ubo_res.value();
 
-    backend_->UpdateBuffer(*skybox_ubo, frame_id * 256, sizeof(camera_vp),
-                           &camera_vp);
-    backend_->BindUniformBuffer(*skybox_ubo, frame_id * 256, sizeof(camera_vp),
-                                12);
+    commands.UpdateBuffer(*skybox_ubo, frame_id * 256, sizeof(camera_vp),
+                          &camera_vp);
+    commands.BindUniformBuffer(*skybox_ubo, frame_id * 256, sizeof(camera_vp),
+                               12);
 
-    backend_->BindTexture(skybox_tex_res.value()->vez, 0);
-    backend_->DrawIndexed(static_cast<uint32_t>(sphere.indices.size()));
+    commands.BindTexture(*skybox_tex_res.value(), 0);
+    DrawMesh(commands, sphere);
 
     return outcome::success();
 }
@@ -1056,9 +1151,15 @@ result<void> Renderer::DownscalePass(FrameIndex frame_id,
     }
 
     auto extent = backend_->GetAbsoluteExtent(dst_desc_res->second.extent);
-    backend_->SetViewport({{extent.width, extent.height}});
-    backend_->SetScissor({{static_cast<uint32_t>(extent.width),
-                           static_cast<uint32_t>(extent.height)}});
+
+    // Only the part of the target at the current render scale is used
+    auto scale = backend_->render_scale();
+    auto scaled_extent = Extent{extent.width * scale, extent.height * scale,
+                                ExtentType::Absolute};
+    backend_->SetViewport({{float(scaled_extent.rounded_width()),
+                            float(scaled_extent.rounded_height())}});
+    backend_->SetScissor(
+        {{scaled_extent.rounded_width(), scaled_extent.rounded_height()}});
 
     backend_->BindDepthStencilState(DepthStencilState{});
     backend_->BindRasterizationState(RasterizationState{});
@@ -1074,22 +1175,29 @@ result<void> Renderer::DownscalePass(FrameIndex frame_id,
         spdlog::error("Couldn't get pipeline for downscaling!");
     }
 
-    auto ubo_name = "downscale_" + std::to_string(downscale_index_++);
-    auto downscale_ubo_res = backend_->GetUniformBuffer(ubo_name.c_str());
+    auto ubo_name = kDownscaleBuffer.WithIndex(downscale_index_++);
+    auto downscale_ubo_res = backend_->GetUniformBuffer(ubo_name);
     if (!downscale_ubo_res) {
         downscale_ubo_res =
-            backend_->CreateUniformBuffer(ubo_name.c_str(), 3 * 256, false);
+            backend_->CreateUniformBuffer(ubo_name, 3 * 256, false);
     }
     auto downscale_ubo = downscale_ubo_res.value();
 
     struct DownscaleUbo {
         glm::vec2 half_pixel;
+        glm::vec2 uv_scale;
+        glm::vec2 uv_max;
     } ubo_data;
 
     auto src_extent = backend_->GetAbsoluteExtent(src_desc_res->second.extent);
     ubo_data.half_pixel = {1.0f / (2 * extent.width),
                            1.0f / (2 * extent.height)};
 
+    // Samples stay within the rendered part of the source
+    ubo_data.uv_scale = glm::vec2(scale);
+    ubo_data.uv_max = {scale - 0.5f / src_extent.width,
+                       scale - 0.5f / src_extent.height};
+
     backend_->UpdateBuffer(*downscale_ubo, frame_id * 256, sizeof(ubo_data),
                            &ubo_data);
     backend_->BindUniformBuffer(*downscale_ubo, frame_id * 256,
@@ -1123,9 +1231,15 @@ result<void> Renderer::UpscalePass(FrameIndex frame_id, const std::string& src,
     }
 
     auto extent = backend_->GetAbsoluteExtent(dst_desc_res->second.extent);
-    backend_->SetViewport({{extent.width, extent.height}});
-    backend_->SetScissor({{static_cast<uint32_t>(extent.width),
-                           static_cast<uint32_t>(extent.height)}});
+
+    // Only the part of the target at the current render scale is used
+    auto scale = backend_->render_scale();
+    auto scaled_extent = Extent{extent.width * scale, extent.height * scale,
+                                ExtentType::Absolute};
+    backend_->SetViewport({{float(scaled_extent.rounded_width()),
+                            float(scaled_extent.rounded_height())}});
+    backend_->SetScissor(
+        {{scaled_extent.rounded_width(), scaled_extent.rounded_height()}});
 
     backend_->BindDepthStencilState(DepthStencilState{});
     backend_->BindRasterizationState(RasterizationState{});
@@ -1141,22 +1255,29 @@ result<void> Renderer::UpscalePass(FrameIndex frame_id, const std::string& src,
         spdlog::error("Couldn't get pipeline for upscaling!");
     }
 
-    auto ubo_name = "upscale_" + std::to_string(upscale_index_++);
-    auto upscale_ubo_res = backend_->GetUniformBuffer(ubo_name.c_str());
+    auto ubo_name = kUpscaleBuffer.WithIndex(upscale_index_++);
+    auto upscale_ubo_res = backend_->GetUniformBuffer(ubo_name);
     if (!upscale_ubo_res) {
         upscale_ubo_res =
-            backend_->CreateUniformBuffer(ubo_name.c_str(), 3 * 256, false);
+            backend_->CreateUniformBuffer(ubo_name, 3 * 256, false);
     }
     auto upscale_ubo = upscale_ubo_res.value();
 
     struct UpscaleUbo {
         glm::vec2 half_pixel;
+        glm::vec2 uv_scale;
+        glm::vec2 uv_max;
     } ubo_data;
 
     auto src_extent = backend_->GetAbsoluteExtent(src_desc_res->second.extent);
     ubo_data.half_pixel = {1.0f / (2 * extent.width),
                            1.0f / (2 * extent.height)};
 
+    // Samples stay within the rendered part of the source
+    ubo_data.uv_scale = glm::vec2(scale);
+    ubo_data.uv_max = {scale - 0.5f / src_extent.width,
+                       scale - 0.5f / src_extent.height};
+
     backend_->UpdateBuffer(*upscale_ubo, frame_id * 256, sizeof(ubo_data),
                            &ubo_data);
     backend_->BindUniformBuffer(*upscale_ubo, frame_id * 256, sizeof(ubo_data),
@@ -1175,17 +1296,17 @@ result<void> Renderer::PostprocessingPass(FrameIndex frame_id) {
     }
 
     auto resolved_image_res =
-        backend_->GetRenderTarget(frame_id, "resolved_image");
+        backend_->GetRenderTarget(frame_id, kResolvedImage);
     if (!resolved_image_res) {
         spdlog::error("Couldn't get the resolved image.");
     }
 
-    auto blur_full_res = backend_->GetRenderTarget(frame_id, "blur_full");
+    auto blur_full_res = backend_->GetRenderTarget(frame_id, kBlurFull);
     if (!blur_full_res) {
         spdlog::error("Couldn't get the blur image.");
     }
 
-    auto depth_res = backend_->GetRenderTarget(frame_id, "depth");
+    auto depth_res = backend_->GetRenderTarget(frame_id, kDepth);
     if (!depth_res) {
         spdlog::error("Couldn't get the resolved depth image.");
     }
@@ -1194,6 +1315,7 @@ result<void> Renderer::PostprocessingPass(FrameIndex frame_id) {
     auto resolved_image = resolved_image_res.value();
     auto depth = depth_res.value();
 
+    // Upscales from the render scale to the whole swapchain
     auto w = engine_.platform().GetWidth();
     auto h = engine_.platform().GetHeight();
     backend_->SetViewport({{static_cast<float>(w), static_cast<float>(h)}});
@@ -1221,10 +1343,10 @@ result<void> Renderer::PostprocessingPass(FrameIndex frame_id) {
     backend_->BindTexture(blur_full->vez, 1);
     backend_->BindTexture(depth->vez, 2);
 
-    constexpr auto ubo_name = "postprocessing";
-    auto ubo_res = backend_->GetUniformBuffer(ubo_name);
+    auto ubo_res = backend_->GetUniformBuffer(kPostprocessingBuffer);
     if (!ubo_res) {
-        ubo_res = backend_->CreateUniformBuffer(ubo_name, 3 * 256, false);
+        ubo_res = backend_->CreateUniformBuffer(kPostprocessingBuffer,
+                                                3 * 256, false);
     }
     auto ubo = ubo_res.value();
 
@@ -1236,12 +1358,19 @@ result<void> Renderer::PostprocessingPass(FrameIndex frame_id) {
 
         float near_plane;
         float far_plane;
+
+        glm::vec2 uv_scale;
+        glm::vec2 uv_max;
     };
 
     OUTCOME_TRY(camera_ref,
                 scene->GetAttachment<Camera>(engine_.main_camera()));
     auto& camera = camera_ref.get();
 
+    // Samples stay within the rendered part of the targets
+    auto scale = backend_->render_scale();
+    auto uv_max = glm::vec2(scale) - 0.5f / glm::vec2(float(w), float(h));
+
     auto ubo_data = PostprocessingUbo{
         50.0f,   // focus_distance
         200.0f,  // focus_range
@@ -1250,6 +1379,9 @@ result<void> Renderer::PostprocessingPass(FrameIndex frame_id) {
 
         camera.near_plane,  // near_plane
         camera.far_plane,   // far_plane
+
+        glm::vec2(scale),  // uv_scale
+        uv_max,            // uv_max
     };
 
     backend_->UpdateBuffer(*ubo, frame_id * 256, sizeof(ubo_data), &ubo_data);
@@ -1267,43 +1399,13 @@ const char* Renderer::GetVertexShaderPreamble(
     if (res != vs_preamble_map_.end()) {
         return res->second.c_str();
     } else {
-        std::stringstream preamble;
-
-        if (desc.has_positions) {
-            preamble << "#define HAS_POSITIONS\n";
-        }
-        if (desc.has_normals) {
-            preamble << "#define HAS_NORMALS\n";
-        }
-        if (desc.has_tangents) {
-            preamble << "#define HAS_TANGENTS\n";
-        }
-        if (desc.has_bitangents) {
-            preamble << "#define HAS_BITANGENTS\n";
-        }
-        if (desc.has_colors) {
-            preamble << "#define HAS_COLORS\n";
-        }
-        if (desc.has_uv0) {
-            preamble << "#define HAS_UV0\n";
-        }
-        if (desc.has_uv1) {
-            preamble << "#define HAS_UV1\n";
-        }
-        if (desc.has_uvw) {
-            preamble << "#define HAS_UVW\n";
-        }
-
-        vs_preamble_map_[desc.int_repr] = preamble.str();
+        vs_preamble_map_[desc.int_repr] = BuildVertexShaderPreamble(desc);
         return vs_preamble_map_[desc.int_repr].c_str();
     }
 }
 
 const char* Renderer::GetVertexShaderPreamble(const Mesh& mesh) {
-    return GetVertexShaderPreamble(VertexShaderPreambleDesc{
-        !mesh.vertices.empty(), !mesh.normals.empty(), !mesh.tangents.empty(),
-        !mesh.bitangents.empty(), !mesh.colors.empty(), mesh.uv_sets.size() > 0,
-        mesh.uv_sets.size() > 1, mesh.uvw_sets.size() > 0});
+    return GetVertexShaderPreamble(GetVertexShaderPreambleDesc(mesh));
 }
 
 const char* Renderer::GetFragmentShaderPreamble(
@@ -1313,143 +1415,357 @@ const char* Renderer::GetFragmentShaderPreamble(
     if (res != fs_preamble_map_.end()) {
         return res->second.c_str();
     } else {
-        std::stringstream preamble;
+        fs_preamble_map_[desc.int_repr] = BuildFragmentShaderPreamble(desc);
+        return fs_preamble_map_[desc.int_repr].c_str();
+    }
+}
 
-        // Mesh
-        if (desc.has_positions) {
-            preamble << "#define HAS_POSITIONS\n";
-        }
-        if (desc.has_normals) {
-            preamble << "#define HAS_NORMALS\n";
-        }
-        if (desc.has_tangents) {
-            preamble << "#define HAS_TANGENTS\n";
-        }
-        if (desc.has_bitangents) {
-            preamble << "#define HAS_BITANGENTS\n";
-        }
-        if (desc.has_colors) {
-            preamble << "#define HAS_COLORS\n";
-        }
-        if (desc.has_uv0) {
-            preamble << "#define HAS_UV0\n";
-        }
-        if (desc.has_uv1) {
-            preamble << "#define HAS_UV1\n";
-        }
-        if (desc.has_uvw) {
-            preamble << "#define HAS_UVW\n";
-        }
+const char* Renderer::GetFragmentShaderPreamble(const Mesh& mesh,
+                                                const Material& material) {
+    return GetFragmentShaderPreamble(GetFragmentShaderPreambleDesc(
+        mesh, material, backend_->GetTexture(kSkyboxTexture).has_value()));
+}
 
-        // Material
-        if (desc.has_diffuse_map) {
-            preamble << "#define HAS_DIFFUSE_MAP\n";
-        }
-        if (desc.has_specular_map) {
-            preamble << "#define HAS_SPECULAR_MAP\n";
-        }
-        if (desc.has_ambient_map) {
-            preamble << "#define HAS_AMBIENT_MAP\n";
-        }
-        if (desc.has_emissive_map) {
-            preamble << "#define HAS_EMISSIVE_MAP\n";
-        }
-        if (desc.has_metallic_roughness_map) {
-            preamble << "#define HAS_METALLIC_ROUGHNESS_MAP\n";
+bool Renderer::IsUploadComplete(Scene& scene, const Mesh& mesh) {
+    if (!backend_->IsUploadComplete(mesh.buffers.upload_ticket)) {
+        return false;
+    }
+
+    auto material_res = scene.GetAttachment<Material>(mesh.material);
+    if (!material_res) {
+        return true;
+    }
+
+    for (const auto& binding : material_res.value().get().texture_bindings) {
+        if (binding.second.empty()) {
+            continue;
         }
-        if (desc.has_height_map) {
-            preamble << "#define HAS_HEIGHT_MAP\n";
+
+        auto texture_res =
+            scene.GetAttachment<Texture>(binding.second[0].index);
+        if (texture_res) {
+            const auto& image = texture_res.value().get().image;
+            if (image && !backend_->IsUploadComplete(image->upload_ticket)) {
+                return false;
+            }
         }
-        if (desc.has_normal_map) {
-            preamble << "#define HAS_NORMAL_MAP\n";
+    }
+
+    return true;
+}
+
+void Renderer::PrepareBatches(Scene& scene, size_t draw_count,
+                              const MeshIndexFn& get_mesh,
+                              PipelineId MeshPipelines::*pipeline,
+                              std::vector<DrawBatch>& batches) {
+    batches.clear();
+
+    AttachmentIndex<Mesh> last_mesh_id{0, 0};
+    bool skipping{false};
+    for (size_t draw = 0; draw < draw_count; draw++) {
+        auto mesh_id = get_mesh(draw);
+        if (draw > 0 && mesh_id == last_mesh_id) {
+            if (!skipping) {
+                batches.back().draw_count++;
+            }
+            continue;
         }
-        if (desc.has_shininess_map) {
-            preamble << "#define HAS_SHININESS_MAP\n";
+
+        last_mesh_id = mesh_id;
+        skipping = true;
+
+        auto mesh_res = scene.GetAttachment<Mesh>(mesh_id);
+        if (!mesh_res) {
+            spdlog::error("Couldn't find mesh {}.", mesh_id);
+            continue;
         }
-        if (desc.has_opacity_map) {
-            preamble << "#define HAS_OPACITY_MAP\n";
+        auto& mesh = mesh_res.value().get();
+
+        if (!IsUploadComplete(scene, mesh)) {
+            // Still streaming in, skip it for now
+            continue;
         }
-        if (desc.has_displacement_map) {
-            preamble << "#define HAS_DISPLACEMENT_MAP\n";
+
+        auto material_res = scene.GetAttachment<Material>(mesh.material);
+        if (!material_res) {
+            spdlog::error("Couldn't find material for mesh {}.", mesh.name);
+            continue;
         }
-        if (desc.has_light_map) {
-            preamble << "#define HAS_LIGHT_MAP\n";
+        auto& material = material_res.value().get();
+
+        const auto& mesh_pipelines =
+            GetMeshPipelines(scene, mesh_id, mesh, material);
+        auto batch_pipeline = pipeline_table_.Get(mesh_pipelines.*pipeline);
+        if (!batch_pipeline) {
+            continue;
         }
-        if (desc.has_reflection_map) {
-            preamble << "#define HAS_REFLECTION_MAP\n";
+
+        batches.push_back({&mesh, &material, batch_pipeline, draw, 1});
+        skipping = false;
+    }
+}
+
+const Renderer::MeshPipelines& Renderer::GetMeshPipelines(
+    Scene& scene, AttachmentIndex<Mesh> mesh_id, const Mesh& mesh,
+    const Material& material) {
+    if (mesh_pipelines_.size() <= mesh_id.id) {
+        mesh_pipelines_.resize(mesh_id.id + 1);
+    }
+    auto& mesh_pipelines = mesh_pipelines_[mesh_id.id];
+
+    // Only called on validated ids
+    auto mesh_revision = scene.GetAttachments<Mesh>()[mesh_id.id].revision;
+    auto material_revision =
+        scene.GetAttachments<Material>()[mesh.material.id].revision;
+
+    if (mesh_pipelines.mesh != mesh_id ||
+        mesh_pipelines.mesh_revision != mesh_revision ||
+        mesh_pipelines.material_revision != material_revision ||
+        mesh_pipelines.generation != pipeline_table_.generation()) {
+        mesh_pipelines.mesh = mesh_id;
+        mesh_pipelines.mesh_revision = mesh_revision;
+        mesh_pipelines.material_revision = material_revision;
+        mesh_pipelines.generation = pipeline_table_.generation();
+
+        mesh_pipelines.shadow = kInvalidPipelineId;
+        mesh_pipelines.forward = kInvalidPipelineId;
+        mesh_pipelines.shadow_pending = true;
+        mesh_pipelines.forward_pending = true;
+    }
+
+    if (!mesh_pipelines.shadow_pending && !mesh_pipelines.forward_pending) {
+        return mesh_pipelines;
+    }
+
+    // Failures are not retried until something changes,
+    // so they are only reported once
+    auto vs_preamble = GetVertexShaderPreamble(mesh);
+
+    if (mesh_pipelines.shadow_pending) {
+        // Opaque casters only need positions, so they share a pipeline
+        auto shadow_res =
+            material.alpha_cutoff < 1.0f
+                ? backend_->RequestGraphicsPipeline(
+                      {GOMA_ASSETS_DIR "shaders/shadow.vert",
+                       ShaderSourceType::Filename, vs_preamble},
+                      {GOMA_ASSETS_DIR "shaders/shadow.frag",
+                       ShaderSourceType::Filename,
+                       GetFragmentShaderPreamble(mesh, material)})
+                : backend_->RequestGraphicsPipeline(
+                      {GOMA_ASSETS_DIR "shaders/depth.vert",
+                       ShaderSourceType::Filename});
+        if (!shadow_res) {
+            spdlog::error("Couldn't get pipeline for the shadow pass.");
+            mesh_pipelines.shadow_pending = false;
+        } else if (shadow_res.value()) {
+            mesh_pipelines.shadow = pipeline_table_.Add(shadow_res.value());
+            mesh_pipelines.shadow_pending = false;
         }
-        if (desc.alpha_mask) {
-            preamble << "#define ALPHAMODE_MASK\n";
+    }
+
+    if (mesh_pipelines.forward_pending) {
+        auto forward_res = backend_->RequestGraphicsPipeline(
+            {GOMA_ASSETS_DIR "shaders/pbr.vert", ShaderSourceType::Filename,
+             vs_preamble},
+            {GOMA_ASSETS_DIR "shaders/pbr.frag", ShaderSourceType::Filename,
+             GetFragmentShaderPreamble(mesh, material)});
+        if (!forward_res) {
+            spdlog::error("Couldn't get pipeline for material {}.",
+                          material.name);
+            mesh_pipelines.forward = kInvalidPipelineId;
+            mesh_pipelines.forward_pending = false;
+        } else if (forward_res.value()) {
+            mesh_pipelines.forward = pipeline_table_.Add(forward_res.value());
+            mesh_pipelines.forward_pending = false;
+        } else {
+            mesh_pipelines.forward = GetFallbackPipeline(mesh, vs_preamble);
         }
+    }
 
-        fs_preamble_map_[desc.int_repr] = preamble.str();
-        return fs_preamble_map_[desc.int_repr].c_str();
+    return mesh_pipelines;
+}
+
+PipelineId Renderer::GetFallbackPipeline(const Mesh& mesh,
+                                         const char* vs_preamble) {
+    if (fallback_generation_ != pipeline_table_.generation()) {
+        fallback_pipelines_.clear();
+        fallback_generation_ = pipeline_table_.generation();
+    }
+
+    auto result = fallback_pipelines_.find(vs_preamble);
+    if (result != fallback_pipelines_.end()) {
+        return result->second;
+    }
+
+    // Also compiled in the background, draws are skipped meanwhile
+    auto fallback_res = backend_->RequestGraphicsPipeline(
+        {GOMA_ASSETS_DIR "shaders/pbr.vert", ShaderSourceType::Filename,
+         vs_preamble},
+        {GOMA_ASSETS_DIR "shaders/pbr.frag", ShaderSourceType::Filename,
+         GetFragmentShaderPreamble(mesh, Material{})});
+    if (!fallback_res) {
+        // Not requested again until the table is cleared
+        fallback_pipelines_[vs_preamble] = kInvalidPipelineId;
+        return kInvalidPipelineId;
     }
+    if (!fallback_res.value()) {
+        return kInvalidPipelineId;
+    }
+
+    auto id = pipeline_table_.Add(fallback_res.value());
+    fallback_pipelines_[vs_preamble] = id;
+    return id;
 }
 
-const char* Renderer::GetFragmentShaderPreamble(const Mesh& mesh,
-                                                const Material& material) {
-    auto check_type = [&](TextureType type) {
-        return material.texture_bindings.find(type) !=
-               material.texture_bindings.end();
-    };
+result<void> Renderer::RecordBatches(const std::vector<DrawBatch>& batches,
+                                     std::vector<CommandStream>& streams,
+                                     const RecordStateFn& record_state,
+                                     const RecordBatchFn& record_batch,
+                                     const RecordDrawFn& record_draw) {
+    size_t draw_count = 0;
+    for (const auto& batch : batches) {
+        draw_count += batch.draw_count;
+    }
 
-    return GetFragmentShaderPreamble(FragmentShaderPreambleDesc{
-        !mesh.vertices.empty(),
-        !mesh.normals.empty(),
-        !mesh.tangents.empty(),
-        !mesh.bitangents.empty(),
-        !mesh.colors.empty(),
-        mesh.uv_sets.size() > 0,
-        mesh.uv_sets.size() > 1,
-        mesh.uvw_sets.size() > 0,
-        check_type(TextureType::Diffuse),
-        check_type(TextureType::Specular),
-        check_type(TextureType::Ambient),
-        check_type(TextureType::Emissive),
-        check_type(TextureType::MetallicRoughness),
-        check_type(TextureType::HeightMap),
-        check_type(TextureType::NormalMap),
-        check_type(TextureType::Shininess),
-        check_type(TextureType::Opacity),
-        check_type(TextureType::Displacement),
-        check_type(TextureType::LightMap),
-        backend_->GetTexture("goma_skybox").has_value(),
-        material.alpha_cutoff < 1.0f,
-    });
+    // Small passes are not worth the extra command buffers
+    auto thread_count = static_cast<uint32_t>(
+        std::min<size_t>(backend_->GetRecordingThreadCount(),
+                         std::max<size_t>(draw_count / kMinDrawsPerThread, 1)));
+    if (streams.size() < thread_count) {
+        streams.resize(thread_count);
+    }
+
+    return backend_->RecordParallel(
+        thread_count, [&](uint32_t thread) -> result<void> {
+            auto& commands = streams[thread];
+            commands.Clear();
+            record_state(commands);
+
+            // Each thread gets an equal share of the draws,
+            // so a batch can be split across threads
+            size_t begin = draw_count * thread / thread_count;
+            size_t end = draw_count * (thread + 1) / thread_count;
+
+            size_t batch_begin = 0;
+            for (const auto& batch : batches) {
+                if (batch_begin >= end) {
+                    break;
+                }
+
+                size_t batch_end = batch_begin + batch.draw_count;
+                if (batch_end > begin) {
+                    record_batch(commands, batch);
+
+                    auto first = std::max(begin, batch_begin) - batch_begin;
+                    auto last = std::min(end, batch_end) - batch_begin;
+                    for (size_t i = first; i < last; i++) {
+                        record_draw(commands, batch, batch.first_draw + i);
+                    }
+                }
+
+                batch_begin = batch_end;
+            }
+
+            return backend_->ExecuteCommands(commands);
+        });
+}
+
+result<std::shared_ptr<Buffer>> Renderer::GetUniformArenaBuffer() {
+    auto buffer_res = backend_->GetUniformBuffer(kUniformArenaBuffer);
+    if (!buffer_res) {
+        buffer_res = backend_->CreateUniformBuffer(
+            kUniformArenaBuffer, 3 * kUniformArenaSize, false);
+    }
+    return buffer_res;
 }
 
-result<void> Renderer::BindMeshBuffers(const Mesh& mesh) {
+result<void> Renderer::FlushUniforms(FrameIndex frame_id,
+                                     const Buffer& uniform_buffer,
+                                     uint64_t first) {
+    if (uniform_arena_.exhausted()) {
+        spdlog::warn("Uniform arena is full, some draws were skipped.");
+    }
+
+    auto used = uniform_arena_.used();
+    if (used <= first) {
+        return outcome::success();
+    }
+
+    return backend_->UpdateBuffer(uniform_buffer,
+                                  frame_id * kUniformArenaSize + first,
+                                  used - first, uniform_arena_.data() + first);
+}
+
+void Renderer::BindMeshBuffers(CommandStream& commands, const Mesh& mesh) {
     uint32_t binding = 0;
     auto bind = [&](const Buffer* buf) {
         if (buf && buf->valid) {
-            backend_->BindVertexBuffer(*buf, binding, 0);
+            commands.BindVertexBuffer(*buf, binding, 0);
         }
         binding++;
     };
 
-    bind(mesh.buffers.vertex.get());
-    bind(mesh.buffers.normal.get());
-    bind(mesh.buffers.tangent.get());
-    bind(mesh.buffers.bitangent.get());
-    bind(mesh.buffers.color.get());
-    bind(mesh.buffers.uv0.get());
-    bind(mesh.buffers.uv1.get());
-    bind(mesh.buffers.uvw.get());
+    bind(mesh.buffers.position.get());
+    bind(mesh.buffers.attributes.get());
+    bind(mesh.buffers.extras.get());
 
     if (!mesh.indices.empty()) {
-        backend_->BindIndexBuffer(*mesh.buffers.index);
+        commands.BindIndexBuffer(*mesh.buffers.index, 0,
+                                 mesh.buffers.short_indices);
     }
+}
 
-    return outcome::success();
+result<std::shared_ptr<VertexInputFormat>> Renderer::GetPositionInputFormat() {
+    // The first stream of the geometry pool
+    VertexInputFormatDesc input_format_desc;
+    input_format_desc.bindings.push_back({0, sizeof(glm::vec3)});
+    input_format_desc.attributes.push_back({0, 0, Format::SFloatRGB32, 0});
+
+    return backend_->GetVertexInputFormat(input_format_desc);
 }
 
-result<void> Renderer::BindMaterialTextures(const Material& material) {
-    Scene* scene = engine_.scene();
-    if (!scene) {
-        return Error::NoSceneLoaded;
+void Renderer::BindPositionBuffer(CommandStream& commands, const Mesh& mesh) {
+    if (mesh.buffers.position && mesh.buffers.position->valid) {
+        commands.BindVertexBuffer(*mesh.buffers.position, 0, 0);
     }
 
+    if (!mesh.indices.empty()) {
+        commands.BindIndexBuffer(*mesh.buffers.index, 0,
+                                 mesh.buffers.short_indices);
+    }
+}
+
+void Renderer::DrawMesh(CommandStream& commands, const Mesh& mesh,
+                        size_t lod) {
+    // Geometry is sub-allocated, so draws start from the mesh offsets
+    const auto& buffers = mesh.buffers;
+    if (lod > 0 && lod <= mesh.lods.size() &&
+        lod <= buffers.lod_index_offsets.size()) {
+        const auto& indices = mesh.lods[lod - 1].indices;
+        commands.DrawIndexed(static_cast<uint32_t>(indices.size()), 1,
+                             buffers.lod_index_offsets[lod - 1],
+                             buffers.vertex_offset);
+    } else if (!mesh.indices.empty()) {
+        commands.DrawIndexed(static_cast<uint32_t>(mesh.indices.size()), 1,
+                             buffers.index_offset, buffers.vertex_offset);
+    } else {
+        commands.Draw(static_cast<uint32_t>(mesh.vertices.size()), 1,
+                      buffers.vertex_offset);
+    }
+}
+
+void Renderer::DrawMeshRanges(CommandStream& commands, const Mesh& mesh,
+                              const IndexRange* ranges, size_t range_count) {
+    const auto& buffers = mesh.buffers;
+    for (size_t i = 0; i < range_count; i++) {
+        commands.DrawIndexed(ranges[i].count, 1,
+                             buffers.index_offset + ranges[i].first,
+                             buffers.vertex_offset);
+    }
+}
+
+result<void> Renderer::BindMaterialTextures(CommandStream& commands,
+                                            const Material& material) {
     uint32_t binding_id = 0;
 
     const std::vector<TextureType> texture_types = {
@@ -1462,26 +1778,41 @@ result<void> Renderer::BindMaterialTextures(const Material& material) {
 
     for (const auto& texture_type : texture_types) {
         if (texture_type == TextureType::Reflection) {
-            auto skybox_tex_res = backend_->GetTexture("goma_skybox");
+            auto skybox_tex_res = backend_->GetTexture(kSkyboxTexture);
             if (skybox_tex_res) {
-                backend_->BindTexture(skybox_tex_res.value()->vez, binding_id);
+                commands.BindTexture(*skybox_tex_res.value(), binding_id);
             }
         }
 
-        auto binding = material.texture_bindings.find(texture_type);
+        OUTCOME_TRY(
+            BindMaterialTexture(commands, material, texture_type, binding_id));
+        binding_id++;
+    }
+
+    return outcome::success();
+}
 
-        if (binding != material.texture_bindings.end() &&
-            !binding->second.empty()) {
-            auto texture_res =
-                scene->GetAttachment<Texture>(binding->second[0].index);
-            if (texture_res) {
-                auto& texture = texture_res.value().get();
-                if (texture.image && texture.image->valid) {
-                    backend_->BindTexture(*texture.image, binding_id);
-                }
+result<void> Renderer::BindMaterialTexture(CommandStream& commands,
+                                           const Material& material,
+                                           TextureType texture_type,
+                                           uint32_t binding_id) {
+    Scene* scene = engine_.scene();
+    if (!scene) {
+        return Error::NoSceneLoaded;
+    }
+
+    auto binding = material.texture_bindings.find(texture_type);
+
+    if (binding != material.texture_bindings.end() &&
+        !binding->second.empty()) {
+        auto texture_res =
+            scene->GetAttachment<Texture>(binding->second[0].index);
+        if (texture_res) {
+            auto& texture = texture_res.value().get();
+            if (texture.image && texture.image->valid) {
+                commands.BindTexture(*texture.image, binding_id);
             }
         }
-        binding_id++;
     }
 
     return outcome::success();
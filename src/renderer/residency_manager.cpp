@@ -0,0 +1,266 @@
+#include "renderer/residency_manager.hpp"
+
+#include "scene/scene.hpp"
+#include "scene/attachments/material.hpp"
+
+namespace goma {
+
+namespace {
+
+template <typename T>
+uint64_t GetRevision(Scene& scene, AttachmentIndex<T> id) {
+    // Only called on validated ids
+    return scene.GetAttachments<T>()[id.id].revision;
+}
+
+}  // namespace
+
+result<void> ResidencyManager::Update(Scene& scene) {
+    if (scene_id_ != scene.id()) {
+        // A new scene has been loaded, start tracking from scratch
+        Reset();
+        scene_id_ = scene.id();
+    }
+
+    auto mesh_revision = scene.GetAttachmentRevision<Mesh>();
+    if (mesh_revision != mesh_revision_) {
+        QueueMeshes(scene);
+        mesh_revision_ = mesh_revision;
+    }
+
+    // Textures are uploaded when referenced by a material,
+    // so changes to either can make new textures resident
+    auto texture_revision = scene.GetAttachmentRevision<Texture>();
+    auto material_revision = scene.GetAttachmentRevision<Material>();
+    if (texture_revision != texture_revision_ ||
+        material_revision != material_revision_) {
+        QueueTextures(scene);
+        texture_revision_ = texture_revision;
+        material_revision_ = material_revision;
+    }
+
+    for (auto it = pending_meshes_.begin(); it != pending_meshes_.end();) {
+        if (MakeResident(scene, *it)) {
+            it = pending_meshes_.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    for (auto it = pending_textures_.begin(); it != pending_textures_.end();) {
+        if (MakeResident(scene, *it)) {
+            it = pending_textures_.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    OUTCOME_TRY(geometry_pool_.Update(scene));
+
+    return outcome::success();
+}
+
+void ResidencyManager::Reset() {
+    mesh_revision_ = 0;
+    texture_revision_ = 0;
+    material_revision_ = 0;
+
+    for (auto& texture : textures_) {
+        DestroyImage(texture.second);
+    }
+
+    meshes_.clear();
+    textures_.clear();
+    pending_meshes_.clear();
+    pending_textures_.clear();
+    geometry_pool_.Reset();
+
+    stats_ = {};
+}
+
+void ResidencyManager::DestroyImage(Residency& residency) {
+    // The backend keeps it alive until the frames using it are complete.
+    // Not found when replaced by a texture loaded from the same path.
+    if (residency.image) {
+        backend_.DestroyTexture(*residency.image);
+        residency.image = nullptr;
+    }
+}
+
+void ResidencyManager::QueueMeshes(Scene& scene) {
+    // Forget meshes that do not exist anymore
+    for (auto it = meshes_.begin(); it != meshes_.end();) {
+        if (!scene.GetAttachment<Mesh>(it->first)) {
+            stats_.resident_meshes--;
+            stats_.mesh_bytes -= it->second.bytes;
+            geometry_pool_.Free(it->first);
+            pending_meshes_.erase(it->first);
+            it = meshes_.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    for (const auto& attachment : scene.GetAttachments<Mesh>()) {
+        if (!attachment.valid()) {
+            continue;
+        }
+
+        auto residency = meshes_.find(attachment.id);
+        if (residency == meshes_.end() ||
+            residency->second.revision < attachment.revision) {
+            pending_meshes_.insert(attachment.id);
+        }
+    }
+}
+
+void ResidencyManager::QueueTextures(Scene& scene) {
+    for (auto it = textures_.begin(); it != textures_.end();) {
+        if (!scene.GetAttachment<Texture>(it->first)) {
+            stats_.resident_textures--;
+            stats_.texture_bytes -= it->second.bytes;
+            DestroyImage(it->second);
+            pending_textures_.erase(it->first);
+            it = textures_.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    scene.ForEach<Material>([&](auto, auto, Material& material) {
+        for (const auto& binding : material.texture_bindings) {
+            if (binding.second.empty()) {
+                continue;
+            }
+
+            auto id = binding.second[0].index;
+            if (!scene.GetAttachment<Texture>(id)) {
+                continue;
+            }
+
+            auto residency = textures_.find(id);
+            if (residency == textures_.end() ||
+                residency->second.revision < GetRevision(scene, id)) {
+                pending_textures_.insert(id);
+            }
+        }
+    });
+}
+
+result<void> ResidencyManager::MakeResident(Scene& scene,
+                                            AttachmentIndex<Mesh> id) {
+    OUTCOME_TRY(mesh_ref, scene.GetAttachment<Mesh>(id));
+    auto& mesh = mesh_ref.get();
+
+    OUTCOME_TRY(bytes, geometry_pool_.Allocate(scene, id, mesh));
+    OUTCOME_TRY(CreateVertexInputFormat(mesh));
+
+    auto& residency = meshes_[id];
+    if (residency.revision == 0) {
+        stats_.resident_meshes++;
+    }
+    stats_.mesh_bytes += bytes - residency.bytes;
+
+    residency.revision = GetRevision(scene, id);
+    residency.bytes = bytes;
+
+    return outcome::success();
+}
+
+result<void> ResidencyManager::MakeResident(Scene& scene,
+                                            AttachmentIndex<Texture> id) {
+    OUTCOME_TRY(texture_ref, scene.GetAttachment<Texture>(id));
+    auto& texture = texture_ref.get();
+
+    if (texture.compressed) {
+        // Not retried, it would only fail again
+        spdlog::warn("Compressed texture \"{}\" not supported.", texture.path);
+        return outcome::success();
+    }
+
+    TextureDesc tex_desc{texture.width, texture.height};
+    OUTCOME_TRY(image, backend_.CreateTexture(texture.path.c_str(), tex_desc,
+                                              texture.data.data()));
+    texture.image = image;
+
+    // The mip chain adds up to a third of the base level
+    size_t bytes = size_t{texture.width} * texture.height *
+                   backend_.GetFormatSize(tex_desc.format);
+    if (tex_desc.mipmapping) {
+        bytes += bytes / 3;
+    }
+
+    // The previous image of a modified texture is replaced
+    auto& residency = textures_[id];
+    DestroyImage(residency);
+
+    if (residency.revision == 0) {
+        stats_.resident_textures++;
+    }
+    stats_.texture_bytes += bytes - residency.bytes;
+
+    residency.revision = GetRevision(scene, id);
+    residency.bytes = bytes;
+    residency.image = image;
+
+    return outcome::success();
+}
+
+result<void> ResidencyManager::CreateVertexInputFormat(Mesh& mesh) {
+    // Matches the packed streams of the geometry pool
+    VertexInputFormatDesc input_format_desc;
+    const auto& packed = mesh.packed;
+
+    auto uv_format = packed.uv_encoding == UVEncoding::UNorm16
+                         ? Format::UNormRG16
+                         : Format::SFloatRG16;
+
+    if (!mesh.vertices.empty()) {
+        input_format_desc.bindings.push_back({0, sizeof(glm::vec3)});
+        input_format_desc.attributes.push_back(
+            {0, 0, Format::SFloatRGB32, 0});
+    }
+
+    if (!packed.attributes.empty()) {
+        input_format_desc.bindings.push_back({1, sizeof(PackedAttributes)});
+
+        if (packed.has_normals) {
+            input_format_desc.attributes.push_back(
+                {1, 1, Format::SNormRG16,
+                 offsetof(PackedAttributes, normal)});
+        }
+        if (packed.has_tangents) {
+            input_format_desc.attributes.push_back(
+                {2, 1, Format::SNormRG16,
+                 offsetof(PackedAttributes, tangent)});
+        }
+        if (packed.has_uv0) {
+            input_format_desc.attributes.push_back(
+                {5, 1, uv_format, offsetof(PackedAttributes, uv0)});
+        }
+    }
+
+    if (!packed.extras.empty()) {
+        input_format_desc.bindings.push_back({2, sizeof(PackedExtras)});
+
+        if (packed.has_colors) {
+            input_format_desc.attributes.push_back(
+                {4, 2, Format::UNormRGBA8, offsetof(PackedExtras, color)});
+        }
+        if (packed.has_uv1) {
+            input_format_desc.attributes.push_back(
+                {6, 2, uv_format, offsetof(PackedExtras, uv1)});
+        }
+        if (packed.has_uvw) {
+            input_format_desc.attributes.push_back(
+                {7, 2, Format::SFloatRGB32, offsetof(PackedExtras, uvw)});
+        }
+    }
+
+    OUTCOME_TRY(input_format, backend_.GetVertexInputFormat(input_format_desc));
+    mesh.vertex_input_format = input_format;
+
+    return outcome::success();
+}
+
+}  // namespace goma
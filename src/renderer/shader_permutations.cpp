@@ -0,0 +1,340 @@
+#include "renderer/shader_permutations.hpp"
+
+#include "scene/scene.hpp"
+#include "scene/vertex_layout.hpp"
+
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+#ifndef GOMA_ASSETS_DIR
+#define GOMA_ASSETS_DIR "assets/"
+#endif
+
+namespace goma {
+
+namespace {
+
+constexpr const char* kManifestHeader = "# goma shader manifest 1";
+
+// Bits used by each preamble description
+constexpr uint32_t kVertexPreambleMask = (1U << 9) - 1;
+constexpr uint32_t kFragmentPreambleMask = (1U << 21) - 1;
+// Fragment bits that come from the mesh rather than the material
+constexpr uint32_t kFragmentMeshMask = (1U << 8) - 1;
+
+}  // namespace
+
+VertexShaderPreambleDesc GetVertexShaderPreambleDesc(const Mesh& mesh) {
+    // Packed meshes only have the attributes that were packed. They do
+    // not store bitangents, which are rebuilt from the normal, tangent
+    // and sign instead.
+    bool packed = IsPacked(mesh);
+    const auto& p = mesh.packed;
+
+    VertexShaderPreambleDesc desc;
+    desc.int_repr = 0;
+    desc.has_positions = !mesh.vertices.empty();
+    desc.has_normals = packed ? p.has_normals : !mesh.normals.empty();
+    desc.has_tangents = packed ? p.has_tangents : !mesh.tangents.empty();
+    desc.has_bitangents = !packed && !mesh.bitangents.empty();
+    desc.has_colors = packed ? p.has_colors : !mesh.colors.empty();
+    desc.has_uv0 = packed ? p.has_uv0 : mesh.uv_sets.size() > 0;
+    desc.has_uv1 = packed ? p.has_uv1 : mesh.uv_sets.size() > 1;
+    desc.has_uvw = packed ? p.has_uvw : mesh.uvw_sets.size() > 0;
+    desc.has_packed_attributes = packed;
+    return desc;
+}
+
+FragmentShaderPreambleDesc GetFragmentShaderPreambleDesc(
+    const Mesh& mesh, const Material& material, bool has_reflection_map) {
+    auto check_type = [&](TextureType type) {
+        return material.texture_bindings.find(type) !=
+               material.texture_bindings.end();
+    };
+
+    FragmentShaderPreambleDesc desc;
+    desc.int_repr = 0;
+
+    // Mesh, as output by the vertex shader
+    auto vertex_desc = GetVertexShaderPreambleDesc(mesh);
+    desc.has_positions = vertex_desc.has_positions;
+    desc.has_normals = vertex_desc.has_normals;
+    desc.has_tangents = vertex_desc.has_tangents;
+    desc.has_bitangents = vertex_desc.has_bitangents;
+    desc.has_colors = vertex_desc.has_colors;
+    desc.has_uv0 = vertex_desc.has_uv0;
+    desc.has_uv1 = vertex_desc.has_uv1;
+    desc.has_uvw = vertex_desc.has_uvw;
+
+    // Material
+    desc.has_diffuse_map = check_type(TextureType::Diffuse);
+    desc.has_specular_map = check_type(TextureType::Specular);
+    desc.has_ambient_map = check_type(TextureType::Ambient);
+    desc.has_emissive_map = check_type(TextureType::Emissive);
+    desc.has_metallic_roughness_map =
+        check_type(TextureType::MetallicRoughness);
+    desc.has_height_map = check_type(TextureType::HeightMap);
+    desc.has_normal_map = check_type(TextureType::NormalMap);
+    desc.has_shininess_map = check_type(TextureType::Shininess);
+    desc.has_opacity_map = check_type(TextureType::Opacity);
+    desc.has_displacement_map = check_type(TextureType::Displacement);
+    desc.has_light_map = check_type(TextureType::LightMap);
+    desc.has_reflection_map = has_reflection_map;
+    desc.alpha_mask = material.alpha_cutoff < 1.0f;
+    return desc;
+}
+
+std::string BuildVertexShaderPreamble(const VertexShaderPreambleDesc& desc) {
+    std::stringstream preamble;
+
+    if (desc.has_positions) {
+        preamble << "#define HAS_POSITIONS\n";
+    }
+    if (desc.has_normals) {
+        preamble << "#define HAS_NORMALS\n";
+    }
+    if (desc.has_tangents) {
+        preamble << "#define HAS_TANGENTS\n";
+    }
+    if (desc.has_bitangents) {
+        preamble << "#define HAS_BITANGENTS\n";
+    }
+    if (desc.has_colors) {
+        preamble << "#define HAS_COLORS\n";
+    }
+    if (desc.has_uv0) {
+        preamble << "#define HAS_UV0\n";
+    }
+    if (desc.has_uv1) {
+        preamble << "#define HAS_UV1\n";
+    }
+    if (desc.has_uvw) {
+        preamble << "#define HAS_UVW\n";
+    }
+    if (desc.has_packed_attributes) {
+        preamble << "#define PACKED_ATTRIBUTES\n";
+        preamble << "#define TANGENT_SIGN_BIAS " << kTangentSignBias << "\n";
+    }
+
+    return preamble.str();
+}
+
+std::string BuildFragmentShaderPreamble(
+    const FragmentShaderPreambleDesc& desc) {
+    std::stringstream preamble;
+
+    // Mesh
+    if (desc.has_positions) {
+        preamble << "#define HAS_POSITIONS\n";
+    }
+    if (desc.has_normals) {
+        preamble << "#define HAS_NORMALS\n";
+    }
+    if (desc.has_tangents) {
+        preamble << "#define HAS_TANGENTS\n";
+    }
+    if (desc.has_bitangents) {
+        preamble << "#define HAS_BITANGENTS\n";
+    }
+    if (desc.has_colors) {
+        preamble << "#define HAS_COLORS\n";
+    }
+    if (desc.has_uv0) {
+        preamble << "#define HAS_UV0\n";
+    }
+    if (desc.has_uv1) {
+        preamble << "#define HAS_UV1\n";
+    }
+    if (desc.has_uvw) {
+        preamble << "#define HAS_UVW\n";
+    }
+
+    // Material
+    if (desc.has_diffuse_map) {
+        preamble << "#define HAS_DIFFUSE_MAP\n";
+    }
+    if (desc.has_specular_map) {
+        preamble << "#define HAS_SPECULAR_MAP\n";
+    }
+    if (desc.has_ambient_map) {
+        preamble << "#define HAS_AMBIENT_MAP\n";
+    }
+    if (desc.has_emissive_map) {
+        preamble << "#define HAS_EMISSIVE_MAP\n";
+    }
+    if (desc.has_metallic_roughness_map) {
+        preamble << "#define HAS_METALLIC_ROUGHNESS_MAP\n";
+    }
+    if (desc.has_height_map) {
+        preamble << "#define HAS_HEIGHT_MAP\n";
+    }
+    if (desc.has_normal_map) {
+        preamble << "#define HAS_NORMAL_MAP\n";
+    }
+    if (desc.has_shininess_map) {
+        preamble << "#define HAS_SHININESS_MAP\n";
+    }
+    if (desc.has_opacity_map) {
+        preamble << "#define HAS_OPACITY_MAP\n";
+    }
+    if (desc.has_displacement_map) {
+        preamble << "#define HAS_DISPLACEMENT_MAP\n";
+    }
+    if (desc.has_light_map) {
+        preamble << "#define HAS_LIGHT_MAP\n";
+    }
+    if (desc.has_reflection_map) {
+        preamble << "#define HAS_REFLECTION_MAP\n";
+    }
+    if (desc.alpha_mask) {
+        preamble << "#define ALPHAMODE_MASK\n";
+    }
+
+    return preamble.str();
+}
+
+ShaderPermutation GetFallbackPermutation(
+    const ShaderPermutation& permutation) {
+    return {permutation.vs, permutation.fs & kFragmentMeshMask};
+}
+
+void ShaderManifest::Add(const Mesh& mesh, const Material& material) {
+    Add(ShaderPermutation{
+        GetVertexShaderPreambleDesc(mesh).int_repr,
+        GetFragmentShaderPreambleDesc(mesh, material, false).int_repr});
+}
+
+void ShaderManifest::Add(Scene& scene) {
+    scene.ForEach<Mesh>([&](Mesh& mesh) {
+        auto material_res = scene.GetAttachment<Material>(mesh.material);
+        if (material_res) {
+            Add(mesh, material_res.value().get());
+        }
+    });
+}
+
+result<void> ShaderManifest::Save(const std::string& path) const {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        spdlog::error("Couldn't open shader manifest \"{}\".", path);
+        return Error::SavingFailed;
+    }
+
+    file << kManifestHeader << "\n";
+    for (const auto& permutation : permutations_) {
+        file << permutation.vs << " " << permutation.fs << "\n";
+    }
+
+    file.close();
+    if (!file) {
+        spdlog::error("Couldn't write shader manifest \"{}\".", path);
+        return Error::SavingFailed;
+    }
+
+    return outcome::success();
+}
+
+result<ShaderManifest> ShaderManifest::Load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        spdlog::error("Couldn't open shader manifest \"{}\".", path);
+        return Error::LoadingFailed;
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != kManifestHeader) {
+        spdlog::error("\"{}\" is not a shader manifest.", path);
+        return Error::LoadingFailed;
+    }
+
+    ShaderManifest manifest;
+    while (std::getline(file, line)) {
+        if (line.empty()) {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        ShaderPermutation permutation{};
+        if (!(fields >> permutation.vs >> permutation.fs) ||
+            (permutation.vs & ~kVertexPreambleMask) ||
+            (permutation.fs & ~kFragmentPreambleMask)) {
+            spdlog::error("Invalid permutation \"{}\" in \"{}\".", line,
+                          path);
+            return Error::LoadingFailed;
+        }
+
+        manifest.Add(permutation);
+    }
+
+    return manifest;
+}
+
+size_t CompileShaderManifest(Backend& backend, const ShaderManifest& manifest,
+                             bool has_reflection_map) {
+    struct Request {
+        ShaderDesc vert;
+        ShaderDesc frag;
+    };
+    std::vector<Request> requests;
+
+    // Opaque shadow casters share a position-only pipeline
+    requests.push_back(
+        {{GOMA_ASSETS_DIR "shaders/depth.vert", ShaderSourceType::Filename},
+         {}});
+
+    // Fallbacks are drawn while the other pipelines are still compiling
+    // after a scene loads, so they are compiled too
+    auto permutations = manifest.permutations();
+    for (const auto& permutation : manifest.permutations()) {
+        permutations.insert(GetFallbackPermutation(permutation));
+    }
+
+    for (const auto& permutation : permutations) {
+        VertexShaderPreambleDesc vs_desc;
+        vs_desc.int_repr = permutation.vs;
+        auto vs_preamble = BuildVertexShaderPreamble(vs_desc);
+
+        FragmentShaderPreambleDesc fs_desc;
+        fs_desc.int_repr = permutation.fs;
+        fs_desc.has_reflection_map = has_reflection_map;
+        auto fs_preamble = BuildFragmentShaderPreamble(fs_desc);
+
+        if (fs_desc.alpha_mask) {
+            requests.push_back({{GOMA_ASSETS_DIR "shaders/shadow.vert",
+                                 ShaderSourceType::Filename, vs_preamble},
+                                {GOMA_ASSETS_DIR "shaders/shadow.frag",
+                                 ShaderSourceType::Filename, fs_preamble}});
+        }
+
+        requests.push_back({{GOMA_ASSETS_DIR "shaders/pbr.vert",
+                             ShaderSourceType::Filename, vs_preamble},
+                            {GOMA_ASSETS_DIR "shaders/pbr.frag",
+                             ShaderSourceType::Filename, fs_preamble}});
+    }
+
+    // Everything is requested first, so that
+    // the backend can compile it all in parallel
+    size_t failed = 0;
+    while (!requests.empty()) {
+        std::vector<Request> pending;
+        for (auto& request : requests) {
+            auto pipeline_res =
+                backend.RequestGraphicsPipeline(request.vert, request.frag);
+            if (!pipeline_res) {
+                failed++;
+            } else if (!pipeline_res.value()) {
+                pending.push_back(std::move(request));
+            }
+        }
+        requests = std::move(pending);
+
+        if (!requests.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    return failed;
+}
+
+}  // namespace goma
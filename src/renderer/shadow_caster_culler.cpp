@@ -0,0 +1,40 @@
+#include "renderer/shadow_caster_culler.hpp"
+
+namespace goma {
+
+bool ShadowCasterCuller::IsVisible(const glm::mat4& light_vp,
+                                   const Box& bounds) {
+    stats_.tested_casters++;
+
+    const auto& min = bounds.min;
+    const auto& max = bounds.max;
+    std::array<glm::vec4, 8> cs_vertices{
+        light_vp * glm::vec4(min, 1.0f),
+        light_vp * glm::vec4(max, 1.0f),
+        light_vp * glm::vec4(min.x, min.y, max.z, 1.0f),
+        light_vp * glm::vec4(min.x, max.y, max.z, 1.0f),
+        light_vp * glm::vec4(min.x, max.y, min.z, 1.0f),
+        light_vp * glm::vec4(max.x, max.y, min.z, 1.0f),
+        light_vp * glm::vec4(max.x, min.y, min.z, 1.0f),
+        light_vp * glm::vec4(max.x, min.y, max.z, 1.0f),
+    };
+
+    auto all_of = [&cs_vertices](bool (*outside)(const glm::vec4&)) {
+        return std::all_of(cs_vertices.begin(), cs_vertices.end(), outside);
+    };
+
+    // No test against the near plane, which extrudes the frustum
+    bool culled =
+        all_of([](const glm::vec4& v) { return v.x <= -v.w; }) ||
+        all_of([](const glm::vec4& v) { return v.x >= v.w; }) ||
+        all_of([](const glm::vec4& v) { return v.y <= -v.w; }) ||
+        all_of([](const glm::vec4& v) { return v.y >= v.w; }) ||
+        all_of([](const glm::vec4& v) { return v.z >= v.w; });
+
+    if (!culled) {
+        stats_.visible_casters++;
+    }
+    return !culled;
+}
+
+}  // namespace goma
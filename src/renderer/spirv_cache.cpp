@@ -0,0 +1,174 @@
+#include "renderer/spirv_cache.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace goma {
+
+namespace {
+
+constexpr uint32_t kFileMagic = 0x56505347;  // "GSPV"
+// Bumped whenever the layout below changes
+constexpr uint32_t kFileVersion = 1;
+constexpr uint32_t kSpirvMagic = 0x07230203;
+
+struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t entry_count;
+};
+
+// Followed by word_count words of SPIR-V
+struct EntryHeader {
+    Hash128 identity;
+    Hash128 content;
+    Hash128 checksum;
+    uint64_t word_count;
+};
+
+Hash128 Checksum(const std::vector<uint32_t>& code) {
+    return MurmurHash3(code.data(), code.size() * sizeof(uint32_t));
+}
+
+// Replaces dst with src in one step, so that readers
+// never see a partially written file
+bool ReplaceAtomically(const std::string& src, const std::string& dst) {
+#ifdef _WIN32
+    return MoveFileExA(src.c_str(), dst.c_str(),
+                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    return std::rename(src.c_str(), dst.c_str()) == 0;
+#endif
+}
+
+}  // namespace
+
+result<void> SpirvCache::Load() {
+    if (path_.empty()) {
+        return outcome::success();
+    }
+
+    std::ifstream file(path_, std::ios_base::in | std::ios_base::binary);
+    if (!file) {
+        return outcome::success();
+    }
+
+    file.seekg(0, std::ios::end);
+    auto remaining = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+
+    FileHeader file_header{};
+    if (remaining < sizeof(file_header) ||
+        !file.read(reinterpret_cast<char*>(&file_header),
+                   sizeof(file_header)) ||
+        file_header.magic != kFileMagic ||
+        file_header.version != kFileVersion) {
+        spdlog::warn("Ignoring invalid shader cache \"{}\".", path_);
+        stats_.rejected++;
+        dirty_ = true;
+        return outcome::success();
+    }
+    remaining -= sizeof(file_header);
+
+    for (uint64_t i = 0; i < file_header.entry_count; i++) {
+        EntryHeader header{};
+        if (remaining < sizeof(header) ||
+            !file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            // Truncated, the remaining entries are lost
+            stats_.rejected += file_header.entry_count - i;
+            break;
+        }
+        remaining -= sizeof(header);
+
+        if (header.word_count == 0 ||
+            header.word_count > remaining / sizeof(uint32_t)) {
+            stats_.rejected += file_header.entry_count - i;
+            break;
+        }
+
+        std::vector<uint32_t> code(header.word_count);
+        auto bytes = header.word_count * sizeof(uint32_t);
+        if (!file.read(reinterpret_cast<char*>(code.data()), bytes)) {
+            stats_.rejected += file_header.entry_count - i;
+            break;
+        }
+        remaining -= bytes;
+
+        if (code[0] != kSpirvMagic || Checksum(code) != header.checksum) {
+            stats_.rejected++;
+            continue;
+        }
+
+        entries_[header.identity] = {header.content, std::move(code)};
+    }
+
+    // Rewrite the file without the rejected entries
+    dirty_ = stats_.rejected > 0;
+    return outcome::success();
+}
+
+result<void> SpirvCache::Save() {
+    if (path_.empty() || !dirty_) {
+        return outcome::success();
+    }
+
+    // Written next to the cache first, a crash while saving
+    // leaves the previous file in place
+    auto tmp_path = path_ + ".tmp";
+    std::ofstream file(tmp_path, std::ios_base::out | std::ios_base::binary |
+                                     std::ios_base::trunc);
+
+    FileHeader file_header{kFileMagic, kFileVersion, entries_.size()};
+    file.write(reinterpret_cast<const char*>(&file_header),
+               sizeof(file_header));
+
+    for (const auto& entry : entries_) {
+        const auto& code = entry.second.code;
+        EntryHeader header{entry.first, entry.second.content, Checksum(code),
+                           code.size()};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(code.data()),
+                   code.size() * sizeof(uint32_t));
+    }
+
+    file.close();
+    if (!file || !ReplaceAtomically(tmp_path, path_)) {
+        spdlog::error("Couldn't save shader cache \"{}\".", path_);
+        std::remove(tmp_path.c_str());
+        return Error::SavingFailed;
+    }
+
+    dirty_ = false;
+    return outcome::success();
+}
+
+const std::vector<uint32_t>* SpirvCache::Find(const Key& key) {
+    auto result = entries_.find(key.identity);
+    if (result == entries_.end()) {
+        stats_.misses++;
+        return nullptr;
+    }
+
+    if (result->second.content != key.content) {
+        stats_.misses++;
+        stats_.invalidated++;
+        return nullptr;
+    }
+
+    stats_.hits++;
+    return &result->second.code;
+}
+
+void SpirvCache::Insert(const Key& key, std::vector<uint32_t> code) {
+    if (code.empty() || code[0] != kSpirvMagic) {
+        return;
+    }
+
+    entries_[key.identity] = {key.content, std::move(code)};
+    dirty_ = true;
+}
+
+}  // namespace goma
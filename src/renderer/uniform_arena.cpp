@@ -0,0 +1,16 @@
+#include "renderer/uniform_arena.hpp"
+
+namespace goma {
+
+result<uint64_t> UniformArena::Push(const void* data, uint64_t size) {
+    auto padded_size = (size + alignment_ - 1) / alignment_ * alignment_;
+    auto offset = head_.fetch_add(padded_size);
+    if (offset + size > data_.size()) {
+        return Error::OutOfCPUMemory;
+    }
+
+    memcpy(&data_[offset], data, size);
+    return offset;
+}
+
+}  // namespace goma
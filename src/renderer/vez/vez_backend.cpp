@@ -29,6 +29,15 @@
         }                                                                    \
     }
 
+// Part of the keys of compiled shaders on disk. Bump it when
+// updating the shader compiler, so that shaders are compiled again.
+constexpr uint32_t kShaderCompilerVersion = 1;
+
+// Also checked against when picking a format for color targets
+constexpr VkImageUsageFlags kColorTargetUsage =
+    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+    VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
 uint64_t sdbm_hash(const char* str) {
     uint64_t hash = 0;
     int c;
@@ -54,9 +63,60 @@ VKAPI_ATTR VkBool32 VKAPI_CALL DebugReportCallback(
 
 namespace goma {
 
+using BoundState = VezContext::BoundState;
+using Bindings = BoundState::Bindings;
+
+// V-EZ records into a command buffer per thread, so the state that binds
+// are filtered against follows the same pattern. Null when the thread is
+// not recording, in which case nothing is filtered.
+static thread_local BoundState* bound_state = nullptr;
+
+// Pipeline statistics query open in the render pass that the thread is
+// recording, ended along with the pass
+constexpr uint32_t kNoStatsQuery = UINT32_MAX;
+static thread_local uint32_t active_stats_query = kNoStatsQuery;
+
+template <typename T>
+bool NeedsBind(BoundState::Tracked<T> Bindings::*slot, const T& value) {
+    return !bound_state ||
+           bound_state->Set(&(bound_state->bindings.*slot), value);
+}
+
+template <typename T>
+bool NeedsBind(
+    std::array<BoundState::Tracked<T>, BoundState::kMaxBindings> Bindings::*
+        slots,
+    uint32_t binding, const T& value) {
+    return !bound_state ||
+           bound_state->Set(
+               BoundState::Slot(bound_state->bindings.*slots, binding), value);
+}
+
+// For binds that are issued as they are, but may overwrite tracked state
+template <typename T>
+void UntrackedBind(BoundState::Tracked<T> Bindings::*slot) {
+    if (bound_state) {
+        (bound_state->bindings.*slot).valid = false;
+        bound_state->issued++;
+    }
+}
+
 VezBackend::VezBackend(const Config& config, const RenderPlan& render_plan)
     : Backend(config, render_plan) {
     SetBuffering(config.buffering);
+
+    auto compiled_plan = CompileRenderPlan(render_plan_);
+    if (compiled_plan) {
+        compiled_plan_ = std::move(compiled_plan.value());
+    }
+
+    thread_pool_ = std::make_unique<ThreadPool>(
+        config.recording_threads > 0 ? config.recording_threads
+                                     : std::thread::hardware_concurrency());
+    compile_pool_ = std::make_unique<ThreadPool>(
+        config.compile_threads > 0
+            ? config.compile_threads
+            : std::max(1U, std::thread::hardware_concurrency() / 2));
 }
 
 VezBackend::~VezBackend() { TeardownContext(); }
@@ -94,6 +154,16 @@ result<void> VezBackend::InitContext() {
     OUTCOME_TRY(device, CreateDevice(p.physical_device));
     context_.device = device;
 
+    OUTCOME_TRY(InitUploads());
+
+    context_.spirv_cache = SpirvCache(config_.shader_cache_path);
+    OUTCOME_TRY(context_.spirv_cache.Load());
+    if (context_.spirv_cache.size() > 0) {
+        spdlog::info("Loaded {} shaders from \"{}\".",
+                     context_.spirv_cache.size(),
+                     context_.spirv_cache.path());
+    }
+
     return outcome::success();
 }
 
@@ -128,31 +198,134 @@ result<std::shared_ptr<Pipeline>> VezBackend::GetGraphicsPipeline(
     }
 
     auto hash = GetGraphicsPipelineHash(vertex_shader, fragment_shader);
-    auto result = context_.pipeline_cache.find(hash);
+    {
+        std::lock_guard<std::mutex> lock(shader_mutex_);
+        auto result = context_.pipeline_cache.find(hash);
+        if (result != context_.pipeline_cache.end()) {
+            return result->second;
+        }
+    }
+
+    OUTCOME_TRY(pipeline,
+                CreateGraphicsPipeline(vertex_shader, fragment_shader));
 
+    // Another thread may have created the same pipeline meanwhile
+    std::lock_guard<std::mutex> lock(shader_mutex_);
+    auto result = context_.pipeline_cache.find(hash);
     if (result != context_.pipeline_cache.end()) {
+        vezDestroyPipeline(device, pipeline);
         return result->second;
-    } else {
-        std::vector<VezPipelineShaderStageCreateInfo> shader_stages;
-        shader_stages.push_back({nullptr, vertex_shader});
-        if (fragment_shader != VK_NULL_HANDLE) {
-            shader_stages.push_back({nullptr, fragment_shader});
-        }
+    }
+
+    auto ret = std::make_shared<Pipeline>(pipeline);
+    context_.pipeline_cache[hash] = ret;
+    return ret;
+}
+
+result<VezPipeline> VezBackend::CreateGraphicsPipeline(VkShaderModule vs,
+                                                       VkShaderModule fs) {
+    std::vector<VezPipelineShaderStageCreateInfo> shader_stages;
+    shader_stages.push_back({nullptr, vs});
+    if (fs != VK_NULL_HANDLE) {
+        shader_stages.push_back({nullptr, fs});
+    }
+
+    VezGraphicsPipelineCreateInfo pipeline_info{};
+    pipeline_info.stageCount = static_cast<uint32_t>(shader_stages.size());
+    pipeline_info.pStages = shader_stages.data();
 
-        VezGraphicsPipelineCreateInfo pipeline_info{};
-        pipeline_info.stageCount = static_cast<uint32_t>(shader_stages.size());
-        pipeline_info.pStages = shader_stages.data();
+    VezPipeline pipeline = VK_NULL_HANDLE;
+    VK_CHECK(
+        vezCreateGraphicsPipeline(context_.device, &pipeline_info, &pipeline));
+    return pipeline;
+}
 
-        VezPipeline pipeline = VK_NULL_HANDLE;
-        VK_CHECK(vezCreateGraphicsPipeline(device, &pipeline_info, &pipeline));
+result<std::shared_ptr<Pipeline>> VezBackend::RequestGraphicsPipeline(
+    const ShaderDesc& vert, const ShaderDesc& frag) {
+    auto key = std::make_pair(
+        GetShaderHash(vert.source.c_str(), vert.preamble.c_str(),
+                      vert.entry_point.c_str()),
+        GetShaderHash(frag.source.c_str(), frag.preamble.c_str(),
+                      frag.entry_point.c_str()));
+
+    auto pending = pending_pipelines_.find(key);
+    if (pending != pending_pipelines_.end()) {
+        if (pending->second->done.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+            return std::shared_ptr<Pipeline>();
+        }
 
-        auto ret = std::make_shared<Pipeline>(pipeline);
-        context_.pipeline_cache[hash] = ret;
+        auto ret = std::move(pending->second->pipeline);
+        pending_pipelines_.erase(pending);
         return ret;
     }
+
+    if (auto pipeline = FindGraphicsPipeline(vert, frag)) {
+        return pipeline;
+    }
+
+    auto request = std::make_shared<PendingPipeline>();
+    request->done = compile_pool_->push([this, request, vert, frag]() {
+        request->pipeline = GetGraphicsPipeline(vert, frag);
+    });
+    pending_pipelines_[key] = request;
+
+    return std::shared_ptr<Pipeline>();
+}
+
+size_t VezBackend::GetPendingPipelineCount() {
+    // Finished ones are only removed when requested again
+    return std::count_if(
+        pending_pipelines_.begin(), pending_pipelines_.end(),
+        [](const auto& pending) {
+            return pending.second->done.wait_for(std::chrono::seconds(0)) !=
+                   std::future_status::ready;
+        });
+}
+
+void VezBackend::WaitForPendingPipelines() {
+    for (auto& pending : pending_pipelines_) {
+        pending.second->done.wait();
+    }
+    pending_pipelines_.clear();
+}
+
+std::shared_ptr<Pipeline> VezBackend::FindGraphicsPipeline(
+    const ShaderDesc& vert, const ShaderDesc& frag) {
+    std::lock_guard<std::mutex> lock(shader_mutex_);
+
+    auto vs = context_.vertex_shader_cache.find(GetShaderHash(
+        vert.source.c_str(), vert.preamble.c_str(), vert.entry_point.c_str()));
+    if (vs == context_.vertex_shader_cache.end()) {
+        return nullptr;
+    }
+
+    VkShaderModule fragment_shader{VK_NULL_HANDLE};
+    if (!frag.source.empty()) {
+        auto fs = context_.fragment_shader_cache.find(
+            GetShaderHash(frag.source.c_str(), frag.preamble.c_str(),
+                          frag.entry_point.c_str()));
+        if (fs == context_.fragment_shader_cache.end()) {
+            return nullptr;
+        }
+        fragment_shader = fs->second;
+    }
+
+    auto result = context_.pipeline_cache.find(
+        GetGraphicsPipelineHash(vs->second, fragment_shader));
+    if (result == context_.pipeline_cache.end()) {
+        return nullptr;
+    }
+    return result->second;
 }
 
 result<void> VezBackend::ClearShaderCache() {
+    // Background compilations would add to the caches
+    WaitForPendingPipelines();
+    CancelShaderReload();
+    changed_shader_files_.clear();
+    std::lock_guard<std::mutex> lock(shader_mutex_);
+
     auto& per_frame = context_.per_frame[context_.current_frame];
 
     for (auto& shader : context_.vertex_shader_cache) {
@@ -173,10 +346,221 @@ result<void> VezBackend::ClearShaderCache() {
         pipeline.second->valid = false;
     }
     context_.pipeline_cache.clear();
+    context_.shader_files.clear();
+    shader_revision_++;
+
+    return outcome::success();
+}
+
+result<void> VezBackend::ReloadChangedShaders() {
+    if (!config_.watch_shaders) {
+        return outcome::success();
+    }
+
+    for (auto& path : shader_watcher_.Poll()) {
+        changed_shader_files_.insert(std::move(path));
+    }
+
+    if (shader_reload_) {
+        if (shader_reload_->done.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+            return outcome::success();
+        }
+
+        if (shader_reload_->status) {
+            ApplyShaderReload(*shader_reload_);
+            shader_reload_.reset();
+        } else {
+            spdlog::error(
+                "Couldn't reload shaders, keeping the previous ones.");
+            CancelShaderReload();
+        }
+    }
+
+    if (changed_shader_files_.empty()) {
+        return outcome::success();
+    }
+
+    auto reload = std::make_unique<ShaderReload>();
+    {
+        std::lock_guard<std::mutex> lock(shader_mutex_);
+        for (const auto& path : changed_shader_files_) {
+            auto sources = context_.shader_files.find(path);
+            if (sources == context_.shader_files.end()) {
+                continue;
+            }
+
+            for (const auto& source : sources->second) {
+                auto& cache = source.stage == VK_SHADER_STAGE_VERTEX_BIT
+                                  ? context_.vertex_shader_cache
+                                  : context_.fragment_shader_cache;
+                auto hash = GetShaderHash(source.desc.source.c_str(),
+                                          source.desc.preamble.c_str(),
+                                          source.desc.entry_point.c_str());
+
+                auto shader = cache.find(hash);
+                if (shader != cache.end()) {
+                    reload->modules.push_back({source.stage, source.desc, hash,
+                                               shader->second,
+                                               VK_NULL_HANDLE});
+                }
+            }
+        }
+    }
+    changed_shader_files_.clear();
+
+    if (reload->modules.empty()) {
+        return outcome::success();
+    }
+    spdlog::info("Reloading {} shaders.", reload->modules.size());
+
+    auto request = reload.get();
+    reload->done = compile_pool_->push(
+        [this, request]() { request->status = RebuildShaders(*request); });
+    shader_reload_ = std::move(reload);
+
+    return outcome::success();
+}
+
+void VezBackend::RegisterShaderFile(const ShaderDesc& desc,
+                                    VkShaderStageFlagBits stage) {
+    // Called with the shader mutex held
+    if (desc.source_type != ShaderSourceType::Filename) {
+        return;
+    }
+
+    context_.shader_files[desc.source].push_back({stage, desc});
+    if (config_.watch_shaders) {
+        shader_watcher_.Watch(desc.source);
+    }
+}
+
+result<void> VezBackend::RebuildShaders(ShaderReload& reload) {
+    std::map<VkShaderModule, VkShaderModule> replacements;
+    for (auto& module : reload.modules) {
+        OUTCOME_TRY(shader, CreateShaderModule(module.desc, module.stage));
+        module.new_module = shader;
+        replacements[module.old_module] = shader;
+    }
+
+    auto replace = [&replacements](VkShaderModule shader) {
+        auto replacement = replacements.find(shader);
+        return replacement != replacements.end() ? replacement->second
+                                                 : shader;
+    };
+
+    std::vector<VezContext::PipelineHash> hashes;
+    {
+        std::lock_guard<std::mutex> lock(shader_mutex_);
+        for (const auto& pipeline : context_.pipeline_cache) {
+            if (replacements.count(pipeline.first[0]) ||
+                replacements.count(pipeline.first[1])) {
+                hashes.push_back(pipeline.first);
+            }
+        }
+    }
+
+    for (const auto& hash : hashes) {
+        OUTCOME_TRY(pipeline,
+                    CreateGraphicsPipeline(replace(hash[0]), replace(hash[1])));
+        reload.pipelines[hash] = pipeline;
+    }
 
     return outcome::success();
 }
 
+void VezBackend::ApplyShaderReload(ShaderReload& reload) {
+    // Pipelines requested meanwhile may use the previous shaders
+    WaitForPendingPipelines();
+
+    std::lock_guard<std::mutex> lock(shader_mutex_);
+    auto& per_frame = context_.per_frame[context_.current_frame];
+
+    std::map<VkShaderModule, VkShaderModule> replacements;
+    for (const auto& module : reload.modules) {
+        auto& cache = module.stage == VK_SHADER_STAGE_VERTEX_BIT
+                          ? context_.vertex_shader_cache
+                          : context_.fragment_shader_cache;
+        cache[module.hash] = module.new_module;
+        replacements[module.old_module] = module.new_module;
+    }
+
+    auto replace = [&replacements](VkShaderModule shader) {
+        auto replacement = replacements.find(shader);
+        return replacement != replacements.end() ? replacement->second
+                                                 : shader;
+    };
+
+    // Pipelines are updated in place, so that renderer handles stay valid.
+    // The previous ones may still be in use, and get orphaned like in
+    // ClearShaderCache.
+    VezContext::PipelineCache updated;
+    auto pipeline = context_.pipeline_cache.begin();
+    while (pipeline != context_.pipeline_cache.end()) {
+        auto hash =
+            GetGraphicsPipelineHash(replace(pipeline->first[0]),
+                                    replace(pipeline->first[1]));
+        if (hash == pipeline->first) {
+            ++pipeline;
+            continue;
+        }
+
+        VezPipeline vez = VK_NULL_HANDLE;
+        auto rebuilt = reload.pipelines.find(pipeline->first);
+        if (rebuilt != reload.pipelines.end()) {
+            vez = rebuilt->second;
+            reload.pipelines.erase(rebuilt);
+        } else if (auto pipeline_res =
+                       CreateGraphicsPipeline(hash[0], hash[1])) {
+            // Created while the reload was compiling
+            vez = pipeline_res.value();
+        }
+
+        if (vez != VK_NULL_HANDLE) {
+            per_frame.orphaned_pipelines.push_back(pipeline->second->vez);
+            pipeline->second->vez = vez;
+        } else {
+            spdlog::error(
+                "Couldn't rebuild pipeline, keeping the previous one.");
+        }
+
+        updated[hash] = std::move(pipeline->second);
+        pipeline = context_.pipeline_cache.erase(pipeline);
+    }
+    context_.pipeline_cache.insert(updated.begin(), updated.end());
+
+    for (const auto& module : reload.modules) {
+        vezDestroyShaderModule(context_.device, module.old_module);
+    }
+    // Rebuilt for pipelines that are no longer cached
+    for (const auto& rebuilt : reload.pipelines) {
+        vezDestroyPipeline(context_.device, rebuilt.second);
+    }
+
+    spdlog::info("Reloaded {} shaders, updating {} pipelines.",
+                 reload.modules.size(), updated.size());
+    reload.modules.clear();
+    reload.pipelines.clear();
+    shader_revision_++;
+}
+
+void VezBackend::CancelShaderReload() {
+    if (!shader_reload_) {
+        return;
+    }
+
+    shader_reload_->done.wait();
+    for (const auto& module : shader_reload_->modules) {
+        if (module.new_module != VK_NULL_HANDLE) {
+            vezDestroyShaderModule(context_.device, module.new_module);
+        }
+    }
+    for (const auto& rebuilt : shader_reload_->pipelines) {
+        vezDestroyPipeline(context_.device, rebuilt.second);
+    }
+    shader_reload_.reset();
+}
+
 result<std::shared_ptr<VertexInputFormat>> VezBackend::GetVertexInputFormat(
     const VertexInputFormatDesc& desc) {
     assert(context_.device && "Context must be initialized");
@@ -219,12 +603,14 @@ result<std::shared_ptr<VertexInputFormat>> VezBackend::GetVertexInputFormat(
 };
 
 result<std::shared_ptr<Image>> VezBackend::CreateTexture(
-    const char* name, const TextureDesc& texture_desc, void* initial_contents) {
+    ResourceName name, const TextureDesc& texture_desc,
+    void* initial_contents) {
     auto hash = GetTextureHash(name);
     auto result = context_.texture_cache.find(hash);
     if (result != context_.texture_cache.end()) {
-        vezDestroyImageView(context_.device, result->second->vez.image_view);
-        vezDestroyImage(context_.device, result->second->vez.image);
+        // Previous frames may still sample the replaced image
+        OrphanImage(*result->second);
+        context_.texture_cache.erase(result);
     }
 
     VkFormat format = GetVkFormat(texture_desc.format);
@@ -253,36 +639,50 @@ result<std::shared_ptr<Image>> VezBackend::CreateTexture(
         image_info.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
     }
 
+    // Shared between the transfer and graphics queues
+    image_info.queueFamilyIndexCount =
+        static_cast<uint32_t>(context_.upload_queue_families.size());
+    image_info.pQueueFamilyIndices = context_.upload_queue_families.data();
+
     OUTCOME_TRY(vulkan_image, CreateImage(hash, image_info));
 
+    UploadTicket ticket = 0;
     if (initial_contents) {
-        OUTCOME_TRY(FillImage(vulkan_image.image,
+        OUTCOME_TRY(fill_ticket,
+                    FillImage(vulkan_image.image,
                               {texture_desc.width, texture_desc.height},
+                              GetFormatSize(texture_desc.format),
                               {initial_contents}));
-    }
-
-    if (mip_levels > 1) {
-        OUTCOME_TRY(GenerateMipmaps(vulkan_image.image,
-                                    texture_desc.array_layers,
-                                    {texture_desc.width, texture_desc.height}));
+        ticket = fill_ticket;
+
+        if (mip_levels > 1) {
+            // Mipmaps are generated once the copy is submitted
+            context_.pending_mipmaps.push_back(
+                {ticket,
+                 vulkan_image.image,
+                 texture_desc.array_layers,
+                 {texture_desc.width, texture_desc.height}});
+        }
     }
 
     OUTCOME_TRY(sampler, GetSampler(texture_desc.sampler));
     vulkan_image.sampler = sampler;
 
     auto ret = std::make_shared<Image>(vulkan_image);
+    ret->upload_ticket = ticket;
     context_.texture_cache[hash] = ret;
     return ret;
 }
 
 result<std::shared_ptr<Image>> VezBackend::CreateCubemap(
-    const char* name, const TextureDesc& texture_desc,
+    ResourceName name, const TextureDesc& texture_desc,
     const CubemapContents& initial_contents) {
     auto hash = GetTextureHash(name);
     auto result = context_.texture_cache.find(hash);
     if (result != context_.texture_cache.end()) {
-        vezDestroyImageView(context_.device, result->second->vez.image_view);
-        vezDestroyImage(context_.device, result->second->vez.image);
+        // Previous frames may still sample the replaced image
+        OrphanImage(*result->second);
+        context_.texture_cache.erase(result);
     }
 
     VkFormat format = GetVkFormat(texture_desc.format);
@@ -312,32 +712,45 @@ result<std::shared_ptr<Image>> VezBackend::CreateCubemap(
         image_info.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
     }
 
+    // Shared between the transfer and graphics queues
+    image_info.queueFamilyIndexCount =
+        static_cast<uint32_t>(context_.upload_queue_families.size());
+    image_info.pQueueFamilyIndices = context_.upload_queue_families.data();
+
     OUTCOME_TRY(vulkan_image, CreateImage(hash, image_info));
 
+    UploadTicket ticket = 0;
     if (initial_contents) {
-        OUTCOME_TRY(FillImage(vulkan_image.image,
+        OUTCOME_TRY(fill_ticket,
+                    FillImage(vulkan_image.image,
                               {texture_desc.width, texture_desc.height},
+                              GetFormatSize(texture_desc.format),
                               {initial_contents.right, initial_contents.left,
                                initial_contents.up, initial_contents.down,
                                initial_contents.front, initial_contents.back}));
-    }
-
-    if (mip_levels > 1) {
-        OUTCOME_TRY(GenerateMipmaps(vulkan_image.image,
-                                    texture_desc.array_layers * 6,
-                                    {texture_desc.width, texture_desc.height}));
+        ticket = fill_ticket;
+
+        if (mip_levels > 1) {
+            // Mipmaps are generated once the copies are submitted
+            context_.pending_mipmaps.push_back(
+                {ticket,
+                 vulkan_image.image,
+                 texture_desc.array_layers * 6,
+                 {texture_desc.width, texture_desc.height}});
+        }
     }
 
     OUTCOME_TRY(sampler, GetSampler(texture_desc.sampler));
     vulkan_image.sampler = sampler;
 
     auto ret = std::make_shared<Image>(vulkan_image);
+    ret->upload_ticket = ticket;
     context_.texture_cache[hash] = ret;
 
     return ret;
 }
 
-result<std::shared_ptr<Image>> VezBackend::GetTexture(const char* name) {
+result<std::shared_ptr<Image>> VezBackend::GetTexture(ResourceName name) {
     auto hash = GetTextureHash(name);
     auto result = context_.texture_cache.find(hash);
     if (result != context_.texture_cache.end()) {
@@ -347,8 +760,31 @@ result<std::shared_ptr<Image>> VezBackend::GetTexture(const char* name) {
     return Error::NotFound;
 }
 
+result<void> VezBackend::DestroyTexture(const Image& image) {
+    auto& cache = context_.texture_cache;
+    auto result = std::find_if(cache.begin(), cache.end(), [&](const auto& t) {
+        return t.second->vez.image == image.vez.image;
+    });
+    if (result == cache.end()) {
+        return Error::NotFound;
+    }
+
+    OrphanImage(*result->second);
+    cache.erase(result);
+
+    return outcome::success();
+}
+
+void VezBackend::OrphanImage(Image& image) {
+    // Destroyed once the frames that may be using it are complete
+    CancelUploads(VK_NULL_HANDLE, image.vez.image);
+    auto& per_frame = context_.per_frame[context_.current_frame];
+    per_frame.orphaned_images.push_back(image.vez);
+    image.valid = false;
+}
+
 result<Framebuffer> VezBackend::CreateFramebuffer(FrameIndex frame_id,
-                                                  const char* name,
+                                                  ResourceName name,
                                                   RenderPassDesc rp_desc) {
     assert(context_.device &&
            "Context must be initialized before creating a framebuffer");
@@ -373,7 +809,7 @@ result<Framebuffer> VezBackend::CreateFramebuffer(FrameIndex frame_id,
                 spdlog::error(
                     "Could not find color target \"{}\" when creating "
                     "framebuffer \"{}\"",
-                    attachment.rt_name, name);
+                    attachment.rt_name, name.str());
                 return image_res.error();
             }
             auto image = image_res.value();
@@ -388,14 +824,14 @@ result<Framebuffer> VezBackend::CreateFramebuffer(FrameIndex frame_id,
                 spdlog::error(
                     "Dimensions for color image \"{}\" not matching dimensions "
                     "of other images when creating framebuffer \"{}\".",
-                    attachment.rt_name, name);
+                    attachment.rt_name, name.str());
                 return Error::DimensionsNotMatching;
             }
         } else {
             spdlog::error(
                 "Color image \"{}\" not found when creating framebuffer "
                 "\"{}\".",
-                attachment.rt_name, name);
+                attachment.rt_name, name.str());
             return Error::NotFound;
         }
     }
@@ -410,7 +846,7 @@ result<Framebuffer> VezBackend::CreateFramebuffer(FrameIndex frame_id,
                 spdlog::error(
                     "Could not find depth target \"{}\" when creating "
                     "framebuffer \"{}\"",
-                    rp_desc.depth_attachment.rt_name, name);
+                    rp_desc.depth_attachment.rt_name, name.str());
                 return image_res.error();
             }
             auto image = image_res.value();
@@ -425,7 +861,7 @@ result<Framebuffer> VezBackend::CreateFramebuffer(FrameIndex frame_id,
                 spdlog::error(
                     "Dimensions for depth image \"{}\" not matching dimensions "
                     "of other images when creating framebuffer \"{}\".",
-                    rp_desc.depth_attachment.rt_name, name);
+                    rp_desc.depth_attachment.rt_name, name.str());
                 return Error::DimensionsNotMatching;
             }
             extent = depth_image_desc_res->second.extent;
@@ -449,7 +885,7 @@ result<Framebuffer> VezBackend::CreateFramebuffer(FrameIndex frame_id,
 }
 
 result<Framebuffer> VezBackend::GetFramebuffer(FrameIndex frame_id,
-                                               const char* name) {
+                                               ResourceName name) {
     assert(context_.device &&
            "Context must be initialized before getting a framebuffer");
 
@@ -463,7 +899,7 @@ result<Framebuffer> VezBackend::GetFramebuffer(FrameIndex frame_id,
 }
 
 result<std::shared_ptr<Buffer>> VezBackend::CreateUniformBuffer(
-    BufferType type, const GenIndex& index, const char* name, uint64_t size,
+    BufferType type, const GenIndex& index, ResourceName name, uint64_t size,
     bool gpu_stored, void* initial_contents) {
     auto hash = GetBufferHash(type, index, name);
     OUTCOME_TRY(buffer, CreateBuffer(hash, static_cast<VkDeviceSize>(size),
@@ -476,7 +912,7 @@ result<std::shared_ptr<Buffer>> VezBackend::CreateUniformBuffer(
 }
 
 result<std::shared_ptr<Buffer>> VezBackend::GetUniformBuffer(
-    BufferType type, const GenIndex& index, const char* name) {
+    BufferType type, const GenIndex& index, ResourceName name) {
     auto hash = GetBufferHash(type, index, name);
     auto result = context_.buffer_cache.find(hash);
     if (result != context_.buffer_cache.end()) {
@@ -487,7 +923,7 @@ result<std::shared_ptr<Buffer>> VezBackend::GetUniformBuffer(
 }
 
 result<std::shared_ptr<Buffer>> VezBackend::CreateUniformBuffer(
-    const char* name, uint64_t size, bool gpu_stored, void* initial_contents) {
+    ResourceName name, uint64_t size, bool gpu_stored, void* initial_contents) {
     auto hash = GetBufferHash(name);
     OUTCOME_TRY(buffer, CreateBuffer(hash, static_cast<VkDeviceSize>(size),
                                      gpu_stored ? VEZ_MEMORY_GPU_ONLY
@@ -498,7 +934,8 @@ result<std::shared_ptr<Buffer>> VezBackend::CreateUniformBuffer(
     return buffer;
 }
 
-result<std::shared_ptr<Buffer>> VezBackend::GetUniformBuffer(const char* name) {
+result<std::shared_ptr<Buffer>> VezBackend::GetUniformBuffer(
+    ResourceName name) {
     auto hash = GetBufferHash(name);
     auto result = context_.buffer_cache.find(hash);
     if (result != context_.buffer_cache.end()) {
@@ -509,7 +946,7 @@ result<std::shared_ptr<Buffer>> VezBackend::GetUniformBuffer(const char* name) {
 }
 
 result<std::shared_ptr<Buffer>> VezBackend::CreateVertexBuffer(
-    const AttachmentIndex<Mesh>& mesh, const char* name, uint64_t size,
+    const AttachmentIndex<Mesh>& mesh, ResourceName name, uint64_t size,
     bool gpu_stored, void* initial_contents) {
     auto hash = GetBufferHash(BufferType::PerMesh, mesh, name);
     OUTCOME_TRY(buffer, CreateBuffer(hash, static_cast<VkDeviceSize>(size),
@@ -522,7 +959,7 @@ result<std::shared_ptr<Buffer>> VezBackend::CreateVertexBuffer(
 }
 
 result<std::shared_ptr<Buffer>> VezBackend::GetVertexBuffer(
-    const AttachmentIndex<Mesh>& mesh, const char* name) {
+    const AttachmentIndex<Mesh>& mesh, ResourceName name) {
     auto hash = GetBufferHash(BufferType::PerMesh, mesh, name);
     auto result = context_.buffer_cache.find(hash);
     if (result != context_.buffer_cache.end()) {
@@ -533,7 +970,7 @@ result<std::shared_ptr<Buffer>> VezBackend::GetVertexBuffer(
 }
 
 result<std::shared_ptr<Buffer>> VezBackend::CreateIndexBuffer(
-    const AttachmentIndex<Mesh>& mesh, const char* name, uint64_t size,
+    const AttachmentIndex<Mesh>& mesh, ResourceName name, uint64_t size,
     bool gpu_stored, void* initial_contents) {
     auto hash = GetBufferHash(BufferType::PerMesh, mesh, name);
     OUTCOME_TRY(buffer, CreateBuffer(hash, static_cast<VkDeviceSize>(size),
@@ -546,7 +983,7 @@ result<std::shared_ptr<Buffer>> VezBackend::CreateIndexBuffer(
 }
 
 result<std::shared_ptr<Buffer>> VezBackend::GetIndexBuffer(
-    const AttachmentIndex<Mesh>& mesh, const char* name) {
+    const AttachmentIndex<Mesh>& mesh, ResourceName name) {
     auto hash = GetBufferHash(BufferType::PerMesh, mesh, name);
     auto result = context_.buffer_cache.find(hash);
     if (result != context_.buffer_cache.end()) {
@@ -571,27 +1008,139 @@ result<void> VezBackend::UpdateBuffer(const Buffer& buffer, uint64_t offset,
     return outcome::success();
 }
 
+result<UploadTicket> VezBackend::UploadBuffer(const Buffer& buffer,
+                                              uint64_t offset, uint64_t size,
+                                              const void* contents) {
+    if (!buffer.valid) {
+        return Error::InvalidBuffer;
+    }
+    if (size == 0) {
+        return context_.last_upload_ticket;
+    }
+
+    VezContext::PendingUpload upload{};
+    upload.buffer = buffer.vez;
+    upload.buffer_offset = offset;
+    upload.size = size;
+    return QueueUpload(std::move(upload), contents);
+}
+
+result<UploadTicket> VezBackend::CopyBuffer(const Buffer& src,
+                                            uint64_t src_offset,
+                                            const Buffer& dst,
+                                            uint64_t dst_offset,
+                                            uint64_t size) {
+    if (!src.valid || !dst.valid) {
+        return Error::InvalidBuffer;
+    }
+
+    // Copies share the ticket sequence with uploads, so that
+    // they only run once the source data has been uploaded
+    VezContext::BufferCopy copy{};
+    copy.ticket = ++context_.last_upload_ticket;
+    copy.src = src.vez;
+    copy.dst = dst.vez;
+    copy.region = {src_offset, dst_offset, size};
+    context_.pending_buffer_copies.push_back(copy);
+
+    return copy.ticket;
+}
+
+result<void> VezBackend::DestroyBuffer(const Buffer& buffer) {
+    auto& cache = context_.buffer_cache;
+    auto result = std::find_if(cache.begin(), cache.end(), [&](const auto& b) {
+        return b.second->vez == buffer.vez;
+    });
+    if (result == cache.end()) {
+        return Error::NotFound;
+    }
+
+    // Destroyed once the frames that may be using it are complete
+    CancelUploads(buffer.vez, VK_NULL_HANDLE);
+    auto& per_frame = context_.per_frame[context_.current_frame];
+    per_frame.orphaned_buffers.push_back(buffer.vez);
+
+    result->second->valid = false;
+    cache.erase(result);
+
+    return outcome::success();
+}
+
+bool VezBackend::IsUploadComplete(UploadTicket ticket) {
+    // Submitted uploads and the copies on the setup command buffer are
+    // waited on by the next graphics submission at every stage, vertex
+    // input included, so any command recorded from now on can use them
+    return ticket <= context_.submitted_upload_ticket;
+}
+
 result<void> VezBackend::SetRenderPlan(RenderPlan render_plan) {
+    OUTCOME_TRY(compiled_plan, CompileRenderPlan(render_plan));
+
     // Teardown any existing render plan
-    for (auto framebuffer : context_.framebuffer_cache) {
-        vezDestroyFramebuffer(context_.device, framebuffer.second);
+    if (context_.device) {
+        vezDeviceWaitIdle(context_.device);
     }
+    DestroyRenderTargets();
 
-    for (auto image : context_.fb_image_cache) {
-        vezDestroyImageView(context_.device, image.second->vez.image_view);
-        vezDestroyImage(context_.device, image.second->vez.image);
+    // Queries refer to passes of the previous plan
+    for (auto& per_frame : context_.per_frame) {
+        per_frame.stats_query_passes.clear();
     }
+    pass_stats_.clear();
 
     // Copy the render plan into render_plan
     render_plan_ = std::move(render_plan);
+    compiled_plan_ = std::move(compiled_plan);
+
+    if (compiled_plan_.culled_passes > 0) {
+        spdlog::info("Render plan: {} of {} passes culled.",
+                     compiled_plan_.culled_passes, render_plan_.passes.size());
+    }
+
+    // Target sizes depend on the swapchain
+    if (context_.swapchain) {
+        auto bandwidth = GetRenderPlanBandwidth();
+        for (const auto& pass : bandwidth.passes) {
+            spdlog::debug("Pass \"{}\": {:.1f} MB read, {:.1f} MB written.",
+                          pass.name, pass.read / (1024.0 * 1024.0),
+                          pass.written / (1024.0 * 1024.0));
+        }
+        spdlog::info(
+            "Render plan: {:.1f} MB read, {:.1f} MB written per frame.",
+            bandwidth.read / (1024.0 * 1024.0),
+            bandwidth.written / (1024.0 * 1024.0));
+    }
     return outcome::success();
 }
 
+RenderPlanBandwidth VezBackend::GetRenderPlanBandwidth() {
+    std::vector<uint64_t> target_sizes;
+    for (const auto& target : compiled_plan_.targets) {
+        const auto& extent = target.depth ? target.depth_desc.extent
+                                          : target.color_desc.extent;
+        auto samples = target.depth ? target.depth_desc.samples
+                                    : target.color_desc.samples;
+        auto format = target.depth ? target.depth_desc.format
+                                   : GetRenderTargetFormat(target.color_desc);
+
+        auto absolute_extent = GetAbsoluteExtent(extent);
+        target_sizes.push_back(uint64_t(absolute_extent.rounded_width()) *
+                               absolute_extent.rounded_height() * samples *
+                               GetFormatSize(format));
+    }
+
+    return EstimateBandwidth(compiled_plan_, target_sizes);
+}
+
 result<void> VezBackend::RenderFrame(std::vector<PassFn> pass_fns,
-                                     const char* present_image) {
+                                     ResourceName present_image) {
     auto frame_id = StartFrame().value();
 
-    for (size_t i = 0; i < render_plan_.passes.size(); i++) {
+    for (size_t p = 0; p < compiled_plan_.passes.size(); p++) {
+        const auto& compiled_pass = compiled_plan_.passes[p];
+        current_pass_ = p;
+
+        auto i = compiled_pass.entry;
         auto& pass = render_plan_.passes[i];
         const auto& pass_name =
             pass.match([](const GeneralPassEntry& gp) { return gp.name; },
@@ -604,6 +1153,10 @@ result<void> VezBackend::RenderFrame(std::vector<PassFn> pass_fns,
         }
         auto& pass_fn = (pass_fns.size() == 1) ? pass_fns[0] : pass_fns[i];
 
+        if (!IsPassEnabled(pass_name)) {
+            continue;
+        }
+
         auto pass_res = pass.match(
             [&pass_fn, frame_id](const GeneralPassEntry&) {
                 return pass_fn(frame_id, nullptr);
@@ -635,7 +1188,7 @@ result<void> VezBackend::RenderFrame(std::vector<PassFn> pass_fns,
         }
 
         if (rp_in_progress_) {
-            vezCmdEndRenderPass();
+            EndRenderPass();
         };
         rp_in_progress_ = false;
 
@@ -655,15 +1208,19 @@ result<void> VezBackend::RenderFrame(std::vector<PassFn> pass_fns,
                         const auto& rt_desc_res =
                             render_plan_.color_images.find(c.rt_name);
                         if (rt_desc_res != render_plan_.color_images.end()) {
-                            auto extent =
-                                GetAbsoluteExtent(rt_desc_res->second.extent);
+                            auto rt_extent = rt_desc_res->second.extent;
+                            if (rt_extent.type ==
+                                ExtentType::RelativeToSwapchain) {
+                                rt_extent.width *= render_scale_;
+                                rt_extent.height *= render_scale_;
+                            }
+                            auto extent = GetAbsoluteExtent(rt_extent);
 
                             VezImageResolve resolve{};
                             resolve.srcSubresource = {0, 0, 1};
                             resolve.dstSubresource = {0, 0, 1};
-                            resolve.extent = {
-                                static_cast<uint32_t>(extent.width),
-                                static_cast<uint32_t>(extent.height), 1};
+                            resolve.extent = {extent.rounded_width(),
+                                              extent.rounded_height(), 1};
                             vezCmdResolveImage(src_image->vez.image,
                                                dst_image->vez.image, 1,
                                                &resolve);
@@ -688,18 +1245,36 @@ result<void> VezBackend::RenderFrame(std::vector<PassFn> pass_fns,
             OUTCOME_TRY(src_image, GetRenderTarget(frame_id, b.src.rt.c_str()));
             OUTCOME_TRY(dst_image, GetRenderTarget(frame_id, b.dst.rt.c_str()));
 
+            auto src_extent = GetAbsoluteExtent(b.src.extent);
+            auto dst_extent = GetAbsoluteExtent(b.dst.extent);
+
+            // Without scaling, a copy does the same and is also valid for
+            // depth targets, which cannot be blitted with a linear filter
+            if (src_extent.rounded_width() == dst_extent.rounded_width() &&
+                src_extent.rounded_height() == dst_extent.rounded_height()) {
+                VezImageCopy copy{};
+                copy.srcSubresource = {b.src.mip_level, b.src.base_array_layer,
+                                       b.src.layer_count};
+                copy.dstSubresource = {b.dst.mip_level, b.dst.base_array_layer,
+                                       b.dst.layer_count};
+                copy.extent = {src_extent.rounded_width(),
+                               src_extent.rounded_height(), 1};
+
+                vezCmdCopyImage(src_image->vez.image, dst_image->vez.image, 1,
+                                &copy);
+                continue;
+            }
+
             VezImageBlit blit{};
             blit.srcSubresource = {b.src.mip_level, b.src.base_array_layer,
                                    b.src.layer_count};
             blit.dstSubresource = {b.dst.mip_level, b.dst.base_array_layer,
                                    b.dst.layer_count};
 
-            auto src_extent = GetAbsoluteExtent(b.src.extent);
             blit.srcOffsets[1] = {
                 static_cast<int32_t>(src_extent.rounded_width()),
                 static_cast<int32_t>(src_extent.rounded_height()), 1};
 
-            auto dst_extent = GetAbsoluteExtent(b.dst.extent);
             blit.dstOffsets[1] = {
                 static_cast<int32_t>(dst_extent.rounded_width()),
                 static_cast<int32_t>(dst_extent.rounded_height()), 1};
@@ -725,12 +1300,25 @@ result<void> VezBackend::RenderFrame(std::vector<PassFn> pass_fns,
     }
     per_frame.setup_semaphore = VK_NULL_HANDLE;
 
+    if (per_frame.upload_fence != VK_NULL_HANDLE) {
+        VK_CHECK(vezWaitForFences(context_.device, 1, &per_frame.upload_fence,
+                                  VK_TRUE, ~0ULL));
+        vezDestroyFence(context_.device, per_frame.upload_fence);
+        per_frame.upload_fence = VK_NULL_HANDLE;
+
+        // The staging memory can now be reused
+        context_.staging_ring.release(per_frame.staging_batch);
+    }
+    per_frame.upload_semaphore = VK_NULL_HANDLE;
+
     if (per_frame.submission_fence != VK_NULL_HANDLE) {
         VK_CHECK(vezWaitForFences(context_.device, 1,
                                   &per_frame.submission_fence, VK_TRUE, ~0ULL));
         vezDestroyFence(context_.device, per_frame.submission_fence);
         per_frame.submission_fence = VK_NULL_HANDLE;
     }
+    ReadPassStats();
+    ReadFrameTimer();
 
     // Destroy any orphaned pipelines
     std::for_each(
@@ -739,6 +1327,75 @@ result<void> VezBackend::RenderFrame(std::vector<PassFn> pass_fns,
         [this](VezPipeline p) { vezDestroyPipeline(context_.device, p); });
     per_frame.orphaned_pipelines.clear();
 
+    for (auto buffer : per_frame.orphaned_buffers) {
+        vezDestroyBuffer(context_.device, buffer);
+    }
+    per_frame.orphaned_buffers.clear();
+
+    for (const auto& image : per_frame.orphaned_images) {
+        vezDestroyImageView(context_.device, image.image_view);
+        vezDestroyImage(context_.device, image.image);
+    }
+    per_frame.orphaned_images.clear();
+
+    return outcome::success();
+}
+
+uint32_t VezBackend::GetRecordingThreadCount() {
+    return static_cast<uint32_t>(thread_pool_->size());
+}
+
+result<void> VezBackend::RecordParallel(uint32_t thread_count,
+                                        const RecordFn& record_fn) {
+    // Splitting the pass needs its attachments to be stored in between
+    bool stored = current_rp_desc_.depth_attachment.rt_name.empty() ||
+                  current_rp_desc_.depth_attachment.store;
+    for (const auto& attachment : current_rp_desc_.color_attachments) {
+        stored = stored && attachment.store;
+    }
+
+    if (thread_count <= 1 || !rp_in_progress_ || !stored) {
+        return Backend::RecordParallel(thread_count, record_fn);
+    }
+
+    // V-EZ has no secondary command buffers, so the current command buffer
+    // is closed and each thread resumes the render pass in its own one.
+    // They are all submitted in order at the end of the frame.
+    EndRenderPass();
+    rp_in_progress_ = false;
+    bound_state = nullptr;
+    VK_CHECK(vezEndCommandBuffer());
+
+    auto& per_frame = context_.per_frame[context_.current_frame];
+    per_frame.command_buffer_active = false;
+
+    OUTCOME_TRY(first, AcquireCommandBuffers(thread_count));
+
+    auto record_thread = [&](size_t thread) -> result<void> {
+        OUTCOME_TRY(BeginCommandBuffer(first + thread));
+        BeginRenderPass(current_framebuffer_, current_rp_desc_, true);
+
+        auto res = record_fn(static_cast<uint32_t>(thread));
+
+        EndRenderPass();
+        bound_state = nullptr;
+        VK_CHECK(vezEndCommandBuffer());
+        return res;
+    };
+
+    std::vector<result<void>> results(thread_count, outcome::success());
+    thread_pool_->parallel_for(thread_count, [&](size_t thread) {
+        results[thread] = record_thread(thread);
+    });
+
+    // Anything else in the pass goes to a new command buffer
+    OUTCOME_TRY(GetActiveCommandBuffer());
+    BeginRenderPass(current_framebuffer_, current_rp_desc_, true);
+    rp_in_progress_ = true;
+
+    for (auto& res : results) {
+        OUTCOME_TRY(res);
+    }
     return outcome::success();
 }
 
@@ -746,6 +1403,15 @@ result<void> VezBackend::BindUniformBuffer(const Buffer& buffer,
                                            uint64_t offset, uint64_t size,
                                            uint32_t binding,
                                            uint32_t array_index) {
+    if (array_index == 0) {
+        if (!NeedsBind(&Bindings::uniform_buffers, binding,
+                       BoundState::BufferBinding{buffer.vez, offset, size})) {
+            return outcome::success();
+        }
+    } else if (bound_state) {
+        bound_state->issued++;
+    }
+
     vezCmdBindBuffer(buffer.vez, offset, size, 0, binding, array_index);
     return outcome::success();
 }
@@ -758,9 +1424,13 @@ result<void> VezBackend::BindTexture(const Image& image, uint32_t binding,
         sampler_ovr = s;
     }
 
-    vezCmdBindImageView(image.vez.image_view,
-                        sampler_override ? sampler_ovr : image.vez.sampler, 0,
-                        binding, 0);
+    BoundState::ImageBinding image_binding{
+        image.vez.image_view,
+        sampler_override ? sampler_ovr : image.vez.sampler};
+    if (NeedsBind(&Bindings::images, binding, image_binding)) {
+        vezCmdBindImageView(image_binding.image_view, image_binding.sampler,
+                            0, binding, 0);
+    }
 
     return outcome::success();
 }
@@ -775,16 +1445,24 @@ result<void> VezBackend::BindTextures(const std::vector<Image>& images,
     }
 
     for (const auto& image : images) {
-        vezCmdBindImageView(image.vez.image_view,
-                            sampler_override ? sampler_ovr : image.vez.sampler,
-                            0, first_binding, 0);
+        BoundState::ImageBinding image_binding{
+            image.vez.image_view,
+            sampler_override ? sampler_ovr : image.vez.sampler};
+        if (NeedsBind(&Bindings::images, first_binding, image_binding)) {
+            vezCmdBindImageView(image_binding.image_view,
+                                image_binding.sampler, 0, first_binding, 0);
+        }
     }
     return outcome::success();
 }
 
 result<void> VezBackend::BindVertexBuffer(const Buffer& vertex_buffer,
                                           uint32_t binding, size_t offset) {
-    vezCmdBindVertexBuffers(binding, 1, &vertex_buffer.vez, &offset);
+    VkDeviceSize vk_offset = static_cast<VkDeviceSize>(offset);
+    if (NeedsBind(&Bindings::vertex_buffers, binding,
+                  BoundState::BufferBinding{vertex_buffer.vez, vk_offset})) {
+        vezCmdBindVertexBuffers(binding, 1, &vertex_buffer.vez, &vk_offset);
+    }
     return outcome::success();
 }
 
@@ -802,36 +1480,83 @@ result<void> VezBackend::BindVertexBuffers(
     std::vector<VkBuffer> buffers;
     buffers.reserve(vertex_buffers.size());
 
+    std::vector<bool> changed;
+    changed.reserve(vertex_buffers.size());
     for (const auto& vb : vertex_buffers) {
+        auto binding = first_binding + static_cast<uint32_t>(buffers.size());
+        BoundState::BufferBinding buffer_binding{vb.vez,
+                                                 vk_offsets[buffers.size()]};
+        changed.push_back(
+            !bound_state ||
+            BoundState::Update(
+                BoundState::Slot(bound_state->bindings.vertex_buffers,
+                                 binding),
+                buffer_binding));
         buffers.push_back(vb.vez);
     }
 
-    vezCmdBindVertexBuffers(first_binding,
-                            static_cast<uint32_t>(buffers.size()),
-                            buffers.data(), vk_offsets.data());
+    // Only runs of changed bindings are issued, each as one call
+    uint64_t calls = 0;
+    for (size_t first = 0; first < buffers.size();) {
+        if (!changed[first]) {
+            first++;
+            continue;
+        }
+
+        auto last = first;
+        while (last < buffers.size() && changed[last]) {
+            last++;
+        }
+
+        vezCmdBindVertexBuffers(first_binding + static_cast<uint32_t>(first),
+                                static_cast<uint32_t>(last - first),
+                                &buffers[first], &vk_offsets[first]);
+        calls++;
+        first = last;
+    }
+
+    if (bound_state) {
+        if (calls > 0) {
+            bound_state->issued += calls;
+        } else {
+            bound_state->elided++;
+        }
+    }
     return outcome::success();
 }
 
 result<void> VezBackend::BindIndexBuffer(const Buffer& index_buffer,
                                          uint64_t offset, bool short_indices) {
-    vezCmdBindIndexBuffer(
+    BoundState::IndexBinding index_binding{
         index_buffer.vez, static_cast<VkDeviceSize>(offset),
-        short_indices ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
+        short_indices ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32};
+    if (NeedsBind(&Bindings::index_buffer, index_binding)) {
+        vezCmdBindIndexBuffer(index_binding.buffer, index_binding.offset,
+                              index_binding.index_type);
+    }
     return outcome::success();
 }
 
 result<void> VezBackend::BindGraphicsPipeline(Pipeline pipeline) {
-    vezCmdBindPipeline(pipeline.vez);
+    if (NeedsBind(&Bindings::pipeline, pipeline.vez)) {
+        vezCmdBindPipeline(pipeline.vez);
+    }
     return outcome::success();
 }
 
 result<void> VezBackend::BindVertexInputFormat(
     VertexInputFormat vertex_input_format) {
-    vezCmdSetVertexInputFormat(vertex_input_format.vez);
+    if (NeedsBind(&Bindings::vertex_input_format, vertex_input_format.vez)) {
+        vezCmdSetVertexInputFormat(vertex_input_format.vez);
+    }
     return outcome::success();
 }
 
 result<void> VezBackend::BindDepthStencilState(const DepthStencilState& state) {
+    if (!NeedsBind(&Bindings::depth_stencil, state)) {
+        return outcome::success();
+    }
+
     VezDepthStencilState vez_state{};
     vez_state.depthTestEnable = state.depth_test;
     vez_state.depthWriteEnable = state.depth_write;
@@ -884,6 +1609,10 @@ result<void> VezBackend::BindColorBlendState(const ColorBlendState& state) {
 }
 
 result<void> VezBackend::BindMultisampleState(const MultisampleState& state) {
+    if (!NeedsBind(&Bindings::multisample, state)) {
+        return outcome::success();
+    }
+
     VezMultisampleState vez_state{};
 
     // Reduce state.samples to a power of 2
@@ -908,6 +1637,10 @@ result<void> VezBackend::BindMultisampleState(const MultisampleState& state) {
 
 result<void> VezBackend::BindInputAssemblyState(
     const InputAssemblyState& state) {
+    if (!NeedsBind(&Bindings::input_assembly, state)) {
+        return outcome::success();
+    }
+
     VezInputAssemblyState vez_state{};
     vez_state.topology = static_cast<VkPrimitiveTopology>(state.topology);
     vez_state.primitiveRestartEnable = state.primitive_restart;
@@ -918,9 +1651,15 @@ result<void> VezBackend::BindInputAssemblyState(
 
 result<void> VezBackend::BindRasterizationState(
     const RasterizationState& state) {
+    if (!NeedsBind(&Bindings::rasterization, state)) {
+        return outcome::success();
+    }
+
     VezRasterizationState vez_state{};
     vez_state.depthBiasEnable = state.depth_bias;
-    vez_state.depthClampEnable = state.depth_clamp;
+    // Left off on devices without the feature, see SupportsDepthClamp()
+    vez_state.depthClampEnable =
+        state.depth_clamp && context_.features.depthClamp;
     vez_state.cullMode = static_cast<VkCullModeFlags>(state.cull_mode);
     vez_state.frontFace = static_cast<VkFrontFace>(state.front_face);
     vez_state.polygonMode = static_cast<VkPolygonMode>(state.polygon_mode);
@@ -965,6 +1704,14 @@ result<void> VezBackend::SetBlendConstants(
 
 result<void> VezBackend::SetViewport(const std::vector<Viewport> viewports,
                                      uint32_t first_viewport) {
+    if (viewports.size() == 1 && first_viewport == 0) {
+        if (!NeedsBind(&Bindings::viewport, viewports[0])) {
+            return outcome::success();
+        }
+    } else if (first_viewport == 0) {
+        UntrackedBind(&Bindings::viewport);
+    }
+
     std::vector<VkViewport> viewports_vez;
     for (const auto& viewport : viewports) {
         viewports_vez.push_back({viewport.x, viewport.y, viewport.width,
@@ -980,6 +1727,14 @@ result<void> VezBackend::SetViewport(const std::vector<Viewport> viewports,
 
 result<void> VezBackend::SetScissor(const std::vector<Scissor> scissors,
                                     uint32_t first_scissor) {
+    if (scissors.size() == 1 && first_scissor == 0) {
+        if (!NeedsBind(&Bindings::scissor, scissors[0])) {
+            return outcome::success();
+        }
+    } else if (first_scissor == 0) {
+        UntrackedBind(&Bindings::scissor);
+    }
+
     std::vector<VkRect2D> scissors_vez;
     for (const auto& scissor : scissors) {
         scissors_vez.push_back(
@@ -1007,37 +1762,132 @@ result<void> VezBackend::DrawIndexed(uint32_t index_count,
     return outcome::success();
 }
 
-result<size_t> VezBackend::StartFrame(uint32_t threads) {
-    assert(context_.device &&
-           "Context must be initialized before starting a frame");
-    VkDevice device = context_.device;
-
-    if (threads == 0) {
-        threads = 1;
+result<void> VezBackend::ExecuteCommands(const CommandStream& stream) {
+    // Calls are qualified to skip virtual dispatch in the loop
+    for (const auto& command : stream) {
+        switch (command.type()) {
+            case CommandType::BindGraphicsPipeline: {
+                auto& cmd = command.as<commands::BindGraphicsPipeline>();
+                if (NeedsBind(&Bindings::pipeline, cmd.pipeline->vez)) {
+                    vezCmdBindPipeline(cmd.pipeline->vez);
+                }
+                break;
+            }
+            case CommandType::BindVertexInputFormat: {
+                auto& cmd = command.as<commands::BindVertexInputFormat>();
+                if (NeedsBind(&Bindings::vertex_input_format,
+                              cmd.vertex_input_format->vez)) {
+                    vezCmdSetVertexInputFormat(cmd.vertex_input_format->vez);
+                }
+                break;
+            }
+            case CommandType::BindVertexBuffer: {
+                auto& cmd = command.as<commands::BindVertexBuffer>();
+                if (NeedsBind(&Bindings::vertex_buffers, cmd.binding,
+                              BoundState::BufferBinding{cmd.buffer->vez,
+                                                        cmd.offset})) {
+                    VkDeviceSize offset = cmd.offset;
+                    vezCmdBindVertexBuffers(cmd.binding, 1, &cmd.buffer->vez,
+                                            &offset);
+                }
+                break;
+            }
+            case CommandType::BindIndexBuffer: {
+                auto& cmd = command.as<commands::BindIndexBuffer>();
+                OUTCOME_TRY(VezBackend::BindIndexBuffer(
+                    *cmd.buffer, cmd.offset, cmd.short_indices));
+                break;
+            }
+            case CommandType::BindTexture: {
+                auto& cmd = command.as<commands::BindTexture>();
+                OUTCOME_TRY(VezBackend::BindTexture(
+                    *cmd.image, cmd.binding,
+                    cmd.has_sampler_override ? &cmd.sampler_override
+                                             : nullptr));
+                break;
+            }
+            case CommandType::BindUniformBuffer: {
+                auto& cmd = command.as<commands::BindUniformBuffer>();
+                OUTCOME_TRY(VezBackend::BindUniformBuffer(
+                    *cmd.buffer, cmd.offset, cmd.size, cmd.binding,
+                    cmd.array_index));
+                break;
+            }
+            case CommandType::UpdateBuffer: {
+                auto& cmd = command.as<commands::UpdateBuffer>();
+                OUTCOME_TRY(VezBackend::UpdateBuffer(
+                    *cmd.buffer, cmd.offset, cmd.size,
+                    command.payload<commands::UpdateBuffer>()));
+                break;
+            }
+            case CommandType::BindDepthStencilState: {
+                auto& cmd = command.as<commands::BindDepthStencilState>();
+                OUTCOME_TRY(VezBackend::BindDepthStencilState(cmd.state));
+                break;
+            }
+            case CommandType::BindRasterizationState: {
+                auto& cmd = command.as<commands::BindRasterizationState>();
+                OUTCOME_TRY(VezBackend::BindRasterizationState(cmd.state));
+                break;
+            }
+            case CommandType::BindMultisampleState: {
+                auto& cmd = command.as<commands::BindMultisampleState>();
+                OUTCOME_TRY(VezBackend::BindMultisampleState(cmd.state));
+                break;
+            }
+            case CommandType::SetViewport: {
+                auto& cmd = command.as<commands::SetViewport>();
+                auto& viewport = cmd.viewport;
+                if (cmd.index != 0 ||
+                    NeedsBind(&Bindings::viewport, viewport)) {
+                    VkViewport viewport_vez = {
+                        viewport.x,         viewport.y,
+                        viewport.width,     viewport.height,
+                        viewport.min_depth, viewport.max_depth};
+                    vezCmdSetViewport(cmd.index, 1, &viewport_vez);
+                }
+                break;
+            }
+            case CommandType::SetScissor: {
+                auto& cmd = command.as<commands::SetScissor>();
+                auto& scissor = cmd.scissor;
+                if (cmd.index != 0 || NeedsBind(&Bindings::scissor, scissor)) {
+                    VkRect2D scissor_vez = {{scissor.x, scissor.y},
+                                            {scissor.width, scissor.height}};
+                    vezCmdSetScissor(cmd.index, 1, &scissor_vez);
+                }
+                break;
+            }
+            case CommandType::Draw: {
+                auto& cmd = command.as<commands::Draw>();
+                vezCmdDraw(cmd.vertex_count, cmd.instance_count,
+                           cmd.first_vertex, cmd.first_instance);
+                break;
+            }
+            case CommandType::DrawIndexed: {
+                auto& cmd = command.as<commands::DrawIndexed>();
+                vezCmdDrawIndexed(cmd.index_count, cmd.instance_count,
+                                  cmd.first_index, cmd.vertex_offset,
+                                  cmd.first_instance);
+                break;
+            }
+        }
     }
 
-    auto& per_frame = context_.per_frame[context_.current_frame];
-
-    auto command_buffer_count = per_frame.command_buffers.size();
-    if (threads > command_buffer_count) {
-        VkQueue graphics_queue = VK_NULL_HANDLE;
-        vezGetDeviceGraphicsQueue(device, 0, &graphics_queue);
+    return outcome::success();
+}
 
-        VezCommandBufferAllocateInfo cmd_info{};
-        cmd_info.commandBufferCount =
-            static_cast<uint32_t>(threads - command_buffer_count);
-        cmd_info.queue = graphics_queue;
+result<size_t> VezBackend::StartFrame() {
+    assert(context_.device &&
+           "Context must be initialized before starting a frame");
 
-        per_frame.command_buffers.resize(threads);
-        VK_CHECK(vezAllocateCommandBuffers(
-            context_.device, &cmd_info,
-            &per_frame.command_buffers[command_buffer_count]));
-    }
+    auto& per_frame = context_.per_frame[context_.current_frame];
+    per_frame.command_buffer_count = 0;
+    per_frame.command_buffer_active = false;
+    per_frame.stats_query_passes.clear();
 
-    per_frame.command_buffer_active.resize(threads);
-    for (size_t i = 0; i < per_frame.command_buffer_active.size(); i++) {
-        per_frame.command_buffer_active[i] = false;
-    }
+    // Submit the uploads for this frame before any rendering
+    OUTCOME_TRY(FlushUploads());
 
     return context_.current_frame;
 }
@@ -1051,16 +1901,27 @@ result<void> VezBackend::StartRenderPass(Framebuffer fb,
     OUTCOME_TRY(GetActiveCommandBuffer());
 
     if (rp_in_progress_) {
-        vezCmdEndRenderPass();
+        EndRenderPass();
     };
     rp_in_progress_ = false;
 
+    current_framebuffer_ = fb.vez;
+    current_rp_desc_ = std::move(rp_desc);
+
+    OUTCOME_TRY(ResetPassStats());
+    BeginRenderPass(current_framebuffer_, current_rp_desc_, false);
+    rp_in_progress_ = true;
+    return outcome::success();
+}
+
+void VezBackend::BeginRenderPass(VezFramebuffer framebuffer,
+                                 const RenderPassDesc& rp_desc, bool load) {
     std::vector<VezAttachmentInfo> attach_infos;
 
     for (auto attachment : rp_desc.color_attachments) {
         attach_infos.push_back(
-            {attachment.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR
-                              : VK_ATTACHMENT_LOAD_OP_LOAD,
+            {attachment.clear && !load ? VK_ATTACHMENT_LOAD_OP_CLEAR
+                                       : VK_ATTACHMENT_LOAD_OP_LOAD,
              attachment.store ? VK_ATTACHMENT_STORE_OP_STORE
                               : VK_ATTACHMENT_STORE_OP_DONT_CARE,
              {attachment.clear_color[0], attachment.clear_color[1],
@@ -1069,8 +1930,9 @@ result<void> VezBackend::StartRenderPass(Framebuffer fb,
 
     if (!rp_desc.depth_attachment.rt_name.empty()) {
         VezAttachmentInfo depth_info{
-            rp_desc.depth_attachment.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR
-                                           : VK_ATTACHMENT_LOAD_OP_LOAD,
+            rp_desc.depth_attachment.clear && !load
+                ? VK_ATTACHMENT_LOAD_OP_CLEAR
+                : VK_ATTACHMENT_LOAD_OP_LOAD,
             rp_desc.depth_attachment.store ? VK_ATTACHMENT_STORE_OP_STORE
                                            : VK_ATTACHMENT_STORE_OP_DONT_CARE};
         depth_info.clearValue.depthStencil = {
@@ -1080,34 +1942,194 @@ result<void> VezBackend::StartRenderPass(Framebuffer fb,
     }
 
     VezRenderPassBeginInfo rp_info{};
-    rp_info.framebuffer = fb.vez;
+    rp_info.framebuffer = framebuffer;
     rp_info.attachmentCount = static_cast<uint32_t>(attach_infos.size());
     rp_info.pAttachments = attach_infos.data();
 
     vezCmdBeginRenderPass(&rp_info);
-    rp_in_progress_ = true;
+
+    // Nothing is assumed to carry over into the pass
+    if (bound_state) {
+        bound_state->Invalidate();
+    }
+
+    BeginPassQuery();
+}
+
+void VezBackend::EndRenderPass() {
+    if (active_stats_query != kNoStatsQuery) {
+        auto& per_frame = context_.per_frame[context_.current_frame];
+        vezCmdEndQuery(per_frame.stats_query_pool, active_stats_query);
+        active_stats_query = kNoStatsQuery;
+    }
+
+    vezCmdEndRenderPass();
+}
+
+result<void> VezBackend::ResetPassStats() {
+    auto& per_frame = context_.per_frame[context_.current_frame];
+
+    // Once per frame, before the first query is begun
+    if (!config_.pass_statistics ||
+        !context_.features.pipelineStatisticsQuery ||
+        !per_frame.stats_query_passes.empty()) {
+        return outcome::success();
+    }
+
+    if (per_frame.stats_query_pool == VK_NULL_HANDLE) {
+        VezQueryPoolCreateInfo pool_info{};
+        pool_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        pool_info.queryCount = kMaxStatsQueries;
+        pool_info.pipelineStatistics =
+            VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+        VK_CHECK(vezCreateQueryPool(context_.device, &pool_info,
+                                    &per_frame.stats_query_pool));
+    }
+
+    vezCmdResetQueryPool(per_frame.stats_query_pool, 0, kMaxStatsQueries);
+    return outcome::success();
+}
+
+void VezBackend::BeginPassQuery() {
+    auto& per_frame = context_.per_frame[context_.current_frame];
+    if (per_frame.stats_query_pool == VK_NULL_HANDLE) {
+        return;
+    }
+
+    // Worker threads resume the pass at the same time
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+
+    auto& query_passes = per_frame.stats_query_passes;
+    if (query_passes.size() >= kMaxStatsQueries) {
+        return;
+    }
+
+    active_stats_query = static_cast<uint32_t>(query_passes.size());
+    query_passes.push_back(current_pass_);
+    vezCmdBeginQuery(per_frame.stats_query_pool, active_stats_query, 0);
+}
+
+void VezBackend::ReadPassStats() {
+    auto& per_frame = context_.per_frame[context_.current_frame];
+
+    auto query_passes = std::move(per_frame.stats_query_passes);
+    per_frame.stats_query_passes.clear();
+
+    auto query_count = static_cast<uint32_t>(query_passes.size());
+    if (query_count == 0) {
+        return;
+    }
+
+    // The frame has finished, so the results are available
+    std::vector<uint64_t> results(query_count);
+    auto res = vezGetQueryPoolResults(
+        context_.device, per_frame.stats_query_pool, 0, query_count,
+        results.size() * sizeof(uint64_t), results.data(), sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT);
+    if (res != VK_SUCCESS) {
+        return;
+    }
+
+    pass_stats_.clear();
+    for (const auto& pass : compiled_plan_.passes) {
+        pass_stats_.push_back({pass.name});
+    }
+    for (uint32_t q = 0; q < query_count; q++) {
+        pass_stats_[query_passes[q]].fragment_invocations += results[q];
+    }
+}
+
+result<void> VezBackend::BeginFrameTimer() {
+    auto& per_frame = context_.per_frame[context_.current_frame];
+    per_frame.frame_timed = false;
+
+    if (!context_.properties.limits.timestampComputeAndGraphics) {
+        return outcome::success();
+    }
+
+    if (per_frame.timestamp_query_pool == VK_NULL_HANDLE) {
+        VezQueryPoolCreateInfo pool_info{};
+        pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        pool_info.queryCount = 2;
+
+        VK_CHECK(vezCreateQueryPool(context_.device, &pool_info,
+                                    &per_frame.timestamp_query_pool));
+    }
+
+    vezCmdResetQueryPool(per_frame.timestamp_query_pool, 0, 2);
+    vezCmdWriteTimestamp(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         per_frame.timestamp_query_pool, 0);
     return outcome::success();
 }
 
+void VezBackend::EndFrameTimer() {
+    auto& per_frame = context_.per_frame[context_.current_frame];
+    if (per_frame.timestamp_query_pool == VK_NULL_HANDLE) {
+        return;
+    }
+
+    vezCmdWriteTimestamp(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         per_frame.timestamp_query_pool, 1);
+    per_frame.frame_timed = true;
+}
+
+void VezBackend::ReadFrameTimer() {
+    auto& per_frame = context_.per_frame[context_.current_frame];
+    if (!per_frame.frame_timed) {
+        return;
+    }
+    per_frame.frame_timed = false;
+
+    // The frame has finished, so the results are available
+    std::array<uint64_t, 2> timestamps{};
+    auto res = vezGetQueryPoolResults(
+        context_.device, per_frame.timestamp_query_pool, 0, 2,
+        sizeof(timestamps), timestamps.data(), sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT);
+    if (res != VK_SUCCESS || timestamps[1] < timestamps[0]) {
+        return;
+    }
+
+    // Ticks are timestampPeriod nanoseconds long
+    gpu_frame_time_ = static_cast<float>(
+        (timestamps[1] - timestamps[0]) *
+        static_cast<double>(context_.properties.limits.timestampPeriod) *
+        1e-9);
+}
+
 result<void> VezBackend::FinishFrame() {
     VkDevice device = context_.device;
 
     VkQueue graphics_queue = VK_NULL_HANDLE;
     vezGetDeviceGraphicsQueue(device, 0, &graphics_queue);
 
+    // The submission needs at least one command buffer
+    OUTCOME_TRY(GetActiveCommandBuffer());
+
     if (rp_in_progress_) {
-        vezCmdEndRenderPass();
+        EndRenderPass();
     }
     rp_in_progress_ = false;
 
+    EndFrameTimer();
     vezEndCommandBuffer();
+    bound_state = nullptr;
 
     auto& per_frame = context_.per_frame[context_.current_frame];
+    per_frame.command_buffer_active = false;
 
-    // Submit the command buffer for the current thread
+    bind_stats_ = {};
+    for (size_t i = 0; i < per_frame.command_buffer_count; i++) {
+        bind_stats_.issued += per_frame.bound_states[i].issued;
+        bind_stats_.elided += per_frame.bound_states[i].elided;
+    }
+
+    // Submit the command buffers of the frame in recording order
     VezSubmitInfo submit_info{};
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &per_frame.command_buffers[0];
+    submit_info.commandBufferCount =
+        static_cast<uint32_t>(per_frame.command_buffer_count);
+    submit_info.pCommandBuffers = per_frame.command_buffers.data();
     submit_info.signalSemaphoreCount = 1;
     submit_info.pSignalSemaphores = &per_frame.submission_semaphore;
 
@@ -1116,7 +2138,14 @@ result<void> VezBackend::FinishFrame() {
 
     if (per_frame.setup_semaphore != VK_NULL_HANDLE) {
         wait_semaphores.push_back(per_frame.setup_semaphore);
-        wait_dst.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+        wait_dst.push_back(GetSetupWaitStages());
+    }
+
+    if (per_frame.upload_semaphore != VK_NULL_HANDLE) {
+        // Not waited on by a setup command buffer
+        wait_semaphores.push_back(per_frame.upload_semaphore);
+        wait_dst.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+        per_frame.upload_semaphore = VK_NULL_HANDLE;
     }
 
     if (per_frame.presentation_semaphore != VK_NULL_HANDLE) {
@@ -1134,7 +2163,7 @@ result<void> VezBackend::FinishFrame() {
     return outcome::success();
 }
 
-result<void> VezBackend::PresentImage(const char* present_image_name) {
+result<void> VezBackend::PresentImage(ResourceName present_image_name) {
     VkDevice device = context_.device;
 
     OUTCOME_TRY(fb_image,
@@ -1166,10 +2195,22 @@ result<void> VezBackend::PresentImage(const char* present_image_name) {
 };
 
 result<void> VezBackend::TeardownContext() {
+    WaitForPendingPipelines();
+    CancelShaderReload();
+
     if (context_.device) {
         vezDeviceWaitIdle(context_.device);
     }
 
+    const auto& shader_stats = context_.spirv_cache.stats();
+    if (shader_stats.hits + shader_stats.misses > 0) {
+        spdlog::info(
+            "Shader cache: {} hits, {} misses ({} outdated), {} rejected.",
+            shader_stats.hits, shader_stats.misses, shader_stats.invalidated,
+            shader_stats.rejected);
+    }
+    context_.spirv_cache.Save();
+
     for (auto& per_frame : context_.per_frame) {
         if (per_frame.setup_command_buffer != VK_NULL_HANDLE) {
             vezFreeCommandBuffers(context_.device, 1,
@@ -1177,6 +2218,34 @@ result<void> VezBackend::TeardownContext() {
             per_frame.setup_command_buffer = VK_NULL_HANDLE;
         }
 
+        if (per_frame.upload_command_buffer != VK_NULL_HANDLE) {
+            vezFreeCommandBuffers(context_.device, 1,
+                                  &per_frame.upload_command_buffer);
+            per_frame.upload_command_buffer = VK_NULL_HANDLE;
+        }
+
+        for (auto buffer : per_frame.orphaned_buffers) {
+            vezDestroyBuffer(context_.device, buffer);
+        }
+        per_frame.orphaned_buffers.clear();
+
+        for (const auto& image : per_frame.orphaned_images) {
+            vezDestroyImageView(context_.device, image.image_view);
+            vezDestroyImage(context_.device, image.image);
+        }
+        per_frame.orphaned_images.clear();
+
+        if (per_frame.stats_query_pool != VK_NULL_HANDLE) {
+            vezDestroyQueryPool(context_.device, per_frame.stats_query_pool);
+            per_frame.stats_query_pool = VK_NULL_HANDLE;
+        }
+
+        if (per_frame.timestamp_query_pool != VK_NULL_HANDLE) {
+            vezDestroyQueryPool(context_.device,
+                                per_frame.timestamp_query_pool);
+            per_frame.timestamp_query_pool = VK_NULL_HANDLE;
+        }
+
         vezFreeCommandBuffers(
             context_.device,
             static_cast<uint32_t>(per_frame.command_buffers.size()),
@@ -1188,20 +2257,13 @@ result<void> VezBackend::TeardownContext() {
         vertex_input.second->valid = false;
     }
 
-    for (auto framebuffer : context_.framebuffer_cache) {
-        vezDestroyFramebuffer(context_.device, framebuffer.second);
-    }
+    DestroyRenderTargets();
 
     for (auto image : context_.texture_cache) {
         vezDestroyImageView(context_.device, image.second->vez.image_view);
         vezDestroyImage(context_.device, image.second->vez.image);
     }
 
-    for (auto image : context_.fb_image_cache) {
-        vezDestroyImageView(context_.device, image.second->vez.image_view);
-        vezDestroyImage(context_.device, image.second->vez.image);
-    }
-
     for (auto sampler : context_.sampler_cache) {
         vezDestroySampler(context_.device, sampler.second);
     }
@@ -1212,6 +2274,11 @@ result<void> VezBackend::TeardownContext() {
     }
     context_.buffer_cache.clear();
 
+    if (context_.staging_buffer) {
+        vezUnmapBuffer(context_.device, context_.staging_buffer);
+        vezDestroyBuffer(context_.device, context_.staging_buffer);
+    }
+
     for (auto pipeline : context_.pipeline_cache) {
         vezDestroyPipeline(context_.device, pipeline.second->vez);
         pipeline.second->valid = false;
@@ -1424,108 +2491,148 @@ result<VezSwapchain> VezBackend::CreateSwapchain(VkSurfaceKHR surface) {
 
 result<VkShaderModule> VezBackend::GetVertexShaderModule(
     const ShaderDesc& vert) {
-    assert(context_.device &&
-           "Context must be initialized before creating a shader");
-    VkDevice device = context_.device;
-
     auto hash = GetShaderHash(vert.source.c_str(), vert.preamble.c_str(),
                               vert.entry_point.c_str());
-    auto result = context_.vertex_shader_cache.find(hash);
-
-    if (result != context_.vertex_shader_cache.end()) {
-        return result->second;
-    } else {
-        std::string buffer;
-        if (vert.source_type == ShaderSourceType::Filename) {
-            std::ifstream t(vert.source,
-                            std::ios_base::in | std::ios_base::binary);
-            t.seekg(0, std::ios::end);
-            size_t size = t.tellg();
-
-            buffer.resize(size);
-            t.seekg(0);
-            t.read(&buffer[0], size);
+    {
+        std::lock_guard<std::mutex> lock(shader_mutex_);
+        auto result = context_.vertex_shader_cache.find(hash);
+        if (result != context_.vertex_shader_cache.end()) {
+            return result->second;
         }
+    }
 
-        VezShaderModuleCreateInfo shader_info{};
-        shader_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-
-        if (vert.source_type == ShaderSourceType::Filename) {
-            shader_info.pGLSLSource = buffer.c_str();
-        } else {
-            shader_info.pGLSLSource = vert.source.c_str();
-        }
-        shader_info.pPreamble = vert.preamble.c_str();
-        shader_info.pEntryPoint = vert.entry_point.c_str();
-
-        VkShaderModule shader = VK_NULL_HANDLE;
-        auto shader_compilation_result =
-            vezCreateShaderModule(device, &shader_info, &shader);
-
-        if (shader_compilation_result == VK_ERROR_INITIALIZATION_FAILED) {
-            // The info log is stored in the V-EZ shader object
-            auto vez_shader = reinterpret_cast<vez::ShaderModule*>(shader);
-            spdlog::error("Vertex shader compilation failed:\n{}",
-                          vez_shader->GetInfoLog());
-        }
-        VK_CHECK(shader_compilation_result);
+    OUTCOME_TRY(shader, CreateShaderModule(vert, VK_SHADER_STAGE_VERTEX_BIT));
 
-        context_.vertex_shader_cache[hash] = shader;
-        return shader;
+    // Another thread may have compiled the same shader meanwhile
+    std::lock_guard<std::mutex> lock(shader_mutex_);
+    auto result = context_.vertex_shader_cache.find(hash);
+    if (result != context_.vertex_shader_cache.end()) {
+        vezDestroyShaderModule(context_.device, shader);
+        return result->second;
     }
+
+    context_.vertex_shader_cache[hash] = shader;
+    RegisterShaderFile(vert, VK_SHADER_STAGE_VERTEX_BIT);
+    return shader;
 }
 
 result<VkShaderModule> VezBackend::GetFragmentShaderModule(
     const ShaderDesc& frag) {
-    assert(context_.device &&
-           "Context must be initialized before creating a shader");
-    VkDevice device = context_.device;
-
     auto hash = GetShaderHash(frag.source.c_str(), frag.preamble.c_str(),
                               frag.entry_point.c_str());
-    auto result = context_.fragment_shader_cache.find(hash);
+    {
+        std::lock_guard<std::mutex> lock(shader_mutex_);
+        auto result = context_.fragment_shader_cache.find(hash);
+        if (result != context_.fragment_shader_cache.end()) {
+            return result->second;
+        }
+    }
+
+    OUTCOME_TRY(shader, CreateShaderModule(frag, VK_SHADER_STAGE_FRAGMENT_BIT));
 
+    // Another thread may have compiled the same shader meanwhile
+    std::lock_guard<std::mutex> lock(shader_mutex_);
+    auto result = context_.fragment_shader_cache.find(hash);
     if (result != context_.fragment_shader_cache.end()) {
+        vezDestroyShaderModule(context_.device, shader);
         return result->second;
-    } else {
-        std::string buffer;
-        if (frag.source_type == ShaderSourceType::Filename) {
-            std::ifstream t(frag.source,
-                            std::ios_base::in | std::ios_base::binary);
-            t.seekg(0, std::ios::end);
-            size_t size = t.tellg();
+    }
 
-            buffer.resize(size);
-            t.seekg(0);
-            t.read(&buffer[0], size);
-        }
+    context_.fragment_shader_cache[hash] = shader;
+    RegisterShaderFile(frag, VK_SHADER_STAGE_FRAGMENT_BIT);
+    return shader;
+}
 
-        VezShaderModuleCreateInfo shader_info{};
-        shader_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+result<VkShaderModule> VezBackend::CreateShaderModule(
+    const ShaderDesc& desc, VkShaderStageFlagBits stage) {
+    assert(context_.device &&
+           "Context must be initialized before creating a shader");
+    VkDevice device = context_.device;
 
-        if (frag.source_type == ShaderSourceType::Filename) {
-            shader_info.pGLSLSource = buffer.c_str();
-        } else {
-            shader_info.pGLSLSource = frag.source.c_str();
+    std::string buffer;
+    if (desc.source_type == ShaderSourceType::Filename) {
+        std::ifstream t(desc.source, std::ios_base::in | std::ios_base::binary);
+        t.seekg(0, std::ios::end);
+        size_t size = t.tellg();
+
+        buffer.resize(size);
+        t.seekg(0);
+        t.read(&buffer[0], size);
+    }
+    const auto& glsl_source =
+        desc.source_type == ShaderSourceType::Filename ? buffer : desc.source;
+
+    // The identity of a shader is where it comes from, the content is
+    // everything the compiled code depends on
+    auto hash_parts = [](std::initializer_list<const std::string*> parts) {
+        std::string key;
+        for (auto part : parts) {
+            key.append(*part);
+            key.push_back('\0');
         }
-        shader_info.pPreamble = frag.preamble.c_str();
-        shader_info.pEntryPoint = frag.entry_point.c_str();
-
-        VkShaderModule shader = VK_NULL_HANDLE;
-        auto shader_compilation_result =
-            vezCreateShaderModule(device, &shader_info, &shader);
+        return MurmurHash3(key.data(), key.size());
+    };
 
-        if (shader_compilation_result == VK_ERROR_INITIALIZATION_FAILED) {
-            // The info log is stored in the V-EZ shader object
-            auto vez_shader = reinterpret_cast<vez::ShaderModule*>(shader);
-            spdlog::error("Fragment shader compilation failed:\n{}",
-                          vez_shader->GetInfoLog());
+    std::string stage_name = std::to_string(stage);
+    std::string compiler_version = std::to_string(kShaderCompilerVersion) +
+                                   "." + std::to_string(VK_HEADER_VERSION);
+
+    SpirvCache::Key key{
+        hash_parts({&stage_name, &desc.source, &desc.preamble,
+                    &desc.entry_point}),
+        hash_parts({&compiler_version, &stage_name, &glsl_source,
+                    &desc.preamble, &desc.entry_point})};
+
+    VezShaderModuleCreateInfo shader_info{};
+    shader_info.stage = stage;
+    shader_info.pEntryPoint = desc.entry_point.c_str();
+
+    // Copied, as other threads may replace the entry
+    std::vector<uint32_t> code;
+    {
+        std::lock_guard<std::mutex> lock(shader_mutex_);
+        if (auto cached = context_.spirv_cache.Find(key)) {
+            code = *cached;
         }
-        VK_CHECK(shader_compilation_result);
+    }
 
-        context_.fragment_shader_cache[hash] = shader;
-        return shader;
+    if (!code.empty()) {
+        shader_info.codeSize = code.size() * sizeof(uint32_t);
+        shader_info.pCode = code.data();
+    } else {
+        shader_info.pGLSLSource = glsl_source.c_str();
+        shader_info.pPreamble = desc.preamble.c_str();
+    }
+
+    VkShaderModule shader = VK_NULL_HANDLE;
+    auto shader_compilation_result =
+        vezCreateShaderModule(device, &shader_info, &shader);
+
+    if (shader_compilation_result == VK_ERROR_INITIALIZATION_FAILED) {
+        // The info log is stored in the V-EZ shader object
+        auto vez_shader = reinterpret_cast<vez::ShaderModule*>(shader);
+        spdlog::error("{} shader compilation failed:\n{}",
+                      stage == VK_SHADER_STAGE_VERTEX_BIT ? "Vertex"
+                                                          : "Fragment",
+                      vez_shader->GetInfoLog());
+    }
+    VK_CHECK(shader_compilation_result);
+
+    if (code.empty()) {
+        // The length is in bytes
+        uint32_t length = 0;
+        vezGetShaderModuleBinary(shader, &length, nullptr);
+
+        std::vector<uint32_t> binary(length / sizeof(uint32_t));
+        if (!binary.empty() &&
+            vezGetShaderModuleBinary(shader, &length, binary.data()) ==
+                VK_SUCCESS) {
+            std::lock_guard<std::mutex> lock(shader_mutex_);
+            context_.spirv_cache.Insert(key, std::move(binary));
+        }
     }
+
+    return shader;
 }
 
 result<std::shared_ptr<Buffer>> VezBackend::CreateBuffer(
@@ -1537,7 +2644,10 @@ result<std::shared_ptr<Buffer>> VezBackend::CreateBuffer(
 
     auto result = context_.buffer_cache.find(hash);
     if (result != context_.buffer_cache.end()) {
-        vezDestroyBuffer(device, result->second->vez);
+        // The old buffer may still be in use by frames in flight
+        CancelUploads(result->second->vez, VK_NULL_HANDLE);
+        auto& per_frame = context_.per_frame[context_.current_frame];
+        per_frame.orphaned_buffers.push_back(result->second->vez);
         result->second->valid = false;
     }
 
@@ -1545,31 +2655,43 @@ result<std::shared_ptr<Buffer>> VezBackend::CreateBuffer(
     buffer_info.size = size;
     buffer_info.usage = usage;
 
+    bool staged = initial_contents && storage == VEZ_MEMORY_GPU_ONLY;
+    if (storage == VEZ_MEMORY_GPU_ONLY) {
+        // Filled from the staging buffer, possibly on the transfer queue,
+        // or copied to other buffers on the graphics queue
+        buffer_info.usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                             VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        buffer_info.queueFamilyIndexCount =
+            static_cast<uint32_t>(context_.upload_queue_families.size());
+        buffer_info.pQueueFamilyIndices =
+            context_.upload_queue_families.data();
+    }
+
     VkBuffer buffer = VK_NULL_HANDLE;
     VK_CHECK(vezCreateBuffer(device, storage, &buffer_info, &buffer));
 
-    if (initial_contents) {
-        if (storage != VEZ_MEMORY_GPU_ONLY) {
-            void* buffer_memory;
-            VK_CHECK(vezMapBuffer(device, buffer, 0, size, &buffer_memory));
-            memcpy(buffer_memory, initial_contents, size);
-
-            VezMappedBufferRange range{};
-            range.buffer = buffer;
-            range.offset = 0;
-            range.size = size;
-            VK_CHECK(vezFlushMappedBufferRanges(device, 1, &range));
-
-            vezUnmapBuffer(device, buffer);
-        } else {
-            // GPU-only buffer can't be mapped, so we use V-EZ's utility
-            // function to submit data
-            VK_CHECK(
-                vezBufferSubData(device, buffer, 0, size, initial_contents));
-        }
+    UploadTicket ticket = 0;
+    if (staged) {
+        VezContext::PendingUpload upload{};
+        upload.buffer = buffer;
+        upload.size = size;
+        ticket = QueueUpload(std::move(upload), initial_contents);
+    } else if (initial_contents) {
+        void* buffer_memory;
+        VK_CHECK(vezMapBuffer(device, buffer, 0, size, &buffer_memory));
+        memcpy(buffer_memory, initial_contents, size);
+
+        VezMappedBufferRange range{};
+        range.buffer = buffer;
+        range.offset = 0;
+        range.size = size;
+        VK_CHECK(vezFlushMappedBufferRanges(device, 1, &range));
+
+        vezUnmapBuffer(device, buffer);
     }
 
     auto ret = std::make_shared<Buffer>(buffer);
+    ret->upload_ticket = ticket;
     context_.buffer_cache[hash] = ret;
     return ret;
 }
@@ -1585,7 +2707,7 @@ result<std::shared_ptr<Buffer>> VezBackend::GetBuffer(
 }
 
 result<std::shared_ptr<Image>> VezBackend::CreateRenderTarget(
-    FrameIndex frame_id, const char* name,
+    FrameIndex frame_id, ResourceName name,
     const ColorRenderTargetDesc& image_desc) {
     auto hash = GetRenderTargetHash(frame_id, name);
     auto result = context_.fb_image_cache.find(hash);
@@ -1594,22 +2716,8 @@ result<std::shared_ptr<Image>> VezBackend::CreateRenderTarget(
         vezDestroyImage(context_.device, result->second->vez.image);
     }
 
-    VkFormat format = GetVkFormat(image_desc.format);
-    Extent extent = GetAbsoluteExtent(image_desc.extent);
-
-    VezImageCreateInfo image_info{};
-    image_info.extent = {extent.rounded_width(), extent.rounded_height(), 1};
-    image_info.imageType = VK_IMAGE_TYPE_2D;
-    image_info.arrayLayers = 1;
-    image_info.mipLevels = image_desc.mip_levels;
-    image_info.format = format;
-    image_info.samples = static_cast<VkSampleCountFlagBits>(image_desc.samples);
-    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-    image_info.usage =
-        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
-        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-
-    OUTCOME_TRY(vulkan_image, CreateImage(hash, image_info));
+    OUTCOME_TRY(vulkan_image,
+                CreateImage(hash, GetRenderTargetInfo(image_desc)));
     OUTCOME_TRY(sampler, GetSampler(image_desc.sampler));
     vulkan_image.sampler = sampler;
 
@@ -1619,7 +2727,7 @@ result<std::shared_ptr<Image>> VezBackend::CreateRenderTarget(
 }
 
 result<std::shared_ptr<Image>> VezBackend::CreateRenderTarget(
-    FrameIndex frame_id, const char* name,
+    FrameIndex frame_id, ResourceName name,
     const DepthRenderTargetDesc& image_desc) {
     auto hash = GetRenderTargetHash(frame_id, name);
     auto result = context_.fb_image_cache.find(hash);
@@ -1628,7 +2736,64 @@ result<std::shared_ptr<Image>> VezBackend::CreateRenderTarget(
         vezDestroyImage(context_.device, result->second->vez.image);
     }
 
-    VkFormat format = GetVkFormat(image_desc.format);
+    OUTCOME_TRY(vulkan_image,
+                CreateImage(hash, GetRenderTargetInfo(image_desc)));
+    OUTCOME_TRY(sampler, GetSampler(image_desc.sampler));
+    vulkan_image.sampler = sampler;
+
+    auto ret = std::make_shared<Image>(vulkan_image);
+    context_.fb_image_cache[hash] = ret;
+    return ret;
+}
+
+VezImageCreateInfo VezBackend::GetRenderTargetInfo(
+    const ColorRenderTargetDesc& image_desc) {
+    Extent extent = GetAbsoluteExtent(image_desc.extent);
+
+    VezImageCreateInfo image_info{};
+    image_info.extent = {extent.rounded_width(), extent.rounded_height(), 1};
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.arrayLayers = 1;
+    image_info.mipLevels = image_desc.mip_levels;
+    image_info.format = GetVkFormat(GetRenderTargetFormat(image_desc));
+    image_info.samples = static_cast<VkSampleCountFlagBits>(image_desc.samples);
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = kColorTargetUsage;
+    return image_info;
+}
+
+Format VezBackend::GetRenderTargetFormat(
+    const ColorRenderTargetDesc& image_desc) {
+    if (image_desc.format != Format::UFloatB10G11R11) {
+        return image_desc.format;
+    }
+
+    // Packed floats are not required to be renderable, blendable or
+    // multisampled, unlike half floats
+    auto format = GetVkFormat(image_desc.format);
+    VkFormatFeatureFlags features =
+        VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT |
+        VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BLEND_BIT;
+
+    VkFormatProperties properties{};
+    vkGetPhysicalDeviceFormatProperties(context_.physical_device, format,
+                                        &properties);
+
+    VkImageFormatProperties image_properties{};
+    auto image_res = vkGetPhysicalDeviceImageFormatProperties(
+        context_.physical_device, format, VK_IMAGE_TYPE_2D,
+        VK_IMAGE_TILING_OPTIMAL, kColorTargetUsage, 0, &image_properties);
+
+    if ((properties.optimalTilingFeatures & features) != features ||
+        image_res != VK_SUCCESS ||
+        !(image_properties.sampleCounts & image_desc.samples)) {
+        return Format::SFloatRGBA16;
+    }
+    return image_desc.format;
+}
+
+VezImageCreateInfo VezBackend::GetRenderTargetInfo(
+    const DepthRenderTargetDesc& image_desc) {
     Extent extent = GetAbsoluteExtent(image_desc.extent);
 
     VezImageCreateInfo image_info{};
@@ -1636,37 +2801,54 @@ result<std::shared_ptr<Image>> VezBackend::CreateRenderTarget(
     image_info.imageType = VK_IMAGE_TYPE_2D;
     image_info.arrayLayers = 1;
     image_info.mipLevels = 1;
-    image_info.format = format;
+    image_info.format = GetVkFormat(image_desc.format);
     image_info.samples = static_cast<VkSampleCountFlagBits>(image_desc.samples);
     image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
     image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
-                       VK_IMAGE_USAGE_SAMPLED_BIT;
+                       VK_IMAGE_USAGE_SAMPLED_BIT |
+                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                       VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    return image_info;
+}
 
-    OUTCOME_TRY(vulkan_image, CreateImage(hash, image_info));
-    OUTCOME_TRY(sampler, GetSampler(image_desc.sampler));
-    vulkan_image.sampler = sampler;
+void VezBackend::DestroyRenderTargets() {
+    for (auto framebuffer : context_.framebuffer_cache) {
+        vezDestroyFramebuffer(context_.device, framebuffer.second);
+    }
+    context_.framebuffer_cache.clear();
 
-    auto ret = std::make_shared<Image>(vulkan_image);
-    context_.fb_image_cache[hash] = ret;
-    return ret;
+    for (auto image : context_.fb_image_cache) {
+        vezDestroyImageView(context_.device, image.second->vez.image_view);
+        vezDestroyImage(context_.device, image.second->vez.image);
+    }
+    context_.fb_image_cache.clear();
 }
 
 result<std::shared_ptr<Image>> VezBackend::GetRenderTarget(FrameIndex frame_id,
-                                                           const char* name) {
+                                                           ResourceName name) {
     auto hash = GetRenderTargetHash(frame_id, name);
     auto result = context_.fb_image_cache.find(hash);
     if (result != context_.fb_image_cache.end()) {
         return result->second;
     } else {
-        auto desc_res = render_plan_.color_images.find(name);
-        if (desc_res != render_plan_.color_images.end()) {
+        // Only searched once per render target, as it is cached afterwards
+        auto has_name = [name](const auto& image) {
+            return ResourceName(image.first) == name;
+        };
+
+        auto& color_images = render_plan_.color_images;
+        auto desc_res =
+            std::find_if(color_images.begin(), color_images.end(), has_name);
+        if (desc_res != color_images.end()) {
             OUTCOME_TRY(fb_image,
                         CreateRenderTarget(frame_id, name, desc_res->second));
             return fb_image;
         }
 
-        auto depth_desc_res = render_plan_.depth_images.find(name);
-        if (depth_desc_res != render_plan_.depth_images.end()) {
+        auto& depth_images = render_plan_.depth_images;
+        auto depth_desc_res =
+            std::find_if(depth_images.begin(), depth_images.end(), has_name);
+        if (depth_desc_res != depth_images.end()) {
             OUTCOME_TRY(fb_image, CreateRenderTarget(frame_id, name,
                                                      depth_desc_res->second));
             return fb_image;
@@ -1677,6 +2859,9 @@ result<std::shared_ptr<Image>> VezBackend::GetRenderTarget(FrameIndex frame_id,
 }
 
 result<VkSampler> VezBackend::GetSampler(const SamplerDesc& sampler_desc) {
+    // Sampler overrides can be bound while recording in parallel
+    std::lock_guard<std::mutex> lock(sampler_mutex_);
+
     auto hash = GetSamplerHash(sampler_desc);
     auto result = context_.sampler_cache.find(hash);
 
@@ -1756,7 +2941,14 @@ result<VulkanImage> VezBackend::CreateImage(VezContext::ImageHash hash,
 
     VkImage image = VK_NULL_HANDLE;
     VK_CHECK(vezCreateImage(device, VEZ_MEMORY_GPU_ONLY, &image_info, &image));
+    OUTCOME_TRY(image_view, CreateImageView(image, image_info));
+
+    VulkanImage vulkan_image{image, image_view};
+    return vulkan_image;
+}
 
+result<VkImageView> VezBackend::CreateImageView(
+    VkImage image, const VezImageCreateInfo& image_info) {
     VezImageSubresourceRange range{};
     range.layerCount = image_info.arrayLayers;
     range.levelCount = image_info.mipLevels;
@@ -1775,30 +2967,29 @@ result<VulkanImage> VezBackend::CreateImage(VezContext::ImageHash hash,
                                    : VK_IMAGE_VIEW_TYPE_2D;
 
     VkImageView image_view;
-    VK_CHECK(vezCreateImageView(device, &image_view_info, &image_view));
-
-    VulkanImage vulkan_image{image, image_view};
-    return vulkan_image;
+    VK_CHECK(
+        vezCreateImageView(context_.device, &image_view_info, &image_view));
+    return image_view;
 }
 
-result<void> VezBackend::FillImage(VkImage image, VkExtent2D extent,
-                                   std::vector<void*> initial_contents) {
-    uint32_t i = 0;
-    for (auto& data : initial_contents) {
-        VezImageSubresourceLayers layers{};
-        layers.baseArrayLayer = i++;
-        layers.layerCount = 1;
-        layers.mipLevel = 0;
+result<UploadTicket> VezBackend::FillImage(
+    VkImage image, VkExtent2D extent, uint32_t texel_size,
+    std::vector<void*> initial_contents) {
+    UploadTicket ticket = 0;
 
-        VezImageSubDataInfo sub_data_info{};
-        sub_data_info.imageExtent = {extent.width, extent.height, 1};
-        sub_data_info.imageOffset = {0, 0, 0};
-        sub_data_info.imageSubresource = layers;
+    uint32_t layer = 0;
+    for (auto& data : initial_contents) {
+        VezContext::PendingUpload upload{};
+        upload.image = image;
+        upload.extent = extent;
+        upload.layer = layer++;
+        upload.texel_size = texel_size;
+        upload.size = VkDeviceSize(extent.width) * extent.height * texel_size;
 
-        vezImageSubData(context_.device, image, &sub_data_info, data);
+        ticket = QueueUpload(std::move(upload), data);
     }
 
-    return outcome::success();
+    return ticket;
 }
 
 result<void> VezBackend::GenerateMipmaps(VkImage image, uint32_t layer_count,
@@ -1831,6 +3022,288 @@ result<void> VezBackend::GenerateMipmaps(VkImage image, uint32_t layer_count,
     return outcome::success();
 }
 
+result<void> VezBackend::InitUploads() {
+    VkDevice device = context_.device;
+
+    // Look for a transfer-only queue family, so that uploads can run
+    // alongside rendering. Otherwise, use the graphics queue.
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(context_.physical_device,
+                                             &family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(context_.physical_device,
+                                             &family_count, families.data());
+
+    uint32_t graphics_family = family_count;
+    uint32_t transfer_family = family_count;
+    for (uint32_t i = 0; i < family_count; i++) {
+        auto flags = families[i].queueFlags;
+        if (graphics_family == family_count &&
+            (flags & VK_QUEUE_GRAPHICS_BIT)) {
+            graphics_family = i;
+        }
+        if (transfer_family == family_count &&
+            (flags & VK_QUEUE_TRANSFER_BIT) &&
+            !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            transfer_family = i;
+        }
+    }
+
+    if (transfer_family != family_count) {
+        vezGetDeviceTransferQueue(device, 0, &context_.transfer_queue);
+    }
+
+    if (context_.transfer_queue != VK_NULL_HANDLE) {
+        context_.upload_queue_families = {graphics_family, transfer_family};
+    } else {
+        vezGetDeviceGraphicsQueue(device, 0, &context_.transfer_queue);
+    }
+
+    // The staging buffer stays mapped for its whole lifetime
+    VezBufferCreateInfo buffer_info{};
+    buffer_info.size = config_.staging_size;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VK_CHECK(vezCreateBuffer(device, VEZ_MEMORY_CPU_TO_GPU, &buffer_info,
+                             &context_.staging_buffer));
+
+    void* staging_data = nullptr;
+    VK_CHECK(vezMapBuffer(device, context_.staging_buffer, 0,
+                          config_.staging_size, &staging_data));
+    context_.staging_data = static_cast<uint8_t*>(staging_data);
+    context_.staging_ring = RingAllocator(config_.staging_size);
+
+    return outcome::success();
+}
+
+UploadTicket VezBackend::QueueUpload(VezContext::PendingUpload upload,
+                                     const void* data) {
+    auto ticket = ++context_.last_upload_ticket;
+    upload.ticket = ticket;
+
+    // Uploads are staged in order, so only copy directly
+    // to the staging buffer if nothing is waiting
+    if (context_.pending_uploads.empty()) {
+        StageUpload(upload, data);
+    }
+
+    if (upload.uploaded < upload.size) {
+        // Over budget, keep a copy of the data for later frames
+        auto bytes = static_cast<const uint8_t*>(data);
+        upload.data.assign(bytes, bytes + upload.size);
+        context_.pending_uploads.push_back(std::move(upload));
+    }
+
+    return ticket;
+}
+
+void VezBackend::StageUpload(VezContext::PendingUpload& upload,
+                             const void* data) {
+    const VkDeviceSize kStagingAlignment = 16;
+    auto& ring = context_.staging_ring;
+
+    // Images are copied in whole rows
+    VkDeviceSize row_size =
+        upload.image ? VkDeviceSize(upload.extent.width) * upload.texel_size
+                     : 1;
+
+    while (upload.uploaded < upload.size) {
+        VkDeviceSize budget =
+            config_.upload_budget > context_.frame_upload_bytes
+                ? config_.upload_budget - context_.frame_upload_bytes
+                : 0;
+        if (context_.frame_upload_bytes == 0) {
+            // Always make some progress, even with a tiny budget
+            budget = std::max(budget, row_size);
+        }
+
+        VkDeviceSize chunk =
+            std::min({upload.size - upload.uploaded, budget,
+                      ring.largest_free_block(kStagingAlignment)});
+        chunk = chunk / row_size * row_size;
+        if (chunk == 0) {
+            break;
+        }
+
+        auto offset = ring.allocate(chunk, kStagingAlignment);
+        if (offset == RingAllocator::kInvalidOffset) {
+            break;
+        }
+        memcpy(context_.staging_data + offset,
+               static_cast<const uint8_t*>(data) + upload.uploaded, chunk);
+
+        VezContext::StagedCopy copy{};
+        if (upload.image) {
+            copy.image = upload.image;
+
+            auto& region = copy.image_region;
+            region.bufferOffset = offset;
+            region.imageSubresource.mipLevel = 0;
+            region.imageSubresource.baseArrayLayer = upload.layer;
+            region.imageSubresource.layerCount = 1;
+            region.imageOffset = {
+                0, static_cast<int32_t>(upload.uploaded / row_size), 0};
+            region.imageExtent = {upload.extent.width,
+                                  static_cast<uint32_t>(chunk / row_size), 1};
+        } else {
+            copy.buffer = upload.buffer;
+            copy.buffer_region = {
+                offset, upload.buffer_offset + upload.uploaded, chunk};
+        }
+        context_.staged_copies.push_back(copy);
+
+        upload.uploaded += chunk;
+        context_.frame_upload_bytes += chunk;
+    }
+}
+
+void VezBackend::CancelUploads(VkBuffer buffer, VkImage image) {
+    auto matches = [&](VkBuffer b, VkImage i) {
+        return (buffer != VK_NULL_HANDLE && b == buffer) ||
+               (image != VK_NULL_HANDLE && i == image);
+    };
+
+    auto& pending = context_.pending_uploads;
+    pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                 [&](const auto& u) {
+                                     return matches(u.buffer, u.image);
+                                 }),
+                  pending.end());
+
+    auto& staged = context_.staged_copies;
+    staged.erase(std::remove_if(staged.begin(), staged.end(),
+                                [&](const auto& c) {
+                                    return matches(c.buffer, c.image);
+                                }),
+                 staged.end());
+
+    // Copies reading from the buffer are kept, as it is only
+    // destroyed once they are complete
+    auto& copies = context_.pending_buffer_copies;
+    copies.erase(std::remove_if(copies.begin(), copies.end(),
+                                [&](const auto& c) {
+                                    return matches(c.dst, VK_NULL_HANDLE);
+                                }),
+                 copies.end());
+
+    auto& mipmaps = context_.pending_mipmaps;
+    mipmaps.erase(std::remove_if(mipmaps.begin(), mipmaps.end(),
+                                 [&](const auto& m) {
+                                     return matches(VK_NULL_HANDLE, m.image);
+                                 }),
+                  mipmaps.end());
+}
+
+result<void> VezBackend::FlushUploads() {
+    // Stage deferred uploads in order, as long as the budget allows
+    while (!context_.pending_uploads.empty()) {
+        auto& upload = context_.pending_uploads.front();
+        StageUpload(upload, upload.data.data());
+
+        if (upload.uploaded < upload.size) {
+            break;
+        }
+        context_.pending_uploads.pop_front();
+    }
+
+    // Anything uploaded from now on counts towards the next frame
+    context_.frame_upload_bytes = 0;
+
+    if (!context_.staged_copies.empty()) {
+        OUTCOME_TRY(SubmitStagedCopies());
+    }
+
+    // Everything before the first upload still waiting is now submitted
+    UploadTicket submitted = context_.last_upload_ticket;
+    if (!context_.pending_uploads.empty()) {
+        submitted = context_.pending_uploads.front().ticket - 1;
+    }
+
+    // Buffer copies go on the setup command buffer, which waits for
+    // the staged copies, and run in order after their source uploads.
+    // Their tickets only complete here because the frame waits for the
+    // setup command buffer at GetSetupWaitStages(), before vertex input.
+    auto& buffer_copies = context_.pending_buffer_copies;
+    while (!buffer_copies.empty() &&
+           buffer_copies.front().ticket <= submitted) {
+        OUTCOME_TRY(GetSetupCommandBuffer());
+
+        const auto& copy = buffer_copies.front();
+        vezCmdCopyBuffer(copy.src, copy.dst, 1, &copy.region);
+        buffer_copies.pop_front();
+    }
+    if (!buffer_copies.empty()) {
+        submitted = std::min(submitted, buffer_copies.front().ticket - 1);
+    }
+    context_.submitted_upload_ticket = submitted;
+
+    // Blits need the graphics queue, so mipmaps are generated
+    // on the setup command buffer, which waits for the copies
+    auto& mipmaps = context_.pending_mipmaps;
+    for (auto it = mipmaps.begin(); it != mipmaps.end();) {
+        if (it->ticket <= context_.submitted_upload_ticket) {
+            OUTCOME_TRY(
+                GenerateMipmaps(it->image, it->layer_count, it->extent));
+            it = mipmaps.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    return outcome::success();
+}
+
+result<void> VezBackend::SubmitStagedCopies() {
+    VkDevice device = context_.device;
+    auto& per_frame = context_.per_frame[context_.current_frame];
+
+    if (per_frame.upload_command_buffer == VK_NULL_HANDLE) {
+        VezCommandBufferAllocateInfo cmd_info{};
+        cmd_info.commandBufferCount = 1;
+        cmd_info.queue = context_.transfer_queue;
+
+        VK_CHECK(vezAllocateCommandBuffers(device, &cmd_info,
+                                           &per_frame.upload_command_buffer));
+    }
+
+    // Record all the copies of this frame in a single command buffer
+    VK_CHECK(
+        vezBeginCommandBuffer(per_frame.upload_command_buffer,
+                              VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT));
+
+    for (const auto& copy : context_.staged_copies) {
+        if (copy.image) {
+            vezCmdCopyBufferToImage(context_.staging_buffer, copy.image, 1,
+                                    &copy.image_region);
+        } else {
+            vezCmdCopyBuffer(context_.staging_buffer, copy.buffer, 1,
+                             &copy.buffer_region);
+        }
+    }
+
+    VK_CHECK(vezEndCommandBuffer());
+
+    VezMappedBufferRange range{};
+    range.buffer = context_.staging_buffer;
+    range.offset = 0;
+    range.size = VK_WHOLE_SIZE;
+    VK_CHECK(vezFlushMappedBufferRanges(device, 1, &range));
+
+    VezSubmitInfo submit_info{};
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &per_frame.upload_command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &per_frame.upload_semaphore;
+
+    VK_CHECK(vezQueueSubmit(context_.transfer_queue, 1, &submit_info,
+                            &per_frame.upload_fence));
+
+    per_frame.staging_batch = context_.staging_ring.close_batch();
+    context_.staged_copies.clear();
+
+    return outcome::success();
+}
+
 result<void> VezBackend::GetSetupCommandBuffer() {
     auto& per_frame = context_.per_frame[context_.current_frame];
 
@@ -1856,7 +3329,13 @@ result<void> VezBackend::GetSetupCommandBuffer() {
     return outcome::success();
 }
 
-result<void> VezBackend::GetActiveCommandBuffer(uint32_t thread) {
+VkPipelineStageFlags VezBackend::GetSetupWaitStages() {
+    // Vertex fetch and shader sampling read what the setup command
+    // buffer wrote, so waiting at color output would be too late
+    return VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+}
+
+result<void> VezBackend::GetActiveCommandBuffer() {
     auto& per_frame = context_.per_frame[context_.current_frame];
 
     if (per_frame.setup_command_buffer_active) {
@@ -1870,20 +3349,77 @@ result<void> VezBackend::GetActiveCommandBuffer(uint32_t thread) {
         submit_info.signalSemaphoreCount = 1;
         submit_info.pSignalSemaphores = &per_frame.setup_semaphore;
 
+        // Mipmap generation needs the uploaded data
+        VkPipelineStageFlags wait_dst = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        if (per_frame.upload_semaphore != VK_NULL_HANDLE) {
+            submit_info.waitSemaphoreCount = 1;
+            submit_info.pWaitSemaphores = &per_frame.upload_semaphore;
+            submit_info.pWaitDstStageMask = &wait_dst;
+        }
+
         VkQueue graphics_queue = VK_NULL_HANDLE;
         vezGetDeviceGraphicsQueue(context_.device, 0, &graphics_queue);
 
         VK_CHECK(vezQueueSubmit(graphics_queue, 1, &submit_info,
                                 &per_frame.setup_fence));
+        per_frame.upload_semaphore = VK_NULL_HANDLE;
     }
 
-    if (!per_frame.command_buffer_active[thread]) {
-        VK_CHECK(
-            vezBeginCommandBuffer(per_frame.command_buffers[thread],
-                                  VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT));
-        per_frame.command_buffer_active[thread] = true;
+    if (!per_frame.command_buffer_active) {
+        OUTCOME_TRY(index, AcquireCommandBuffers(1));
+        OUTCOME_TRY(BeginCommandBuffer(index));
+        per_frame.command_buffer_active = true;
+
+        // Command buffers are submitted in recording order
+        if (index == 0) {
+            OUTCOME_TRY(BeginFrameTimer());
+        }
+    }
+
+    return outcome::success();
+}
+
+result<size_t> VezBackend::AcquireCommandBuffers(uint32_t count) {
+    auto& per_frame = context_.per_frame[context_.current_frame];
+
+    auto first = per_frame.command_buffer_count;
+    auto allocated = per_frame.command_buffers.size();
+    if (first + count > allocated) {
+        VkQueue graphics_queue = VK_NULL_HANDLE;
+        vezGetDeviceGraphicsQueue(context_.device, 0, &graphics_queue);
+
+        VezCommandBufferAllocateInfo cmd_info{};
+        cmd_info.commandBufferCount =
+            static_cast<uint32_t>(first + count - allocated);
+        cmd_info.queue = graphics_queue;
+
+        per_frame.command_buffers.resize(first + count);
+        auto res = vezAllocateCommandBuffers(
+            context_.device, &cmd_info, &per_frame.command_buffers[allocated]);
+        if (res != VK_SUCCESS) {
+            per_frame.command_buffers.resize(allocated);
+            return Error::GenericVulkanError;
+        }
+    }
+
+    if (per_frame.bound_states.size() < first + count) {
+        per_frame.bound_states.resize(first + count);
     }
 
+    per_frame.command_buffer_count = first + count;
+    return first;
+}
+
+result<void> VezBackend::BeginCommandBuffer(size_t index) {
+    auto& per_frame = context_.per_frame[context_.current_frame];
+
+    VK_CHECK(
+        vezBeginCommandBuffer(per_frame.command_buffers[index],
+                              VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT));
+
+    // Binds on this thread are now recorded into the new command buffer
+    bound_state = &per_frame.bound_states[index];
+    bound_state->Reset();
     return outcome::success();
 }
 
@@ -1903,6 +3439,16 @@ VkFormat VezBackend::GetVkFormat(Format format) {
             return VK_FORMAT_R32G32_SFLOAT;
         case Format::SFloatR32:
             return VK_FORMAT_R32_SFLOAT;
+        case Format::SFloatRGBA16:
+            return VK_FORMAT_R16G16B16A16_SFLOAT;
+        case Format::SFloatRG16:
+            return VK_FORMAT_R16G16_SFLOAT;
+        case Format::SNormRG16:
+            return VK_FORMAT_R16G16_SNORM;
+        case Format::UNormRG16:
+            return VK_FORMAT_R16G16_UNORM;
+        case Format::UFloatB10G11R11:
+            return VK_FORMAT_B10G11R11_UFLOAT_PACK32;
         case Format::DepthOnly:
             return VK_FORMAT_D32_SFLOAT;
         case Format::DepthStencil:
@@ -1916,6 +3462,33 @@ VkFormat VezBackend::GetVkFormat(Format format) {
     }
 }
 
+uint32_t VezBackend::GetFormatSize(Format format) {
+    switch (format) {
+        case Format::SFloatRGBA32:
+            return 16;
+        case Format::SFloatRGB32:
+            return 12;
+        case Format::SFloatRG32:
+        case Format::SFloatRGBA16:
+            return 8;
+        case Format::DepthStencil:
+            return 8;
+        case Format::UNormRGBA8:
+        case Format::UNormBGRA8:
+        case Format::SrgbRGBA8:
+        case Format::SFloatR32:
+        case Format::SFloatRG16:
+        case Format::SNormRG16:
+        case Format::UNormRG16:
+        case Format::UFloatB10G11R11:
+        case Format::DepthOnly:
+        case Format::SwapchainFormat:
+        case Format::Undefined:
+        default:
+            return 4;
+    }
+}
+
 Extent VezBackend::GetAbsoluteExtent(Extent extent) {
     switch (extent.type) {
         case ExtentType::Absolute:
@@ -1929,14 +3502,15 @@ Extent VezBackend::GetAbsoluteExtent(Extent extent) {
     }
 }
 
-VezContext::BufferHash VezBackend::GetBufferHash(const char* name) {
-    return {sdbm_hash(name)};
+VezContext::BufferHash VezBackend::GetBufferHash(ResourceName name) {
+    // Named buffers do not belong to any type
+    return {UINT64_MAX, 0, 0, name.hash()};
 }
 
 VezContext::BufferHash VezBackend::GetBufferHash(BufferType type,
                                                  const GenIndex& index,
-                                                 const char* name) {
-    return {static_cast<uint64_t>(type), index.id, index.gen, sdbm_hash(name)};
+                                                 ResourceName name) {
+    return {static_cast<uint64_t>(type), index.id, index.gen, name.hash()};
 }
 
 VezContext::ShaderHash VezBackend::GetShaderHash(const char* source,
@@ -1952,58 +3526,52 @@ VezContext::PipelineHash VezBackend::GetGraphicsPipelineHash(
 
 VezContext::VertexInputFormatHash VezBackend::GetVertexInputFormatHash(
     const VertexInputFormatDesc& desc) {
-    VezContext::VertexInputFormatHash hash;
-
-    union BindingAttributeBitField {
-        struct {
-            uint32_t b_binding : 8;
-            uint32_t b_stride : 16;
-            bool b_per_instance : 1;
-            uint32_t a_location : 8;
-            uint32_t a_binding : 8;
-            uint32_t a_offset : 16;
-            Format a_format : 7;
-        };
-
-        uint64_t int_repr;
+    // Plain fields without padding, so that the bytes can be hashed
+    struct BindingAttribute {
+        uint32_t b_binding;
+        uint32_t b_stride;
+        uint32_t b_per_instance;
+        uint32_t a_location;
+        uint32_t a_binding;
+        uint32_t a_offset;
+        uint32_t a_format;
     };
 
     size_t max_size = std::max(desc.bindings.size(), desc.attributes.size());
+    std::vector<BindingAttribute> fields(max_size);
     for (size_t i = 0; i < max_size; i++) {
-        BindingAttributeBitField bit_field;
+        auto& field = fields[i];
         if (i < desc.bindings.size()) {
             const auto& binding = desc.bindings[i];
-            bit_field.b_binding = binding.binding;
-            bit_field.b_stride = binding.stride;
-            bit_field.b_per_instance = binding.per_instance;
+            field.b_binding = binding.binding;
+            field.b_stride = binding.stride;
+            field.b_per_instance = binding.per_instance;
         }
 
         if (i < desc.attributes.size()) {
             const auto& attribute = desc.attributes[i];
-            bit_field.a_location = attribute.location;
-            bit_field.a_binding = attribute.binding;
-            bit_field.a_offset = attribute.offset;
-            bit_field.a_format = attribute.format;
+            field.a_location = attribute.location;
+            field.a_binding = attribute.binding;
+            field.a_offset = attribute.offset;
+            field.a_format = static_cast<uint32_t>(attribute.format);
         }
-
-        hash.push_back(bit_field.int_repr);
     }
 
-    return hash;
+    return MurmurHash3(fields.data(), fields.size() * sizeof(fields[0]));
 }
 
-VezContext::ImageHash VezBackend::GetTextureHash(const char* name) {
-    return {sdbm_hash(name)};
+VezContext::ImageHash VezBackend::GetTextureHash(ResourceName name) {
+    return {0, name.hash()};
 }
 
 VezContext::ImageHash VezBackend::GetRenderTargetHash(FrameIndex frame_id,
-                                                      const char* name) {
-    return {frame_id, sdbm_hash(name)};
+                                                      ResourceName name) {
+    return {frame_id, name.hash()};
 }
 
 VezContext::FramebufferHash VezBackend::GetFramebufferHash(FrameIndex frame_id,
-                                                           const char* name) {
-    return {frame_id, sdbm_hash(name)};
+                                                           ResourceName name) {
+    return {frame_id, name.hash()};
 }
 
 VezContext::SamplerHash VezBackend::GetSamplerHash(
@@ -2030,10 +3598,12 @@ VezContext::SamplerHash VezBackend::GetSamplerHash(
         static_cast<int>(sampler_desc.compare_op),
     };
 
-    std::vector<uint64_t> hash(3);
+    static_assert(sizeof(bit_field) <= sizeof(VezContext::SamplerHash),
+                  "Sampler description does not fit its hash");
+    VezContext::SamplerHash hash{};
     memcpy(hash.data(), &bit_field, sizeof(bit_field));
 
-    return std::move(hash);
+    return hash;
 }
 
 }  // namespace goma
@@ -0,0 +1,537 @@
+#include "scene/mesh_optimizer.hpp"
+
+#include <cassert>
+
+namespace goma {
+
+namespace {
+
+constexpr uint32_t kUnusedVertex = ~0U;
+constexpr int kOverdrawGridSize = 128;
+
+bool IsTriangleList(const Mesh& mesh) {
+    return !mesh.indices.empty() && mesh.indices.size() % 3 == 0;
+}
+
+// Attributes are either missing or have one element per vertex, so that
+// remapping cannot leave elements of other vertices behind
+bool HasMatchingAttributes(const Mesh& mesh) {
+    auto vertex_count = mesh.vertices.size();
+    auto matches = [vertex_count](const auto& attribute) {
+        return attribute.empty() || attribute.size() == vertex_count;
+    };
+
+    return matches(mesh.normals) && matches(mesh.tangents) &&
+           matches(mesh.bitangents) && matches(mesh.colors) &&
+           std::all_of(mesh.uv_sets.begin(), mesh.uv_sets.end(), matches) &&
+           std::all_of(mesh.uvw_sets.begin(), mesh.uvw_sets.end(), matches);
+}
+
+template <typename T>
+void RemapAttribute(std::vector<T>& attribute,
+                    const std::vector<uint32_t>& remap, size_t vertex_count) {
+    if (attribute.empty()) {
+        return;
+    }
+    assert(attribute.size() == remap.size() &&
+           "Attributes must be checked with HasMatchingAttributes()");
+
+    std::vector<T> result(vertex_count);
+    for (size_t i = 0; i < remap.size(); i++) {
+        if (remap[i] != kUnusedVertex) {
+            result[remap[i]] = attribute[i];
+        }
+    }
+    attribute = std::move(result);
+}
+
+// remap[old_index] is the new index of each vertex, or kUnusedVertex
+void RemapVertices(Mesh& mesh, const std::vector<uint32_t>& remap,
+                   size_t vertex_count) {
+    RemapAttribute(mesh.vertices, remap, vertex_count);
+    RemapAttribute(mesh.normals, remap, vertex_count);
+    RemapAttribute(mesh.tangents, remap, vertex_count);
+    RemapAttribute(mesh.bitangents, remap, vertex_count);
+    RemapAttribute(mesh.colors, remap, vertex_count);
+    for (auto& uv_set : mesh.uv_sets) {
+        RemapAttribute(uv_set, remap, vertex_count);
+    }
+    for (auto& uvw_set : mesh.uvw_sets) {
+        RemapAttribute(uvw_set, remap, vertex_count);
+    }
+
+    for (auto& index : mesh.indices) {
+        index = remap[index];
+    }
+}
+
+template <typename T>
+void AppendBytes(std::string& key, const std::vector<T>& attribute,
+                 size_t vertex) {
+    if (vertex < attribute.size()) {
+        const auto* bytes = reinterpret_cast<const char*>(&attribute[vertex]);
+        key.append(bytes, sizeof(T));
+    }
+}
+
+// Simulates a FIFO cache: a vertex is cached if fewer than cache_size
+// misses happened since it was last loaded
+class CacheSimulator {
+  public:
+    CacheSimulator(size_t vertex_count, size_t cache_size)
+        : timestamps_(vertex_count, 0),
+          cache_size_(cache_size),
+          time_(cache_size) {}
+
+    bool access(uint32_t vertex) {
+        if (time_ - timestamps_[vertex] < cache_size_) {
+            return true;
+        }
+        timestamps_[vertex] = time_++;
+        return false;
+    }
+
+  private:
+    std::vector<uint64_t> timestamps_;
+    uint64_t cache_size_;
+    // Starts past the cache size, so that no vertex is cached initially
+    uint64_t time_;
+};
+
+struct DepthGrid {
+    std::vector<float> depth;
+    size_t shaded{0};
+
+    DepthGrid()
+        : depth(kOverdrawGridSize * kOverdrawGridSize,
+                std::numeric_limits<float>::max()) {}
+
+    size_t covered() const {
+        return std::count_if(depth.begin(), depth.end(), [](float d) {
+            return d != std::numeric_limits<float>::max();
+        });
+    }
+
+    // Vertices are in grid space, with depth in z
+    void Rasterize(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        auto edge = [](const glm::vec3& p, const glm::vec3& q, float x,
+                       float y) {
+            return (q.x - p.x) * (y - p.y) - (q.y - p.y) * (x - p.x);
+        };
+
+        float area = edge(a, b, c.x, c.y);
+        if (area == 0.0f) {
+            return;
+        }
+
+        int min_x = std::max(int(std::min({a.x, b.x, c.x})), 0);
+        int min_y = std::max(int(std::min({a.y, b.y, c.y})), 0);
+        int max_x = std::min(int(std::max({a.x, b.x, c.x})) + 1,
+                             kOverdrawGridSize - 1);
+        int max_y = std::min(int(std::max({a.y, b.y, c.y})) + 1,
+                             kOverdrawGridSize - 1);
+
+        for (int y = min_y; y <= max_y; y++) {
+            for (int x = min_x; x <= max_x; x++) {
+                float px = x + 0.5f;
+                float py = y + 0.5f;
+
+                // Barycentrics are positive inside for either winding
+                float w0 = edge(b, c, px, py) / area;
+                float w1 = edge(c, a, px, py) / area;
+                float w2 = edge(a, b, px, py) / area;
+                if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+                    continue;
+                }
+
+                float z = w0 * a.z + w1 * b.z + w2 * c.z;
+                auto& d = depth[y * kOverdrawGridSize + x];
+                if (z < d) {
+                    d = z;
+                    shaded++;
+                }
+            }
+        }
+    }
+};
+
+}  // namespace
+
+VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices,
+                                    size_t vertex_count, size_t cache_size) {
+    VertexCacheStats stats{};
+    if (indices.size() < 3) {
+        return stats;
+    }
+
+    CacheSimulator cache(vertex_count, cache_size);
+    std::vector<bool> used(vertex_count, false);
+
+    size_t misses = 0;
+    size_t used_count = 0;
+    for (auto index : indices) {
+        if (!cache.access(index)) {
+            misses++;
+        }
+        if (!used[index]) {
+            used[index] = true;
+            used_count++;
+        }
+    }
+
+    stats.acmr = float(misses) / (indices.size() / 3);
+    stats.atvr = float(misses) / used_count;
+    return stats;
+}
+
+float AnalyzeOverdraw(const std::vector<uint32_t>& indices,
+                      const std::vector<glm::vec3>& positions) {
+    if (indices.size() < 3 || positions.empty()) {
+        return 0.0f;
+    }
+
+    glm::vec3 min = positions[0];
+    glm::vec3 max = positions[0];
+    for (const auto& position : positions) {
+        min = glm::min(min, position);
+        max = glm::max(max, position);
+    }
+
+    float extent = std::max({max.x - min.x, max.y - min.y, max.z - min.z});
+    if (extent == 0.0f) {
+        return 0.0f;
+    }
+    float scale = (kOverdrawGridSize - 1) / extent;
+
+    size_t shaded = 0;
+    size_t covered = 0;
+
+    for (int axis = 0; axis < 3; axis++) {
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+
+        for (float direction : {1.0f, -1.0f}) {
+            DepthGrid grid;
+
+            for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+                const auto& p0 = positions[indices[i]];
+                const auto& p1 = positions[indices[i + 1]];
+                const auto& p2 = positions[indices[i + 2]];
+
+                // Views come in opposite pairs, so the total does not
+                // depend on the winding order of front faces
+                auto normal = glm::cross(p1 - p0, p2 - p0);
+                if (normal[axis] * direction <= 0.0f) {
+                    continue;
+                }
+
+                auto to_grid = [&](const glm::vec3& p) {
+                    return glm::vec3((p[u] - min[u]) * scale,
+                                     (p[v] - min[v]) * scale,
+                                     -p[axis] * direction);
+                };
+                grid.Rasterize(to_grid(p0), to_grid(p1), to_grid(p2));
+            }
+
+            shaded += grid.shaded;
+            covered += grid.covered();
+        }
+    }
+
+    return covered > 0 ? float(shaded) / covered : 0.0f;
+}
+
+size_t WeldVertices(Mesh& mesh) {
+    auto vertex_count = mesh.vertices.size();
+    if (vertex_count == 0 || mesh.indices.empty() ||
+        !HasMatchingAttributes(mesh)) {
+        return 0;
+    }
+
+    // Identical vertices get the same new index, in order of first occurrence
+    std::unordered_map<std::string, uint32_t> unique_vertices;
+    std::vector<uint32_t> remap(vertex_count, kUnusedVertex);
+    uint32_t unique_count = 0;
+
+    std::string key;
+    for (size_t i = 0; i < vertex_count; i++) {
+        key.clear();
+        AppendBytes(key, mesh.vertices, i);
+        AppendBytes(key, mesh.normals, i);
+        AppendBytes(key, mesh.tangents, i);
+        AppendBytes(key, mesh.bitangents, i);
+        AppendBytes(key, mesh.colors, i);
+        for (const auto& uv_set : mesh.uv_sets) {
+            AppendBytes(key, uv_set, i);
+        }
+        for (const auto& uvw_set : mesh.uvw_sets) {
+            AppendBytes(key, uvw_set, i);
+        }
+
+        auto result = unique_vertices.emplace(key, unique_count);
+        if (result.second) {
+            unique_count++;
+        }
+        remap[i] = result.first->second;
+    }
+
+    if (unique_count == vertex_count) {
+        return 0;
+    }
+
+    RemapVertices(mesh, remap, unique_count);
+    return vertex_count - unique_count;
+}
+
+void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertex_count,
+                         size_t cache_size) {
+    auto triangle_count = indices.size() / 3;
+    if (triangle_count == 0 || indices.size() % 3 != 0) {
+        return;
+    }
+
+    // Triangles adjacent to each vertex, and how many are not emitted yet
+    std::vector<uint32_t> live_count(vertex_count, 0);
+    for (auto index : indices) {
+        live_count[index]++;
+    }
+
+    std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+    for (size_t i = 0; i < vertex_count; i++) {
+        adjacency_offsets[i + 1] = adjacency_offsets[i] + live_count[i];
+    }
+
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> fill(adjacency_offsets.begin(),
+                               adjacency_offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+        adjacency[fill[indices[i]]++] = uint32_t(i / 3);
+    }
+
+    std::vector<int64_t> timestamps(vertex_count, 0);
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<uint32_t> dead_ends;
+    std::vector<uint32_t> candidates;
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+
+    int64_t cache = static_cast<int64_t>(cache_size);
+    int64_t time = cache + 1;
+    size_t cursor = 0;
+    int64_t fanning = indices[0];
+
+    while (fanning >= 0) {
+        // Emit all the remaining triangles around the fanning vertex
+        candidates.clear();
+        for (auto i = adjacency_offsets[fanning];
+             i < adjacency_offsets[fanning + 1]; i++) {
+            auto triangle = adjacency[i];
+            if (emitted[triangle]) {
+                continue;
+            }
+
+            for (size_t j = 0; j < 3; j++) {
+                auto vertex = indices[triangle * 3 + j];
+                result.push_back(vertex);
+                dead_ends.push_back(vertex);
+                candidates.push_back(vertex);
+                live_count[vertex]--;
+
+                if (time - timestamps[vertex] > cache) {
+                    timestamps[vertex] = time++;
+                }
+            }
+            emitted[triangle] = true;
+        }
+
+        // Prefer the oldest candidate that will still be in the cache
+        // after fanning around it
+        fanning = -1;
+        int64_t best_priority = -1;
+        for (auto vertex : candidates) {
+            if (live_count[vertex] == 0) {
+                continue;
+            }
+
+            int64_t priority = 0;
+            if (time - timestamps[vertex] + 2 * live_count[vertex] <= cache) {
+                priority = time - timestamps[vertex];
+            }
+            if (priority > best_priority) {
+                best_priority = priority;
+                fanning = vertex;
+            }
+        }
+
+        // Otherwise backtrack to recently used vertices, or scan forward
+        while (fanning < 0 && !dead_ends.empty()) {
+            auto vertex = dead_ends.back();
+            dead_ends.pop_back();
+            if (live_count[vertex] > 0) {
+                fanning = vertex;
+            }
+        }
+
+        while (fanning < 0 && cursor < vertex_count) {
+            if (live_count[cursor] > 0) {
+                fanning = cursor;
+            }
+            cursor++;
+        }
+    }
+
+    indices = std::move(result);
+}
+
+void OptimizeOverdraw(std::vector<uint32_t>& indices,
+                      const std::vector<glm::vec3>& positions, float threshold,
+                      size_t cache_size) {
+    auto triangle_count = indices.size() / 3;
+    if (triangle_count == 0 || indices.size() % 3 != 0) {
+        return;
+    }
+
+    auto mesh_acmr =
+        AnalyzeVertexCache(indices, positions.size(), cache_size).acmr;
+
+    // A cluster ends when the next triangle reloads all its vertices,
+    // unless splitting there would hurt the cache too much
+    std::vector<size_t> cluster_starts{0};
+    CacheSimulator cache(positions.size(), cache_size);
+    size_t cluster_misses = 0;
+    size_t cluster_triangles = 0;
+
+    for (size_t t = 0; t < triangle_count; t++) {
+        size_t misses = 0;
+        for (size_t j = 0; j < 3; j++) {
+            if (!cache.access(indices[t * 3 + j])) {
+                misses++;
+            }
+        }
+
+        if (cluster_triangles > 0 && misses == 3 &&
+            float(cluster_misses) / cluster_triangles <=
+                threshold * mesh_acmr) {
+            cluster_starts.push_back(t);
+            cluster_misses = 0;
+            cluster_triangles = 0;
+        }
+
+        cluster_misses += misses;
+        cluster_triangles++;
+    }
+    cluster_starts.push_back(triangle_count);
+
+    auto cluster_count = cluster_starts.size() - 1;
+    if (cluster_count < 2) {
+        return;
+    }
+
+    // Area-weighted centroids and normals
+    std::vector<glm::vec3> centroids(cluster_count, glm::vec3{});
+    std::vector<glm::vec3> normals(cluster_count, glm::vec3{});
+    std::vector<float> areas(cluster_count, 0.0f);
+    glm::vec3 mesh_centroid{};
+    float mesh_area = 0.0f;
+
+    for (size_t c = 0; c < cluster_count; c++) {
+        for (auto t = cluster_starts[c]; t < cluster_starts[c + 1]; t++) {
+            const auto& p0 = positions[indices[t * 3]];
+            const auto& p1 = positions[indices[t * 3 + 1]];
+            const auto& p2 = positions[indices[t * 3 + 2]];
+
+            auto normal = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(normal);
+
+            centroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+            normals[c] += normal;
+            areas[c] += area;
+        }
+
+        mesh_centroid += centroids[c];
+        mesh_area += areas[c];
+        if (areas[c] > 0.0f) {
+            centroids[c] /= areas[c];
+        }
+    }
+    if (mesh_area > 0.0f) {
+        mesh_centroid /= mesh_area;
+    }
+
+    std::vector<float> sort_keys(cluster_count, 0.0f);
+    for (size_t c = 0; c < cluster_count; c++) {
+        float normal_length = glm::length(normals[c]);
+        if (normal_length > 0.0f) {
+            sort_keys[c] = glm::dot(centroids[c] - mesh_centroid,
+                                    normals[c] / normal_length);
+        }
+    }
+
+    // Stable, so that ties keep the cache-friendly order
+    std::vector<size_t> order(cluster_count);
+    for (size_t c = 0; c < cluster_count; c++) {
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return sort_keys[a] > sort_keys[b];
+    });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (auto c : order) {
+        result.insert(result.end(), indices.begin() + cluster_starts[c] * 3,
+                      indices.begin() + cluster_starts[c + 1] * 3);
+    }
+    indices = std::move(result);
+}
+
+void OptimizeVertexFetch(Mesh& mesh) {
+    auto vertex_count = mesh.vertices.size();
+    if (vertex_count == 0 || mesh.indices.empty() ||
+        !HasMatchingAttributes(mesh)) {
+        return;
+    }
+
+    std::vector<uint32_t> remap(vertex_count, kUnusedVertex);
+    uint32_t next_vertex = 0;
+    for (auto index : mesh.indices) {
+        if (remap[index] == kUnusedVertex) {
+            remap[index] = next_vertex++;
+        }
+    }
+
+    RemapVertices(mesh, remap, next_vertex);
+}
+
+MeshOptimizationStats OptimizeMesh(Mesh& mesh) {
+    MeshOptimizationStats stats{};
+    if (!IsTriangleList(mesh)) {
+        return stats;
+    }
+
+    if (!HasMatchingAttributes(mesh)) {
+        spdlog::warn(
+            "Mesh \"{}\" not optimized, its attributes do not match its "
+            "vertex count.",
+            mesh.name);
+        return stats;
+    }
+
+    stats.cache_before =
+        AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+    stats.overdraw_before = AnalyzeOverdraw(mesh.indices, mesh.vertices);
+
+    stats.welded_vertices = WeldVertices(mesh);
+    OptimizeVertexCache(mesh.indices, mesh.vertices.size());
+    OptimizeOverdraw(mesh.indices, mesh.vertices);
+    OptimizeVertexFetch(mesh);
+
+    stats.cache_after = AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+    stats.overdraw_after = AnalyzeOverdraw(mesh.indices, mesh.vertices);
+    stats.optimized = true;
+
+    return stats;
+}
+
+}  // namespace goma
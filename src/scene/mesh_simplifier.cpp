@@ -0,0 +1,418 @@
+#include "scene/mesh_simplifier.hpp"
+
+#include "scene/mesh_optimizer.hpp"
+
+#include <tuple>
+#include <unordered_set>
+
+namespace goma {
+
+namespace {
+
+// LODs smaller than this are not worth a separate draw
+constexpr size_t kMinLodTriangles = 16;
+
+// Stop the chain when a LOD keeps more than this fraction of triangles
+constexpr float kMinLodReduction = 0.85f;
+
+// Border planes are weighted more than surface planes,
+// so that borders do not shrink
+constexpr double kBorderWeight = 10.0;
+
+enum class VertexKind { Manifold, Border, Locked };
+
+// Symmetric 4x4 matrix of the squared distance to a set of planes
+struct Quadric {
+    double a00{0}, a01{0}, a02{0}, a03{0};
+    double a11{0}, a12{0}, a13{0};
+    double a22{0}, a23{0};
+    double a33{0};
+    double weight{0};
+
+    static Quadric FromPlane(const glm::vec3& n, float d, double weight) {
+        Quadric q;
+        q.weight = weight;
+        q.a00 = weight * n.x * n.x;
+        q.a01 = weight * n.x * n.y;
+        q.a02 = weight * n.x * n.z;
+        q.a03 = weight * n.x * d;
+        q.a11 = weight * n.y * n.y;
+        q.a12 = weight * n.y * n.z;
+        q.a13 = weight * n.y * d;
+        q.a22 = weight * n.z * n.z;
+        q.a23 = weight * n.z * d;
+        q.a33 = weight * d * d;
+        return q;
+    }
+
+    Quadric& operator+=(const Quadric& q) {
+        a00 += q.a00, a01 += q.a01, a02 += q.a02, a03 += q.a03;
+        a11 += q.a11, a12 += q.a12, a13 += q.a13;
+        a22 += q.a22, a23 += q.a23;
+        a33 += q.a33;
+        weight += q.weight;
+        return *this;
+    }
+
+    // Weighted average of the squared distances
+    double Evaluate(const glm::vec3& p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double error = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z +
+                       2 * a03 * x + a11 * y * y + 2 * a12 * y * z +
+                       2 * a13 * y + a22 * z * z + 2 * a23 * z + a33;
+        return weight > 0.0 ? std::max(error / weight, 0.0) : 0.0;
+    }
+};
+
+struct Collapse {
+    uint32_t from;
+    uint32_t to;
+    double cost;
+};
+
+uint64_t EdgeKey(uint32_t a, uint32_t b) { return (uint64_t(a) << 32) | b; }
+
+// Maps each vertex to the first vertex with the same position
+std::vector<uint32_t> GetPositionRemap(const Mesh& mesh) {
+    std::vector<uint32_t> remap(mesh.vertices.size());
+    std::map<std::tuple<float, float, float>, uint32_t> positions;
+
+    for (uint32_t i = 0; i < mesh.vertices.size(); i++) {
+        const auto& p = mesh.vertices[i];
+        remap[i] = positions.emplace(std::make_tuple(p.x, p.y, p.z), i)
+                       .first->second;
+    }
+    return remap;
+}
+
+uint32_t NextCorner(size_t corner) {
+    return uint32_t(corner - corner % 3 + (corner + 1) % 3);
+}
+
+// Flags the triangle corners whose outgoing edge has no opposite half-edge,
+// i.e. lies on an open border. Returns the border edges in both directions.
+std::unordered_set<uint64_t> FindBorderEdges(
+    const std::vector<uint32_t>& indices,
+    const std::vector<uint32_t>& position_remap,
+    std::vector<bool>& border_corners) {
+    std::unordered_set<uint64_t> half_edges;
+    for (size_t i = 0; i < indices.size(); i++) {
+        half_edges.insert(EdgeKey(position_remap[indices[i]],
+                                  position_remap[indices[NextCorner(i)]]));
+    }
+
+    std::unordered_set<uint64_t> border_edges;
+    border_corners.assign(indices.size(), false);
+    for (size_t i = 0; i < indices.size(); i++) {
+        auto a = position_remap[indices[i]];
+        auto b = position_remap[indices[NextCorner(i)]];
+        if (half_edges.find(EdgeKey(b, a)) == half_edges.end()) {
+            border_corners[i] = true;
+            border_edges.insert(EdgeKey(a, b));
+            border_edges.insert(EdgeKey(b, a));
+        }
+    }
+    return border_edges;
+}
+
+std::vector<VertexKind> ClassifyVertices(
+    const std::vector<uint32_t>& indices,
+    const std::vector<uint32_t>& position_remap,
+    const std::vector<bool>& border_corners) {
+    auto vertex_count = position_remap.size();
+
+    // Vertices sharing a position with others are on a seam
+    std::vector<uint32_t> siblings(vertex_count, 0);
+    for (auto p : position_remap) {
+        siblings[p]++;
+    }
+
+    std::vector<uint32_t> border_count(vertex_count, 0);
+    for (size_t i = 0; i < indices.size(); i++) {
+        if (border_corners[i]) {
+            border_count[indices[i]]++;
+            border_count[indices[NextCorner(i)]]++;
+        }
+    }
+
+    std::vector<VertexKind> kinds(vertex_count, VertexKind::Manifold);
+    for (size_t i = 0; i < vertex_count; i++) {
+        if (siblings[position_remap[i]] > 1) {
+            kinds[i] = VertexKind::Locked;
+        } else if (border_count[i] == 2) {
+            kinds[i] = VertexKind::Border;
+        } else if (border_count[i] > 0) {
+            // Corners and non-manifold borders
+            kinds[i] = VertexKind::Locked;
+        }
+    }
+    return kinds;
+}
+
+std::vector<Quadric> ComputeQuadrics(const std::vector<glm::vec3>& positions,
+                                     const std::vector<uint32_t>& indices,
+                                     const std::vector<bool>& border_corners) {
+    std::vector<Quadric> quadrics(positions.size());
+
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        const auto& p0 = positions[indices[i]];
+        const auto& p1 = positions[indices[i + 1]];
+        const auto& p2 = positions[indices[i + 2]];
+
+        auto normal = glm::cross(p1 - p0, p2 - p0);
+        float area = glm::length(normal);
+        if (area == 0.0f) {
+            continue;
+        }
+        normal /= area;
+
+        auto q = Quadric::FromPlane(normal, -glm::dot(normal, p0), area);
+        quadrics[indices[i]] += q;
+        quadrics[indices[i + 1]] += q;
+        quadrics[indices[i + 2]] += q;
+
+        // Planes through border edges, perpendicular to the surface
+        for (size_t j = 0; j < 3; j++) {
+            if (!border_corners[i + j]) {
+                continue;
+            }
+
+            auto a = indices[i + j];
+            auto b = indices[i + (j + 1) % 3];
+            auto edge = positions[b] - positions[a];
+            float length = glm::length(edge);
+            if (length == 0.0f) {
+                continue;
+            }
+
+            auto border_normal = glm::normalize(glm::cross(edge, normal));
+            auto border_q = Quadric::FromPlane(
+                border_normal, -glm::dot(border_normal, positions[a]),
+                kBorderWeight * length * length);
+            quadrics[a] += border_q;
+            quadrics[b] += border_q;
+        }
+    }
+
+    return quadrics;
+}
+
+}  // namespace
+
+std::vector<uint32_t> SimplifyMesh(const Mesh& mesh,
+                                   const std::vector<uint32_t>& indices,
+                                   size_t target_index_count,
+                                   float target_error, float* result_error) {
+    const auto& positions = mesh.vertices;
+    std::vector<uint32_t> result = indices;
+    double max_cost = 0.0;
+
+    if (result_error) {
+        *result_error = 0.0f;
+    }
+    if (indices.empty() || indices.size() % 3 != 0 || positions.empty()) {
+        return result;
+    }
+
+    glm::vec3 min = positions[0];
+    glm::vec3 max = positions[0];
+    for (const auto& position : positions) {
+        min = glm::min(min, position);
+        max = glm::max(max, position);
+    }
+    double extent = std::max({max.x - min.x, max.y - min.y, max.z - min.z});
+    if (extent == 0.0) {
+        return result;
+    }
+    double cost_limit = target_error * extent * target_error * extent;
+
+    std::vector<bool> border_corners;
+    auto position_remap = GetPositionRemap(mesh);
+    FindBorderEdges(result, position_remap, border_corners);
+    auto kinds = ClassifyVertices(result, position_remap, border_corners);
+    auto quadrics = ComputeQuadrics(positions, result, border_corners);
+
+    auto vertex_count = positions.size();
+    std::vector<uint32_t> remap(vertex_count);
+    std::vector<bool> touched(vertex_count);
+    std::vector<uint32_t> adjacency_offsets(vertex_count + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<Collapse> collapses;
+
+    // Each pass collapses an independent set of the cheapest edges
+    while (result.size() > target_index_count) {
+        // Border vertices may only slide along the current border
+        auto borders =
+            FindBorderEdges(result, position_remap, border_corners);
+
+        // Triangles adjacent to each vertex
+        std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+        for (auto index : result) {
+            adjacency_offsets[index + 1]++;
+        }
+        for (size_t i = 0; i < vertex_count; i++) {
+            adjacency_offsets[i + 1] += adjacency_offsets[i];
+        }
+        adjacency.resize(result.size());
+        std::vector<uint32_t> fill(adjacency_offsets.begin(),
+                                   adjacency_offsets.end() - 1);
+        for (size_t i = 0; i < result.size(); i++) {
+            adjacency[fill[result[i]]++] = uint32_t(i / 3);
+        }
+
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i++) {
+            auto a = result[i];
+            auto b = result[NextCorner(i)];
+
+            for (auto edge : {std::make_pair(a, b), std::make_pair(b, a)}) {
+                auto from = edge.first;
+                auto to = edge.second;
+
+                if (kinds[from] == VertexKind::Locked) {
+                    continue;
+                }
+                if (kinds[from] == VertexKind::Border &&
+                    borders.find(EdgeKey(from, position_remap[to])) ==
+                        borders.end()) {
+                    continue;
+                }
+
+                auto q = quadrics[from];
+                q += quadrics[to];
+                double cost = q.Evaluate(positions[to]);
+                if (cost <= cost_limit) {
+                    collapses.push_back({from, to, cost});
+                }
+            }
+        }
+
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse& a, const Collapse& b) {
+                      return std::tie(a.cost, a.from, a.to) <
+                             std::tie(b.cost, b.from, b.to);
+                  });
+
+        for (size_t i = 0; i < vertex_count; i++) {
+            remap[i] = uint32_t(i);
+        }
+        std::fill(touched.begin(), touched.end(), false);
+
+        // Manifold collapses remove two triangles, border ones only one
+        size_t triangles_to_remove = (result.size() - target_index_count) / 3;
+        size_t removed_triangles = 0;
+        size_t collapse_count = 0;
+
+        for (const auto& collapse : collapses) {
+            if (removed_triangles >= std::max(triangles_to_remove, size_t(1))) {
+                break;
+            }
+            if (touched[collapse.from] || touched[collapse.to]) {
+                continue;
+            }
+
+            // Moving triangles around "from" must not flip them
+            const auto& p_to = positions[collapse.to];
+            bool flipped = false;
+            for (auto j = adjacency_offsets[collapse.from];
+                 j < adjacency_offsets[collapse.from + 1] && !flipped; j++) {
+                auto t = adjacency[j] * 3;
+                glm::vec3 p[3];
+                bool has_to = false;
+                for (size_t k = 0; k < 3; k++) {
+                    p[k] = positions[result[t + k]];
+                    has_to = has_to || result[t + k] == collapse.to;
+                }
+                if (has_to) {
+                    continue;
+                }
+
+                auto before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                for (size_t k = 0; k < 3; k++) {
+                    if (result[t + k] == collapse.from) {
+                        p[k] = p_to;
+                    }
+                }
+                auto after = glm::cross(p[1] - p[0], p[2] - p[0]);
+                flipped = glm::dot(before, after) <= 0.0f;
+            }
+            if (flipped) {
+                continue;
+            }
+
+            // Lock the whole neighbourhood for the rest of the pass
+            for (auto j = adjacency_offsets[collapse.from];
+                 j < adjacency_offsets[collapse.from + 1]; j++) {
+                auto t = adjacency[j] * 3;
+                for (size_t k = 0; k < 3; k++) {
+                    touched[result[t + k]] = true;
+                }
+            }
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to] += quadrics[collapse.from];
+            max_cost = std::max(max_cost, collapse.cost);
+
+            removed_triangles +=
+                kinds[collapse.from] == VertexKind::Border ? 1 : 2;
+            collapse_count++;
+        }
+
+        if (collapse_count == 0) {
+            break;
+        }
+
+        // Drop the triangles that became degenerate
+        size_t write = 0;
+        for (size_t i = 0; i < result.size(); i += 3) {
+            auto a = remap[result[i]];
+            auto b = remap[result[i + 1]];
+            auto c = remap[result[i + 2]];
+            if (a != b && b != c && c != a) {
+                result[write++] = a;
+                result[write++] = b;
+                result[write++] = c;
+            }
+        }
+        result.resize(write);
+    }
+
+    if (result_error) {
+        *result_error = float(std::sqrt(max_cost) / extent);
+    }
+    return result;
+}
+
+void GenerateLods(Mesh& mesh) {
+    mesh.lods.clear();
+    if (mesh.indices.empty() || mesh.indices.size() % 3 != 0) {
+        return;
+    }
+
+    mesh.lods.reserve(kMaxMeshLods);
+    const auto* indices = &mesh.indices;
+    while (mesh.lods.size() < kMaxMeshLods) {
+        auto target_index_count = indices->size() / 6 * 3;
+        if (target_index_count < kMinLodTriangles * 3) {
+            break;
+        }
+
+        MeshLod lod;
+        lod.indices = SimplifyMesh(mesh, *indices, target_index_count,
+                                   kMaxLodError, &lod.error);
+        if (lod.indices.size() > indices->size() * kMinLodReduction) {
+            break;
+        }
+
+        // Errors add up along the chain
+        if (!mesh.lods.empty()) {
+            lod.error += mesh.lods.back().error;
+        }
+
+        OptimizeVertexCache(lod.indices, mesh.vertices.size());
+        mesh.lods.push_back(std::move(lod));
+        indices = &mesh.lods.back().indices;
+    }
+}
+
+}  // namespace goma
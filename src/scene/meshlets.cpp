@@ -0,0 +1,113 @@
+#include "scene/meshlets.hpp"
+
+namespace goma {
+
+namespace {
+
+void ComputeBounds(const Mesh& mesh, Meshlet& meshlet) {
+    const auto& positions = mesh.vertices;
+    auto begin = mesh.indices.begin() + meshlet.first_index;
+    auto end = begin + meshlet.index_count;
+
+    glm::vec3 min = positions[*begin];
+    glm::vec3 max = positions[*begin];
+    for (auto it = begin; it != end; it++) {
+        min = glm::min(min, positions[*it]);
+        max = glm::max(max, positions[*it]);
+    }
+
+    meshlet.center = (min + max) * 0.5f;
+    meshlet.radius = 0.0f;
+    for (auto it = begin; it != end; it++) {
+        meshlet.radius = std::max(
+            meshlet.radius, glm::length(positions[*it] - meshlet.center));
+    }
+
+    // The cone axis is the average normal, its spread the widest one
+    std::vector<glm::vec3> normals;
+    normals.reserve(meshlet.index_count / 3);
+    glm::vec3 axis{};
+    for (auto it = begin; it != end; it += 3) {
+        const auto& p0 = positions[it[0]];
+        auto normal = glm::cross(positions[it[1]] - p0, positions[it[2]] - p0);
+        float length = glm::length(normal);
+        if (length > 0.0f) {
+            normals.push_back(normal / length);
+            axis += normals.back();
+        }
+    }
+
+    meshlet.cone_axis = {};
+    meshlet.cone_cutoff = 1.0f;
+
+    float axis_length = glm::length(axis);
+    if (normals.empty() || axis_length == 0.0f) {
+        return;
+    }
+    axis /= axis_length;
+
+    float min_dot = 1.0f;
+    for (const auto& normal : normals) {
+        min_dot = std::min(min_dot, glm::dot(normal, axis));
+    }
+
+    // Wider than a hemisphere, some triangle always faces the camera
+    if (min_dot <= 0.0f) {
+        return;
+    }
+
+    meshlet.cone_axis = axis;
+    meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+}
+
+}  // namespace
+
+void BuildMeshlets(Mesh& mesh) {
+    mesh.meshlets.clear();
+    if (mesh.indices.empty() || mesh.indices.size() % 3 != 0) {
+        return;
+    }
+
+    // Vertices are marked with the id of the last meshlet using them
+    std::vector<uint32_t> marks(mesh.vertices.size(), ~0U);
+    uint32_t meshlet_id = 0;
+    Meshlet meshlet{};
+
+    auto finish = [&]() {
+        ComputeBounds(mesh, meshlet);
+        mesh.meshlets.push_back(meshlet);
+
+        meshlet_id++;
+        meshlet = {};
+    };
+
+    for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+        auto a = mesh.indices[i];
+        auto b = mesh.indices[i + 1];
+        auto c = mesh.indices[i + 2];
+
+        auto count_new = [&]() {
+            return (marks[a] != meshlet_id) +
+                   (marks[b] != meshlet_id && b != a) +
+                   (marks[c] != meshlet_id && c != a && c != b);
+        };
+
+        uint32_t new_vertices = count_new();
+        if (meshlet.vertex_count + new_vertices > kMeshletMaxVertices ||
+            meshlet.index_count / 3 + 1 > kMeshletMaxTriangles) {
+            finish();
+            meshlet.first_index = static_cast<uint32_t>(i);
+            new_vertices = count_new();
+        }
+
+        marks[a] = marks[b] = marks[c] = meshlet_id;
+        meshlet.vertex_count += new_vertices;
+        meshlet.index_count += 3;
+    }
+
+    if (meshlet.index_count > 0) {
+        finish();
+    }
+}
+
+}  // namespace goma
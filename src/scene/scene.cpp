@@ -2,6 +2,8 @@
 
 #include "common/error_codes.hpp"
 
+#include <atomic>
+
 namespace goma {
 
 std::ostream& operator<<(std::ostream& o, const goma::GenIndex& id) {
@@ -35,7 +37,12 @@ std::ostream& operator<<(std::ostream& o, const Attachment<T>& a) {
     return o;
 }
 
-Scene::Scene() { nodes_.emplace_back(NodeIndex{0}, NodeIndex{0, 0}); }
+Scene::Scene() {
+    static std::atomic<uint64_t> next_id{1};
+    id_ = next_id++;
+
+    nodes_.emplace_back(NodeIndex{0}, NodeIndex{0, 0});
+}
 
 result<NodeIndex> Scene::CreateNode(const NodeIndex parent,
                                     const Transform& transform) {
@@ -95,7 +102,25 @@ result<void> Scene::SetTransform(NodeIndex id, const Transform& transform) {
     }
 
     nodes_[id.id].transform = transform;
-    nodes_[id.id].cached_model.reset();
+    InvalidateTransforms(id);
+    return outcome::success();
+}
+
+result<Mobility> Scene::GetMobility(NodeIndex id) {
+    if (!ValidateNode(id)) {
+        return Error::InvalidNode;
+    }
+    return nodes_[id.id].mobility;
+}
+
+result<void> Scene::SetMobility(NodeIndex id, Mobility mobility) {
+    if (!ValidateNode(id)) {
+        return Error::InvalidNode;
+    }
+
+    // Reported as moved, so that systems pick up the new mobility
+    nodes_[id.id].mobility = mobility;
+    moved_nodes_.insert(id);
     return outcome::success();
 }
 
@@ -178,6 +203,10 @@ result<void> Scene::DeleteNode(NodeIndex id) {
         if (child_node.parent == id) {
             child_node.parent = new_parent;
             nodes_[new_parent.id].children.insert(child_node.id);
+
+            if (child_node.valid()) {
+                InvalidateTransforms(child_node.id);
+            }
         }
     }
 
@@ -188,10 +217,29 @@ result<void> Scene::DeleteNode(NodeIndex id) {
     // invalid and store the last valid generation into the node's id
     // (which is unused while the node is invalid)
     nodes_[id.id].id = {nodes_[id.id].id.gen, 0};
+    moved_nodes_.insert(id);
 
     return outcome::success();
 }
 
+void Scene::InvalidateTransforms(NodeIndex id) {
+    // Invalidate the cached model of the node and all of its descendants
+    std::stack<NodeIndex> node_stack;
+    node_stack.push(id);
+
+    while (!node_stack.empty()) {
+        auto cur_id = node_stack.top();
+        node_stack.pop();
+
+        nodes_[cur_id.id].cached_model.reset();
+        moved_nodes_.insert(cur_id);
+
+        for (const auto& child : nodes_[cur_id.id].children) {
+            node_stack.push(child);
+        }
+    }
+}
+
 bool Scene::ValidateNode(NodeIndex id) {
     return id.gen != 0 && id.id < nodes_.size() &&
            nodes_[id.id].id.gen == id.gen;
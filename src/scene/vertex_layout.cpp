@@ -0,0 +1,209 @@
+#include "scene/vertex_layout.hpp"
+
+#include <glm/gtc/packing.hpp>
+
+namespace goma {
+
+namespace {
+
+glm::vec2 SignNotZero(const glm::vec2& v) {
+    return {v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f};
+}
+
+bool InUnitRange(const std::vector<glm::vec2>& uvs) {
+    return std::all_of(uvs.begin(), uvs.end(), [](const glm::vec2& uv) {
+        return uv.x >= 0.0f && uv.x <= 1.0f && uv.y >= 0.0f && uv.y <= 1.0f;
+    });
+}
+
+uint32_t PackUV(const glm::vec2& uv, UVEncoding encoding) {
+    return encoding == UVEncoding::UNorm16 ? glm::packUnorm2x16(uv)
+                                           : glm::packHalf2x16(uv);
+}
+
+}  // namespace
+
+glm::vec2 OctEncode(const glm::vec3& v) {
+    float l1_norm = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    if (l1_norm == 0.0f) {
+        return {0.0f, 0.0f};
+    }
+
+    glm::vec2 e = glm::vec2(v.x, v.y) / l1_norm;
+    if (v.z < 0.0f) {
+        // Fold the lower hemisphere over the diagonals
+        e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * SignNotZero(e);
+    }
+    return e;
+}
+
+glm::vec3 OctDecode(const glm::vec2& e) {
+    glm::vec3 v{e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y)};
+    if (v.z < 0.0f) {
+        glm::vec2 xy = (1.0f - glm::abs(glm::vec2(v.y, v.x))) *
+                       SignNotZero(glm::vec2(v.x, v.y));
+        v.x = xy.x;
+        v.y = xy.y;
+    }
+    return glm::normalize(v);
+}
+
+uint32_t PackNormal(const glm::vec3& normal) {
+    return glm::packSnorm2x16(OctEncode(normal));
+}
+
+uint32_t PackTangent(const glm::vec3& tangent, float bitangent_sign) {
+    auto e = OctEncode(tangent);
+
+    // Remap x to [bias, 1] and flip it for negative signs
+    float x = e.x * 0.5f + 0.5f;
+    x = kTangentSignBias + (1.0f - kTangentSignBias) * x;
+    e.x = bitangent_sign < 0.0f ? -x : x;
+
+    return glm::packSnorm2x16(e);
+}
+
+glm::vec3 UnpackNormal(uint32_t packed) {
+    return OctDecode(glm::unpackSnorm2x16(packed));
+}
+
+glm::vec3 UnpackTangent(uint32_t packed, float* bitangent_sign) {
+    auto e = glm::unpackSnorm2x16(packed);
+    if (bitangent_sign) {
+        *bitangent_sign = e.x < 0.0f ? -1.0f : 1.0f;
+    }
+
+    e.x = (std::abs(e.x) - kTangentSignBias) / (1.0f - kTangentSignBias);
+    e.x = e.x * 2.0f - 1.0f;
+    return OctDecode(e);
+}
+
+void PackVertices(Mesh& mesh) {
+    auto& packed = mesh.packed;
+    packed = {};
+    packed.vertex_count = mesh.vertices.size();
+
+    auto vertex_count = packed.vertex_count;
+    auto has = [vertex_count](const auto& attribute) {
+        return !attribute.empty() && attribute.size() >= vertex_count;
+    };
+
+    bool has_normals = has(mesh.normals);
+    bool has_tangents = has(mesh.tangents);
+    bool has_bitangents = has(mesh.bitangents);
+    bool has_uv0 = mesh.uv_sets.size() > 0 && has(mesh.uv_sets[0]);
+    bool has_uv1 = mesh.uv_sets.size() > 1 && has(mesh.uv_sets[1]);
+    bool has_colors = has(mesh.colors);
+    bool has_uvw = mesh.uvw_sets.size() > 0 && has(mesh.uvw_sets[0]);
+
+    packed.has_normals = has_normals;
+    packed.has_tangents = has_tangents;
+    packed.has_uv0 = has_uv0;
+    packed.has_colors = has_colors;
+    packed.has_uv1 = has_uv1;
+    packed.has_uvw = has_uvw;
+
+    // UNorm16 is more precise, but cannot represent tiling UVs
+    bool unit_uvs = (!has_uv0 || InUnitRange(mesh.uv_sets[0])) &&
+                    (!has_uv1 || InUnitRange(mesh.uv_sets[1]));
+    packed.uv_encoding = unit_uvs ? UVEncoding::UNorm16 : UVEncoding::Half;
+
+    if (has_normals || has_tangents || has_uv0) {
+        packed.attributes.resize(vertex_count);
+
+        for (size_t i = 0; i < vertex_count; i++) {
+            auto& attributes = packed.attributes[i];
+
+            if (has_normals) {
+                attributes.normal = PackNormal(mesh.normals[i]);
+            }
+
+            if (has_tangents) {
+                float sign = 1.0f;
+                if (has_normals && has_bitangents) {
+                    auto bitangent =
+                        glm::cross(mesh.normals[i], mesh.tangents[i]);
+                    sign = glm::dot(bitangent, mesh.bitangents[i]) < 0.0f
+                               ? -1.0f
+                               : 1.0f;
+                }
+                attributes.tangent = PackTangent(mesh.tangents[i], sign);
+            }
+
+            if (has_uv0) {
+                attributes.uv0 =
+                    PackUV(mesh.uv_sets[0][i], packed.uv_encoding);
+            }
+        }
+    }
+
+    if (has_colors || has_uv1 || has_uvw) {
+        packed.extras.resize(vertex_count);
+
+        for (size_t i = 0; i < vertex_count; i++) {
+            auto& extras = packed.extras[i];
+
+            if (has_colors) {
+                extras.color = glm::packUnorm4x8(
+                    glm::clamp(mesh.colors[i], 0.0f, 1.0f));
+            }
+
+            if (has_uv1) {
+                extras.uv1 = PackUV(mesh.uv_sets[1][i], packed.uv_encoding);
+            }
+
+            if (has_uvw) {
+                extras.uvw = mesh.uvw_sets[0][i];
+            }
+        }
+    }
+
+    // 0xFFFF is the primitive restart index for 16-bit indices,
+    // so it must not be used as a vertex index
+    if (!mesh.indices.empty() &&
+        vertex_count < std::numeric_limits<uint16_t>::max()) {
+        auto index_count = mesh.indices.size();
+        for (const auto& lod : mesh.lods) {
+            index_count += lod.indices.size();
+        }
+
+        packed.short_indices.reserve(index_count);
+        for (auto index : mesh.indices) {
+            packed.short_indices.push_back(static_cast<uint16_t>(index));
+        }
+        for (const auto& lod : mesh.lods) {
+            for (auto index : lod.indices) {
+                packed.short_indices.push_back(static_cast<uint16_t>(index));
+            }
+        }
+    }
+}
+
+bool IsPacked(const Mesh& mesh) {
+    return !mesh.vertices.empty() &&
+           mesh.packed.vertex_count == mesh.vertices.size();
+}
+
+size_t GetPackedVertexSize(const Mesh& mesh) {
+    size_t size = sizeof(glm::vec3);
+    if (!mesh.packed.attributes.empty()) {
+        size += sizeof(PackedAttributes);
+    }
+    if (!mesh.packed.extras.empty()) {
+        size += sizeof(PackedExtras);
+    }
+    return size;
+}
+
+size_t GetUnpackedVertexSize(const Mesh& mesh) {
+    size_t size = sizeof(glm::vec3);
+    size += mesh.normals.empty() ? 0 : sizeof(glm::vec3);
+    size += mesh.tangents.empty() ? 0 : sizeof(glm::vec3);
+    size += mesh.bitangents.empty() ? 0 : sizeof(glm::vec3);
+    size += mesh.colors.empty() ? 0 : sizeof(glm::vec4);
+    size += std::min(mesh.uv_sets.size(), size_t(2)) * sizeof(glm::vec2);
+    size += mesh.uvw_sets.empty() ? 0 : sizeof(glm::vec3);
+    return size;
+}
+
+}  // namespace goma
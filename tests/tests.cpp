@@ -9,13 +9,37 @@
 #include "scene/attachments/light.hpp"
 #include "scene/attachments/mesh.hpp"
 #include "scene/loaders/assimp_loader.hpp"
-
+#include "scene/mesh_optimizer.hpp"
+#include "scene/mesh_simplifier.hpp"
+#include "scene/meshlets.hpp"
+#include "scene/vertex_layout.hpp"
+
+#include "renderer/command_stream.hpp"
+#include "renderer/draw_registry.hpp"
+#include "renderer/dynamic_resolution.hpp"
+#include "renderer/lod_selector.hpp"
+#include "renderer/meshlet_culler.hpp"
+#include "renderer/pipeline_table.hpp"
+#include "renderer/render_graph.hpp"
+#include "renderer/resource_name.hpp"
+#include "renderer/shader_permutations.hpp"
+#include "renderer/shadow_caster_culler.hpp"
+#include "renderer/spirv_cache.hpp"
+#include "renderer/uniform_arena.hpp"
 #include "renderer/vez/vez_backend.hpp"
 #include "platform/win32_platform.hpp"
 
 #include "infrastructure/cache.hpp"
+#include "infrastructure/file_watcher.hpp"
+#include "infrastructure/flat_hash_map.hpp"
+#include "infrastructure/murmur_hash.hpp"
+#include "infrastructure/offset_allocator.hpp"
+#include "infrastructure/ring_allocator.hpp"
+#include "infrastructure/thread_pool.hpp"
 
 #include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <thread>
 #include <set>
@@ -121,6 +145,420 @@ TEST(SceneTest, CanCreateATexture) {
     ASSERT_TRUE(texture);
 }
 
+TEST(SceneTest, CanTrackMovedNodes) {
+    Scene s;
+
+    auto node = s.CreateNode(s.GetRootNode()).value();
+    auto child_node = s.CreateNode(node).value();
+    EXPECT_TRUE(s.GetMovedNodes().empty());
+
+    auto child_model = s.GetTransformMatrix(child_node).value();
+    EXPECT_EQ(child_model, glm::mat4(1.0f));
+
+    s.SetTransform(node, Transform{glm::vec3(1.0f, 0.0f, 0.0f)});
+    EXPECT_EQ(s.GetMovedNodes(), std::set<NodeIndex>({node, child_node}));
+
+    // The cached model of the child node must have been invalidated too
+    child_model = s.GetTransformMatrix(child_node).value();
+    EXPECT_EQ(child_model, glm::translate(glm::vec3(1.0f, 0.0f, 0.0f)));
+
+    s.ClearMovedNodes();
+    EXPECT_TRUE(s.GetMovedNodes().empty());
+}
+
+TEST(SceneTest, CanTrackModifiedAttachments) {
+    Scene s;
+
+    auto mesh_id = s.CreateAttachment<Mesh>(Mesh{"mesh"}).value();
+    auto other_id = s.CreateAttachment<Mesh>(Mesh{"other_mesh"}).value();
+
+    const auto& meshes = s.GetAttachments<Mesh>();
+    auto revision = s.GetAttachmentRevision<Mesh>();
+    EXPECT_EQ(meshes[other_id.id].revision, revision);
+    EXPECT_LT(meshes[mesh_id.id].revision, revision);
+
+    ASSERT_TRUE(s.MarkAttachmentModified<Mesh>(mesh_id));
+    EXPECT_GT(s.GetAttachmentRevision<Mesh>(), revision);
+    EXPECT_GT(meshes[mesh_id.id].revision, revision);
+    EXPECT_LT(meshes[other_id.id].revision, meshes[mesh_id.id].revision);
+
+    EXPECT_FALSE(s.MarkAttachmentModified<Mesh>(AttachmentIndex<Mesh>{}));
+}
+
+TEST(SceneTest, CanMaintainDrawRegistry) {
+    Scene s;
+    DrawRegistry registry;
+
+    auto node = s.CreateNode(s.GetRootNode()).value();
+    auto other_node = s.CreateNode(s.GetRootNode()).value();
+
+    Mesh mesh{"mesh"};
+    mesh.bounding_box = std::make_unique<Box>();
+    mesh.bounding_box->min = glm::vec3(-1.0f);
+    mesh.bounding_box->max = glm::vec3(1.0f);
+
+    auto mesh_id = s.CreateAttachment<Mesh>(node, std::move(mesh)).value();
+
+    registry.Update(s);
+    ASSERT_EQ(registry.size(), 1);
+    EXPECT_EQ(registry.items()[0].mesh, mesh_id);
+    EXPECT_EQ(registry.items()[0].node, node);
+    EXPECT_EQ(registry.items()[0].bounds.max, glm::vec3(1.0f));
+
+    s.Attach<Mesh>(mesh_id, other_node);
+    registry.Update(s);
+    EXPECT_EQ(registry.size(), 2);
+
+    // Moving a node only updates the corresponding item
+    s.SetTransform(other_node, Transform{glm::vec3(0.0f, 2.0f, 0.0f)});
+    registry.Update(s);
+    ASSERT_EQ(registry.size(), 2);
+
+    for (const auto& item : registry.items()) {
+        auto expected_max = item.node == other_node
+                                ? glm::vec3(1.0f, 3.0f, 1.0f)
+                                : glm::vec3(1.0f);
+        EXPECT_EQ(item.bounds.max, expected_max);
+    }
+
+    // Modified mesh data refreshes the bounds
+    s.GetAttachment<Mesh>(mesh_id).value().get().bounding_box->max =
+        glm::vec3(2.0f);
+    s.MarkAttachmentModified<Mesh>(mesh_id);
+    registry.Update(s);
+
+    for (const auto& item : registry.items()) {
+        auto expected_max = item.node == other_node
+                                ? glm::vec3(2.0f, 4.0f, 2.0f)
+                                : glm::vec3(2.0f);
+        EXPECT_EQ(item.bounds.max, expected_max);
+    }
+
+    s.Detach<Mesh>(mesh_id, node);
+    registry.Update(s);
+    ASSERT_EQ(registry.size(), 1);
+    EXPECT_EQ(registry.items()[0].node, other_node);
+
+    s.DeleteNode(other_node);
+    registry.Update(s);
+    EXPECT_EQ(registry.size(), 0);
+
+    // Items of a previous scene are dropped, even with the same revision
+    s.Attach<Mesh>(mesh_id, node);
+    registry.Update(s);
+    ASSERT_EQ(registry.size(), 1);
+
+    Scene new_scene;
+    registry.Update(new_scene);
+    EXPECT_EQ(registry.size(), 0);
+
+    // Also when a new scene takes the address of a destroyed one
+    auto old_scene = std::make_unique<Scene>();
+    old_scene->CreateAttachment<Mesh>(old_scene->GetRootNode(), Mesh{"a"});
+    registry.Update(*old_scene);
+    auto old_id = old_scene->id();
+    old_scene.reset();
+
+    auto next_scene = std::make_unique<Scene>();
+    EXPECT_NE(next_scene->id(), old_id);
+    auto child = next_scene->CreateNode(next_scene->GetRootNode()).value();
+    next_scene->CreateAttachment<Mesh>(child, Mesh{"b"});
+    registry.Update(*next_scene);
+    ASSERT_EQ(registry.size(), 1);
+    EXPECT_EQ(registry.items()[0].node, child);
+}
+
+TEST(SceneTest, CanTrackStaticDrawItems) {
+    Scene s;
+    DrawRegistry registry;
+
+    auto node = s.CreateNode(s.GetRootNode()).value();
+    auto other_node = s.CreateNode(s.GetRootNode()).value();
+    EXPECT_EQ(s.GetMobility(node).value(), Mobility::Static);
+    EXPECT_FALSE(s.SetMobility(NodeIndex{}, Mobility::Movable));
+
+    ASSERT_TRUE(s.SetMobility(other_node, Mobility::Movable));
+    auto mesh_id = s.CreateAttachment<Mesh>(node, Mesh{"mesh"}).value();
+    s.Attach<Mesh>(mesh_id, other_node);
+
+    registry.Update(s);
+    ASSERT_EQ(registry.size(), 2);
+    for (const auto& item : registry.items()) {
+        EXPECT_EQ(item.is_static, item.node == node);
+    }
+
+    // Moving a movable node keeps what was cached from static items
+    auto revision = registry.static_revision();
+    s.SetTransform(other_node, Transform{glm::vec3(0.0f, 2.0f, 0.0f)});
+    registry.Update(s);
+    EXPECT_EQ(registry.static_revision(), revision);
+
+    // Moving a static node, or making it movable, invalidates it
+    s.SetTransform(node, Transform{glm::vec3(0.0f, 2.0f, 0.0f)});
+    registry.Update(s);
+    EXPECT_GT(registry.static_revision(), revision);
+
+    // So does modifying the material or texture of a static item
+    auto texture_id = s.CreateAttachment<Texture>(Texture{}).value();
+    Material material{};
+    material.texture_bindings[TextureType::Diffuse].push_back({texture_id});
+    auto material_id = s.CreateAttachment<Material>(std::move(material));
+    s.GetAttachment<Mesh>(mesh_id).value().get().material =
+        material_id.value();
+    s.MarkAttachmentModified<Mesh>(mesh_id);
+    registry.Update(s);
+
+    revision = registry.static_revision();
+    s.GetAttachment<Material>(material_id.value()).value().get().alpha_cutoff =
+        0.5f;
+    s.MarkAttachmentModified<Material>(material_id.value());
+    registry.Update(s);
+    EXPECT_GT(registry.static_revision(), revision);
+
+    revision = registry.static_revision();
+    s.MarkAttachmentModified<Texture>(texture_id);
+    registry.Update(s);
+    EXPECT_GT(registry.static_revision(), revision);
+
+    revision = registry.static_revision();
+    s.SetMobility(node, Mobility::Movable);
+    registry.Update(s);
+    EXPECT_GT(registry.static_revision(), revision);
+    for (const auto& item : registry.items()) {
+        EXPECT_FALSE(item.is_static);
+    }
+}
+
+TEST(SceneTest, CanPackVertices) {
+    Mesh mesh{"quad"};
+    mesh.vertices = {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0}};
+    mesh.normals.assign(4, glm::normalize(glm::vec3(0.3f, -0.5f, -0.8f)));
+    mesh.tangents.assign(4, glm::vec3(1, 0, 0));
+    mesh.bitangents.assign(4, glm::vec3(0, 0, -1));
+    mesh.uv_sets = {{{0, 0}, {1, 0}, {1, 1}, {0, 1}}};
+    mesh.indices = {0, 1, 2, 0, 2, 3};
+
+    PackVertices(mesh);
+    EXPECT_TRUE(IsPacked(mesh));
+    ASSERT_EQ(mesh.packed.vertex_count, 4);
+    ASSERT_EQ(mesh.packed.attributes.size(), 4);
+    EXPECT_TRUE(mesh.packed.extras.empty());
+    EXPECT_EQ(mesh.packed.uv_encoding, UVEncoding::UNorm16);
+    EXPECT_EQ(mesh.packed.short_indices.size(), 6);
+
+    const auto& attributes = mesh.packed.attributes[0];
+    auto normal = UnpackNormal(attributes.normal);
+    EXPECT_GT(glm::dot(normal, mesh.normals[0]), 0.9999f);
+
+    // cross(n, t) points away from the bitangent, so the sign is negative
+    float sign = 0.0f;
+    auto tangent = UnpackTangent(attributes.tangent, &sign);
+    EXPECT_GT(glm::dot(tangent, mesh.tangents[0]), 0.9999f);
+    EXPECT_EQ(sign, -1.0f);
+
+    EXPECT_LT(GetPackedVertexSize(mesh) * 2, GetUnpackedVertexSize(mesh));
+
+    // Tiling UVs need half floats
+    mesh.uv_sets[0][2] = {4, 4};
+    PackVertices(mesh);
+    EXPECT_EQ(mesh.packed.uv_encoding, UVEncoding::Half);
+
+    // Attributes missing for some vertices are not packed,
+    // so the vertex shader must not expect them either
+    mesh.colors.assign(2, glm::vec4(1.0f));
+    PackVertices(mesh);
+    EXPECT_TRUE(mesh.packed.has_normals);
+    EXPECT_TRUE(mesh.packed.has_uv0);
+    EXPECT_FALSE(mesh.packed.has_colors);
+    EXPECT_TRUE(mesh.packed.extras.empty());
+
+    auto preamble_desc = GetVertexShaderPreambleDesc(mesh);
+    EXPECT_TRUE(preamble_desc.has_normals);
+    EXPECT_TRUE(preamble_desc.has_uv0);
+    EXPECT_FALSE(preamble_desc.has_colors);
+    EXPECT_FALSE(preamble_desc.has_bitangents);
+
+    // Nothing to pack without vertices
+    Mesh empty{"empty"};
+    PackVertices(empty);
+    EXPECT_FALSE(IsPacked(empty));
+}
+
+TEST(SceneTest, CanOptimizeMeshes) {
+    // Unindexed grid, as if every triangle had its own vertices
+    auto make_grid = []() {
+        const int size = 8;
+        Mesh mesh{"grid"};
+        for (float y = 0; y < size; y++) {
+            for (float x = 0; x < size; x++) {
+                glm::vec3 quad[] = {{x, y, 0},
+                                    {x + 1, y, 0},
+                                    {x, y + 1, 0},
+                                    {x + 1, y + 1, 0}};
+                for (auto corner : {0, 1, 2, 1, 3, 2}) {
+                    mesh.indices.push_back(uint32_t(mesh.vertices.size()));
+                    mesh.vertices.push_back(quad[corner]);
+                    mesh.normals.push_back({0, 0, 1});
+                }
+            }
+        }
+        return mesh;
+    };
+
+    auto mesh = make_grid();
+    auto stats = OptimizeMesh(mesh);
+    ASSERT_TRUE(stats.optimized);
+
+    EXPECT_EQ(mesh.vertices.size(), 81);
+    EXPECT_EQ(mesh.normals.size(), 81);
+    EXPECT_EQ(stats.welded_vertices, 8 * 8 * 6 - 81);
+    EXPECT_EQ(mesh.indices.size(), 8 * 8 * 6);
+    EXPECT_LT(stats.cache_after.acmr, stats.cache_before.acmr);
+    EXPECT_GE(stats.cache_after.atvr, 1.0f);
+    EXPECT_FLOAT_EQ(stats.overdraw_after, 1.0f);
+
+    // Vertices are fetched in order
+    EXPECT_EQ(mesh.indices[0], 0);
+    EXPECT_EQ(*std::max_element(mesh.indices.begin(), mesh.indices.end()),
+              80);
+
+    // Results are deterministic, so they can be cached
+    auto other_mesh = make_grid();
+    OptimizeMesh(other_mesh);
+    EXPECT_EQ(other_mesh.indices, mesh.indices);
+    EXPECT_EQ(other_mesh.vertices, mesh.vertices);
+
+    // Attributes that do not match the vertices are not remapped
+    auto bad_mesh = make_grid();
+    bad_mesh.normals.pop_back();
+    EXPECT_FALSE(OptimizeMesh(bad_mesh).optimized);
+    EXPECT_EQ(bad_mesh.vertices.size(), 8 * 8 * 6);
+}
+
+TEST(SceneTest, CanGenerateLods) {
+    // Bumpy open grid, so that both the surface and the border matter
+    const uint32_t size = 32;
+    Mesh mesh{"terrain"};
+    for (uint32_t y = 0; y <= size; y++) {
+        for (uint32_t x = 0; x <= size; x++) {
+            float u = float(x) / size;
+            float v = float(y) / size;
+            mesh.vertices.push_back({u, v, 0.02f * std::sin(6.0f * u)});
+        }
+    }
+    for (uint32_t y = 0; y < size; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+            uint32_t i = y * (size + 1) + x;
+            mesh.indices.insert(mesh.indices.end(),
+                                {i, i + 1, i + size + 1, i + 1, i + size + 2,
+                                 i + size + 1});
+        }
+    }
+
+    GenerateLods(mesh);
+    ASSERT_GE(mesh.lods.size(), 3);
+
+    auto index_count = mesh.indices.size();
+    auto total_index_count = index_count;
+    float error = 0.0f;
+    for (const auto& lod : mesh.lods) {
+        EXPECT_LT(lod.indices.size(), index_count);
+        EXPECT_EQ(lod.indices.size() % 3, 0);
+        EXPECT_GE(lod.error, error);
+        EXPECT_LE(lod.error, kMaxLodError * kMaxMeshLods);
+        index_count = lod.indices.size();
+        total_index_count += index_count;
+        error = lod.error;
+    }
+
+    // Border corners never move
+    const auto& coarsest = mesh.lods.back().indices;
+    const uint32_t last = (size + 1) * (size + 1) - 1;
+    for (uint32_t corner : {0U, size, last - size, last}) {
+        EXPECT_NE(std::find(coarsest.begin(), coarsest.end(), corner),
+                  coarsest.end());
+    }
+
+    // Packed short indices include the LODs
+    PackVertices(mesh);
+    EXPECT_EQ(mesh.packed.short_indices.size(), total_index_count);
+
+    LodSelector selector;
+    EXPECT_FLOAT_EQ(LodSelector::GetScreenSize({0, 0, -10}, 1, {0, 0, 0}, 2),
+                    0.2f);
+    EXPECT_EQ(selector.Select(1.0f, 0, 2), 0);
+    EXPECT_EQ(selector.Select(0.3f, 0, 2), 1);
+    EXPECT_EQ(selector.Select(0.01f, 0, 2), 2);
+
+    // Near a threshold, the current LOD is kept
+    EXPECT_EQ(selector.Select(0.48f, 0, 2), 0);
+    EXPECT_EQ(selector.Select(0.52f, 1, 2), 1);
+}
+
+TEST(SceneTest, CanCullMeshlets) {
+    // Flat grid facing +Z
+    const uint32_t size = 32;
+    Mesh mesh{"floor"};
+    for (uint32_t y = 0; y <= size; y++) {
+        for (uint32_t x = 0; x <= size; x++) {
+            mesh.vertices.push_back({float(x) / size, float(y) / size, 0});
+        }
+    }
+    for (uint32_t y = 0; y < size; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+            uint32_t i = y * (size + 1) + x;
+            mesh.indices.insert(mesh.indices.end(),
+                                {i, i + 1, i + size + 1, i + 1, i + size + 2,
+                                 i + size + 1});
+        }
+    }
+
+    BuildMeshlets(mesh);
+    ASSERT_GT(mesh.meshlets.size(), 1);
+
+    uint32_t next_index = 0;
+    for (const auto& meshlet : mesh.meshlets) {
+        EXPECT_EQ(meshlet.first_index, next_index);
+        EXPECT_LE(meshlet.vertex_count, kMeshletMaxVertices);
+        EXPECT_LE(meshlet.index_count / 3, kMeshletMaxTriangles);
+        EXPECT_FLOAT_EQ(meshlet.cone_axis.z, 1.0f);
+        EXPECT_LT(meshlet.cone_cutoff, 1.0f);
+        next_index += meshlet.index_count;
+    }
+    EXPECT_EQ(next_index, mesh.indices.size());
+
+    auto proj = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 100.0f);
+    auto get_mvp = [&proj](const glm::vec3& eye, const glm::vec3& target) {
+        return proj * glm::lookAt(eye, target, glm::vec3(0, 1, 0));
+    };
+
+    MeshletCuller culler;
+    std::vector<IndexRange> ranges;
+
+    // Fully visible meshlets are merged into one draw
+    glm::vec3 above{0.5f, 0.5f, 2.0f};
+    auto mvp = get_mvp(above, {0.5f, 0.5f, 0.0f});
+    ASSERT_EQ(culler.Cull(mesh, mvp, above, true, ranges), 1);
+    EXPECT_EQ(ranges[0].first, 0);
+    EXPECT_EQ(ranges[0].count, mesh.indices.size());
+
+    // Seen from below, all meshlets face away
+    glm::vec3 below{0.5f, 0.5f, -2.0f};
+    mvp = get_mvp(below, {0.5f, 0.5f, 0.0f});
+    ranges.clear();
+    EXPECT_EQ(culler.Cull(mesh, mvp, below, true, ranges), 0);
+    EXPECT_EQ(culler.Cull(mesh, mvp, below, false, ranges), 1);
+
+    // Close to a corner, only part of the grid is in the frustum
+    glm::vec3 corner{0.1f, 0.1f, 0.1f};
+    mvp = get_mvp(corner, {0.1f, 0.1f, 0.0f});
+    culler.ResetStats();
+    ranges.clear();
+    culler.Cull(mesh, mvp, corner, true, ranges);
+    EXPECT_GT(culler.stats().visible_meshlets, 0);
+    EXPECT_LT(culler.stats().visible_meshlets, mesh.meshlets.size());
+}
+
 TEST(InfrastructureTest, CanCreateCache) {
     struct Cached {
         struct Key {
@@ -164,6 +602,764 @@ TEST(InfrastructureTest, CanCreateCache) {
     }
 }
 
+TEST(InfrastructureTest, CanAllocateFromRing) {
+    RingAllocator ring(1024);
+    uint64_t invalid = RingAllocator::kInvalidOffset;
+
+    EXPECT_EQ(ring.allocate(512), 0);
+    EXPECT_EQ(ring.allocate(100, 256), 512);
+    auto first_batch = ring.close_batch();
+
+    // Alignment padding counts as used space
+    EXPECT_EQ(ring.allocate(500), invalid);
+    EXPECT_EQ(ring.largest_free_block(256), 256);
+    EXPECT_EQ(ring.allocate(256, 256), 768);
+    auto second_batch = ring.close_batch();
+
+    EXPECT_EQ(ring.used(), 1024);
+    EXPECT_EQ(ring.allocate(1), invalid);
+
+    // Releasing the first batch lets allocations wrap around
+    ring.release(first_batch);
+    EXPECT_EQ(ring.used(), 412);
+    EXPECT_EQ(ring.largest_free_block(), 612);
+    EXPECT_EQ(ring.allocate(600), 0);
+    auto third_batch = ring.close_batch();
+
+    ring.release(second_batch);
+    ring.release(third_batch);
+    EXPECT_EQ(ring.used(), 0);
+}
+
+TEST(InfrastructureTest, CanSubAllocateOffsets) {
+    OffsetAllocator allocator(100);
+    uint64_t invalid = OffsetAllocator::kInvalidOffset;
+
+    auto first = allocator.allocate(30);
+    auto second = allocator.allocate(30);
+    auto third = allocator.allocate(30);
+    EXPECT_EQ(first, 0);
+    EXPECT_EQ(second, 30);
+    EXPECT_EQ(third, 60);
+    EXPECT_EQ(allocator.allocate(20), invalid);
+
+    EXPECT_TRUE(allocator.free(second));
+    EXPECT_FALSE(allocator.free(second));
+    EXPECT_EQ(allocator.largest_free_block(), 30);
+    EXPECT_GT(allocator.fragmentation(), 0.0f);
+
+    // Best fit picks the smaller block at the end
+    EXPECT_EQ(allocator.allocate(5), 90);
+
+    // Freed neighbours are merged
+    allocator.free(first);
+    EXPECT_EQ(allocator.largest_free_block(), 60);
+
+    allocator.free(third);
+    allocator.free(90);
+    EXPECT_EQ(allocator.used(), 0);
+    EXPECT_EQ(allocator.largest_free_block(), 100);
+    EXPECT_EQ(allocator.fragmentation(), 0.0f);
+}
+
+TEST(InfrastructureTest, CanRunParallelTasks) {
+    ThreadPool thread_pool(4);
+    EXPECT_EQ(thread_pool.size(), 4);
+
+    std::vector<size_t> results(100, 0);
+    thread_pool.parallel_for(results.size(),
+                             [&results](size_t i) { results[i] = i * i; });
+
+    for (size_t i = 0; i < results.size(); i++) {
+        EXPECT_EQ(results[i], i * i);
+    }
+
+    auto future = thread_pool.push([&results]() { results.clear(); });
+    future.get();
+    EXPECT_TRUE(results.empty());
+}
+
+TEST(InfrastructureTest, CanWatchFiles) {
+    const char* path = "test_watched_file.txt";
+    {
+        std::ofstream file(path);
+        file << "first";
+    }
+
+    FileWatcher watcher(std::chrono::milliseconds(0));
+    watcher.Watch(path);
+    EXPECT_TRUE(watcher.Poll().empty());
+
+    {
+        std::ofstream file(path);
+        file << "second version";
+    }
+
+    auto changed = watcher.Poll();
+    ASSERT_EQ(changed.size(), 1);
+    EXPECT_EQ(changed[0], path);
+    EXPECT_TRUE(watcher.Poll().empty());
+
+    std::remove(path);
+}
+
+TEST(InfrastructureTest, CanUseFlatHashMap) {
+    using Key = std::array<uint64_t, 2>;
+    FlatHashMap<Key, int> map;
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(map.find({1, 2}), map.end());
+
+    // Enough entries to rehash a few times
+    for (int i = 0; i < 1000; i++) {
+        map[{uint64_t(i), 42}] = i;
+    }
+    EXPECT_EQ(map.size(), 1000);
+    EXPECT_FALSE(map.insert({{5, 42}, -1}).second);
+    EXPECT_EQ(map.find({5, 42})->second, 5);
+    EXPECT_EQ(map.count({5, 43}), 0);
+
+    // Iterators stay valid when erasing
+    auto it = map.begin();
+    while (it != map.end()) {
+        it = it->second % 2 ? map.erase(it) : std::next(it);
+    }
+    EXPECT_EQ(map.size(), 500);
+    EXPECT_EQ(map.count({4, 42}), 1);
+    EXPECT_EQ(map.count({5, 42}), 0);
+    EXPECT_EQ(map.erase({4, 42}), 1);
+    EXPECT_EQ(map.erase({4, 42}), 0);
+
+    // Erased slots get reused
+    auto capacity = map.capacity();
+    for (int i = 0; i < 10000; i++) {
+        map[{uint64_t(i), 7}] = i;
+        map.erase({uint64_t(i), 7});
+    }
+    EXPECT_EQ(map.capacity(), capacity);
+    EXPECT_EQ(map.size(), 499);
+
+    map.clear();
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(map.begin(), map.end());
+}
+
+TEST(InfrastructureTest, CanLookUpFlatHashMapLikeStdMap) {
+    // Keys shaped like buffer hashes, which only differ in one word,
+    // looked up in the map of vectors that backend caches used to be
+    constexpr uint64_t kEntries = 512;
+
+    std::map<std::vector<uint64_t>, uint64_t> tree_map;
+    FlatHashMap<std::array<uint64_t, 4>, uint64_t> flat_map;
+    for (uint64_t i = 0; i < kEntries; i += 2) {
+        tree_map[{2, i, 1, 0xdeadbeef}] = i;
+        flat_map[{2, i, 1, 0xdeadbeef}] = i;
+    }
+    EXPECT_EQ(flat_map.size(), tree_map.size());
+
+    // Half the lookups miss
+    for (uint64_t i = 0; i < 2 * kEntries; i++) {
+        auto tree_it = tree_map.find({2, i, 1, 0xdeadbeef});
+        auto flat_it = flat_map.find({2, i, 1, 0xdeadbeef});
+        ASSERT_EQ(flat_it == flat_map.end(), tree_it == tree_map.end())
+            << "Key " << i;
+        if (flat_it != flat_map.end()) {
+            EXPECT_EQ(flat_it->second, tree_it->second);
+        }
+    }
+
+    // Every entry is visited once
+    uint64_t sum = 0;
+    for (const auto& entry : flat_map) {
+        sum += entry.second;
+    }
+    EXPECT_EQ(sum, (kEntries / 2) * (kEntries - 2) / 2);
+}
+
+TEST(CommandStreamTest, CanRecordCommands) {
+    CommandStream stream;
+    EXPECT_TRUE(stream.empty());
+
+    Pipeline pipeline{VezPipeline(VK_NULL_HANDLE)};
+    Buffer buffer{VkBuffer(VK_NULL_HANDLE)};
+    std::array<float, 3> contents = {1.0f, 2.0f, 3.0f};
+
+    stream.BindGraphicsPipeline(pipeline);
+    stream.BindVertexBuffer(buffer, 2, 64);
+    stream.UpdateBuffer(buffer, 256, sizeof(contents), contents.data());
+    stream.DrawIndexed(36, 1, 6, 4);
+    EXPECT_EQ(stream.size(), 4);
+
+    std::vector<CommandType> types;
+    for (const auto& command : stream) {
+        types.push_back(command.type());
+
+        switch (command.type()) {
+            case CommandType::BindGraphicsPipeline:
+                EXPECT_EQ(command.as<commands::BindGraphicsPipeline>().pipeline,
+                          &pipeline);
+                break;
+            case CommandType::BindVertexBuffer: {
+                auto& cmd = command.as<commands::BindVertexBuffer>();
+                EXPECT_EQ(cmd.buffer, &buffer);
+                EXPECT_EQ(cmd.binding, 2);
+                EXPECT_EQ(cmd.offset, 64);
+                break;
+            }
+            case CommandType::UpdateBuffer: {
+                // Contents are copied, so the source can go away
+                auto& cmd = command.as<commands::UpdateBuffer>();
+                EXPECT_EQ(cmd.offset, 256);
+                EXPECT_EQ(cmd.size, sizeof(contents));
+                EXPECT_EQ(memcmp(command.payload<commands::UpdateBuffer>(),
+                                 contents.data(), sizeof(contents)),
+                          0);
+                break;
+            }
+            case CommandType::DrawIndexed: {
+                auto& cmd = command.as<commands::DrawIndexed>();
+                EXPECT_EQ(cmd.index_count, 36);
+                EXPECT_EQ(cmd.first_index, 6);
+                EXPECT_EQ(cmd.vertex_offset, 4);
+                break;
+            }
+            default:
+                ADD_FAILURE();
+        }
+    }
+
+    std::vector<CommandType> expected_types = {
+        CommandType::BindGraphicsPipeline, CommandType::BindVertexBuffer,
+        CommandType::UpdateBuffer, CommandType::DrawIndexed};
+    EXPECT_EQ(types, expected_types);
+
+    // Streams can be reused after clearing
+    auto bytes = stream.bytes();
+    stream.Clear();
+    EXPECT_TRUE(stream.empty());
+    EXPECT_TRUE(stream.begin() == stream.end());
+
+    stream.Draw(3);
+    EXPECT_EQ(stream.size(), 1);
+    EXPECT_LT(stream.bytes(), bytes);
+}
+
+TEST(UniformArenaTest, CanPushFromThreads) {
+    UniformArena arena(1024 * 256);
+    ThreadPool thread_pool(4);
+
+    std::vector<uint64_t> offsets(1024);
+    thread_pool.parallel_for(offsets.size(), [&](size_t i) {
+        auto value = static_cast<uint32_t>(i);
+        offsets[i] = arena.Push(value).value();
+    });
+
+    // Each push gets its own aligned slot holding its data
+    std::set<uint64_t> unique_offsets(offsets.begin(), offsets.end());
+    EXPECT_EQ(unique_offsets.size(), offsets.size());
+    for (size_t i = 0; i < offsets.size(); i++) {
+        EXPECT_EQ(offsets[i] % UniformArena::kDefaultAlignment, 0);
+
+        uint32_t value;
+        memcpy(&value, arena.data() + offsets[i], sizeof(value));
+        EXPECT_EQ(value, i);
+    }
+    EXPECT_EQ(arena.used(), arena.size());
+    EXPECT_FALSE(arena.exhausted());
+
+    uint32_t value = 0;
+    EXPECT_FALSE(arena.Push(value));
+    EXPECT_TRUE(arena.exhausted());
+
+    arena.Reset();
+    EXPECT_EQ(arena.used(), 0);
+    EXPECT_EQ(arena.Push(value).value(), 0);
+}
+
+TEST(BoundStateTest, CanElideRedundantBinds) {
+    VezContext::BoundState state;
+    auto& bindings = state.bindings;
+
+    RasterizationState rasterization;
+    EXPECT_TRUE(state.Set(&bindings.rasterization, rasterization));
+    EXPECT_FALSE(state.Set(&bindings.rasterization, rasterization));
+
+    rasterization.cull_mode = CullMode::None;
+    EXPECT_TRUE(state.Set(&bindings.rasterization, rasterization));
+
+    VezContext::BoundState::BufferBinding ubo{VK_NULL_HANDLE, 256, 64};
+    auto slot = VezContext::BoundState::Slot(bindings.uniform_buffers, 12);
+    EXPECT_TRUE(state.Set(slot, ubo));
+    EXPECT_FALSE(state.Set(slot, ubo));
+
+    ubo.offset = 512;
+    EXPECT_TRUE(state.Set(slot, ubo));
+
+    // Bindings out of range are not tracked
+    auto untracked = VezContext::BoundState::Slot(
+        bindings.uniform_buffers, VezContext::BoundState::kMaxBindings);
+    EXPECT_EQ(untracked, nullptr);
+    EXPECT_TRUE(state.Set(untracked, ubo));
+    EXPECT_TRUE(state.Set(untracked, ubo));
+
+    // Binds covering several slots count their calls themselves
+    auto vb_slot = VezContext::BoundState::Slot(bindings.vertex_buffers, 0);
+    EXPECT_TRUE(VezContext::BoundState::Update(vb_slot, ubo));
+    EXPECT_FALSE(VezContext::BoundState::Update(vb_slot, ubo));
+
+    EXPECT_EQ(state.issued, 6);
+    EXPECT_EQ(state.elided, 2);
+
+    // A new render pass binds everything again
+    state.Invalidate();
+    EXPECT_TRUE(state.Set(&bindings.rasterization, rasterization));
+    EXPECT_TRUE(state.Set(slot, ubo));
+    EXPECT_EQ(state.issued, 8);
+
+    state.Reset();
+    EXPECT_EQ(state.issued, 0);
+    EXPECT_EQ(state.elided, 0);
+}
+
+TEST(PipelineTableTest, CanAssignPipelineIds) {
+    PipelineTable table;
+    auto pipeline_a = std::make_shared<Pipeline>(VK_NULL_HANDLE);
+    auto pipeline_b = std::make_shared<Pipeline>(VK_NULL_HANDLE);
+
+    auto id_a = table.Add(pipeline_a);
+    auto id_b = table.Add(pipeline_b);
+    EXPECT_NE(id_a, id_b);
+    EXPECT_EQ(table.Add(pipeline_a), id_a);
+    EXPECT_EQ(table.Add(nullptr), kInvalidPipelineId);
+    EXPECT_EQ(table.size(), 2);
+
+    EXPECT_EQ(table.Get(id_a), pipeline_a.get());
+    EXPECT_EQ(table.Get(id_b), pipeline_b.get());
+    EXPECT_EQ(table.Get(kInvalidPipelineId), nullptr);
+
+    auto generation = table.generation();
+    table.Clear();
+    EXPECT_NE(table.generation(), generation);
+    EXPECT_EQ(table.Get(id_a), nullptr);
+    EXPECT_EQ(table.size(), 0);
+}
+
+TEST(SpirvCacheTest, CanPersistShaders) {
+    const char* path = "test_shader_cache.bin";
+    std::remove(path);
+
+    auto hash = [](const std::string& str) {
+        return MurmurHash3(str.data(), str.size());
+    };
+    SpirvCache::Key key{hash("shader.vert"), hash("void main() {}")};
+    std::vector<uint32_t> code{0x07230203, 0x00010000, 1, 2, 3};
+
+    {
+        SpirvCache cache(path);
+        EXPECT_TRUE(cache.Load());
+        EXPECT_EQ(cache.Find(key), nullptr);
+
+        cache.Insert(key, code);
+        EXPECT_TRUE(cache.Save());
+        EXPECT_EQ(cache.stats().misses, 1);
+    }
+
+    {
+        SpirvCache cache(path);
+        EXPECT_TRUE(cache.Load());
+        EXPECT_EQ(cache.size(), 1);
+
+        auto cached = cache.Find(key);
+        ASSERT_NE(cached, nullptr);
+        EXPECT_EQ(*cached, code);
+        EXPECT_EQ(cache.stats().hits, 1);
+
+        // The source has changed since it was cached
+        SpirvCache::Key edited_key{key.identity, hash("void main() { }")};
+        EXPECT_EQ(cache.Find(edited_key), nullptr);
+        EXPECT_EQ(cache.stats().invalidated, 1);
+    }
+
+    // Flip a bit in the stored code
+    {
+        std::fstream file(path, std::ios_base::in | std::ios_base::out |
+                                    std::ios_base::binary);
+        file.seekg(-1, std::ios::end);
+        char last = 0;
+        file.read(&last, 1);
+        last ^= 1;
+        file.seekp(-1, std::ios::end);
+        file.write(&last, 1);
+    }
+
+    {
+        SpirvCache cache(path);
+        EXPECT_TRUE(cache.Load());
+        EXPECT_EQ(cache.size(), 0);
+        EXPECT_EQ(cache.stats().rejected, 1);
+        EXPECT_EQ(cache.Find(key), nullptr);
+    }
+
+    std::remove(path);
+}
+
+TEST(ShaderManifestTest, CanSaveAndLoadPermutations) {
+    const char* path = "test_manifest.shaders";
+    std::remove(path);
+
+    Mesh mesh{"mesh"};
+    mesh.vertices = {glm::vec3(0.0f)};
+    mesh.normals = {glm::vec3(0.0f, 1.0f, 0.0f)};
+
+    Material plain{"plain"};
+    Material masked{"masked"};
+    masked.alpha_cutoff = 0.5f;
+
+    ShaderManifest manifest;
+    manifest.Add(mesh, plain);
+    manifest.Add(mesh, plain);
+    manifest.Add(mesh, masked);
+    EXPECT_EQ(manifest.size(), 2);
+
+    // Both materials share the vertex shader
+    auto first = *manifest.permutations().begin();
+    auto last = *manifest.permutations().rbegin();
+    EXPECT_EQ(first.vs, last.vs);
+
+    VertexShaderPreambleDesc vs_desc;
+    vs_desc.int_repr = first.vs;
+    EXPECT_EQ(BuildVertexShaderPreamble(vs_desc),
+              "#define HAS_POSITIONS\n#define HAS_NORMALS\n");
+
+    FragmentShaderPreambleDesc fs_desc;
+    fs_desc.int_repr = last.fs;
+    EXPECT_TRUE(fs_desc.alpha_mask);
+    EXPECT_FALSE(fs_desc.has_reflection_map);
+
+    EXPECT_TRUE(manifest.Save(path));
+    auto loaded = ShaderManifest::Load(path);
+    ASSERT_TRUE(loaded);
+    EXPECT_EQ(loaded.value().permutations(), manifest.permutations());
+
+    // Flags beyond the vertex shader ones
+    {
+        std::ofstream file(path, std::ios::app);
+        file << (1 << 9) << " 0\n";
+    }
+    EXPECT_FALSE(ShaderManifest::Load(path));
+
+    std::remove(path);
+}
+
+TEST(ShaderManifestTest, CanCompilePipelinesInBackground) {
+    VezBackend vez;
+    auto init_context_result = vez.InitContext();
+    if (!init_context_result) {
+        cerr << "Skipping test: " << init_context_result.error().message()
+             << endl;
+        GTEST_SKIP();
+    }
+
+    Mesh mesh{"mesh"};
+    mesh.vertices = {glm::vec3(0.0f)};
+    mesh.normals = {glm::vec3(0.0f, 1.0f, 0.0f)};
+    mesh.uv_sets = {{glm::vec2(0.0f)}};
+
+    Material textured{"textured"};
+    textured.texture_bindings[TextureType::Diffuse] = {};
+
+    ShaderManifest manifest;
+    manifest.Add(mesh, textured);
+    auto permutation = *manifest.permutations().begin();
+    auto fallback = GetFallbackPermutation(permutation);
+    EXPECT_EQ(fallback.vs, permutation.vs);
+
+    FragmentShaderPreambleDesc fs_desc;
+    fs_desc.int_repr = fallback.fs;
+    EXPECT_TRUE(fs_desc.has_uv0);
+    EXPECT_FALSE(fs_desc.has_diffuse_map);
+    EXPECT_FALSE(fs_desc.alpha_mask);
+
+    auto request = [&](const ShaderPermutation& permutation) {
+        VertexShaderPreambleDesc vs_desc;
+        vs_desc.int_repr = permutation.vs;
+        FragmentShaderPreambleDesc fs_desc;
+        fs_desc.int_repr = permutation.fs;
+        return vez.RequestGraphicsPipeline(
+            {GOMA_ASSETS_DIR "shaders/pbr.vert", ShaderSourceType::Filename,
+             BuildVertexShaderPreamble(vs_desc)},
+            {GOMA_ASSETS_DIR "shaders/pbr.frag", ShaderSourceType::Filename,
+             BuildFragmentShaderPreamble(fs_desc)});
+    };
+
+    // The first request only starts compiling
+    auto pipeline_res = request(permutation);
+    ASSERT_TRUE(pipeline_res);
+    EXPECT_FALSE(pipeline_res.value());
+
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (!pipeline_res.value() &&
+           std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        pipeline_res = request(permutation);
+        ASSERT_TRUE(pipeline_res);
+    }
+    ASSERT_TRUE(pipeline_res.value());
+    EXPECT_EQ(vez.GetPendingPipelineCount(), 0);
+
+    // Once compiled, it is returned right away
+    auto cached_res = request(permutation);
+    ASSERT_TRUE(cached_res);
+    EXPECT_EQ(cached_res.value(), pipeline_res.value());
+
+    // Preloading also compiles the fallback
+    EXPECT_EQ(CompileShaderManifest(vez, manifest, false), 0);
+    auto fallback_res = request(fallback);
+    ASSERT_TRUE(fallback_res);
+    EXPECT_TRUE(fallback_res.value());
+}
+
+TEST(ResourceNameTest, CanHashNamesAtCompileTime) {
+    constexpr ResourceName depth{"depth"};
+
+    // FNV-1a reference values
+    static_assert(ResourceName("").hash() == 0xcbf29ce484222325ULL, "");
+    static_assert(ResourceName("a").hash() == 0xaf63dc4c8601ec8cULL, "");
+
+    std::string runtime_name = "depth";
+    EXPECT_EQ(ResourceName(runtime_name), depth);
+    EXPECT_EQ(ResourceName(runtime_name.c_str()), depth);
+    EXPECT_NE(ResourceName("color"), depth);
+
+    constexpr auto first = ResourceName("downscale").WithIndex(0);
+    constexpr auto second = ResourceName("downscale").WithIndex(1);
+    EXPECT_NE(first, second);
+    EXPECT_NE(first, ResourceName("downscale"));
+    EXPECT_EQ(first, ResourceName("downscale").WithIndex(0));
+
+#ifndef NDEBUG
+    EXPECT_EQ(depth.str(), "depth");
+    EXPECT_EQ(second.str(), "downscale_1");
+    EXPECT_EQ(ResourceName(runtime_name).str(), "depth");
+#endif
+}
+
+TEST(RenderGraphTest, CanCompileRenderPlan) {
+    RenderPlan render_plan{};
+    render_plan.color_images = {
+        {"color", {{}, 4}},
+        {"resolved", {}},
+        {"half", {{0.5f, 0.5f}}},
+        {"debug", {}},
+        {"output", {}},
+    };
+    render_plan.depth_images = {{"depth", {{}, 4, Format::DepthOnly}}};
+    render_plan.passes = {
+        GeneralPassEntry{"update_buffers"},
+        RenderPassEntry{
+            "forward",
+            RenderPassDesc{{ColorAttachmentDesc{"color", true, true,
+                                                {0.0f, 0.0f, 0.0f, 1.0f},
+                                                "resolved"}},
+                           DepthAttachmentDesc{"depth"}}},
+        RenderPassEntry{"debug",
+                        RenderPassDesc{{ColorAttachmentDesc{"debug"}}},
+                        {},
+                        {"depth"}},
+        RenderPassEntry{"downscale",
+                        RenderPassDesc{{ColorAttachmentDesc{"half"}}},
+                        {},
+                        {"resolved"}},
+        RenderPassEntry{"compose",
+                        RenderPassDesc{{ColorAttachmentDesc{"output"}}},
+                        {},
+                        {"resolved", "half"}},
+    };
+    render_plan.output = "output";
+
+    auto plan_res = CompileRenderPlan(render_plan);
+    ASSERT_TRUE(plan_res);
+    auto& plan = plan_res.value();
+
+    // Nothing consumes the debug pass
+    EXPECT_EQ(plan.culled_passes, 1);
+    ASSERT_EQ(plan.passes.size(), 4);
+    EXPECT_EQ(plan.passes[1].entry, 1);
+    EXPECT_EQ(plan.passes[2].entry, 3);
+
+    auto target = [&plan](const char* name) -> const auto& {
+        return plan.targets[plan.FindTarget(name)];
+    };
+    EXPECT_EQ(target("color").first_use, 1);
+    EXPECT_EQ(target("color").last_use, 1);
+    EXPECT_EQ(target("resolved").last_use, 3);
+    EXPECT_EQ(target("half").first_use, 2);
+    EXPECT_TRUE(target("color").transient);
+    EXPECT_FALSE(target("output").transient);
+    EXPECT_EQ(target("output").last_use, plan.passes.size());
+    EXPECT_FALSE(target("debug").used());
+    EXPECT_EQ(plan.FindTarget("missing"), CompiledRenderPlan::kNone);
+
+    // Unknown targets are rejected
+    render_plan.passes.push_back(GeneralPassEntry{"blit", {}, {"missing"}});
+    EXPECT_FALSE(CompileRenderPlan(render_plan));
+}
+
+TEST(RenderGraphTest, CanLoadDepthFromPrepass) {
+    // Like the renderer's plan, the forward pass clears depth unless
+    // a pre-pass has laid it down
+    auto make_plan = [](bool depth_prepass) {
+        RenderPlan render_plan{};
+        render_plan.color_images = {{"color", {}}, {"output", {}}};
+        render_plan.depth_images = {{"depth", {{}, 1, Format::DepthOnly}}};
+        render_plan.passes = {
+            RenderPassEntry{
+                "forward",
+                RenderPassDesc{{ColorAttachmentDesc{"color"}},
+                               DepthAttachmentDesc{"depth", !depth_prepass}}},
+            RenderPassEntry{"compose",
+                            RenderPassDesc{{ColorAttachmentDesc{"output"}}},
+                            {},
+                            {"color", "depth"}},
+        };
+        if (depth_prepass) {
+            render_plan.passes.insert(
+                render_plan.passes.begin(),
+                RenderPassEntry{
+                    "depth_prepass",
+                    RenderPassDesc{{}, DepthAttachmentDesc{"depth"}}});
+        }
+        render_plan.output = "output";
+        return CompileRenderPlan(render_plan);
+    };
+
+    auto reads = [](const CompiledRenderPlan::Pass& pass, size_t target) {
+        return std::find(pass.reads.begin(), pass.reads.end(), target) !=
+               pass.reads.end();
+    };
+
+    auto prepass_res = make_plan(true);
+    ASSERT_TRUE(prepass_res);
+    auto& prepass = prepass_res.value();
+    ASSERT_EQ(prepass.passes.size(), 3);
+    EXPECT_EQ(prepass.passes[1].name, "forward");
+
+    auto depth = prepass.FindTarget("depth");
+    EXPECT_FALSE(reads(prepass.passes[0], depth));
+    EXPECT_TRUE(reads(prepass.passes[1], depth));
+    EXPECT_EQ(prepass.targets[depth].first_use, 0);
+
+    auto forward_res = make_plan(false);
+    ASSERT_TRUE(forward_res);
+    auto& forward = forward_res.value();
+    ASSERT_EQ(forward.passes.size(), 2);
+    EXPECT_FALSE(reads(forward.passes[0], forward.FindTarget("depth")));
+}
+
+TEST(RenderGraphTest, CanEstimateBandwidth) {
+    RenderPlan render_plan{};
+    render_plan.color_images = {
+        {"color", {{}, 4, 1, 1, Format::UFloatB10G11R11}},
+        {"resolved", {{}, 1, 1, 1, Format::UFloatB10G11R11}},
+        {"output", {}},
+    };
+    render_plan.depth_images = {{"depth", {{}, 4, Format::DepthOnly}}};
+    render_plan.passes = {
+        RenderPassEntry{
+            "forward",
+            RenderPassDesc{{ColorAttachmentDesc{"color", true, true,
+                                                {0.0f, 0.0f, 0.0f, 1.0f},
+                                                "resolved"}},
+                           DepthAttachmentDesc{"depth"}}},
+        RenderPassEntry{"compose",
+                        RenderPassDesc{{ColorAttachmentDesc{"output"}}},
+                        {},
+                        {"resolved"}},
+    };
+    render_plan.output = "output";
+
+    auto plan_res = CompileRenderPlan(render_plan);
+    ASSERT_TRUE(plan_res);
+    auto& plan = plan_res.value();
+
+    std::vector<uint64_t> target_sizes(plan.targets.size());
+    target_sizes[plan.FindTarget("color")] = 400;
+    target_sizes[plan.FindTarget("resolved")] = 100;
+    target_sizes[plan.FindTarget("output")] = 100;
+    target_sizes[plan.FindTarget("depth")] = 400;
+
+    auto bandwidth = EstimateBandwidth(plan, target_sizes);
+    ASSERT_EQ(bandwidth.passes.size(), 2);
+
+    // Cleared attachments are not read, the resolve reads the samples
+    EXPECT_EQ(bandwidth.passes[0].name, "forward");
+    EXPECT_EQ(bandwidth.passes[0].read, 400);
+    EXPECT_EQ(bandwidth.passes[0].written, 900);
+    EXPECT_EQ(bandwidth.passes[1].read, 100);
+    EXPECT_EQ(bandwidth.passes[1].written, 100);
+    EXPECT_EQ(bandwidth.read, 500);
+    EXPECT_EQ(bandwidth.written, 1000);
+}
+
+TEST(DynamicResolutionTest, CanHoldTargetFrameTime) {
+    DynamicResolution::Config config;
+    DynamicResolution controller(config);
+    EXPECT_FLOAT_EQ(controller.scale(), config.max_scale);
+
+    // Frame time with a fixed part and one growing with the pixel count
+    auto run = [&controller](float fixed, float per_pixel) {
+        float frame_time = 0.0f;
+        for (int i = 0; i < 300; i++) {
+            auto scale = controller.scale();
+            frame_time = fixed + per_pixel * scale * scale;
+            controller.Update(frame_time);
+        }
+        return frame_time;
+    };
+
+    auto frame_time = run(0.004f, 0.020f);
+    EXPECT_LT(controller.scale(), config.max_scale);
+    EXPECT_LE(frame_time, config.target_frame_time);
+    EXPECT_GE(frame_time, config.target_frame_time * config.headroom);
+
+    // Lighter load, the scale goes back up
+    run(0.002f, 0.008f);
+    EXPECT_FLOAT_EQ(controller.scale(), config.max_scale);
+
+    // Too heavy for any scale
+    run(0.0f, 0.1f);
+    EXPECT_FLOAT_EQ(controller.scale(), config.min_scale);
+
+    config.enabled = false;
+    controller = DynamicResolution(config);
+    run(0.0f, 0.1f);
+    EXPECT_FLOAT_EQ(controller.scale(), config.max_scale);
+}
+
+TEST(ShadowCasterCullerTest, CanCullCasters) {
+    // Light at the origin looking down -Z, reaching 10 units
+    auto light_vp = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 0.0f, 10.0f) *
+                    glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+                                glm::vec3(0.0f, 1.0f, 0.0f));
+    ShadowCasterCuller culler;
+
+    Box inside{{-1.0f, -1.0f, -6.0f}, {1.0f, 1.0f, -4.0f}};
+    EXPECT_TRUE(culler.IsVisible(light_vp, inside));
+
+    // Behind the near plane, but still between the light and receivers
+    Box toward_light{{-1.0f, -1.0f, 4.0f}, {1.0f, 1.0f, 6.0f}};
+    EXPECT_TRUE(culler.IsVisible(light_vp, toward_light));
+
+    Box beyond_far{{-1.0f, -1.0f, -16.0f}, {1.0f, 1.0f, -14.0f}};
+    EXPECT_FALSE(culler.IsVisible(light_vp, beyond_far));
+
+    Box aside{{14.0f, -1.0f, -6.0f}, {16.0f, 1.0f, -4.0f}};
+    EXPECT_FALSE(culler.IsVisible(light_vp, aside));
+
+    EXPECT_EQ(culler.stats().tested_casters, 4);
+    EXPECT_EQ(culler.stats().visible_casters, 2);
+}
+
 TEST(AssimpLoaderTest, CanLoadAModel) {
     AssimpLoader loader;
     auto result =
@@ -178,6 +1374,7 @@ TEST(AssimpLoaderTest, CanLoadAModel) {
     EXPECT_EQ(scene->GetAttachmentCount<Camera>(), 1);
     EXPECT_EQ(scene->GetAttachmentCount<Light>(), 0);
     EXPECT_EQ(scene->GetAttachmentCount<Mesh>(), 1);
+    EXPECT_EQ(loader.shader_manifest().size(), 1);
 
     auto& attached_nodes = scene->GetAttachedNodes<Mesh>({0}).value().get();
     EXPECT_EQ(attached_nodes, std::set<NodeIndex>({2}));
@@ -192,6 +1389,18 @@ TEST(AssimpLoaderTest, CanLoadAModel) {
     ASSERT_EQ(assimp_children.value().size(), 2);
 }
 
+TEST(VezSubmitTest, WaitsForSetupBeforeGeometryAndSampling) {
+    // Staged copies, mip blits and compacted geometry are read
+    // by vertex fetch and by shaders, not only by color output
+    VkPipelineStageFlags consumers = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                                     VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                                     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+    auto stages = VezBackend::GetSetupWaitStages();
+    EXPECT_TRUE(stages == VK_PIPELINE_STAGE_ALL_COMMANDS_BIT ||
+                (stages & consumers) == consumers);
+}
+
 class VezBackendTest : public ::testing::Test {
   protected:
     VezBackend vez;
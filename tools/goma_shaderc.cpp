@@ -0,0 +1,84 @@
+// Compiles the shader permutations of a scene ahead of time into the
+// shader cache, so that shipped content does not compile them at runtime.
+//
+//   goma-shaderc <scene or manifest> [shader cache]
+//
+// A scene is loaded to find its permutations, which are also saved next
+// to it as <scene>.shaders. Files ending in .shaders are read as a
+// manifest instead. The cache defaults to the one the engine reads.
+
+#include "renderer/shader_permutations.hpp"
+#include "renderer/vez/vez_backend.hpp"
+#include "scene/loaders/assimp_loader.hpp"
+
+#include <thread>
+
+namespace {
+
+constexpr const char* kManifestExtension = ".shaders";
+
+bool EndsWith(const std::string& str, const std::string& suffix) {
+    return str.size() >= suffix.size() &&
+           str.compare(str.size() - suffix.size(), suffix.size(), suffix) ==
+               0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    using namespace goma;
+
+    if (argc < 2) {
+        spdlog::error("Usage: goma-shaderc <scene or manifest> [cache]");
+        return 1;
+    }
+    std::string input = argv[1];
+
+    ShaderManifest manifest;
+    if (EndsWith(input, kManifestExtension)) {
+        auto manifest_res = ShaderManifest::Load(input);
+        if (!manifest_res) {
+            return 1;
+        }
+        manifest = std::move(manifest_res.value());
+    } else {
+        AssimpLoader loader;
+        if (!loader.ReadSceneFromFile(input.c_str())) {
+            spdlog::error("Couldn't load scene \"{}\".", input);
+            return 1;
+        }
+        manifest = loader.shader_manifest();
+
+        if (!manifest.Save(input + kManifestExtension)) {
+            return 1;
+        }
+    }
+
+    Backend::Config config;
+    config.compile_threads = std::thread::hardware_concurrency();
+    config.watch_shaders = false;
+    if (argc > 2) {
+        config.shader_cache_path = argv[2];
+    }
+
+    // No surface is needed to compile shaders
+    VezBackend backend(config);
+    if (auto result = backend.InitContext()) {
+        spdlog::info("Context initialized.");
+    } else {
+        spdlog::error(result.error().message());
+        return 1;
+    }
+
+    // The engine always creates a skybox, so shaders sample it
+    auto failed = CompileShaderManifest(backend, manifest, true);
+    spdlog::info("Compiled {} shader permutations into \"{}\".",
+                 manifest.size(), config.shader_cache_path);
+    if (failed > 0) {
+        spdlog::error("{} pipelines couldn't be compiled.", failed);
+        return 1;
+    }
+
+    // The cache is saved when the backend is torn down
+    return 0;
+}